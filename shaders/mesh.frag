@@ -6,6 +6,7 @@ layout(location = 0) in vec3 vNrm;
 layout(location = 1) in vec2 vUv;
 layout(location = 2) in vec3 vPosW;
 layout(location = 3) in vec4 vTangent;
+layout(location = 4) flat in uint vDrawIndex;
 
 
 
@@ -42,6 +43,12 @@ vec3 FresnelSchlick(float cosTheta, vec3 F0) {
     return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
 }
 
+vec4 sampleMaterialTexture(uint tex, vec2 uv, vec4 fallback) {
+    if (tex == INVALID_TEXTURE)
+        return fallback;
+    return texture(tTextures[nonuniformEXT(tex)], uv);
+}
+
 vec3 acesTonemap(vec3 x) {
     
     const float a = 2.51;
@@ -62,18 +69,23 @@ void main() {
     mat3 TBN = mat3(T, B, N);
 
     
-    vec3 baseTex = texture(tBaseColor, vUv).rgb;
-    vec3 albedo = (uMaterial.baseColorFactor.rgb * baseTex);
+    DrawData draw = uDraws.draws[vDrawIndex];
+    Material mat = uMaterials.materials[draw.materialId];
+    vec4 baseFactor = mat.baseColorFactor * draw.baseColorFactor;
+    vec2 mrFactor = mat.metallicRoughnessFactor * draw.metallicRoughnessFactor;
+
+    vec3 baseTex = sampleMaterialTexture(mat.baseColorTex, vUv, vec4(1.0)).rgb;
+    vec3 albedo = (baseFactor.rgb * baseTex);
 
-    vec3 nTex = texture(tNormal, vUv).xyz * 2.0 - 1.0;
+    vec3 nTex = sampleMaterialTexture(mat.normalTex, vUv, vec4(0.5, 0.5, 1.0, 1.0)).xyz * 2.0 - 1.0;
     vec3 Nw = normalize(TBN * nTex);
 
-    vec3 mr = texture(tMetalRough, vUv).rgb;
+    vec3 mr = sampleMaterialTexture(mat.metalRoughTex, vUv, vec4(0.0, 1.0, 0.0, 1.0)).rgb;
     float roughTex = mr.g;
     float metalTex = mr.b;
 
-    float metallic = clamp(uMaterial.metallicRoughnessFactor.x * metalTex, 0.0, 1.0);
-    float roughness = clamp(uMaterial.metallicRoughnessFactor.y * roughTex, 0.04, 1.0);
+    float metallic = clamp(mrFactor.x * metalTex, 0.0, 1.0);
+    float roughness = clamp(mrFactor.y * roughTex, 0.04, 1.0);
 
     vec3 V = normalize(uCamera.camPos - vPosW);
     vec3 L = normalize(uLight.lightDir);
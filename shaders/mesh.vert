@@ -13,10 +13,11 @@ layout(location = 0) out vec3 vNrm;
 layout(location = 1) out vec2 vUv;
 layout(location = 2) out vec3 vPosW;
 layout(location = 3) out vec4 vTangent;
+layout(location = 4) flat out uint vDrawIndex;
 
 void main() {
-    uint transformIndex = uint(gl_InstanceIndex);
-    mat4 model = uTransforms.models[transformIndex];
+    uint drawIndex = uint(gl_InstanceIndex);
+    mat4 model = uTransforms.models[uDraws.draws[drawIndex].transformIndex];
     vec4 posW4 = model * vec4(inPos, 1.0);
     vPosW = posW4.xyz;
 
@@ -24,6 +25,8 @@ void main() {
     vNrm = normalize(nrmMat * inNrm);
 
     vUv = inUv;
-    vTangent = inTangent;
+    // Tangents are in mesh space like the positions; mirroring transforms flip the bitangent sign.
+    vTangent = vec4(normalize(mat3(model) * inTangent.xyz), inTangent.w * sign(determinant(mat3(model))));
+    vDrawIndex = drawIndex;
     gl_Position = uCamera.proj * uCamera.view * posW4;
 }
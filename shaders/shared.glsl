@@ -1,17 +1,20 @@
 #ifndef SHARED_GLSL
 #define SHARED_GLSL
 
+#extension GL_EXT_nonuniform_qualifier : require
+
 #define SET_FRAME 0
 #define SET_MATERIAL 1
 
 #define BIND_CAMERA 0
 #define BIND_LIGHT 1
 #define BIND_TRANSFORMS 2
+#define BIND_DRAWS 3
+
+#define BIND_MATERIALS 0
+#define BIND_TEXTURES 1
 
-#define BIND_BASE_COLOR 0
-#define BIND_NORMAL 1
-#define BIND_METAL_ROUGH 2
-#define BIND_MATERIAL 3
+#define INVALID_TEXTURE 0xFFFFFFFFu
 
 layout(std140, set = SET_FRAME, binding = BIND_CAMERA) uniform CameraUBO {
     mat4 view;
@@ -31,14 +34,37 @@ layout(std430, set = SET_FRAME, binding = BIND_TRANSFORMS) readonly buffer Trans
     mat4 models[];
 } uTransforms;
 
-layout(std140, set = SET_MATERIAL, binding = BIND_MATERIAL) uniform MaterialUBO {
+// Matches ShaderLayout::DrawData; indexed by gl_InstanceIndex (firstInstance = draw slot).
+struct DrawData {
+    uint meshId;
+    uint materialId;
+    uint transformIndex;
+    uint _pad0;
     vec4 baseColorFactor;
     vec2 metallicRoughnessFactor;
-    vec2 _pad0;
-} uMaterial;
+    vec2 _pad1;
+};
+
+layout(std430, set = SET_FRAME, binding = BIND_DRAWS) readonly buffer Draws {
+    DrawData draws[];
+} uDraws;
+
+// Matches ShaderLayout::MaterialGPU.
+struct Material {
+    vec4 baseColorFactor;
+    vec2 metallicRoughnessFactor;
+    uint baseColorTex;
+    uint normalTex;
+    uint metalRoughTex;
+    uint _pad0;
+    uint _pad1;
+    uint _pad2;
+};
+
+layout(std430, set = SET_MATERIAL, binding = BIND_MATERIALS) readonly buffer Materials {
+    Material materials[];
+} uMaterials;
 
-layout(set = SET_MATERIAL, binding = BIND_BASE_COLOR) uniform sampler2D tBaseColor;
-layout(set = SET_MATERIAL, binding = BIND_NORMAL) uniform sampler2D tNormal;
-layout(set = SET_MATERIAL, binding = BIND_METAL_ROUGH) uniform sampler2D tMetalRough;
+layout(set = SET_MATERIAL, binding = BIND_TEXTURES) uniform sampler2D tTextures[];
 
 #endif
@@ -1,45 +1,83 @@
 
 #include "GltfLoader.hpp"
 
-#include "engine/assets/mini_json.hpp"
+#include "engine/assets/mini_json_ondemand.hpp"
+#include "engine/core/JobSystem.hpp"
+#include "engine/core/MappedFile.hpp"
+#include "engine/core/Trace.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstring>
-#include <fstream>
-#include <sstream>
+#include <span>
+#include <string_view>
 #include <unordered_set>
 
 namespace {
 
-static bool readFileText(const std::string& path, std::string& out, std::string& err)
+template <typename T>
+static T readLE(const uint8_t* p)
 {
-    std::ifstream f(path, std::ios::binary);
-    if (!f) {
-        err = "Failed to open: " + path;
-        return false;
-    }
-    std::ostringstream ss;
-    ss << f.rdbuf();
-    out = ss.str();
-    return true;
+    T v{};
+    std::memcpy(&v, p, sizeof(T));
+    return v;
 }
 
-static bool readFileBin(const std::string& path, std::vector<uint8_t>& out, std::string& err)
+// Binary glTF: a 12-byte header, then length-prefixed chunks, the first holding the JSON and an optional second one
+// the BIN payload that buffers[0] refers to.
+constexpr uint32_t kGlbMagic = 0x46546C67;  // "glTF"
+constexpr uint32_t kGlbChunkJson = 0x4E4F534A;
+constexpr uint32_t kGlbChunkBin = 0x004E4942;
+
+static bool isGlb(std::span<const uint8_t> file)
+{
+    return file.size() >= 4 && readLE<uint32_t>(file.data()) == kGlbMagic;
+}
+
+static bool splitGlb(std::span<const uint8_t> file, std::string_view& json, std::span<const uint8_t>& bin, std::string& err)
 {
-    std::ifstream f(path, std::ios::binary);
-    if (!f) {
-        err = "Failed to open: " + path;
+    if (file.size() < 12 || readLE<uint32_t>(file.data() + 4) != 2) {
+        err = "Unsupported GLB header";
+        return false;
+    }
+    const size_t length = readLE<uint32_t>(file.data() + 8);
+    if (length > file.size()) {
+        err = "GLB truncated";
+        return false;
+    }
+
+    json = {};
+    bin = {};
+    for (size_t at = 12; at + 8 <= length;) {
+        const size_t chunkLength = readLE<uint32_t>(file.data() + at);
+        const uint32_t chunkType = readLE<uint32_t>(file.data() + at + 4);
+        at += 8;
+        if (chunkLength > length - at) {
+            err = "GLB chunk out of range";
+            return false;
+        }
+        const uint8_t* chunk = file.data() + at;
+        if (at == 20) {
+            if (chunkType != kGlbChunkJson) {
+                err = "GLB does not start with a JSON chunk";
+                return false;
+            }
+            json = { reinterpret_cast<const char*>(chunk), chunkLength };
+        } else if (chunkType == kGlbChunkBin && bin.empty()) {
+            bin = { chunk, chunkLength };
+        }
+        // Chunks are 4-byte aligned; unknown ones are skipped.
+        at += (chunkLength + 3) & ~size_t(3);
+    }
+    if (json.empty()) {
+        err = "GLB has no JSON chunk";
         return false;
     }
-    f.seekg(0, std::ios::end);
-    size_t sz = (size_t)f.tellg();
-    f.seekg(0, std::ios::beg);
-    out.resize(sz);
-    f.read((char*)out.data(), (std::streamsize)sz);
     return true;
 }
 
@@ -51,7 +89,7 @@ static std::string dirOf(const std::string& path)
     return path.substr(0, p + 1);
 }
 
-static uint32_t u32(const mini_json::Value& v, uint32_t def = 0)
+static uint32_t u32(const mini_json::Element& v, uint32_t def = 0)
 {
     if (!v.is_num())
         return def;
@@ -60,25 +98,37 @@ static uint32_t u32(const mini_json::Value& v, uint32_t def = 0)
         return def;
     return (uint32_t)d;
 }
-static int i32(const mini_json::Value& v, int def = -1)
+static int i32(const mini_json::Element& v, int def = -1)
 {
     if (!v.is_num())
         return def;
     return (int)v.as_num();
 }
-static float f32(const mini_json::Value& v, float def = 0.0f)
+static float f32(const mini_json::Element& v, float def = 0.0f)
 {
     if (!v.is_num())
         return def;
     return (float)v.as_num();
 }
 
-static glm::mat4 nodeLocalMatrix(const mini_json::Value& node)
+// Fills out only when v is an array of exactly n values.
+static bool readFloats(const mini_json::Element& v, float* out, size_t n, float def)
 {
-    if (auto* m = node.get("matrix"); m && m->is_arr() && m->as_arr().size() == 16) {
+    size_t i = 0;
+    for (mini_json::Element e : v.as_arr()) {
+        if (i == n)
+            return false;
+        out[i++] = f32(e, def);
+    }
+    return i == n;
+}
+
+static glm::mat4 nodeLocalMatrix(const mini_json::Element& node)
+{
+    if (float m[16]; readFloats(node.get("matrix"), m, 16, 0.0f)) {
         glm::mat4 M(1.0f);
         for (int i = 0; i < 16; i++) {
-            M[i / 4][i % 4] = f32(*m->at(i));
+            M[i / 4][i % 4] = m[i];
         }
         return M;
     }
@@ -86,14 +136,14 @@ static glm::mat4 nodeLocalMatrix(const mini_json::Value& node)
     glm::vec3 S(1.0f);
     glm::quat R(1.0f, 0.0f, 0.0f, 0.0f);
 
-    if (auto* t = node.get("translation"); t && t->is_arr() && t->as_arr().size() == 3) {
-        T = { f32(*t->at(0)), f32(*t->at(1)), f32(*t->at(2)) };
+    if (float t[3]; readFloats(node.get("translation"), t, 3, 0.0f)) {
+        T = { t[0], t[1], t[2] };
     }
-    if (auto* s = node.get("scale"); s && s->is_arr() && s->as_arr().size() == 3) {
-        S = { f32(*s->at(0), 1), f32(*s->at(1), 1), f32(*s->at(2), 1) };
+    if (float sc[3]; readFloats(node.get("scale"), sc, 3, 1.0f)) {
+        S = { sc[0], sc[1], sc[2] };
     }
-    if (auto* r = node.get("rotation"); r && r->is_arr() && r->as_arr().size() == 4) {
-        R = glm::quat(f32(*r->at(3), 1), f32(*r->at(0)), f32(*r->at(1)), f32(*r->at(2)));
+    if (float r[4]; readFloats(node.get("rotation"), r, 4, 0.0f)) {
+        R = glm::quat(r[3], r[0], r[1], r[2]);
     }
 
     glm::mat4 M = glm::translate(glm::mat4(1.0f), T) * glm::mat4_cast(R) * glm::scale(glm::mat4(1.0f), S);
@@ -149,430 +199,598 @@ static size_t typeCount(const std::string& t)
     return 0;
 }
 
-template <typename T>
-static T readLE(const uint8_t* p)
-{
-    T v{};
-    std::memcpy(&v, p, sizeof(T));
-    return v;
-}
-
-static bool loadArrays(const mini_json::Value& root,
+static bool loadArrays(const mini_json::Element& root,
                        std::vector<BufferView>& bvs,
                        std::vector<Accessor>& accs,
-                       std::vector<mini_json::Value> const*& meshes,
-                       std::vector<mini_json::Value> const*& nodes,
-                       std::vector<mini_json::Value> const*& scenes,
+                       std::vector<mini_json::Element>& meshes,
+                       std::vector<mini_json::Element>& nodes,
+                       std::vector<mini_json::Element>& scenes,
                        std::string& err)
 {
-    auto* bufferViews = root.get("bufferViews");
-    auto* accessors = root.get("accessors");
-    auto* meshesV = root.get("meshes");
-    auto* nodesV = root.get("nodes");
-    auto* scenesV = root.get("scenes");
-    if (!bufferViews || !bufferViews->is_arr()) {
+    auto bufferViews = root.get("bufferViews");
+    auto accessors = root.get("accessors");
+    auto meshesV = root.get("meshes");
+    auto nodesV = root.get("nodes");
+    auto scenesV = root.get("scenes");
+    if (!bufferViews || !bufferViews.is_arr()) {
         err = "No bufferViews";
         return false;
     }
-    if (!accessors || !accessors->is_arr()) {
+    if (!accessors || !accessors.is_arr()) {
         err = "No accessors";
         return false;
     }
-    if (!meshesV || !meshesV->is_arr()) {
+    if (!meshesV || !meshesV.is_arr()) {
         err = "No meshes";
         return false;
     }
-    if (!nodesV || !nodesV->is_arr()) {
+    if (!nodesV || !nodesV.is_arr()) {
         err = "No nodes";
         return false;
     }
-    if (!scenesV || !scenesV->is_arr()) {
+    if (!scenesV || !scenesV.is_arr()) {
         err = "No scenes";
         return false;
     }
 
-    bvs.resize(bufferViews->as_arr().size());
-    for (size_t i = 0; i < bvs.size(); i++) {
-        if (!bufferViews->as_arr()[i].is_obj()) {
+    // Walked once in order; indexing the arrays would rescan them from the start every time.
+    for (mini_json::Element o : bufferViews.as_arr()) {
+        const size_t i = bvs.size();
+        if (!o.is_obj()) {
             err = "bufferViews[" + std::to_string(i) + "] not an object";
             return false;
         }
-        auto& o = bufferViews->as_arr()[i].as_obj();
-        if (auto it = o.find("buffer"); it != o.end())
-            bvs[i].buffer = i32(it->second, 0);
+        bvs.emplace_back();
+        if (auto v = o.get("buffer"))
+            bvs[i].buffer = i32(v, 0);
         else
             bvs[i].buffer = 0;
-        if (auto it = o.find("byteOffset"); it != o.end())
-            bvs[i].byteOffset = (size_t)u32(it->second, 0);
-        if (auto it = o.find("byteLength"); it != o.end())
-            bvs[i].byteLength = (size_t)u32(it->second, 0);
+        if (auto v = o.get("byteOffset"))
+            bvs[i].byteOffset = (size_t)u32(v, 0);
+        if (auto v = o.get("byteLength"))
+            bvs[i].byteLength = (size_t)u32(v, 0);
         else {
             err = "bufferViews[" + std::to_string(i) + "] missing byteLength";
             return false;
         }
-        if (auto it = o.find("byteStride"); it != o.end())
-            bvs[i].byteStride = (size_t)u32(it->second, 0);
+        if (auto v = o.get("byteStride"))
+            bvs[i].byteStride = (size_t)u32(v, 0);
     }
 
-    accs.resize(accessors->as_arr().size());
-    for (size_t i = 0; i < accs.size(); i++) {
-        if (!accessors->as_arr()[i].is_obj()) {
+    for (mini_json::Element o : accessors.as_arr()) {
+        const size_t i = accs.size();
+        if (!o.is_obj()) {
             err = "accessors[" + std::to_string(i) + "] not an object";
             return false;
         }
-        auto& o = accessors->as_arr()[i].as_obj();
+        accs.emplace_back();
 
-        if (auto it = o.find("bufferView"); it != o.end())
-            accs[i].bufferView = i32(it->second, -1);
+        if (auto v = o.get("bufferView"))
+            accs[i].bufferView = i32(v, -1);
         else
             accs[i].bufferView = -1;
-        if (auto it = o.find("byteOffset"); it != o.end())
-            accs[i].byteOffset = (size_t)u32(it->second, 0);
-        if (auto it = o.find("componentType"); it != o.end())
-            accs[i].componentType = u32(it->second, 0);
+        if (auto v = o.get("byteOffset"))
+            accs[i].byteOffset = (size_t)u32(v, 0);
+        if (auto v = o.get("componentType"))
+            accs[i].componentType = u32(v, 0);
         else {
             err = "accessors[" + std::to_string(i) + "] missing componentType";
             return false;
         }
-        if (auto it = o.find("count"); it != o.end())
-            accs[i].count = u32(it->second, 0);
+        if (auto v = o.get("count"))
+            accs[i].count = u32(v, 0);
         else {
             err = "accessors[" + std::to_string(i) + "] missing count";
             return false;
         }
-        if (auto it = o.find("type"); it != o.end() && it->second.is_str())
-            accs[i].type = it->second.as_str();
-        if (auto it = o.find("normalized"); it != o.end() && it->second.is_bool())
-            accs[i].normalized = it->second.as_bool();
-    }
-
-    meshes = &meshesV->as_arr();
-    nodes = &nodesV->as_arr();
-    scenes = &scenesV->as_arr();
+        if (auto v = o.get("type"); v && v.is_str())
+            accs[i].type = v.as_str();
+        if (auto v = o.get("normalized"); v && v.is_bool())
+            accs[i].normalized = v.as_bool();
+    }
+
+    for (mini_json::Element m : meshesV.as_arr())
+        meshes.push_back(m);
+    for (mini_json::Element n : nodesV.as_arr())
+        nodes.push_back(n);
+    for (mini_json::Element sc : scenesV.as_arr())
+        scenes.push_back(sc);
     return true;
 }
 
-static bool readAccessorVec(const std::vector<uint8_t>& bin,
-                            const std::vector<BufferView>& bvs,
-                            const Accessor& a,
-                            std::vector<float>& out,
-                            size_t comps,
-                            std::string& err)
+// Strided window onto one accessor's elements, read straight out of the mapped buffer.
+struct AccessorView {
+    const uint8_t* data = nullptr;
+    size_t stride = 0;
+    uint32_t count = 0;
+    uint32_t componentType = 0;
+
+    float component(size_t i, size_t c) const { return readLE<float>(data + i * stride + c * sizeof(float)); }
+    uint32_t index(size_t i) const
+    {
+        const uint8_t* p = data + i * stride;
+        switch (componentType) {
+            case 5121:
+                return readLE<uint8_t>(p);
+            case 5123:
+                return readLE<uint16_t>(p);
+            default:
+                return readLE<uint32_t>(p);
+        }
+    }
+};
+
+// what prefixes the error messages.
+static bool viewAccessor(const std::vector<std::span<const uint8_t>>& buffers,
+                         const std::vector<BufferView>& bvs,
+                         const Accessor& a,
+                         size_t elementSize,
+                         const char* what,
+                         AccessorView& out,
+                         std::string& err)
 {
     if (a.bufferView < 0 || (size_t)a.bufferView >= bvs.size()) {
-        err = "Accessor missing bufferView";
+        err = std::string(what) + " missing bufferView";
         return false;
     }
-    if (a.componentType != 5126) {
-        err = "Only FLOAT accessors supported for attributes";
+    const auto& bv = bvs[(size_t)a.bufferView];
+    if (bv.buffer < 0 || (size_t)bv.buffer >= buffers.size()) {
+        err = std::string(what) + " references a missing buffer";
         return false;
     }
-    if (typeCount(a.type) != comps) {
-        err = "Accessor type mismatch";
+    const std::span<const uint8_t> buffer = buffers[(size_t)bv.buffer];
+    if (bv.byteOffset > buffer.size() || bv.byteLength > buffer.size() - bv.byteOffset) {
+        err = std::string(what) + " bufferView out of range";
         return false;
     }
-    const auto& bv = bvs[(size_t)a.bufferView];
-    size_t stride = bv.byteStride ? bv.byteStride : comps * sizeof(float);
-    size_t start = bv.byteOffset + a.byteOffset;
-    if (a.count == 0) {
-        out.clear();
-        return true;
-    }
 
-    size_t need = start + stride * (size_t)(a.count - 1) + comps * sizeof(float);
-    if (need > bin.size()) {
-        err = "Accessor out of range";
+    out = {};
+    out.stride = bv.byteStride ? bv.byteStride : elementSize;
+    out.componentType = a.componentType;
+    if (a.count == 0)
+        return true;
+    size_t need = a.byteOffset + out.stride * (size_t)(a.count - 1) + elementSize;
+    if (need > bv.byteLength) {
+        err = std::string(what) + " out of range";
         return false;
     }
-
-    out.resize((size_t)a.count * comps);
-    for (size_t i = 0; i < a.count; i++) {
-        const uint8_t* p = bin.data() + start + i * stride;
-        for (size_t c = 0; c < comps; c++) {
-            out[i * comps + c] = readLE<float>(p + c * sizeof(float));
-        }
-    }
+    out.data = buffer.data() + bv.byteOffset + a.byteOffset;
+    out.count = a.count;
     return true;
 }
 
-static bool readAccessorIndices(const std::vector<uint8_t>& bin,
-                                const std::vector<BufferView>& bvs,
-                                const Accessor& a,
-                                std::vector<uint32_t>& out,
-                                std::string& err)
+static bool viewAttribute(const std::vector<std::span<const uint8_t>>& buffers,
+                          const std::vector<BufferView>& bvs,
+                          const Accessor& a,
+                          size_t comps,
+                          AccessorView& out,
+                          std::string& err)
 {
-    if (a.bufferView < 0 || (size_t)a.bufferView >= bvs.size()) {
-        err = "Indices missing bufferView";
+    if (a.componentType != 5126) {
+        err = "Only FLOAT accessors supported for attributes";
         return false;
     }
+    if (typeCount(a.type) != comps) {
+        err = "Accessor type mismatch";
+        return false;
+    }
+    return viewAccessor(buffers, bvs, a, comps * sizeof(float), "Accessor", out, err);
+}
+
+static bool viewIndices(const std::vector<std::span<const uint8_t>>& buffers,
+                        const std::vector<BufferView>& bvs,
+                        const Accessor& a,
+                        AccessorView& out,
+                        std::string& err)
+{
     if (typeCount(a.type) != 1) {
         err = "Indices must be SCALAR";
         return false;
     }
-    const auto& bv = bvs[(size_t)a.bufferView];
-    size_t comps = 1;
-    size_t cs = componentSize(a.componentType);
-    if (cs == 0) {
+    if (a.componentType != 5121 && a.componentType != 5123 && a.componentType != 5125) {
         err = "Unsupported index componentType";
         return false;
     }
-    size_t stride = bv.byteStride ? bv.byteStride : cs * comps;
-    size_t start = bv.byteOffset + a.byteOffset;
-    if (a.count == 0) {
-        out.clear();
-        return true;
+    return viewAccessor(buffers, bvs, a, componentSize(a.componentType), "Indices", out, err);
+}
+
+// Primitives never share vertices, so each one's tangents only depend on its own triangles.
+static void computeTangents(Vertex* verts, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount, uint32_t base)
+{
+    std::vector<glm::vec3> tan1(vertexCount, glm::vec3(0.0f));
+    std::vector<glm::vec3> tan2(vertexCount, glm::vec3(0.0f));
+
+    for (uint32_t i = 0; i + 2 < indexCount; i += 3) {
+        uint32_t i0 = indices[i + 0] - base;
+        uint32_t i1 = indices[i + 1] - base;
+        uint32_t i2 = indices[i + 2] - base;
+        if (i0 >= vertexCount || i1 >= vertexCount || i2 >= vertexCount)
+            continue;
+
+        const glm::vec3& p0 = verts[i0].pos;
+        const glm::vec3& p1 = verts[i1].pos;
+        const glm::vec3& p2 = verts[i2].pos;
+        const glm::vec2& w0 = verts[i0].uv;
+        const glm::vec2& w1 = verts[i1].uv;
+        const glm::vec2& w2 = verts[i2].uv;
+
+        glm::vec3 e1 = p1 - p0;
+        glm::vec3 e2 = p2 - p0;
+        glm::vec2 d1 = w1 - w0;
+        glm::vec2 d2 = w2 - w0;
+
+        float r = (d1.x * d2.y - d1.y * d2.x);
+        if (fabs(r) < 1e-20f)
+            continue;
+        r = 1.0f / r;
+
+        glm::vec3 sdir = (e1 * d2.y - e2 * d1.y) * r;
+        glm::vec3 tdir = (e2 * d1.x - e1 * d2.x) * r;
+
+        tan1[i0] += sdir;
+        tan1[i1] += sdir;
+        tan1[i2] += sdir;
+
+        tan2[i0] += tdir;
+        tan2[i1] += tdir;
+        tan2[i2] += tdir;
     }
-    size_t need = start + stride * (size_t)(a.count - 1) + cs * comps;
-    if (need > bin.size()) {
-        err = "Indices out of range";
-        return false;
+
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        glm::vec3 n = verts[i].nrm;
+        glm::vec3 t = tan1[i];
+
+        t = glm::normalize(t - n * glm::dot(n, t));
+        if (!std::isfinite(t.x) || !std::isfinite(t.y) || !std::isfinite(t.z) || glm::length(t) < 1e-6f)
+            t = glm::vec3(1.0f, 0.0f, 0.0f);
+
+        float w = (glm::dot(glm::cross(n, t), tan2[i]) < 0.0f) ? -1.0f : 1.0f;
+        verts[i].tangent = glm::vec4(t, w);
     }
+}
 
-    out.resize((size_t)a.count);
-    for (size_t i = 0; i < a.count; i++) {
-        const uint8_t* p = bin.data() + start + i * stride;
-        uint32_t v = 0;
-        switch (a.componentType) {
-            case 5121:
-                v = (uint32_t)readLE<uint8_t>(p);
-                break;
-            case 5123:
-                v = (uint32_t)readLE<uint16_t>(p);
-                break;
-            case 5125:
-                v = (uint32_t)readLE<uint32_t>(p);
-                break;
-            default:
-                err = "Unsupported index type";
+// A triangle primitive located and validated by the gather phase. Decoding it reads only the mapped buffers and
+// writes only its own ranges of the mesh, so any number of them can decode at once.
+struct PrimitiveDecode {
+    AccessorView pos, nrm, uv, idx;
+    bool indexed = false;
+    uint32_t mesh = 0;
+    uint32_t firstVertex = 0;
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+};
+
+// Locates the triangle primitives of a glTF mesh and sizes the mesh for all of them; nothing is decoded yet.
+static bool gatherMesh(const mini_json::Element& mesh,
+                       const std::vector<BufferView>& bvs,
+                       const std::vector<Accessor>& accs,
+                       const std::vector<std::span<const uint8_t>>& buffers,
+                       uint32_t meshIndex,
+                       GltfMesh& out,
+                       std::vector<PrimitiveDecode>& prims,
+                       std::string& err)
+{
+    auto primsV = mesh.get("primitives");
+    if (!primsV || !primsV.is_arr())
+        return true;
+    uint64_t vertexCount = 0, indexCount = 0;
+    for (mini_json::Element prim : primsV.as_arr()) {
+        if (!prim.is_obj())
+            continue;
+
+        if (auto mode = prim.get("mode"); mode && mode.is_num()) {
+            if ((int)mode.as_num() != 4)
+                continue;
+        }
+
+        auto attr = prim.get("attributes");
+        if (!attr || !attr.is_obj())
+            continue;
+
+        auto posV = attr.get("POSITION");
+        if (!posV)
+            continue;
+
+        int accPos = (int)posV.as_num();
+        int accNrm = -1, accUv = -1;
+        if (auto v = attr.get("NORMAL"); v && v.is_num())
+            accNrm = (int)v.as_num();
+        if (auto v = attr.get("TEXCOORD_0"); v && v.is_num())
+            accUv = (int)v.as_num();
+
+        if (accPos < 0 || (size_t)accPos >= accs.size()) {
+            err = "Bad POSITION accessor";
+            return false;
+        }
+
+        PrimitiveDecode p;
+        if (!viewAttribute(buffers, bvs, accs[(size_t)accPos], 3, p.pos, err))
+            return false;
+        if (accNrm >= 0) {
+            if ((size_t)accNrm >= accs.size()) {
+                err = "Bad NORMAL accessor";
+                return false;
+            }
+            if (!viewAttribute(buffers, bvs, accs[(size_t)accNrm], 3, p.nrm, err))
                 return false;
         }
-        out[i] = v;
+        if (accUv >= 0) {
+            if ((size_t)accUv >= accs.size()) {
+                err = "Bad TEXCOORD_0 accessor";
+                return false;
+            }
+            if (!viewAttribute(buffers, bvs, accs[(size_t)accUv], 2, p.uv, err))
+                return false;
+        }
+        // Empty attributes are treated as absent; short ones would read past their views.
+        if ((p.nrm.count && p.nrm.count < p.pos.count) || (p.uv.count && p.uv.count < p.pos.count)) {
+            err = "Attribute count mismatch";
+            return false;
+        }
+
+        if (auto idxV = prim.get("indices"); idxV && idxV.is_num()) {
+            int accI = (int)idxV.as_num();
+            if (accI < 0 || (size_t)accI >= accs.size()) {
+                err = "Bad indices accessor";
+                return false;
+            }
+            if (!viewIndices(buffers, bvs, accs[(size_t)accI], p.idx, err))
+                return false;
+            p.indexed = true;
+        }
+
+        p.mesh = meshIndex;
+        p.firstVertex = (uint32_t)vertexCount;
+        p.firstIndex = (uint32_t)indexCount;
+        p.indexCount = p.indexed ? p.idx.count : p.pos.count;
+        vertexCount += p.pos.count;
+        indexCount += p.indexCount;
+        if (vertexCount > UINT32_MAX || indexCount > UINT32_MAX) {
+            err = "Mesh too large";
+            return false;
+        }
+        prims.push_back(p);
     }
+    out.vertices.resize((size_t)vertexCount);
+    out.indices.resize((size_t)indexCount);
     return true;
 }
 
-static void gatherNodeRecursive(int nodeIndex,
-                                const std::vector<mini_json::Value>& nodes,
-                                const std::vector<mini_json::Value>& meshes,
-                                const std::vector<BufferView>& bvs,
-                                const std::vector<Accessor>& accs,
-                                const std::vector<uint8_t>& bin,
-                                glm::mat4 parent,
-                                std::vector<Vertex>& outV,
-                                std::vector<uint32_t>& outI,
-                                std::string& err,
-                                bool& ok)
+// Returns false if an index points past the primitive's vertices.
+static bool decodePrimitive(const PrimitiveDecode& p, GltfMesh& mesh)
 {
-    if (!ok)
-        return;
-    if (nodeIndex < 0 || (size_t)nodeIndex >= nodes.size())
-        return;
-    const auto& node = nodes[(size_t)nodeIndex];
+    Vertex* verts = mesh.vertices.data() + p.firstVertex;
+    for (size_t i = 0; i < p.pos.count; i++) {
+        glm::vec3 P(p.pos.component(i, 0), p.pos.component(i, 1), p.pos.component(i, 2));
+        glm::vec3 N(0, 1, 0);
+        if (p.nrm.count)
+            N = glm::normalize(glm::vec3(p.nrm.component(i, 0), p.nrm.component(i, 1), p.nrm.component(i, 2)));
+        glm::vec2 Uv(0.0f);
+        if (p.uv.count)
+            Uv = { p.uv.component(i, 0), p.uv.component(i, 1) };
+        verts[i] = Vertex{ P, N, Uv };
+    }
+
+    uint32_t* indices = mesh.indices.data() + p.firstIndex;
+    for (uint32_t i = 0; i < p.indexCount; i++) {
+        const uint32_t v = p.indexed ? p.idx.index(i) : i;
+        if (v >= p.pos.count)
+            return false;
+        indices[i] = p.firstVertex + v;
+    }
+
+    computeTangents(verts, p.pos.count, indices, p.indexCount, p.firstVertex);
+    return true;
+}
+
+// EXT_mesh_gpu_instancing: one TRS transform per instance, relative to the node. Only FLOAT attributes are supported.
+static bool readInstances(const mini_json::Element& node,
+                          const std::vector<BufferView>& bvs,
+                          const std::vector<Accessor>& accs,
+                          const std::vector<std::span<const uint8_t>>& buffers,
+                          std::vector<glm::mat4>& out,
+                          std::string& err)
+{
+    auto attr = node.get("extensions").get("EXT_mesh_gpu_instancing").get("attributes");
+    if (!attr.is_obj())
+        return true;
+
+    const char* names[3] = { "TRANSLATION", "ROTATION", "SCALE" };
+    const size_t comps[3] = { 3, 4, 3 };
+    AccessorView views[3];
+    uint32_t count = 0;
+    bool any = false;
+    for (int k = 0; k < 3; ++k) {
+        auto v = attr.get(names[k]);
+        if (!v)
+            continue;
+        const int a = i32(v, -1);
+        if (a < 0 || (size_t)a >= accs.size()) {
+            err = std::string("Bad EXT_mesh_gpu_instancing ") + names[k] + " accessor";
+            return false;
+        }
+        if (!viewAttribute(buffers, bvs, accs[(size_t)a], comps[k], views[k], err))
+            return false;
+        if (any && views[k].count != count) {
+            err = "EXT_mesh_gpu_instancing attribute counts differ";
+            return false;
+        }
+        count = views[k].count;
+        any = true;
+    }
+
+    out.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        glm::vec3 T(0.0f);
+        glm::vec3 S(1.0f);
+        glm::quat R(1.0f, 0.0f, 0.0f, 0.0f);
+        if (views[0].count)
+            T = { views[0].component(i, 0), views[0].component(i, 1), views[0].component(i, 2) };
+        if (views[1].count)
+            R = glm::quat(views[1].component(i, 3), views[1].component(i, 0), views[1].component(i, 1), views[1].component(i, 2));
+        if (views[2].count)
+            S = { views[2].component(i, 0), views[2].component(i, 1), views[2].component(i, 2) };
+        out[i] = glm::translate(glm::mat4(1.0f), T) * glm::mat4_cast(R) * glm::scale(glm::mat4(1.0f), S);
+    }
+    return true;
+}
+
+struct NodeGather {
+    const std::vector<mini_json::Element>& nodes;
+    const std::vector<mini_json::Element>& meshes;
+    const std::vector<BufferView>& bvs;
+    const std::vector<Accessor>& accs;
+    const std::vector<std::span<const uint8_t>>& buffers;
+    GltfSceneData& out;
+    std::vector<PrimitiveDecode>& prims;
+    std::string& err;
+    // Output mesh of each glTF mesh: -1 until first referenced, -2 if it has no triangles.
+    std::vector<int> meshMap;
+    std::vector<bool> visited;
+};
+
+// Appends the node and its subtree parents first. Meshes are gathered once, on their first reference.
+static bool gatherNode(NodeGather& g, int nodeIndex, int parent)
+{
+    if (nodeIndex < 0 || (size_t)nodeIndex >= g.nodes.size() || g.visited[(size_t)nodeIndex])
+        return true;
+    g.visited[(size_t)nodeIndex] = true;
+    const auto& node = g.nodes[(size_t)nodeIndex];
     if (!node.is_obj())
-        return;
-
-    glm::mat4 M = parent * nodeLocalMatrix(node);
-
-    if (auto* meshIdxV = node.get("mesh"); meshIdxV && meshIdxV->is_num()) {
-        int meshIdx = (int)meshIdxV->as_num();
-        if (meshIdx >= 0 && (size_t)meshIdx < meshes.size()) {
-            const auto& mesh = meshes[(size_t)meshIdx].as_obj();
-            auto itPrims = mesh.find("primitives");
-            if (itPrims != mesh.end() && itPrims->second.is_arr()) {
-                for (auto& primV : itPrims->second.as_arr()) {
-                    if (!primV.is_obj())
-                        continue;
-                    auto& prim = primV.as_obj();
-
-                    if (auto it = prim.find("mode"); it != prim.end() && it->second.is_num()) {
-                        if ((int)it->second.as_num() != 4)
-                            continue;
-                    }
-
-                    auto itAttr = prim.find("attributes");
-                    if (itAttr == prim.end() || !itAttr->second.is_obj())
-                        continue;
-                    auto& attr = itAttr->second.as_obj();
-
-                    auto itPos = attr.find("POSITION");
-                    if (itPos == attr.end())
-                        continue;
-
-                    int accPos = (int)itPos->second.as_num();
-                    int accNrm = -1, accUv = -1;
-                    if (auto it = attr.find("NORMAL"); it != attr.end() && it->second.is_num())
-                        accNrm = (int)it->second.as_num();
-                    if (auto it = attr.find("TEXCOORD_0"); it != attr.end() && it->second.is_num())
-                        accUv = (int)it->second.as_num();
-
-                    if (accPos < 0 || (size_t)accPos >= accs.size()) {
-                        err = "Bad POSITION accessor";
-                        ok = false;
-                        return;
-                    }
-
-                    std::vector<float> pos, nrm, uv;
-                    if (!readAccessorVec(bin, bvs, accs[(size_t)accPos], pos, 3, err)) {
-                        ok = false;
-                        return;
-                    }
-                    if (accNrm >= 0) {
-                        if ((size_t)accNrm >= accs.size()) {
-                            err = "Bad NORMAL accessor";
-                            ok = false;
-                            return;
-                        }
-                        if (!readAccessorVec(bin, bvs, accs[(size_t)accNrm], nrm, 3, err)) {
-                            ok = false;
-                            return;
-                        }
-                    }
-                    if (accUv >= 0) {
-                        if ((size_t)accUv >= accs.size()) {
-                            err = "Bad TEXCOORD_0 accessor";
-                            ok = false;
-                            return;
-                        }
-                        if (!readAccessorVec(bin, bvs, accs[(size_t)accUv], uv, 2, err)) {
-                            ok = false;
-                            return;
-                        }
-                    }
-
-                    std::vector<uint32_t> idx;
-                    auto itIdx = prim.find("indices");
-                    if (itIdx != prim.end() && itIdx->second.is_num()) {
-                        int accI = (int)itIdx->second.as_num();
-                        if (accI < 0 || (size_t)accI >= accs.size()) {
-                            err = "Bad indices accessor";
-                            ok = false;
-                            return;
-                        }
-                        if (!readAccessorIndices(bin, bvs, accs[(size_t)accI], idx, err)) {
-                            ok = false;
-                            return;
-                        }
-                    } else {
-                        idx.resize(pos.size() / 3);
-                        for (uint32_t i = 0; i < (uint32_t)idx.size(); i++)
-                            idx[i] = i;
-                    }
-
-                    uint32_t base = (uint32_t)outV.size();
-                    outV.resize(outV.size() + pos.size() / 3);
-
-                    glm::mat3 NrmM = glm::transpose(glm::inverse(glm::mat3(M)));
-
-                    for (size_t i = 0; i < pos.size() / 3; i++) {
-                        glm::vec3 P(pos[i * 3 + 0], pos[i * 3 + 1], pos[i * 3 + 2]);
-                        glm::vec3 Pw = glm::vec3(M * glm::vec4(P, 1.0f));
-                        glm::vec3 Nw(0, 1, 0);
-                        if (!nrm.empty()) {
-                            glm::vec3 N(nrm[i * 3 + 0], nrm[i * 3 + 1], nrm[i * 3 + 2]);
-                            Nw = glm::normalize(NrmM * N);
-                        }
-                        glm::vec2 Uv(0.0f);
-                        if (!uv.empty())
-                            Uv = { uv[i * 2 + 0], uv[i * 2 + 1] };
-                        outV[base + (uint32_t)i] = Vertex{ Pw, Nw, Uv };
-                    }
-
-                    outI.reserve(outI.size() + idx.size());
-
-                    uint32_t localVertCount = (uint32_t)(pos.size() / 3);
-                    for (auto v : idx) {
-                        if (v >= localVertCount) {
-                            err = "Index out of range for primitive";
-                            ok = false;
-                            return;
-                        }
-                        outI.push_back(base + v);
-                    }
-                }
+        return true;
+
+    GltfNode n;
+    n.parent = parent;
+    n.local = nodeLocalMatrix(node);
+
+    if (auto meshIdxV = node.get("mesh"); meshIdxV && meshIdxV.is_num()) {
+        int meshIdx = (int)meshIdxV.as_num();
+        if (meshIdx >= 0 && (size_t)meshIdx < g.meshes.size()) {
+            int& mapped = g.meshMap[(size_t)meshIdx];
+            if (mapped == -1) {
+                GltfMesh mesh;
+                const size_t firstPrim = g.prims.size();
+                const uint32_t outIndex = (uint32_t)g.out.meshes.size();
+                if (!gatherMesh(g.meshes[(size_t)meshIdx], g.bvs, g.accs, g.buffers, outIndex, mesh, g.prims, g.err))
+                    return false;
+                mapped = mesh.indices.empty() ? -2 : (int)outIndex;
+                if (mapped >= 0)
+                    g.out.meshes.push_back(std::move(mesh));
+                else
+                    g.prims.resize(firstPrim);
             }
+            n.mesh = std::max(mapped, -1);
         }
+        if (n.mesh >= 0 && !readInstances(node, g.bvs, g.accs, g.buffers, n.instances, g.err))
+            return false;
     }
 
-    if (auto* ch = node.get("children"); ch && ch->is_arr()) {
-        for (auto& c : ch->as_arr()) {
+    const int self = (int)g.out.nodes.size();
+    g.out.nodes.push_back(std::move(n));
+
+    if (auto ch = node.get("children"); ch && ch.is_arr()) {
+        for (mini_json::Element c : ch.as_arr()) {
             if (!c.is_num())
                 continue;
-            gatherNodeRecursive((int)c.as_num(), nodes, meshes, bvs, accs, bin, M, outV, outI, err, ok);
+            if (!gatherNode(g, (int)c.as_num(), self))
+                return false;
         }
     }
+    return true;
 }
 
-}  // namespace
-
-bool loadGltfScene(const std::string& path, GltfSceneData& out, std::string& err)
+// Maps every entry of the buffers array. A buffer without a uri is the BIN chunk of a .glb; the others are external
+// files next to the manifest, kept open in files until the scene has been read.
+static bool mapBuffers(const std::string& path,
+                       const mini_json::Element& buffersV,
+                       std::span<const uint8_t> glbBin,
+                       std::vector<MappedFile>& files,
+                       std::vector<std::span<const uint8_t>>& buffers,
+                       std::string& err)
 {
-    out = {};
-    std::string jsonText;
-    if (!readFileText(path, jsonText, err))
-        return false;
+    for (mini_json::Element b : buffersV.as_arr()) {
+        const std::string name = "buffers[" + std::to_string(buffers.size()) + "]";
+        std::span<const uint8_t> data;
+        if (auto uri = b.get("uri"); !uri) {
+            if (!buffers.empty() || glbBin.empty()) {
+                err = name + ".uri missing";
+                return false;
+            }
+            data = glbBin;
+        } else if (!uri.is_str()) {
+            err = name + ".uri not a string";
+            return false;
+        } else {
+            const std::string u = uri.as_str();
+            if (u.starts_with("data:")) {
+                err = name + ": embedded data URIs are not supported";
+                return false;
+            }
+            files.emplace_back();
+            if (!files.back().open(dirOf(path) + u, err))
+                return false;
+            data = files.back().bytes();
+        }
 
-    mini_json::Value root;
-    try {
-        root = mini_json::parse(jsonText);
-    } catch (const std::exception& e) {
-        err = e.what();
-        return false;
+        // The BIN chunk may carry up to three bytes of padding past byteLength.
+        auto lengthV = b.get("byteLength");
+        if (!lengthV.is_num()) {
+            err = name + ".byteLength missing";
+            return false;
+        }
+        const double byteLength = lengthV.as_num();
+        if (byteLength < 0 || byteLength > (double)data.size()) {
+            err = name + ".byteLength larger than its data";
+            return false;
+        }
+        buffers.push_back(data.first((size_t)byteLength));
     }
+    return true;
+}
+
+static bool loadScene(const std::string& path,
+                      const mini_json::Element& root,
+                      std::span<const uint8_t> glbBin,
+                      JobSystem* jobs,
+                      GltfSceneData& out,
+                      std::string& err)
+{
     if (!root.is_obj()) {
         err = "Root JSON not object";
         return false;
     }
 
-    auto* buffers = root.get("buffers");
-    if (!buffers || !buffers->is_arr() || buffers->as_arr().empty()) {
+    auto buffers = root.get("buffers");
+    if (!buffers || !buffers.is_arr() || buffers.as_arr().empty()) {
         err = "No buffers";
         return false;
     }
-    auto& b0 = buffers->as_arr()[0].as_obj();
-    auto itUri = b0.find("uri");
-    if (itUri == b0.end() || !itUri->second.is_str()) {
-        err = "buffers[0].uri missing (export as .gltf + .bin)";
-        return false;
-    }
-    std::string binPath = dirOf(path) + itUri->second.as_str();
-
-    std::vector<uint8_t> bin;
-    if (!readFileBin(binPath, bin, err))
+    std::vector<MappedFile> files;
+    std::vector<std::span<const uint8_t>> bufferData;
+    if (!mapBuffers(path, buffers, glbBin, files, bufferData, err))
         return false;
 
     std::vector<BufferView> bvs;
     std::vector<Accessor> accs;
-    std::vector<mini_json::Value> const *meshes = nullptr, *nodes = nullptr, *scenes = nullptr;
+    std::vector<mini_json::Element> meshes, nodes, scenes;
     if (!loadArrays(root, bvs, accs, meshes, nodes, scenes, err))
         return false;
 
     std::vector<std::string> imageUris;
-    if (auto* imgs = root.get("images"); imgs && imgs->is_arr()) {
-        imageUris.reserve(imgs->as_arr().size());
-        for (auto& iv : imgs->as_arr()) {
-            if (!iv.is_obj()) {
-                imageUris.emplace_back();
-                continue;
-            }
-            auto& io = iv.as_obj();
-            auto it = io.find("uri");
-            if (it != io.end() && it->second.is_str())
-                imageUris.push_back(it->second.as_str());
+    if (auto imgs = root.get("images"); imgs && imgs.is_arr()) {
+        for (mini_json::Element iv : imgs.as_arr()) {
+            auto uri = iv.get("uri");
+            if (uri && uri.is_str())
+                imageUris.push_back(uri.as_str());
             else
                 imageUris.emplace_back();
         }
     }
     std::vector<int> texToImage;
-    if (auto* tex = root.get("textures"); tex && tex->is_arr()) {
-        texToImage.resize(tex->as_arr().size(), -1);
-        for (size_t i = 0; i < tex->as_arr().size(); ++i) {
-            auto& tv = tex->as_arr()[i];
-            if (!tv.is_obj())
-                continue;
-            auto& to = tv.as_obj();
-            auto it = to.find("source");
-            if (it != to.end() && it->second.is_num())
-                texToImage[i] = (int)it->second.as_num();
+    if (auto tex = root.get("textures"); tex && tex.is_arr()) {
+        for (mini_json::Element tv : tex.as_arr()) {
+            auto source = tv.get("source");
+            texToImage.push_back(source && source.is_num() ? (int)source.as_num() : -1);
         }
     }
     auto resolveTextureUri = [&](int texIndex) -> std::string {
@@ -585,138 +803,129 @@ bool loadGltfScene(const std::string& path, GltfSceneData& out, std::string& err
     };
 
     int materialIndex = 0;
-    if (meshes && !meshes->empty()) {
-        const auto& mo = (*meshes)[0].as_obj();
-        auto itP = mo.find("primitives");
-        if (itP != mo.end() && itP->second.is_arr() && !itP->second.as_arr().empty()) {
-            const auto& prim = itP->second.as_arr()[0].as_obj();
-            auto itM = prim.find("material");
-            if (itM != prim.end() && itM->second.is_num())
-                materialIndex = (int)itM->second.as_num();
+    if (!meshes.empty()) {
+        auto prims = meshes[0].get("primitives");
+        if (prims && prims.is_arr() && !prims.as_arr().empty()) {
+            auto m = prims.at(0).get("material");
+            if (m && m.is_num())
+                materialIndex = (int)m.as_num();
         }
     }
 
-    if (auto* mats = root.get("materials"); mats && mats->is_arr() && !mats->as_arr().empty()) {
-        if (materialIndex < 0 || (size_t)materialIndex >= mats->as_arr().size())
-            materialIndex = 0;
-        const auto& mat = mats->as_arr()[(size_t)materialIndex].as_obj();
+    if (auto mats = root.get("materials"); mats && mats.is_arr() && !mats.as_arr().empty()) {
+        mini_json::Element mat = materialIndex >= 0 ? mats.at((size_t)materialIndex) : mini_json::Element();
+        if (!mat)
+            mat = mats.at(0);
+        auto textureUri = [&](const mini_json::Element& t) -> std::string {
+            auto index = t.get("index");
+            return index && index.is_num() ? resolveTextureUri((int)index.as_num()) : std::string();
+        };
 
-        if (auto itP = mat.find("pbrMetallicRoughness"); itP != mat.end() && itP->second.is_obj()) {
-            const auto& pbr = itP->second.as_obj();
-
-            if (auto it = pbr.find("baseColorFactor"); it != pbr.end() && it->second.is_arr()) {
-                auto& a = it->second.as_arr();
-                if (a.size() >= 4 && a[0].is_num() && a[1].is_num() && a[2].is_num() && a[3].is_num())
+        if (auto pbr = mat.get("pbrMetallicRoughness"); pbr && pbr.is_obj()) {
+            if (auto f = pbr.get("baseColorFactor"); f && f.is_arr()) {
+                const mini_json::Element a[4] = { f.at(0), f.at(1), f.at(2), f.at(3) };
+                if (a[0].is_num() && a[1].is_num() && a[2].is_num() && a[3].is_num())
                     out.material.baseColorFactor =
                         glm::vec4((float)a[0].as_num(), (float)a[1].as_num(), (float)a[2].as_num(), (float)a[3].as_num());
             }
-            if (auto it = pbr.find("metallicFactor"); it != pbr.end() && it->second.is_num())
-                out.material.metallicFactor = (float)it->second.as_num();
-            if (auto it = pbr.find("roughnessFactor"); it != pbr.end() && it->second.is_num())
-                out.material.roughnessFactor = (float)it->second.as_num();
-
-            if (auto it = pbr.find("baseColorTexture"); it != pbr.end() && it->second.is_obj()) {
-                const auto& t = it->second.as_obj();
-                auto itI = t.find("index");
-                if (itI != t.end() && itI->second.is_num())
-                    out.material.baseColorUri = resolveTextureUri((int)itI->second.as_num());
-            }
-            if (auto it = pbr.find("metallicRoughnessTexture"); it != pbr.end() && it->second.is_obj()) {
-                const auto& t = it->second.as_obj();
-                auto itI = t.find("index");
-                if (itI != t.end() && itI->second.is_num())
-                    out.material.metallicRoughnessUri = resolveTextureUri((int)itI->second.as_num());
-            }
-        }
+            if (auto f = pbr.get("metallicFactor"); f && f.is_num())
+                out.material.metallicFactor = (float)f.as_num();
+            if (auto f = pbr.get("roughnessFactor"); f && f.is_num())
+                out.material.roughnessFactor = (float)f.as_num();
 
-        if (auto it = mat.find("normalTexture"); it != mat.end() && it->second.is_obj()) {
-            const auto& t = it->second.as_obj();
-            auto itI = t.find("index");
-            if (itI != t.end() && itI->second.is_num())
-                out.material.normalUri = resolveTextureUri((int)itI->second.as_num());
+            out.material.baseColorUri = textureUri(pbr.get("baseColorTexture"));
+            out.material.metallicRoughnessUri = textureUri(pbr.get("metallicRoughnessTexture"));
         }
+        out.material.normalUri = textureUri(mat.get("normalTexture"));
     }
 
     int sceneIndex = 0;
-    if (auto* s = root.get("scene"); s && s->is_num())
-        sceneIndex = (int)s->as_num();
-    if (sceneIndex < 0 || (size_t)sceneIndex >= scenes->size())
+    if (auto s = root.get("scene"); s && s.is_num())
+        sceneIndex = (int)s.as_num();
+    if (sceneIndex < 0 || (size_t)sceneIndex >= scenes.size())
         sceneIndex = 0;
 
-    const auto& scene = (*scenes)[(size_t)sceneIndex].as_obj();
-    auto itNodes = scene.find("nodes");
-    if (itNodes == scene.end() || !itNodes->second.is_arr()) {
+    auto sceneNodes = scenes[(size_t)sceneIndex].get("nodes");
+    if (!sceneNodes || !sceneNodes.is_arr()) {
         err = "Scene has no nodes";
         return false;
     }
 
-    bool ok = true;
-    glm::mat4 I(1.0f);
-    for (auto& n : itNodes->second.as_arr()) {
-        if (!n.is_num())
-            continue;
-        gatherNodeRecursive((int)n.as_num(), *nodes, *meshes, bvs, accs, bin, I, out.vertices, out.indices, err, ok);
+    // Gather walks the JSON and sizes every mesh; decode then fills the meshes one primitive per job.
+    std::vector<PrimitiveDecode> prims;
+    {
+        CFGC_ZONE("Gather glTF nodes");
+        NodeGather g{ nodes, meshes, bvs, accs, bufferData, out, prims, err, std::vector<int>(meshes.size(), -1),
+                      std::vector<bool>(nodes.size(), false) };
+        for (mini_json::Element n : sceneNodes.as_arr()) {
+            if (!n.is_num())
+                continue;
+            if (!gatherNode(g, (int)n.as_num(), -1))
+                return false;
+        }
     }
 
-    if (!ok)
-        return false;
-    if (out.vertices.empty() || out.indices.empty()) {
+    if (out.meshes.empty()) {
         err = "Loaded glTF but got no triangles";
         return false;
     }
 
-    {
-        std::vector<glm::vec3> tan1(out.vertices.size(), glm::vec3(0.0f));
-        std::vector<glm::vec3> tan2(out.vertices.size(), glm::vec3(0.0f));
-
-        for (size_t i = 0; i + 2 < out.indices.size(); i += 3) {
-            uint32_t i0 = out.indices[i + 0];
-            uint32_t i1 = out.indices[i + 1];
-            uint32_t i2 = out.indices[i + 2];
-            if (i0 >= out.vertices.size() || i1 >= out.vertices.size() || i2 >= out.vertices.size())
-                continue;
-
-            const glm::vec3& p0 = out.vertices[i0].pos;
-            const glm::vec3& p1 = out.vertices[i1].pos;
-            const glm::vec3& p2 = out.vertices[i2].pos;
-            const glm::vec2& w0 = out.vertices[i0].uv;
-            const glm::vec2& w1 = out.vertices[i1].uv;
-            const glm::vec2& w2 = out.vertices[i2].uv;
-
-            glm::vec3 e1 = p1 - p0;
-            glm::vec3 e2 = p2 - p0;
-            glm::vec2 d1 = w1 - w0;
-            glm::vec2 d2 = w2 - w0;
-
-            float r = (d1.x * d2.y - d1.y * d2.x);
-            if (fabs(r) < 1e-20f)
-                continue;
-            r = 1.0f / r;
-
-            glm::vec3 sdir = (e1 * d2.y - e2 * d1.y) * r;
-            glm::vec3 tdir = (e2 * d1.x - e1 * d2.x) * r;
-
-            tan1[i0] += sdir;
-            tan1[i1] += sdir;
-            tan1[i2] += sdir;
-
-            tan2[i0] += tdir;
-            tan2[i1] += tdir;
-            tan2[i2] += tdir;
+    std::atomic<bool> indicesOk{ true };
+    auto decodeRange = [&](uint32_t begin, uint32_t end, uint32_t) {
+        CFGC_ZONE("Decode primitives");
+        for (uint32_t i = begin; i < end; ++i) {
+            if (!decodePrimitive(prims[i], out.meshes[prims[i].mesh]))
+                indicesOk.store(false, std::memory_order_relaxed);
         }
+    };
+    if (jobs) {
+        // Several ranges per worker so one large primitive does not hold up the rest.
+        const uint32_t grain = std::max(1u, (uint32_t)prims.size() / (jobs->workerCount() * 8));
+        jobs->parallelFor((uint32_t)prims.size(), grain, decodeRange);
+    } else {
+        decodeRange(0, (uint32_t)prims.size(), 0);
+    }
+    if (!indicesOk.load()) {
+        err = "Index out of range for primitive";
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
 
-        for (size_t i = 0; i < out.vertices.size(); ++i) {
-            glm::vec3 n = out.vertices[i].nrm;
-            glm::vec3 t = tan1[i];
+bool loadGltfScene(const std::string& path, GltfSceneData& out, std::string& err, JobSystem* jobs)
+{
+    CFGC_ZONE("loadGltfScene");
+    out = {};
+    MappedFile file;
+    if (!file.open(path, err))
+        return false;
 
-            t = glm::normalize(t - n * glm::dot(n, t));
-            if (!std::isfinite(t.x) || !std::isfinite(t.y) || !std::isfinite(t.z) || glm::length(t) < 1e-6f)
-                t = glm::vec3(1.0f, 0.0f, 0.0f);
+    std::string_view json = file.text();
+    std::span<const uint8_t> glbBin;
+    if (isGlb(file.bytes()) && !splitGlb(file.bytes(), json, glbBin, err)) {
+        err = path + ": " + err;
+        return false;
+    }
 
-            float w = (glm::dot(glm::cross(n, t), tan2[i]) < 0.0f) ? -1.0f : 1.0f;
-            out.vertices[i].tangent = glm::vec4(t, w);
-        }
+    // Only the structure is indexed up front; fields are parsed as they are read below, which may also throw. Both
+    // the index and every accessor point into the mappings, so nothing is copied until vertices are written out.
+    mini_json::OnDemandDocument doc;
+    try {
+        mini_json::parse_on_demand(json, doc);
+        return loadScene(path, doc.root(), glbBin, jobs, out, err);
+    } catch (const std::exception& e) {
+        err = e.what();
+        return false;
     }
+}
 
-    return true;
+void gltfWorldTransforms(const std::vector<GltfNode>& nodes, std::vector<glm::mat4>& out)
+{
+    out.resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const GltfNode& n = nodes[i];
+        out[i] = n.parent >= 0 ? out[(size_t)n.parent] * n.local : n.local;
+    }
 }
@@ -6,6 +6,8 @@
 #include <string>
 #include <vector>
 
+class JobSystem;
+
 struct GltfMaterialData {
     glm::vec4 baseColorFactor{ 1.0f };
     float metallicFactor = 1.0f;
@@ -16,10 +18,32 @@ struct GltfMaterialData {
     std::string metallicRoughnessUri;
 };
 
-struct GltfSceneData {
+// Vertices are in the mesh's own space and shared by every node that references the mesh.
+struct GltfMesh {
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
+};
+
+struct GltfNode {
+    // Index into GltfSceneData::nodes, always lower than the node's own; -1 for roots of the scene.
+    int parent = -1;
+    // Index into GltfSceneData::meshes, or -1.
+    int mesh = -1;
+    glm::mat4 local{ 1.0f };
+    // EXT_mesh_gpu_instancing transforms, each relative to the node. When empty the mesh is placed once, at the node.
+    std::vector<glm::mat4> instances;
+};
+
+struct GltfSceneData {
+    std::vector<GltfMesh> meshes;
+    // Nodes of the default scene reachable from its roots, parents before children.
+    std::vector<GltfNode> nodes;
     GltfMaterialData material;
 };
 
-bool loadGltfScene(const std::string& path, GltfSceneData& out, std::string& err);
+// With jobs, primitives decode and generate their tangents in parallel; must then be called from a thread that may
+// submit to it.
+bool loadGltfScene(const std::string& path, GltfSceneData& out, std::string& err, JobSystem* jobs = nullptr);
+
+// World matrix of every node, from its local matrix and its parent's world matrix.
+void gltfWorldTransforms(const std::vector<GltfNode>& nodes, std::vector<glm::mat4>& out);
@@ -0,0 +1,99 @@
+#include "MeshPartition.hpp"
+
+#include <algorithm>
+
+std::vector<MeshChunk> partitionMesh(const std::vector<Vertex>& vertices,
+                                     std::vector<uint32_t>& indices,
+                                     const MeshPartitionSettings& settings)
+{
+    std::vector<MeshChunk> chunks;
+    const uint32_t triCount = (uint32_t)(indices.size() / 3);
+    if (triCount == 0 || vertices.empty())
+        return chunks;
+
+    std::vector<glm::vec3> centroids(triCount);
+    std::vector<uint32_t> order(triCount);
+    for (uint32_t t = 0; t < triCount; ++t) {
+        const uint32_t i0 = indices[t * 3 + 0];
+        const uint32_t i1 = indices[t * 3 + 1];
+        const uint32_t i2 = indices[t * 3 + 2];
+        glm::vec3 c(0.0f);
+        if (i0 < vertices.size() && i1 < vertices.size() && i2 < vertices.size())
+            c = (vertices[i0].pos + vertices[i1].pos + vertices[i2].pos) * (1.0f / 3.0f);
+        centroids[t] = c;
+        order[t] = t;
+    }
+
+    const uint32_t maxTris = std::max(settings.maxTrianglesPerChunk, 1u);
+
+    struct Range {
+        uint32_t begin = 0;
+        uint32_t end = 0;
+    };
+    std::vector<Range> leaves;
+    std::vector<Range> stack;
+    stack.push_back(Range{ 0, triCount });
+
+    while (!stack.empty()) {
+        const Range r = stack.back();
+        stack.pop_back();
+
+        glm::vec3 cmin = centroids[order[r.begin]];
+        glm::vec3 cmax = cmin;
+        for (uint32_t i = r.begin + 1; i < r.end; ++i) {
+            cmin = glm::min(cmin, centroids[order[i]]);
+            cmax = glm::max(cmax, centroids[order[i]]);
+        }
+        const glm::vec3 ext = cmax - cmin;
+        const float longest = std::max(ext.x, std::max(ext.y, ext.z));
+
+        if (r.end - r.begin <= maxTris || longest < settings.minChunkExtent) {
+            leaves.push_back(r);
+            continue;
+        }
+
+        const int axis = (ext.x >= ext.y && ext.x >= ext.z) ? 0 : (ext.y >= ext.z ? 1 : 2);
+        const uint32_t mid = r.begin + (r.end - r.begin) / 2;
+        std::nth_element(order.begin() + r.begin, order.begin() + mid, order.begin() + r.end,
+                         [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+        // Push the upper half first so leaves come out in a depth-first, spatially coherent order.
+        stack.push_back(Range{ mid, r.end });
+        stack.push_back(Range{ r.begin, mid });
+    }
+
+    std::vector<uint32_t> reordered;
+    reordered.reserve((size_t)triCount * 3);
+    chunks.reserve(leaves.size());
+
+    for (const Range& r : leaves) {
+        MeshChunk c{};
+        c.firstIndex = (uint32_t)reordered.size();
+        c.indexCount = (r.end - r.begin) * 3;
+
+        bool first = true;
+        for (uint32_t i = r.begin; i < r.end; ++i) {
+            const uint32_t t = order[i];
+            for (uint32_t k = 0; k < 3; ++k) {
+                const uint32_t vi = indices[t * 3 + k];
+                reordered.push_back(vi);
+                if (vi >= vertices.size())
+                    continue;
+                const glm::vec3& p = vertices[vi].pos;
+                if (first) {
+                    c.boundsMin = p;
+                    c.boundsMax = p;
+                    first = false;
+                } else {
+                    c.boundsMin = glm::min(c.boundsMin, p);
+                    c.boundsMax = glm::max(c.boundsMax, p);
+                }
+            }
+        }
+        chunks.push_back(c);
+    }
+
+    // Trailing indices that do not form a whole triangle are dropped, as the draw path ignores them anyway.
+    indices = std::move(reordered);
+    return chunks;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "engine/gfx/Mesh.hpp"
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// A contiguous index range of a merged mesh whose triangles are spatially close.
+struct MeshChunk {
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+    glm::vec3 boundsMin{ 0.0f };
+    glm::vec3 boundsMax{ 0.0f };
+};
+
+struct MeshPartitionSettings {
+    uint32_t maxTrianglesPerChunk = 2048;
+    // Chunks whose triangle centroids span less than this (world units) on every axis are not split further.
+    float minChunkExtent = 1.0f;
+};
+
+// Splits a triangle list into chunks by recursive median splits along the longest axis.
+// Reorders `indices` in place so that every chunk is one contiguous range; vertices are untouched.
+std::vector<MeshChunk> partitionMesh(const std::vector<Vertex>& vertices,
+                                     std::vector<uint32_t>& indices,
+                                     const MeshPartitionSettings& settings = {});
@@ -1,5 +1,7 @@
 #include "ObjLoader.hpp"
 
+#include "engine/core/Trace.hpp"
+
 #include <charconv>
 #include <cstdio>
 #include <cstdlib>
@@ -63,6 +65,7 @@ static bool parseVertexTriplet(const std::string_view& token, int& v, int& vt, i
 
 bool loadObj(const std::string& path, ObjMeshData& out, std::string& error)
 {
+    CFGC_ZONE("loadObj");
     out = {};
     error.clear();
 
@@ -1,7 +1,12 @@
 
 #pragma once
+#include <algorithm>
 #include <cctype>
+#include <charconv>
 #include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -55,21 +60,11 @@ struct Value {
     }
 };
 
-class Parser {
-   public:
-    explicit Parser(std::string_view s) : src(s) {}
-
-    Value parse()
-    {
-        skip_ws();
-        Value out = parse_value();
-        skip_ws();
-        if (pos != src.size())
-            throw err("trailing characters");
-        return out;
-    }
+// Cursor and token helpers shared by Parser and DocumentParser.
+class Scanner {
+   protected:
+    explicit Scanner(std::string_view s) : src(s) {}
 
-   private:
     std::string_view src;
     size_t pos = 0;
 
@@ -94,6 +89,79 @@ class Parser {
         return false;
     }
 
+    void expect(char c)
+    {
+        if (!consume(c))
+            throw err(std::string("expected '") + c + "'");
+    }
+
+    // Checks the number grammar and returns its text.
+    std::string_view scan_number()
+    {
+        size_t start = pos;
+        if (consume('-')) {
+        }
+        if (consume('0')) {
+        } else {
+            if (!std::isdigit((unsigned char)peek()))
+                throw err("bad number");
+            while (std::isdigit((unsigned char)peek()))
+                getc();
+        }
+        if (consume('.')) {
+            if (!std::isdigit((unsigned char)peek()))
+                throw err("bad number");
+            while (std::isdigit((unsigned char)peek()))
+                getc();
+        }
+        if (peek() == 'e' || peek() == 'E') {
+            getc();
+            if (peek() == '+' || peek() == '-')
+                getc();
+            if (!std::isdigit((unsigned char)peek()))
+                throw err("bad number");
+            while (std::isdigit((unsigned char)peek()))
+                getc();
+        }
+        return src.substr(start, pos - start);
+    }
+
+    bool parse_bool()
+    {
+        if (src.substr(pos, 4) == "true") {
+            pos += 4;
+            return true;
+        }
+        if (src.substr(pos, 5) == "false") {
+            pos += 5;
+            return false;
+        }
+        throw err("bad bool");
+    }
+
+    void parse_null()
+    {
+        if (src.substr(pos, 4) != "null")
+            throw err("bad null");
+        pos += 4;
+    }
+};
+
+class Parser : Scanner {
+   public:
+    explicit Parser(std::string_view s) : Scanner(s) {}
+
+    Value parse()
+    {
+        skip_ws();
+        Value out = parse_value();
+        skip_ws();
+        if (pos != src.size())
+            throw err("trailing characters");
+        return out;
+    }
+
+   private:
     Value parse_value()
     {
         char c = peek();
@@ -114,12 +182,6 @@ class Parser {
         throw err("unexpected token");
     }
 
-    void expect(char c)
-    {
-        if (!consume(c))
-            throw err(std::string("expected '") + c + "'");
-    }
-
     std::string parse_string()
     {
         expect('"');
@@ -192,32 +254,7 @@ class Parser {
 
     double parse_number()
     {
-        size_t start = pos;
-        if (consume('-')) {
-        }
-        if (consume('0')) {
-        } else {
-            if (!std::isdigit((unsigned char)peek()))
-                throw err("bad number");
-            while (std::isdigit((unsigned char)peek()))
-                getc();
-        }
-        if (consume('.')) {
-            if (!std::isdigit((unsigned char)peek()))
-                throw err("bad number");
-            while (std::isdigit((unsigned char)peek()))
-                getc();
-        }
-        if (peek() == 'e' || peek() == 'E') {
-            getc();
-            if (peek() == '+' || peek() == '-')
-                getc();
-            if (!std::isdigit((unsigned char)peek()))
-                throw err("bad number");
-            while (std::isdigit((unsigned char)peek()))
-                getc();
-        }
-        auto sv = src.substr(start, pos - start);
+        auto sv = scan_number();
         try {
             return std::stod(std::string(sv));
         } catch (...) {
@@ -225,26 +262,6 @@ class Parser {
         }
     }
 
-    bool parse_bool()
-    {
-        if (src.substr(pos, 4) == "true") {
-            pos += 4;
-            return true;
-        }
-        if (src.substr(pos, 5) == "false") {
-            pos += 5;
-            return false;
-        }
-        throw err("bad bool");
-    }
-
-    void parse_null()
-    {
-        if (src.substr(pos, 4) != "null")
-            throw err("bad null");
-        pos += 4;
-    }
-
     Array parse_array()
     {
         expect('[');
@@ -293,4 +310,334 @@ inline Value parse(std::string_view s)
     return Parser(s).parse();
 }
 
+// Arena DOM. parse_document() builds the tree in one monotonic arena instead of a heap allocation per string, array and
+// object: strings and keys are views into the source text, so the source has to outlive the Document, and arrays and
+// objects are contiguous runs of nodes. Keys are compared in place, which suits the small objects of formats like glTF.
+// Strings keep their escapes until as_str() asks for them; raw_str() is the zero-copy path for strings without any.
+struct Member;
+
+class Node {
+   public:
+    enum class Type : uint8_t { Null, Bool, Num, Str, Arr, Obj };
+
+    Type type() const { return t; }
+    bool is_null() const { return t == Type::Null; }
+    bool is_bool() const { return t == Type::Bool; }
+    bool is_num() const { return t == Type::Num; }
+    bool is_str() const { return t == Type::Str; }
+    bool is_arr() const { return t == Type::Arr; }
+    bool is_obj() const { return t == Type::Obj; }
+
+    // Accessors of another type return false, zero or an empty range rather than throwing.
+    bool as_bool() const { return t == Type::Bool && b; }
+    double as_num() const { return t == Type::Num ? num : 0.0; }
+    std::string_view raw_str() const { return t == Type::Str ? std::string_view(str, count) : std::string_view(); }
+    bool has_escapes() const { return escaped; }
+    std::string as_str() const;
+    std::span<const Node> as_arr() const { return t == Type::Arr ? std::span<const Node>(items, count) : std::span<const Node>(); }
+    std::span<const Member> as_obj() const;
+
+    const Node* get(std::string_view key) const;
+    const Node* at(size_t i) const { return t == Type::Arr && i < count ? &items[i] : nullptr; }
+
+   private:
+    friend class DocumentParser;
+
+    Type t = Type::Null;
+    bool escaped = false;
+    uint32_t count = 0;
+    union {
+        bool b;
+        double num = 0.0;
+        const char* str;
+        const Node* items;
+        const Member* members;
+    };
+};
+
+struct Member {
+    // Unescaped; keys with escapes are decoded into the arena while parsing.
+    std::string_view key;
+    Node value;
+};
+
+inline std::span<const Member> Node::as_obj() const
+{
+    return t == Type::Obj ? std::span<const Member>(members, count) : std::span<const Member>();
+}
+
+inline const Node* Node::get(std::string_view key) const
+{
+    for (const Member& m : as_obj()) {
+        if (m.key == key)
+            return &m.value;
+    }
+    return nullptr;
+}
+
+// Decodes the escapes of a string the parser already validated.
+inline void append_unescaped(std::string_view raw, std::string& out)
+{
+    for (size_t i = 0; i < raw.size(); ++i) {
+        char c = raw[i];
+        if (c != '\\') {
+            out.push_back(c);
+            continue;
+        }
+        char e = raw[++i];
+        switch (e) {
+            case 'b':
+                out.push_back('\b');
+                break;
+            case 'f':
+                out.push_back('\f');
+                break;
+            case 'n':
+                out.push_back('\n');
+                break;
+            case 'r':
+                out.push_back('\r');
+                break;
+            case 't':
+                out.push_back('\t');
+                break;
+            case 'u': {
+                unsigned code = 0;
+                std::from_chars(raw.data() + i + 1, raw.data() + i + 5, code, 16);
+                out.push_back(code <= 0x7F ? (char)code : '?');
+                i += 4;
+            } break;
+            default:
+                out.push_back(e);
+                break;
+        }
+    }
+}
+
+inline std::string Node::as_str() const
+{
+    std::string out;
+    if (!escaped)
+        return std::string(raw_str());
+    out.reserve(count);
+    append_unescaped(raw_str(), out);
+    return out;
+}
+
+// Bump allocator behind Document. Blocks are capped in size, so a large tree wastes at most one partly used block.
+class Arena {
+   public:
+    explicit Arena(size_t firstBlock) : nextBlock(std::clamp<size_t>(firstBlock, 4096, kMaxBlock)) {}
+
+    void* allocate(size_t size, size_t align)
+    {
+        size_t at = (used + align - 1) & ~(align - 1);
+        if (blocks.empty() || at + size > capacity) {
+            capacity = std::max(nextBlock, size);
+            nextBlock = kMaxBlock;
+            blocks.push_back(std::make_unique<std::byte[]>(capacity));
+            at = 0;
+        }
+        used = at + size;
+        bytes += size;
+        return blocks.back().get() + at;
+    }
+
+    size_t allocated() const { return bytes; }
+
+   private:
+    static constexpr size_t kMaxBlock = 4u << 20;
+
+    std::vector<std::unique_ptr<std::byte[]>> blocks;
+    size_t nextBlock = 0;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t bytes = 0;
+};
+
+class Document {
+   public:
+    Document() = default;
+
+    const Node& root() const { return rootNode; }
+    // Bytes the tree occupies in the arena.
+    size_t arena_bytes() const { return arena ? arena->allocated() : 0; }
+
+   private:
+    friend class DocumentParser;
+
+    std::unique_ptr<Arena> arena;
+    Node rootNode;
+};
+
+class DocumentParser : Scanner {
+   public:
+    explicit DocumentParser(std::string_view s) : Scanner(s) {}
+
+    Document parse()
+    {
+        // glTF-like text comes out at about twice its size as a tree, so small documents fit the first block.
+        doc.arena = std::make_unique<Arena>(src.size() * 2);
+        skip_ws();
+        doc.rootNode = parse_value();
+        skip_ws();
+        if (pos != src.size())
+            throw err("trailing characters");
+        return std::move(doc);
+    }
+
+   private:
+    Document doc;
+    // Children of every open array and object; each container moves its run into the arena when it closes.
+    std::vector<Member> stack;
+
+    template <typename T>
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(doc.arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    Node parse_value()
+    {
+        Node n;
+        char c = peek();
+        if (c == '"') {
+            n.t = Node::Type::Str;
+            std::string_view raw = scan_string(n.escaped);
+            n.str = raw.data();
+            n.count = (uint32_t)raw.size();
+        } else if (c == '{') {
+            parse_object(n);
+        } else if (c == '[') {
+            parse_array(n);
+        } else if (c == 't' || c == 'f') {
+            n.t = Node::Type::Bool;
+            n.b = parse_bool();
+        } else if (c == 'n') {
+            parse_null();
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            std::string_view sv = scan_number();
+            n.t = Node::Type::Num;
+            if (std::from_chars(sv.data(), sv.data() + sv.size(), n.num).ec != std::errc())
+                throw err("bad number");
+        } else {
+            throw err("unexpected token");
+        }
+        return n;
+    }
+
+    // Returns the text between the quotes; escapes are validated but left in place.
+    std::string_view scan_string(bool& escaped)
+    {
+        expect('"');
+        const size_t start = pos;
+        escaped = false;
+        while (true) {
+            if (pos >= src.size())
+                throw err("unterminated string");
+            char c = src[pos++];
+            if (c == '"')
+                break;
+            if (c != '\\')
+                continue;
+            escaped = true;
+            char e = getc();
+            if (e == 'u') {
+                if (pos + 4 > src.size())
+                    throw err("bad unicode escape");
+                for (int i = 0; i < 4; i++) {
+                    if (!std::isxdigit((unsigned char)getc()))
+                        throw err("bad unicode escape");
+                }
+            } else if (!std::strchr("\"\\/bfnrt", e) || e == '\0') {
+                throw err("bad escape");
+            }
+        }
+        const size_t len = pos - 1 - start;
+        if (len > UINT32_MAX)
+            throw err("string too long");
+        return src.substr(start, len);
+    }
+
+    uint32_t close(size_t base)
+    {
+        const size_t n = stack.size() - base;
+        if (n > UINT32_MAX)
+            throw err("container too large");
+        return (uint32_t)n;
+    }
+
+    void parse_array(Node& n)
+    {
+        expect('[');
+        skip_ws();
+        n.t = Node::Type::Arr;
+        const size_t base = stack.size();
+        if (!consume(']')) {
+            while (true) {
+                skip_ws();
+                Node item = parse_value();
+                stack.push_back(Member{ {}, item });
+                skip_ws();
+                if (consume(']'))
+                    break;
+                expect(',');
+            }
+        }
+        n.count = close(base);
+        Node* items = allocate<Node>(n.count);
+        for (uint32_t i = 0; i < n.count; ++i)
+            items[i] = stack[base + i].value;
+        n.items = items;
+        stack.resize(base);
+    }
+
+    void parse_object(Node& n)
+    {
+        expect('{');
+        skip_ws();
+        n.t = Node::Type::Obj;
+        const size_t base = stack.size();
+        if (!consume('}')) {
+            while (true) {
+                skip_ws();
+                if (peek() != '"')
+                    throw err("expected key string");
+                bool escaped = false;
+                std::string_view key = scan_string(escaped);
+                if (escaped)
+                    key = decode_key(key);
+                skip_ws();
+                expect(':');
+                skip_ws();
+                Node value = parse_value();
+                stack.push_back(Member{ key, value });
+                skip_ws();
+                if (consume('}'))
+                    break;
+                expect(',');
+            }
+        }
+        n.count = close(base);
+        Member* members = allocate<Member>(n.count);
+        std::copy(stack.begin() + (ptrdiff_t)base, stack.end(), members);
+        n.members = members;
+        stack.resize(base);
+    }
+
+    std::string_view decode_key(std::string_view raw)
+    {
+        std::string decoded;
+        append_unescaped(raw, decoded);
+        char* p = allocate<char>(decoded.size());
+        std::memcpy(p, decoded.data(), decoded.size());
+        return std::string_view(p, decoded.size());
+    }
+};
+
+inline Document parse_document(std::string_view s)
+{
+    return DocumentParser(s).parse();
+}
+
 }  // namespace mini_json
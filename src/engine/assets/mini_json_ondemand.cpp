@@ -0,0 +1,472 @@
+#include "mini_json_ondemand.hpp"
+
+#include "mini_json.hpp"
+
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MINI_JSON_X64 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define MINI_JSON_TARGET_AVX2
+#else
+#define MINI_JSON_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace mini_json {
+
+namespace {
+
+[[noreturn]] void fail(const char* msg)
+{
+    throw std::runtime_error(std::string("mini_json: ") + msg);
+}
+
+// Character classes of one 64-byte block, bit i standing for byte i.
+struct BlockMasks {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;
+    uint64_t space;
+};
+
+using ClassifyFn = void (*)(const uint8_t* p, size_t blocks, BlockMasks* out);
+
+enum : uint8_t { kQuote = 1, kBackslash = 2, kOp = 4, kSpace = 8 };
+
+struct ClassTable {
+    uint8_t c[256]{};
+    constexpr ClassTable()
+    {
+        c[(uint8_t)'"'] = kQuote;
+        c[(uint8_t)'\\'] = kBackslash;
+        for (char o : { '{', '}', '[', ']', ':', ',' })
+            c[(uint8_t)o] = kOp;
+        for (char s : { ' ', '\t', '\n', '\r' })
+            c[(uint8_t)s] = kSpace;
+    }
+};
+constexpr ClassTable kClasses;
+
+void classifyScalar(const uint8_t* p, size_t blocks, BlockMasks* out)
+{
+    for (size_t b = 0; b < blocks; ++b, p += 64) {
+        BlockMasks m{};
+        for (uint32_t i = 0; i < 64; ++i) {
+            const uint64_t bit = 1ull << i;
+            const uint8_t c = kClasses.c[p[i]];
+            if (c & kQuote)
+                m.quote |= bit;
+            if (c & kBackslash)
+                m.backslash |= bit;
+            if (c & kOp)
+                m.op |= bit;
+            if (c & kSpace)
+                m.space |= bit;
+        }
+        out[b] = m;
+    }
+}
+
+#if defined(MINI_JSON_X64)
+uint64_t eq16(__m128i v0, __m128i v1, __m128i v2, __m128i v3, char c)
+{
+    const __m128i k = _mm_set1_epi8(c);
+    return (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v0, k)) |
+           ((uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v1, k)) << 16) |
+           ((uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v2, k)) << 32) |
+           ((uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v3, k)) << 48);
+}
+
+void classifySSE2(const uint8_t* p, size_t blocks, BlockMasks* out)
+{
+    for (size_t b = 0; b < blocks; ++b, p += 64) {
+        const __m128i v0 = _mm_loadu_si128((const __m128i*)p);
+        const __m128i v1 = _mm_loadu_si128((const __m128i*)(p + 16));
+        const __m128i v2 = _mm_loadu_si128((const __m128i*)(p + 32));
+        const __m128i v3 = _mm_loadu_si128((const __m128i*)(p + 48));
+        BlockMasks& m = out[b];
+        m.quote = eq16(v0, v1, v2, v3, '"');
+        m.backslash = eq16(v0, v1, v2, v3, '\\');
+        m.op = eq16(v0, v1, v2, v3, '{') | eq16(v0, v1, v2, v3, '}') | eq16(v0, v1, v2, v3, '[') | eq16(v0, v1, v2, v3, ']') |
+               eq16(v0, v1, v2, v3, ':') | eq16(v0, v1, v2, v3, ',');
+        m.space = eq16(v0, v1, v2, v3, ' ') | eq16(v0, v1, v2, v3, '\t') | eq16(v0, v1, v2, v3, '\n') | eq16(v0, v1, v2, v3, '\r');
+    }
+}
+
+MINI_JSON_TARGET_AVX2 uint64_t mask64(__m256i lo, __m256i hi)
+{
+    return (uint64_t)(uint32_t)_mm256_movemask_epi8(lo) | ((uint64_t)(uint32_t)_mm256_movemask_epi8(hi) << 32);
+}
+
+MINI_JSON_TARGET_AVX2 void classifyAVX2(const uint8_t* p, size_t blocks, BlockMasks* out)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i ops[6] = { _mm256_set1_epi8('{'), _mm256_set1_epi8('}'), _mm256_set1_epi8('['),
+                             _mm256_set1_epi8(']'), _mm256_set1_epi8(':'), _mm256_set1_epi8(',') };
+    for (size_t b = 0; b < blocks; ++b, p += 64) {
+        const __m256i lo = _mm256_loadu_si256((const __m256i*)p);
+        const __m256i hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+        BlockMasks& m = out[b];
+        m.quote = mask64(_mm256_cmpeq_epi8(lo, quote), _mm256_cmpeq_epi8(hi, quote));
+        m.backslash = mask64(_mm256_cmpeq_epi8(lo, backslash), _mm256_cmpeq_epi8(hi, backslash));
+
+        __m256i oplo = _mm256_cmpeq_epi8(lo, ops[0]);
+        __m256i ophi = _mm256_cmpeq_epi8(hi, ops[0]);
+        for (int i = 1; i < 6; ++i) {
+            oplo = _mm256_or_si256(oplo, _mm256_cmpeq_epi8(lo, ops[i]));
+            ophi = _mm256_or_si256(ophi, _mm256_cmpeq_epi8(hi, ops[i]));
+        }
+        m.op = mask64(oplo, ophi);
+
+        const __m256i wslo = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(lo, space), _mm256_cmpeq_epi8(lo, tab)),
+                                             _mm256_or_si256(_mm256_cmpeq_epi8(lo, lf), _mm256_cmpeq_epi8(lo, cr)));
+        const __m256i wshi = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(hi, space), _mm256_cmpeq_epi8(hi, tab)),
+                                             _mm256_or_si256(_mm256_cmpeq_epi8(hi, lf), _mm256_cmpeq_epi8(hi, cr)));
+        m.space = mask64(wslo, wshi);
+    }
+}
+
+bool cpuHasAVX2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int r[4]{};
+    __cpuid(r, 0);
+    if (r[0] < 7)
+        return false;
+    __cpuid(r, 1);
+    const bool osxsave = (r[2] & (1 << 27)) != 0;
+    const bool avx = (r[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(r, 7, 0);
+    return (r[1] & (1 << 5)) != 0;
+#else
+    // Also checks that the OS saves the YMM registers.
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// Carries the string and escape state from one block to the next.
+struct ScanState {
+    uint64_t inString = 0;  // all ones while a string is open across the block boundary
+    uint64_t escapeNext = 0;  // 1 if the block starts with an escaped character
+    uint64_t scalarTail = 0;  // 1 if the previous block ended inside a number or literal
+};
+
+uint64_t prefixXor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Characters preceded by an odd run of backslashes. Escapes are rare in manifests, so this walks the backslashes one at
+// a time rather than resolving runs with carries.
+uint64_t escapedChars(uint64_t backslash, ScanState& s)
+{
+    uint64_t escaped = s.escapeNext;
+    s.escapeNext = 0;
+    backslash &= ~escaped;
+    while (backslash) {
+        const uint32_t i = (uint32_t)std::countr_zero(backslash);
+        if (i == 63) {
+            s.escapeNext = 1;
+            break;
+        }
+        escaped |= 1ull << (i + 1);
+        backslash &= ~(3ull << i);
+    }
+    return escaped;
+}
+
+// Bits of the structural tokens in one block.
+uint64_t structurals(const BlockMasks& m, ScanState& s)
+{
+    const uint64_t escaped = (m.backslash | s.escapeNext) ? escapedChars(m.backslash, s) : 0;
+    const uint64_t quotes = m.quote & ~escaped;
+    // Set from each opening quote up to, not including, its closing quote.
+    const uint64_t inString = prefixXor(quotes) ^ s.inString;
+    s.inString = (uint64_t)((int64_t)inString >> 63);
+
+    const uint64_t ops = m.op & ~inString;
+    const uint64_t openQuotes = quotes & inString;
+    const uint64_t scalar = ~(m.op | m.space | m.quote) & ~inString;
+    const uint64_t scalarStarts = scalar & ~((scalar << 1) | s.scalarTail);
+    s.scalarTail = scalar >> 63;
+    return ops | openQuotes | scalarStarts;
+}
+
+}  // namespace
+
+StructuralIndex::Kernel StructuralIndex::best_kernel()
+{
+#if defined(MINI_JSON_X64)
+    static const Kernel best = cpuHasAVX2() ? Kernel::AVX2 : Kernel::SSE2;
+    return best;
+#else
+    return Kernel::Scalar;
+#endif
+}
+
+const char* StructuralIndex::kernel_name(Kernel kernel)
+{
+    switch (kernel) {
+        case Kernel::Scalar:
+            return "scalar";
+        case Kernel::SSE2:
+            return "SSE2";
+        case Kernel::AVX2:
+            return "AVX2";
+        default:
+            return "auto";
+    }
+}
+
+void StructuralIndex::build(std::string_view text, Kernel kernel)
+{
+    if (text.size() >= UINT32_MAX)
+        fail("document too large");
+    src = text;
+    positions.clear();
+    next.clear();
+
+    if (kernel == Kernel::Auto || (kernel == Kernel::AVX2 && best_kernel() != Kernel::AVX2))
+        kernel = best_kernel();
+    ClassifyFn classify = classifyScalar;
+#if defined(MINI_JSON_X64)
+    if (kernel == Kernel::SSE2)
+        classify = classifySSE2;
+    else if (kernel == Kernel::AVX2)
+        classify = classifyAVX2;
+#endif
+
+    // Classified in chunks so the kernel runs through its loads without a call per block.
+    constexpr size_t kChunkBlocks = 64;
+    BlockMasks masks[kChunkBlocks];
+    ScanState state;
+    positions.reserve(text.size() / 6 + 16);
+
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+    const size_t fullBlocks = text.size() / 64;
+    auto emit = [&](uint64_t bits, uint32_t base) {
+        const size_t at = positions.size();
+        positions.resize(at + (size_t)std::popcount(bits));
+        uint32_t* out = positions.data() + at;
+        while (bits) {
+            *out++ = base + (uint32_t)std::countr_zero(bits);
+            bits &= bits - 1;
+        }
+    };
+    for (size_t b = 0; b < fullBlocks; b += kChunkBlocks) {
+        const size_t n = std::min(kChunkBlocks, fullBlocks - b);
+        classify(data + b * 64, n, masks);
+        for (size_t i = 0; i < n; ++i)
+            emit(structurals(masks[i], state), (uint32_t)((b + i) * 64));
+    }
+    if (const size_t tail = text.size() % 64) {
+        // Padded with spaces, which are neither structural nor part of a scalar.
+        uint8_t last[64];
+        std::memset(last, ' ', sizeof(last));
+        std::memcpy(last, data + fullBlocks * 64, tail);
+        classify(last, 1, masks);
+        emit(structurals(masks[0], state), (uint32_t)(fullBlocks * 64));
+    }
+    if (state.inString)
+        fail("unterminated string");
+
+    // Stage two pairs brackets, so skipping a value never scans what is inside it.
+    next.resize(positions.size());
+    std::vector<uint32_t> open;
+    for (uint32_t t = 0; t < (uint32_t)positions.size(); ++t) {
+        next[t] = t + 1;
+        const char c = src[positions[t]];
+        if (c == '{' || c == '[') {
+            open.push_back(t);
+        } else if (c == '}' || c == ']') {
+            if (open.empty() || src[positions[open.back()]] != (c == '}' ? '{' : '['))
+                fail("mismatched bracket");
+            next[open.back()] = t + 1;
+            open.pop_back();
+        }
+    }
+    if (!open.empty())
+        fail("unclosed bracket");
+}
+
+bool Element::as_bool() const
+{
+    const std::string_view s = index ? index->source().substr(index->position(token)) : std::string_view();
+    return s.starts_with("true");
+}
+
+double Element::as_num() const
+{
+    if (!is_num())
+        return 0.0;
+    const std::string_view s = index->source();
+    const char* first = s.data() + index->position(token);
+    const char* last = s.data() + s.size();
+    double v = 0.0;
+    const char* digits = first + (*first == '-' ? 1 : 0);
+    const auto r = std::from_chars(first, last, v);
+    if (digits == last || *digits < '0' || *digits > '9' || r.ec != std::errc())
+        fail("bad number");
+    if (r.ptr != last && !std::strchr(" \t\r\n,]}", *r.ptr))
+        fail("bad number");
+    return v;
+}
+
+std::string_view Element::raw_str() const
+{
+    if (!is_str())
+        return {};
+    const std::string_view s = index->source();
+    const size_t begin = index->position(token) + 1;
+    size_t end = begin;
+    // The index has no closing quotes; the first one not escaped ends the string.
+    while (true) {
+        end = s.find('"', end);
+        if (end == std::string_view::npos)
+            fail("unterminated string");
+        size_t slashes = 0;
+        while (end - slashes > begin && s[end - slashes - 1] == '\\')
+            ++slashes;
+        if ((slashes & 1) == 0)
+            break;
+        ++end;
+    }
+    return s.substr(begin, end - begin);
+}
+
+std::string Element::as_str() const
+{
+    const std::string_view raw = raw_str();
+    if (raw.find('\\') == std::string_view::npos)
+        return std::string(raw);
+    std::string out;
+    out.reserve(raw.size());
+    append_unescaped(raw, out);
+    return out;
+}
+
+uint32_t Element::first_child() const
+{
+    const uint32_t t = token + 1;
+    if (t >= index->size())
+        fail("truncated document");
+    const char c = index->token_char(t);
+    return (c == ']' || c == '}') ? 0 : t;
+}
+
+Element::Range<Element::ArrayIterator> Element::as_arr() const
+{
+    if (!is_arr())
+        return {};
+    return { ArrayIterator(index, first_child()) };
+}
+
+Element::Range<Element::ObjectIterator> Element::as_obj() const
+{
+    if (!is_obj())
+        return {};
+    return { ObjectIterator(index, first_child()) };
+}
+
+size_t Element::size() const
+{
+    size_t n = 0;
+    if (is_arr()) {
+        for (auto it = as_arr().begin(); it != ArrayIterator{}; ++it)
+            ++n;
+    } else if (is_obj()) {
+        for (auto it = as_obj().begin(); it != ObjectIterator{}; ++it)
+            ++n;
+    }
+    return n;
+}
+
+Element Element::get(std::string_view key) const
+{
+    for (const Field& f : as_obj()) {
+        if (f.key == key)
+            return f.value();
+    }
+    return {};
+}
+
+Element Element::at(size_t i) const
+{
+    for (Element e : as_arr()) {
+        if (i-- == 0)
+            return e;
+    }
+    return {};
+}
+
+Element::ArrayIterator& Element::ArrayIterator::operator++()
+{
+    const uint32_t t = index->after(token);
+    if (t >= index->size())
+        fail("truncated array");
+    const char c = index->token_char(t);
+    if (c == ',')
+        token = t + 1;
+    else if (c == ']')
+        token = 0;
+    else
+        fail("expected ',' or ']'");
+    return *this;
+}
+
+Field Element::ObjectIterator::operator*() const
+{
+    if (token + 2 >= index->size() || index->token_char(token) != '"' || index->token_char(token + 1) != ':')
+        fail("expected key string");
+    Field f;
+    f.key = Element(index, token).raw_str();
+    f.index = index;
+    f.valueToken = token + 2;
+    return f;
+}
+
+Element::ObjectIterator& Element::ObjectIterator::operator++()
+{
+    const uint32_t t = token + 2 < index->size() ? index->after(token + 2) : UINT32_MAX;
+    if (t >= index->size())
+        fail("truncated object");
+    const char c = index->token_char(t);
+    if (c == ',')
+        token = t + 1;
+    else if (c == '}')
+        token = 0;
+    else
+        fail("expected ',' or '}'");
+    return *this;
+}
+
+void parse_on_demand(std::string_view s, OnDemandDocument& out, StructuralIndex::Kernel kernel)
+{
+    out.index.build(s, kernel);
+    if (out.index.size() == 0)
+        fail("empty document");
+    if (out.index.after(0) != out.index.size())
+        fail("trailing characters");
+}
+
+}  // namespace mini_json
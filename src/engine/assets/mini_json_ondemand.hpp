@@ -0,0 +1,158 @@
+#pragma once
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mini_json {
+
+// Stage one of the on-demand parser: the offsets of every structural character ({ } [ ] : ,), every opening quote and
+// the first character of every other scalar outside strings, found 64 bytes at a time. The character classes come from
+// SSE2 or AVX2 compares where available; escapes and string regions are then resolved with bit arithmetic that is the
+// same for every kernel, so all of them produce the same index.
+class StructuralIndex {
+   public:
+    enum class Kernel : uint8_t { Auto, Scalar, SSE2, AVX2 };
+
+    // Throws on unterminated strings and unbalanced or mismatched brackets; anything finer is checked when read.
+    void build(std::string_view text, Kernel kernel = Kernel::Auto);
+
+    // Best kernel this CPU supports.
+    static Kernel best_kernel();
+    static const char* kernel_name(Kernel kernel);
+
+    std::string_view source() const { return src; }
+    size_t size() const { return positions.size(); }
+    uint32_t position(uint32_t token) const { return positions[token]; }
+    char token_char(uint32_t token) const { return src[positions[token]]; }
+    // Token after the value starting at token; jumps over whole arrays and objects.
+    uint32_t after(uint32_t token) const { return next[token]; }
+
+   private:
+    std::string_view src;
+    std::vector<uint32_t> positions;
+    std::vector<uint32_t> next;
+};
+
+class Element;
+
+struct Field {
+    // As written in the source; lookups compare keys without decoding escapes.
+    std::string_view key;
+    Element value() const;
+
+    const StructuralIndex* index = nullptr;
+    uint32_t valueToken = 0;
+};
+
+// Read-only view of one value in a StructuralIndex. Nothing is decoded until asked for: numbers are parsed by as_num(),
+// strings located by raw_str(), and lookups walk members by jumping over the values they skip. Missing values are
+// invalid Elements, which test false and answer every query with false, zero or an empty range.
+class Element {
+   public:
+    class ArrayIterator;
+    class ObjectIterator;
+
+    template <typename It>
+    struct Range {
+        It first;
+        It begin() const { return first; }
+        It end() const { return It{}; }
+        bool empty() const { return first == It{}; }
+    };
+
+    Element() = default;
+    Element(const StructuralIndex* i, uint32_t t) : index(i), token(t) {}
+
+    explicit operator bool() const { return index != nullptr; }
+
+    bool is_null() const { return kind() == 'n'; }
+    bool is_bool() const { return kind() == 't' || kind() == 'f'; }
+    bool is_num() const { return kind() == '-' || (kind() >= '0' && kind() <= '9'); }
+    bool is_str() const { return kind() == '"'; }
+    bool is_arr() const { return kind() == '['; }
+    bool is_obj() const { return kind() == '{'; }
+
+    bool as_bool() const;
+    double as_num() const;
+    // Text between the quotes with escapes still in place; as_str() decodes them.
+    std::string_view raw_str() const;
+    std::string as_str() const;
+
+    Range<ArrayIterator> as_arr() const;
+    Range<ObjectIterator> as_obj() const;
+    // Walks the array or object; prefer iterating over calling at() in a loop.
+    size_t size() const;
+
+    Element get(std::string_view key) const;
+    Element at(size_t i) const;
+
+   private:
+    char kind() const { return index ? index->token_char(token) : '\0'; }
+    // First token inside the array or object, or 0 if it is empty.
+    uint32_t first_child() const;
+
+    const StructuralIndex* index = nullptr;
+    uint32_t token = 0;
+};
+
+class Element::ArrayIterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Element;
+    using difference_type = std::ptrdiff_t;
+
+    ArrayIterator() = default;
+    ArrayIterator(const StructuralIndex* i, uint32_t t) : index(i), token(t) {}
+
+    Element operator*() const { return Element(index, token); }
+    ArrayIterator& operator++();
+    bool operator==(const ArrayIterator& o) const { return token == o.token; }
+
+   private:
+    const StructuralIndex* index = nullptr;
+    uint32_t token = 0;
+};
+
+class Element::ObjectIterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Field;
+    using difference_type = std::ptrdiff_t;
+
+    ObjectIterator() = default;
+    ObjectIterator(const StructuralIndex* i, uint32_t t) : index(i), token(t) {}
+
+    Field operator*() const;
+    ObjectIterator& operator++();
+    bool operator==(const ObjectIterator& o) const { return token == o.token; }
+
+   private:
+    const StructuralIndex* index = nullptr;
+    uint32_t token = 0;
+};
+
+inline Element Field::value() const
+{
+    return Element(index, valueToken);
+}
+
+// Owns the index; the source text has to outlive it.
+class OnDemandDocument {
+   public:
+    OnDemandDocument() = default;
+    OnDemandDocument(const OnDemandDocument&) = delete;
+    OnDemandDocument& operator=(const OnDemandDocument&) = delete;
+
+    Element root() const { return index.size() ? Element(&index, 0) : Element(); }
+    const StructuralIndex& structure() const { return index; }
+
+   private:
+    friend void parse_on_demand(std::string_view s, OnDemandDocument& out, StructuralIndex::Kernel kernel);
+    StructuralIndex index;
+};
+
+void parse_on_demand(std::string_view s, OnDemandDocument& out, StructuralIndex::Kernel kernel = StructuralIndex::Kernel::Auto);
+
+}  // namespace mini_json
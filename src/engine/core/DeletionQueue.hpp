@@ -8,8 +8,11 @@
 
 class DeletionQueue {
    public:
+    // Room for a few handles plus a GpuAllocation captured by value.
+    using Fn = SmallFn<void(), 96>;
+
     void reserve(size_t n) { fns.reserve(n); }
-    void push(SmallFn<void()>&& fn) { fns.push_back(std::move(fn)); }
+    void push(Fn&& fn) { fns.push_back(std::move(fn)); }
 
     template <typename F>
     void push(F&& fn)
@@ -24,8 +27,16 @@ class DeletionQueue {
         fns.clear();
     }
 
+    // Moves other's entries behind this queue's own, keeping their order.
+    void append(DeletionQueue& other)
+    {
+        for (Fn& fn : other.fns)
+            fns.push_back(std::move(fn));
+        other.fns.clear();
+    }
+
     bool empty() const { return fns.empty(); }
 
    private:
-    std::vector<SmallFn<void()>> fns;
+    std::vector<Fn> fns;
 };
@@ -0,0 +1,258 @@
+#include "engine/core/JobSystem.hpp"
+
+#include "engine/core/Log.hpp"
+#include "engine/core/Trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <utility>
+
+namespace {
+
+thread_local uint32_t tlsWorker = 0;
+
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+uint32_t JobSystem::currentWorker()
+{
+    return tlsWorker;
+}
+
+void JobSystem::start(uint32_t threadCount)
+{
+    stop();
+    if (threadCount == kAutoThreads) {
+        const uint32_t hw = std::thread::hardware_concurrency();
+        threadCount = hw > 1 ? hw - 1 : 0u;
+    }
+
+    quit = false;
+    workers.clear();
+    for (uint32_t i = 0; i < threadCount + 1; ++i)
+        workers.push_back(std::make_unique<Worker>());
+    tlsWorker = 0;
+    resetStats();
+
+    threads.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; ++i)
+        threads.emplace_back([this, i]() { workerLoop(i + 1); });
+}
+
+void JobSystem::stop()
+{
+#if defined(CFGC_DIAGNOSTICS)
+    if (!workers.empty())
+        logStats();
+#endif
+    {
+        std::lock_guard<std::mutex> lk(sleepLock);
+        quit = true;
+    }
+    wake.notify_all();
+    for (auto& t : threads)
+        t.join();
+    threads.clear();
+    workers.clear();
+    queued.store(0, std::memory_order_relaxed);
+}
+
+void JobSystem::run(Counter& counter, JobFn fn)
+{
+    Job job{ std::move(fn), &counter };
+    counter.pending.fetch_add(1, std::memory_order_relaxed);
+    if (threads.empty()) {
+        execute(job, currentWorker());
+        return;
+    }
+    push(currentWorker(), &job, 1);
+}
+
+void JobSystem::wait(Counter& counter)
+{
+    const uint32_t worker = currentWorker();
+    while (counter.pending.load(std::memory_order_acquire) != 0) {
+        if (!runOne(worker))
+            std::this_thread::yield();
+    }
+    if (counter.failed.load(std::memory_order_relaxed)) {
+        std::exception_ptr e = std::exchange(counter.error, nullptr);
+        counter.failed.store(false, std::memory_order_relaxed);
+        if (e)
+            std::rethrow_exception(e);
+    }
+}
+
+void JobSystem::forRanges(uint32_t count, uint32_t grain, RangeFn fn, void* ctx)
+{
+    if (count == 0)
+        return;
+    grain = std::max(grain, 1u);
+    const uint32_t ranges = (count + grain - 1) / grain;
+    const uint32_t worker = currentWorker();
+    if (ranges == 1 || threads.empty()) {
+        fn(ctx, 0, count, worker);
+        return;
+    }
+
+    // The first range stays with the caller; the rest go to its deque in one go, where idle workers steal them.
+    Counter counter;
+    std::vector<Job> jobs;
+    jobs.reserve(ranges - 1);
+    for (uint32_t r = ranges; r-- > 1;) {
+        const uint32_t begin = r * grain;
+        const uint32_t end = std::min(begin + grain, count);
+        jobs.push_back(Job{ [fn, ctx, begin, end](uint32_t w) { fn(ctx, begin, end, w); }, &counter });
+    }
+    counter.pending.store(ranges, std::memory_order_relaxed);
+    push(worker, jobs.data(), (uint32_t)jobs.size());
+
+    Job first{ [fn, ctx, end = std::min(grain, count)](uint32_t w) { fn(ctx, 0, end, w); }, &counter };
+    execute(first, worker);
+    wait(counter);
+}
+
+void JobSystem::push(uint32_t worker, Job* jobs, uint32_t count)
+{
+    // Counted before they become visible, so a thief can never take the count below zero.
+    queued.fetch_add(count);
+    Worker& w = *workers[worker];
+    {
+        std::lock_guard<std::mutex> lk(w.lock);
+        for (uint32_t i = 0; i < count; ++i)
+            w.jobs.push_back(std::move(jobs[i]));
+    }
+    // Pairs with the sleepers increment in workerLoop: either the sleeper sees the new jobs or the notify reaches it.
+    if (sleepers.load() != 0) {
+        { std::lock_guard<std::mutex> lk(sleepLock); }
+        if (count == 1)
+            wake.notify_one();
+        else
+            wake.notify_all();
+    }
+}
+
+bool JobSystem::runOne(uint32_t worker)
+{
+    if (queued.load(std::memory_order_relaxed) == 0)
+        return false;
+
+    Job job;
+    bool found = false;
+    {
+        Worker& own = *workers[worker];
+        std::lock_guard<std::mutex> lk(own.lock);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            found = true;
+        }
+    }
+
+    const uint32_t n = (uint32_t)workers.size();
+    for (uint32_t i = 1; i < n && !found; ++i) {
+        Worker& victim = *workers[(worker + i) % n];
+        std::lock_guard<std::mutex> lk(victim.lock);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            found = true;
+            workers[worker]->steals.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if (!found)
+        return false;
+
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    execute(job, worker);
+    return true;
+}
+
+void JobSystem::execute(Job& job, uint32_t worker)
+{
+    const int64_t t0 = nowNs();
+    try {
+        job.fn(worker);
+    } catch (...) {
+        if (!job.counter->failed.exchange(true, std::memory_order_relaxed))
+            job.counter->error = std::current_exception();
+    }
+    if (worker < workers.size()) {
+        Worker& w = *workers[worker];
+        w.busyNs.fetch_add((uint64_t)(nowNs() - t0), std::memory_order_relaxed);
+        w.jobsRun.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Last: once the counter drops the waiter may return and destroy both it and whatever the job referenced.
+    job.counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void JobSystem::workerLoop(uint32_t worker)
+{
+    tlsWorker = worker;
+#if defined(CFGC_TRACE)
+    const std::string name = "Worker " + std::to_string(worker);
+    CFGC_TRACE_THREAD_NAME(name.c_str());
+#endif
+    for (;;) {
+        if (runOne(worker))
+            continue;
+
+        // Jobs are short, so spin briefly before going to sleep.
+        bool ran = false;
+        for (int spin = 0; spin < 64 && !ran; ++spin) {
+            std::this_thread::yield();
+            ran = runOne(worker);
+        }
+        if (ran)
+            continue;
+
+        CFGC_ZONE("Idle");
+        std::unique_lock<std::mutex> lk(sleepLock);
+        sleepers.fetch_add(1);
+        wake.wait(lk, [this]() { return quit || queued.load() != 0; });
+        sleepers.fetch_sub(1);
+        if (quit)
+            return;
+    }
+}
+
+std::vector<JobSystem::WorkerStats> JobSystem::stats() const
+{
+    const double wallNs = (double)std::max<int64_t>(nowNs() - statsStartNs.load(std::memory_order_relaxed), 1);
+    std::vector<WorkerStats> out(workers.size());
+    for (size_t i = 0; i < workers.size(); ++i) {
+        const Worker& w = *workers[i];
+        const uint64_t busy = w.busyNs.load(std::memory_order_relaxed);
+        out[i].jobs = w.jobsRun.load(std::memory_order_relaxed);
+        out[i].steals = w.steals.load(std::memory_order_relaxed);
+        out[i].busyMs = (double)busy / 1e6;
+        out[i].utilization = std::min((double)busy / wallNs, 1.0);
+    }
+    return out;
+}
+
+void JobSystem::resetStats()
+{
+    for (auto& w : workers) {
+        w->jobsRun.store(0, std::memory_order_relaxed);
+        w->steals.store(0, std::memory_order_relaxed);
+        w->busyNs.store(0, std::memory_order_relaxed);
+    }
+    statsStartNs.store(nowNs(), std::memory_order_relaxed);
+}
+
+void JobSystem::logStats() const
+{
+    const std::vector<WorkerStats> st = stats();
+    CFGC_LOGF("JobSystem: %u workers", workerCount());
+    for (size_t i = 0; i < st.size(); ++i) {
+        CFGC_LOGF("  worker %zu: %llu jobs, %llu stolen, %.1f ms busy (%.1f%%)", i, (unsigned long long)st[i].jobs,
+                  (unsigned long long)st[i].steals, st[i].busyMs, st[i].utilization * 100.0);
+    }
+}
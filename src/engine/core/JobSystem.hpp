@@ -0,0 +1,110 @@
+#pragma once
+
+#include "engine/core/SmallFn.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Work-stealing job system. Every worker owns a deque: it pushes and pops its own jobs at the back and, once that runs
+// dry, steals from the front of the others'. The thread that calls start() is worker 0; it has no thread of its own and
+// runs jobs while it waits. Worker indices stay below workerCount(), so they can index per-worker resources, which is
+// why only worker 0 and jobs themselves may submit or wait.
+class JobSystem {
+   public:
+    static constexpr uint32_t kAutoThreads = ~0u;
+
+    using JobFn = SmallFn<void(uint32_t worker), 64>;
+
+    // Unfinished jobs submitted under it. A job may submit children under the counter it runs under, so waiting on a
+    // parent covers everything it spawned, or under a counter of its own that it waits on before returning.
+    class Counter {
+       public:
+        bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+       private:
+        friend class JobSystem;
+        std::atomic<uint32_t> pending{ 0 };
+        std::atomic<bool> failed{ false };
+        std::exception_ptr error;
+    };
+
+    JobSystem() = default;
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+    ~JobSystem() { stop(); }
+
+    // Starts threadCount threads next to the calling one; kAutoThreads leaves one hardware thread per core to worker 0.
+    void start(uint32_t threadCount = kAutoThreads);
+    void stop();
+
+    uint32_t workerCount() const { return workers.empty() ? 1u : (uint32_t)workers.size(); }
+    // Index of the calling worker; 0 for the thread that started the system.
+    static uint32_t currentWorker();
+
+    void run(Counter& counter, JobFn fn);
+    // Runs queued jobs until counter reaches zero, then rethrows the first exception a job under it threw.
+    void wait(Counter& counter);
+
+    // Calls fn(begin, end, worker) on ranges of at most grain items that together cover [0, count), and returns once
+    // all of them are done. A single range runs inline on the calling thread.
+    template <typename F>
+    void parallelFor(uint32_t count, uint32_t grain, F&& fn)
+    {
+        using T = std::remove_reference_t<F>;
+        forRanges(count, grain, [](void* ctx, uint32_t b, uint32_t e, uint32_t w) { (*static_cast<T*>(ctx))(b, e, w); }, (void*)&fn);
+    }
+
+    struct WorkerStats {
+        uint64_t jobs = 0;
+        // Jobs taken from another worker's deque.
+        uint64_t steals = 0;
+        double busyMs = 0.0;
+        // Share of the time since the last resetStats() spent running jobs.
+        double utilization = 0.0;
+    };
+    std::vector<WorkerStats> stats() const;
+    void resetStats();
+    // Also called by stop() in diagnostics builds.
+    void logStats() const;
+
+   private:
+    using RangeFn = void (*)(void*, uint32_t, uint32_t, uint32_t);
+
+    struct Job {
+        JobFn fn;
+        Counter* counter = nullptr;
+    };
+
+    struct alignas(64) Worker {
+        std::mutex lock;
+        std::deque<Job> jobs;
+        std::atomic<uint64_t> jobsRun{ 0 };
+        std::atomic<uint64_t> steals{ 0 };
+        std::atomic<uint64_t> busyNs{ 0 };
+    };
+
+    void forRanges(uint32_t count, uint32_t grain, RangeFn fn, void* ctx);
+    void push(uint32_t worker, Job* jobs, uint32_t count);
+    bool runOne(uint32_t worker);
+    void execute(Job& job, uint32_t worker);
+    void workerLoop(uint32_t worker);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    std::atomic<uint32_t> queued{ 0 };
+    std::atomic<uint32_t> sleepers{ 0 };
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    bool quit = false;
+
+    std::atomic<int64_t> statsStartNs{ 0 };
+};
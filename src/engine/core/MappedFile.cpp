@@ -0,0 +1,113 @@
+#include "engine/core/MappedFile.hpp"
+
+#include <utility>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile& MappedFile::operator=(MappedFile&& o) noexcept
+{
+    if (this != &o) {
+        close();
+        base = std::exchange(o.base, nullptr);
+        length = std::exchange(o.length, 0);
+        opened = std::exchange(o.opened, false);
+    }
+    return *this;
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::open(const std::string& path, std::string& err)
+{
+    close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        err = "Failed to open: " + path;
+        return false;
+    }
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        err = "Failed to stat: " + path;
+        return false;
+    }
+    if (size.QuadPart > 0) {
+        // The view keeps the section alive, so both handles can go once it is mapped.
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (mapping)
+            CloseHandle(mapping);
+        if (!view) {
+            CloseHandle(file);
+            err = "Failed to map: " + path;
+            return false;
+        }
+        base = static_cast<const uint8_t*>(view);
+        length = (size_t)size.QuadPart;
+    }
+    CloseHandle(file);
+    opened = true;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (base)
+        UnmapViewOfFile(base);
+    base = nullptr;
+    length = 0;
+    opened = false;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path, std::string& err)
+{
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        err = "Failed to open: " + path;
+        return false;
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        err = "Failed to stat: " + path;
+        return false;
+    }
+    if (st.st_size > 0) {
+        void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view == MAP_FAILED) {
+            ::close(fd);
+            err = "Failed to map: " + path;
+            return false;
+        }
+        // Loaders read front to back; ask for aggressive readahead.
+        madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+        base = static_cast<const uint8_t*>(view);
+        length = (size_t)st.st_size;
+    }
+    ::close(fd);
+    opened = true;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (base)
+        munmap(const_cast<uint8_t*>(base), length);
+    base = nullptr;
+    length = 0;
+    opened = false;
+}
+
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Read-only view of a whole file mapped into memory. Pages are faulted in from the page cache as they are touched, so
+// nothing is copied and only the parts actually read count towards the resident set.
+class MappedFile {
+   public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& o) noexcept { *this = std::move(o); }
+    MappedFile& operator=(MappedFile&& o) noexcept;
+
+    // Empty files open successfully with size() 0.
+    bool open(const std::string& path, std::string& err);
+    void close();
+
+    bool isOpen() const { return opened; }
+    const uint8_t* data() const { return base; }
+    size_t size() const { return length; }
+    std::span<const uint8_t> bytes() const { return { base, length }; }
+    std::string_view text() const { return { reinterpret_cast<const char*>(base), length }; }
+
+   private:
+    const uint8_t* base = nullptr;
+    size_t length = 0;
+    bool opened = false;
+};
@@ -0,0 +1,208 @@
+#include "engine/core/Trace.hpp"
+
+#if defined(CFGC_TRACE)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// Per thread; 32 bytes an event, so 1 MiB holds the last 32k zones of each thread.
+constexpr uint64_t kCapacity = 1u << 15;
+
+// Fields are relaxed atomics so the exporter may read slots the owner is rewriting; the head re-check in collect()
+// discards those.
+struct Event {
+    std::atomic<const char*> name{ nullptr };
+    std::atomic<uint64_t> begin{ 0 };
+    std::atomic<uint64_t> end{ 0 };
+    // Frame number plus one for frame markers, zero for zones.
+    std::atomic<uint64_t> frame{ 0 };
+};
+
+struct ThreadBuffer {
+    uint32_t tid = 0;
+    std::string name;  // guarded by Registry::lock
+    std::atomic<uint64_t> head{ 0 };
+    std::unique_ptr<Event[]> events{ new Event[kCapacity] };
+};
+
+struct Registry {
+    std::mutex lock;
+    // Buffers outlive their threads, so zones of finished threads still make it into the trace.
+    std::vector<std::unique_ptr<ThreadBuffer>> threads;
+    uint64_t epochNs = Trace::nowNs();
+    std::atomic<uint64_t> frameCount{ 0 };
+};
+
+Registry& registry()
+{
+    static Registry r;
+    return r;
+}
+
+thread_local ThreadBuffer* tlsBuffer = nullptr;
+thread_local uint64_t tlsFrameBegin = 0;
+
+ThreadBuffer& threadBuffer()
+{
+    if (!tlsBuffer) {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lk(r.lock);
+        r.threads.push_back(std::make_unique<ThreadBuffer>());
+        tlsBuffer = r.threads.back().get();
+        tlsBuffer->tid = (uint32_t)r.threads.size();
+        tlsBuffer->name = "Thread " + std::to_string(tlsBuffer->tid);
+    }
+    return *tlsBuffer;
+}
+
+void record(const char* name, uint64_t beginNs, uint64_t endNs, uint64_t frame)
+{
+    ThreadBuffer& t = threadBuffer();
+    const uint64_t h = t.head.load(std::memory_order_relaxed);
+    // Orders the previous head store before the slot writes: an exporter that sees any of them also sees that head.
+    std::atomic_thread_fence(std::memory_order_release);
+    Event& e = t.events[h & (kCapacity - 1)];
+    e.name.store(name, std::memory_order_relaxed);
+    e.begin.store(beginNs, std::memory_order_relaxed);
+    e.end.store(endNs, std::memory_order_relaxed);
+    e.frame.store(frame, std::memory_order_relaxed);
+    t.head.store(h + 1, std::memory_order_release);
+}
+
+struct Collected {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+    uint64_t frame;
+};
+
+void collect(const ThreadBuffer& t, std::vector<Collected>& out)
+{
+    const uint64_t head = t.head.load(std::memory_order_acquire);
+    const uint64_t first = head > kCapacity ? head - kCapacity : 0;
+    out.clear();
+    out.reserve((size_t)(head - first));
+    for (uint64_t i = first; i < head; ++i) {
+        const Event& e = t.events[i & (kCapacity - 1)];
+        out.push_back({ e.name.load(std::memory_order_relaxed), e.begin.load(std::memory_order_relaxed),
+                        e.end.load(std::memory_order_relaxed), e.frame.load(std::memory_order_relaxed) });
+    }
+
+    // The owner may have lapped the oldest slots meanwhile, including the one it is writing right now.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t now = t.head.load(std::memory_order_relaxed);
+    const uint64_t valid = now >= kCapacity ? now - kCapacity + 1 : 0;
+    if (valid > first)
+        out.erase(out.begin(), out.begin() + (ptrdiff_t)std::min(valid - first, (uint64_t)out.size()));
+}
+
+void writeString(std::ofstream& f, const char* s)
+{
+    f << '"';
+    for (; s && *s; ++s) {
+        if (*s == '"' || *s == '\\')
+            f << '\\';
+        if ((unsigned char)*s >= 0x20)
+            f << *s;
+    }
+    f << '"';
+}
+
+}  // namespace
+
+namespace Trace {
+
+uint64_t nowNs()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void zone(const char* name, uint64_t beginNs, uint64_t endNs)
+{
+    record(name, beginNs, endNs, 0);
+}
+
+void beginFrame()
+{
+    tlsFrameBegin = nowNs();
+}
+
+void endFrame()
+{
+    if (tlsFrameBegin == 0)
+        return;
+    const uint64_t frame = registry().frameCount.fetch_add(1, std::memory_order_relaxed);
+    record("Frame", tlsFrameBegin, nowNs(), frame + 1);
+    tlsFrameBegin = 0;
+}
+
+void setThreadName(const char* name)
+{
+    ThreadBuffer& t = threadBuffer();
+    std::lock_guard<std::mutex> lk(registry().lock);
+    t.name = name;
+}
+
+bool writeChromeJson(const std::string& path)
+{
+    std::ofstream f(path, std::ios::trunc);
+    if (!f)
+        return false;
+
+    Registry& r = registry();
+    std::vector<std::pair<ThreadBuffer*, std::string>> threads;
+    {
+        std::lock_guard<std::mutex> lk(r.lock);
+        for (auto& t : r.threads)
+            threads.emplace_back(t.get(), t->name);
+    }
+
+    // Timestamps are microseconds since the first traced call, which keeps them readable and well within double precision.
+    auto us = [&](uint64_t ns) { return (double)(int64_t)(ns - r.epochNs) / 1000.0; };
+
+    f.setf(std::ios::fixed);
+    f.precision(3);
+    f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool firstEvent = true;
+    auto next = [&]() {
+        if (!firstEvent)
+            f << ",\n";
+        firstEvent = false;
+    };
+
+    std::vector<Collected> events;
+    for (const auto& [t, name] : threads) {
+        next();
+        f << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << t->tid << ",\"args\":{\"name\":";
+        writeString(f, name.c_str());
+        f << "}}";
+
+        collect(*t, events);
+        for (const Collected& e : events) {
+            next();
+            f << "{\"ph\":\"X\",\"name\":";
+            writeString(f, e.name);
+            f << ",\"pid\":1,\"tid\":" << t->tid << ",\"ts\":" << us(e.begin) << ",\"dur\":" << (double)(e.end - e.begin) / 1000.0;
+            if (e.frame) {
+                f << ",\"cat\":\"frame\",\"args\":{\"frame\":" << e.frame - 1 << "}},\n";
+                f << "{\"ph\":\"i\",\"s\":\"g\",\"name\":\"Frame " << e.frame - 1 << "\",\"pid\":1,\"tid\":" << t->tid
+                  << ",\"ts\":" << us(e.begin) << '}';
+            } else {
+                f << '}';
+            }
+        }
+    }
+    f << "\n]}\n";
+    return (bool)f;
+}
+
+}  // namespace Trace
+
+#endif
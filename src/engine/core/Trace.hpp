@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// CPU timeline profiler. Zones go to a ring buffer owned by the recording thread, so recording never takes a lock, and
+// writeChromeJson() turns whatever the buffers still hold into a trace for chrome://tracing or ui.perfetto.dev. Only the
+// name pointer is stored, so names must be string literals or otherwise live until the trace is written.
+//
+// Everything below is compiled out unless CFGC_TRACE is defined; use the CFGC_ZONE* / CFGC_TRACE_* macros rather than
+// calling into Trace directly.
+namespace Trace {
+
+uint64_t nowNs();
+
+void zone(const char* name, uint64_t beginNs, uint64_t endNs);
+
+// Called by VulkanContext::beginFrame()/endFrame(). Each frame becomes a zone on the calling thread plus a marker that
+// spans every thread in the viewer.
+void beginFrame();
+void endFrame();
+
+// Names the calling thread in the trace.
+void setThreadName(const char* name);
+
+// Threads keep recording while the buffers are copied; events overwritten during the copy are dropped from the file.
+bool writeChromeJson(const std::string& path);
+
+class Scope {
+   public:
+    explicit Scope(const char* zoneName) : name(zoneName), begin(nowNs()) {}
+    ~Scope() { zone(name, begin, nowNs()); }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    const char* name;
+    uint64_t begin;
+};
+
+}  // namespace Trace
+
+#if defined(CFGC_TRACE)
+#define CFGC_TRACE_CAT2(a, b) a##b
+#define CFGC_TRACE_CAT(a, b) CFGC_TRACE_CAT2(a, b)
+#define CFGC_ZONE(name) ::Trace::Scope CFGC_TRACE_CAT(cfgcZone, __LINE__)(name)
+#define CFGC_ZONE_FUNC() CFGC_ZONE(__func__)
+#define CFGC_TRACE_FRAME_BEGIN() ::Trace::beginFrame()
+#define CFGC_TRACE_FRAME_END() ::Trace::endFrame()
+#define CFGC_TRACE_THREAD_NAME(name) ::Trace::setThreadName(name)
+#else
+#define CFGC_ZONE(name) \
+    do {                \
+    } while (0)
+#define CFGC_ZONE_FUNC() \
+    do {                 \
+    } while (0)
+#define CFGC_TRACE_FRAME_BEGIN() \
+    do {                         \
+    } while (0)
+#define CFGC_TRACE_FRAME_END() \
+    do {                       \
+    } while (0)
+#define CFGC_TRACE_THREAD_NAME(name) \
+    do {                             \
+    } while (0)
+#endif
@@ -0,0 +1,372 @@
+#include "GeometryPool.hpp"
+
+#include "VulkanHelpers.hpp"
+#include "engine/core/Log.hpp"
+
+#include <algorithm>
+
+namespace {
+constexpr VkBufferUsageFlags kVertexUsage =
+    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+constexpr VkBufferUsageFlags kIndexUsage =
+    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+constexpr VkBufferUsageFlags kTableUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+void destroyBufferDeferred(VulkanContext& vk, VkBuffer buf, const GpuAllocation& mem)
+{
+    if (!buf && !mem)
+        return;
+    const VkDevice dev = vk.device();
+    GpuAllocator* allocator = &vk.allocator();
+    vk.frameDeletionQueue().push([dev, allocator, buf, mem]() {
+        if (buf)
+            vkDestroyBuffer(dev, buf, nullptr);
+        allocator->free(mem);
+    });
+}
+}  // namespace
+
+void GeometryPool::RangeAllocator::reset(uint32_t capacity)
+{
+    freeBlocks.clear();
+    cap = capacity;
+    if (cap > 0)
+        freeBlocks.push_back(Block{ 0, cap });
+}
+
+bool GeometryPool::RangeAllocator::allocate(uint32_t count, uint32_t& outOffset)
+{
+    if (count == 0)
+        return false;
+    for (size_t i = 0; i < freeBlocks.size(); ++i) {
+        Block& b = freeBlocks[i];
+        if (b.count < count)
+            continue;
+        outOffset = b.offset;
+        b.offset += count;
+        b.count -= count;
+        if (b.count == 0)
+            freeBlocks.erase(freeBlocks.begin() + (ptrdiff_t)i);
+        return true;
+    }
+    return false;
+}
+
+void GeometryPool::RangeAllocator::free(uint32_t offset, uint32_t count)
+{
+    if (count == 0)
+        return;
+    auto it = std::lower_bound(freeBlocks.begin(), freeBlocks.end(), offset, [](const Block& b, uint32_t off) { return b.offset < off; });
+    it = freeBlocks.insert(it, Block{ offset, count });
+
+    auto next = it + 1;
+    if (next != freeBlocks.end() && it->offset + it->count == next->offset) {
+        it->count += next->count;
+        freeBlocks.erase(next);
+    }
+    if (it != freeBlocks.begin()) {
+        auto prev = it - 1;
+        if (prev->offset + prev->count == it->offset) {
+            prev->count += it->count;
+            freeBlocks.erase(it);
+        }
+    }
+}
+
+void GeometryPool::RangeAllocator::grow(uint32_t newCapacity)
+{
+    if (newCapacity <= cap)
+        return;
+    const uint32_t oldCap = cap;
+    cap = newCapacity;
+    free(oldCap, newCapacity - oldCap);
+}
+
+void GeometryPool::init(VulkanContext& vk, uint32_t vertexCapacity, uint32_t indexCapacity, uint32_t meshCapacity)
+{
+    GpuAllocator& allocator = vk.allocator();
+
+    vertexCapacity = std::max(vertexCapacity, 1u);
+    indexCapacity = std::max(indexCapacity, 1u);
+    meshCapacity = std::max(meshCapacity, 1u);
+
+    createBuffer(allocator, sizeof(Vertex) * (VkDeviceSize)vertexCapacity, kVertexUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vb, vbMem,
+                 "vkCreateBuffer(geometry vb)");
+    createBuffer(allocator, sizeof(uint32_t) * (VkDeviceSize)indexCapacity, kIndexUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ib, ibMem,
+                 "vkCreateBuffer(geometry ib)");
+    createBuffer(allocator, sizeof(GpuMesh) * (VkDeviceSize)meshCapacity, kTableUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, tableBuf,
+                 tableMem, "vkCreateBuffer(geometry mesh table)");
+
+    vertexAlloc.reset(vertexCapacity);
+    indexAlloc.reset(indexCapacity);
+    tableCapacity = meshCapacity;
+
+    meshes.clear();
+    table.clear();
+    freeMeshIds.clear();
+    vertexRanges.clear();
+    dirtyBegin = ~0u;
+    dirtyEnd = 0;
+}
+
+void GeometryPool::shutdown(VulkanContext& vk)
+{
+    destroyBufferDeferred(vk, vb, vbMem);
+    destroyBufferDeferred(vk, ib, ibMem);
+    destroyBufferDeferred(vk, tableBuf, tableMem);
+    vb = {};
+    vbMem = {};
+    ib = {};
+    ibMem = {};
+    tableBuf = {};
+    tableMem = {};
+    tableCapacity = 0;
+
+    vertexAlloc.reset(0);
+    indexAlloc.reset(0);
+    vertexRanges.clear();
+    meshes.clear();
+    table.clear();
+    freeMeshIds.clear();
+    dirtyBegin = ~0u;
+    dirtyEnd = 0;
+    ++generation;
+}
+
+void GeometryPool::growBuffer(VulkanContext& vk,
+                              UploadManager& up,
+                              VkBuffer& buf,
+                              GpuAllocation& mem,
+                              VkDeviceSize oldBytes,
+                              VkDeviceSize newBytes,
+                              VkBufferUsageFlags usage,
+                              const char* where)
+{
+    VkBuffer newBuf{};
+    GpuAllocation newMem{};
+    createBuffer(vk.allocator(), newBytes, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, newBuf, newMem, where);
+
+    // Earlier uploads in this batch may still be writing the old buffer.
+    up.memoryBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                     VK_ACCESS_TRANSFER_READ_BIT);
+    up.copyBuffer(buf, newBuf, 0, 0, oldBytes);
+
+    up.destroyBuffer(vk, buf, mem);
+    buf = newBuf;
+    mem = newMem;
+}
+
+bool GeometryPool::allocVertices(VulkanContext& vk, UploadManager& up, uint32_t count, uint32_t& outOffset)
+{
+    if (vertexAlloc.allocate(count, outOffset))
+        return true;
+    if (!up.cmd())
+        return false;
+
+    const uint32_t oldCap = vertexAlloc.capacity();
+    const uint32_t newCap = std::max(oldCap * 2u, oldCap + count);
+    growBuffer(vk, up, vb, vbMem, sizeof(Vertex) * (VkDeviceSize)oldCap, sizeof(Vertex) * (VkDeviceSize)newCap, kVertexUsage,
+               "vkCreateBuffer(geometry vb grow)");
+    vertexAlloc.grow(newCap);
+    CFGC_LOGF("GeometryPool: vertex capacity %u -> %u", oldCap, newCap);
+    return vertexAlloc.allocate(count, outOffset);
+}
+
+bool GeometryPool::allocIndices(VulkanContext& vk, UploadManager& up, uint32_t count, uint32_t& outOffset)
+{
+    if (indexAlloc.allocate(count, outOffset))
+        return true;
+    if (!up.cmd())
+        return false;
+
+    const uint32_t oldCap = indexAlloc.capacity();
+    const uint32_t newCap = std::max(oldCap * 2u, oldCap + count);
+    growBuffer(vk, up, ib, ibMem, sizeof(uint32_t) * (VkDeviceSize)oldCap, sizeof(uint32_t) * (VkDeviceSize)newCap, kIndexUsage,
+               "vkCreateBuffer(geometry ib grow)");
+    indexAlloc.grow(newCap);
+    CFGC_LOGF("GeometryPool: index capacity %u -> %u", oldCap, newCap);
+    return indexAlloc.allocate(count, outOffset);
+}
+
+void GeometryPool::growTable(VulkanContext& vk, uint32_t minCapacity)
+{
+    if (minCapacity <= tableCapacity)
+        return;
+    const uint32_t newCap = std::max(tableCapacity * 2u, minCapacity);
+
+    // The CPU mirror holds every entry, so the new table is simply re-uploaded in full on the next flush.
+    destroyBufferDeferred(vk, tableBuf, tableMem);
+    tableBuf = {};
+    tableMem = {};
+    createBuffer(vk.allocator(), sizeof(GpuMesh) * (VkDeviceSize)newCap, kTableUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, tableBuf,
+                 tableMem, "vkCreateBuffer(geometry mesh table grow)");
+    tableCapacity = newCap;
+
+    if (!table.empty()) {
+        dirtyBegin = 0;
+        dirtyEnd = (uint32_t)table.size();
+    }
+}
+
+uint32_t GeometryPool::allocMeshSlots(VulkanContext& vk, uint32_t count)
+{
+    // Groups always get fresh consecutive ids so callers can address parts as firstId + i.
+    if (count == 1 && !freeMeshIds.empty()) {
+        const uint32_t id = freeMeshIds.back();
+        freeMeshIds.pop_back();
+        return id;
+    }
+    const uint32_t id = (uint32_t)meshes.size();
+    meshes.resize(meshes.size() + count);
+    table.resize(table.size() + count);
+    growTable(vk, (uint32_t)meshes.size());
+    return id;
+}
+
+void GeometryPool::writeTableEntry(uint32_t meshId)
+{
+    const MeshInfo& m = meshes[meshId];
+    GpuMesh g{};
+    if (m.live) {
+        const glm::vec3 center = (m.boundsMin + m.boundsMax) * 0.5f;
+        g.centerRadius = glm::vec4(center, glm::length(m.boundsMax - center));
+        g.firstIndex = m.firstIndex;
+        g.indexCount = m.indexCount;
+        g.vertexOffset = m.vertexOffset;
+    }
+    table[meshId] = g;
+    dirtyBegin = std::min(dirtyBegin, meshId);
+    dirtyEnd = std::max(dirtyEnd, meshId + 1);
+}
+
+uint32_t GeometryPool::addMesh(VulkanContext& vk,
+                               UploadManager& up,
+                               const std::vector<Vertex>& vertices,
+                               const std::vector<uint32_t>& indices)
+{
+    if (vertices.empty() || indices.empty())
+        return kInvalidMesh;
+
+    MeshChunk whole{};
+    whole.firstIndex = 0;
+    whole.indexCount = (uint32_t)indices.size();
+    whole.boundsMin = vertices[0].pos;
+    whole.boundsMax = vertices[0].pos;
+    for (const Vertex& v : vertices) {
+        whole.boundsMin = glm::min(whole.boundsMin, v.pos);
+        whole.boundsMax = glm::max(whole.boundsMax, v.pos);
+    }
+    return addMeshGroup(vk, up, vertices, indices, { whole });
+}
+
+uint32_t GeometryPool::addMeshGroup(VulkanContext& vk,
+                                    UploadManager& up,
+                                    const std::vector<Vertex>& vertices,
+                                    const std::vector<uint32_t>& indices,
+                                    const std::vector<MeshChunk>& parts)
+{
+    if (vertices.empty() || indices.empty() || parts.empty())
+        return kInvalidMesh;
+    for (const MeshChunk& p : parts) {
+        if (p.indexCount == 0 || (uint64_t)p.firstIndex + p.indexCount > indices.size())
+            return kInvalidMesh;
+    }
+
+    const uint32_t vcount = (uint32_t)vertices.size();
+    const uint32_t icount = (uint32_t)indices.size();
+
+    uint32_t vbase = 0;
+    if (!allocVertices(vk, up, vcount, vbase))
+        return kInvalidMesh;
+    uint32_t ibase = 0;
+    if (!allocIndices(vk, up, icount, ibase)) {
+        vertexAlloc.free(vbase, vcount);
+        return kInvalidMesh;
+    }
+
+    if (!up.uploadToBuffer(vb, sizeof(Vertex) * (VkDeviceSize)vbase, vertices.data(), sizeof(Vertex) * (VkDeviceSize)vcount,
+                           alignof(Vertex)) ||
+        !up.uploadToBuffer(ib, sizeof(uint32_t) * (VkDeviceSize)ibase, indices.data(), sizeof(uint32_t) * (VkDeviceSize)icount,
+                           alignof(uint32_t))) {
+        vertexAlloc.free(vbase, vcount);
+        indexAlloc.free(ibase, icount);
+        return kInvalidMesh;
+    }
+
+    // Index ranges not covered by any part are returned to the pool right away.
+    std::vector<MeshChunk> sorted = parts;
+    std::sort(sorted.begin(), sorted.end(), [](const MeshChunk& a, const MeshChunk& b) { return a.firstIndex < b.firstIndex; });
+    uint32_t cursor = 0;
+    for (const MeshChunk& p : sorted) {
+        if (p.firstIndex > cursor)
+            indexAlloc.free(ibase + cursor, p.firstIndex - cursor);
+        cursor = std::max(cursor, p.firstIndex + p.indexCount);
+    }
+    if (cursor < icount)
+        indexAlloc.free(ibase + cursor, icount - cursor);
+
+    vertexRanges[vbase] = VertexRange{ vcount, (uint32_t)parts.size() };
+
+    const uint32_t firstId = allocMeshSlots(vk, (uint32_t)parts.size());
+    for (size_t i = 0; i < parts.size(); ++i) {
+        const uint32_t id = firstId + (uint32_t)i;
+        MeshInfo& m = meshes[id];
+        m.firstIndex = ibase + parts[i].firstIndex;
+        m.indexCount = parts[i].indexCount;
+        m.vertexOffset = (int32_t)vbase;
+        m.vertexCount = vcount;
+        m.boundsMin = parts[i].boundsMin;
+        m.boundsMax = parts[i].boundsMax;
+        m.live = true;
+        writeTableEntry(id);
+    }
+    return firstId;
+}
+
+void GeometryPool::removeMesh(VulkanContext& vk, uint32_t meshId)
+{
+    if (!valid(meshId))
+        return;
+
+    MeshInfo& m = meshes[meshId];
+    const uint32_t firstIndex = m.firstIndex;
+    const uint32_t indexCount = m.indexCount;
+    const uint32_t vertexOffset = (uint32_t)m.vertexOffset;
+    m = MeshInfo{};
+    writeTableEntry(meshId);
+
+    // Draws recorded for frames still in flight may reference these ranges; free them once the current frame retires.
+    const uint64_t gen = generation;
+    vk.frameDeletionQueue().push([this, gen, meshId, firstIndex, indexCount, vertexOffset]() {
+        if (gen != generation)
+            return;
+        indexAlloc.free(firstIndex, indexCount);
+        auto it = vertexRanges.find(vertexOffset);
+        if (it != vertexRanges.end() && --it->second.refs == 0) {
+            vertexAlloc.free(vertexOffset, it->second.count);
+            vertexRanges.erase(it);
+        }
+        freeMeshIds.push_back(meshId);
+    });
+}
+
+void GeometryPool::flush(UploadManager& up)
+{
+    if (!up.cmd())
+        return;
+
+    if (dirtyBegin < dirtyEnd) {
+        // The previous upload of these entries may still be read by culling of earlier frames.
+        up.memoryBarrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, 0);
+        const VkDeviceSize off = sizeof(GpuMesh) * (VkDeviceSize)dirtyBegin;
+        const VkDeviceSize bytes = sizeof(GpuMesh) * (VkDeviceSize)(dirtyEnd - dirtyBegin);
+        if (!up.uploadToBuffer(tableBuf, off, table.data() + dirtyBegin, bytes, alignof(GpuMesh)))
+            return;
+        dirtyBegin = ~0u;
+        dirtyEnd = 0;
+    }
+
+    up.memoryBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                     VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                     VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "../assets/MeshPartition.hpp"
+#include "Mesh.hpp"
+#include "UploadManager.hpp"
+#include "VulkanContext.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Shared vertex/index storage for every mesh in the scene. Meshes are sub-allocated ranges of one
+// vertex buffer and one index buffer, so any mix of meshes can be drawn from a single indirect call.
+// A per-mesh table (bounds sphere, firstIndex, indexCount, vertexOffset) is mirrored on the GPU and
+// indexed by meshId in cull.comp.
+class GeometryPool {
+   public:
+    static constexpr uint32_t kInvalidMesh = ~0u;
+
+    struct MeshInfo {
+        uint32_t firstIndex = 0;
+        uint32_t indexCount = 0;
+        int32_t vertexOffset = 0;
+        uint32_t vertexCount = 0;
+        glm::vec3 boundsMin{ 0.0f };
+        glm::vec3 boundsMax{ 0.0f };
+        bool live = false;
+    };
+
+    // Matches the Mesh struct in cull.comp (std430).
+    struct GpuMesh {
+        glm::vec4 centerRadius{ 0.0f };
+        uint32_t firstIndex = 0;
+        uint32_t indexCount = 0;
+        int32_t vertexOffset = 0;
+        uint32_t _pad0 = 0;
+    };
+
+    void init(VulkanContext& vk, uint32_t vertexCapacity = 1u << 20, uint32_t indexCapacity = 4u << 20, uint32_t meshCapacity = 1024);
+    void shutdown(VulkanContext& vk);
+
+    // Uploads must be recorded between up.beginFrame() and up.endFrame(). Returns kInvalidMesh on failure.
+    uint32_t addMesh(VulkanContext& vk, UploadManager& up, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+    // Registers every part as its own mesh sharing one vertex range; part ranges index into `indices`.
+    // Returns the id of the first part, the rest follow consecutively.
+    uint32_t addMeshGroup(VulkanContext& vk,
+                          UploadManager& up,
+                          const std::vector<Vertex>& vertices,
+                          const std::vector<uint32_t>& indices,
+                          const std::vector<MeshChunk>& parts);
+
+    // Ranges are released once the current frame slot comes around again.
+    void removeMesh(VulkanContext& vk, uint32_t meshId);
+
+    // Uploads dirty mesh table entries and makes all pool writes visible to vertex input and shaders.
+    void flush(UploadManager& up);
+
+    VkBuffer vertexBuffer() const { return vb; }
+    VkBuffer indexBuffer() const { return ib; }
+    VkBuffer meshTableBuffer() const { return tableBuf; }
+    VkDeviceSize meshTableBytes() const { return sizeof(GpuMesh) * (VkDeviceSize)tableCapacity; }
+
+    uint32_t meshCount() const { return (uint32_t)meshes.size(); }
+    const MeshInfo& mesh(uint32_t meshId) const { return meshes[meshId]; }
+    bool valid(uint32_t meshId) const { return meshId < meshes.size() && meshes[meshId].live; }
+
+   private:
+    // First-fit free list over [0, capacity), kept sorted by offset and coalesced on free.
+    class RangeAllocator {
+       public:
+        void reset(uint32_t capacity);
+        bool allocate(uint32_t count, uint32_t& outOffset);
+        void free(uint32_t offset, uint32_t count);
+        void grow(uint32_t newCapacity);
+        uint32_t capacity() const { return cap; }
+
+       private:
+        struct Block {
+            uint32_t offset = 0;
+            uint32_t count = 0;
+        };
+        std::vector<Block> freeBlocks;
+        uint32_t cap = 0;
+    };
+
+    struct VertexRange {
+        uint32_t count = 0;
+        uint32_t refs = 0;
+    };
+
+    bool allocVertices(VulkanContext& vk, UploadManager& up, uint32_t count, uint32_t& outOffset);
+    bool allocIndices(VulkanContext& vk, UploadManager& up, uint32_t count, uint32_t& outOffset);
+    void growBuffer(VulkanContext& vk,
+                    UploadManager& up,
+                    VkBuffer& buf,
+                    GpuAllocation& mem,
+                    VkDeviceSize oldBytes,
+                    VkDeviceSize newBytes,
+                    VkBufferUsageFlags usage,
+                    const char* where);
+    void growTable(VulkanContext& vk, uint32_t minCapacity);
+    uint32_t allocMeshSlots(VulkanContext& vk, uint32_t count);
+    void writeTableEntry(uint32_t meshId);
+
+    VkBuffer vb{};
+    GpuAllocation vbMem{};
+    VkBuffer ib{};
+    GpuAllocation ibMem{};
+
+    VkBuffer tableBuf{};
+    GpuAllocation tableMem{};
+    uint32_t tableCapacity = 0;
+
+    RangeAllocator vertexAlloc;
+    RangeAllocator indexAlloc;
+    std::unordered_map<uint32_t, VertexRange> vertexRanges;
+
+    std::vector<MeshInfo> meshes;
+    std::vector<GpuMesh> table;
+    std::vector<uint32_t> freeMeshIds;
+    uint32_t dirtyBegin = ~0u;
+    uint32_t dirtyEnd = 0;
+
+    // Bumped on shutdown so deferred range frees queued before it are dropped.
+    uint64_t generation = 0;
+};
@@ -0,0 +1,463 @@
+#include "GpuAllocator.hpp"
+
+#include "VulkanHelpers.hpp"
+#include "engine/core/Log.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+namespace {
+
+VkDeviceSize alignUp(VkDeviceSize v, VkDeviceSize a)
+{
+    return (v + a - 1) & ~(a - 1);
+}
+
+uint32_t msb(VkDeviceSize v)
+{
+    return 63u - (uint32_t)std::countl_zero((uint64_t)v);
+}
+
+}  // namespace
+
+void GpuAllocator::init(VkDevice device, VkPhysicalDevice phys, VkDeviceSize preferredBlockSize)
+{
+    dev = device;
+    preferredBlock = preferredBlockSize;
+    vkGetPhysicalDeviceMemoryProperties(phys, &memProps);
+    pools.assign(memProps.memoryTypeCount * 2, Pool{});
+}
+
+void GpuAllocator::shutdown()
+{
+    for (uint32_t id = 0; id < blocks.size(); ++id) {
+        if (!blocks[id])
+            continue;
+        if (blocks[id]->allocations)
+            CFGC_LOGF("GpuAllocator: block %u released with %u live allocations", id, blocks[id]->allocations);
+        releaseBlock(id);
+    }
+    blocks.clear();
+    recycledBlocks.clear();
+    pools.clear();
+    liveDeviceMemory = 0;
+    dev = VK_NULL_HANDLE;
+}
+
+uint32_t GpuAllocator::findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags flags) const
+{
+    for (uint32_t i = 0; i < memProps.memoryTypeCount; i++) {
+        if ((typeBits & (1u << i)) && (memProps.memoryTypes[i].propertyFlags & flags) == flags)
+            return i;
+    }
+    throw std::runtime_error("GpuAllocator: no compatible memory type");
+}
+
+VkDeviceSize GpuAllocator::blockSizeFor(uint32_t memoryType) const
+{
+    // Small heaps (e.g. the host-visible BAR window) would be exhausted by a handful of full-size blocks.
+    const VkDeviceSize heapSize = memProps.memoryHeaps[memProps.memoryTypes[memoryType].heapIndex].size;
+    if (heapSize <= 1024ull * 1024ull * 1024ull)
+        return std::max<VkDeviceSize>(std::min(preferredBlock, heapSize / 8), 1ull << kMinShift);
+    return preferredBlock;
+}
+
+GpuAllocation GpuAllocator::allocate(const VkMemoryRequirements& req,
+                                     VkMemoryPropertyFlags memFlags,
+                                     Kind kind,
+                                     Lifetime lifetime,
+                                     const char* debugWhere)
+{
+    const uint32_t type = findMemoryType(req.memoryTypeBits, memFlags);
+    const uint32_t poolId = type * 2 + (kind == Kind::Image ? 1u : 0u);
+    const VkDeviceSize alignment = std::max<VkDeviceSize>(req.alignment, 1);
+    const VkDeviceSize blockSize = blockSizeFor(type);
+    VkResult result = VK_SUCCESS;
+
+    if (req.size <= blockSize / 2) {
+        if (lifetime == Lifetime::Transient) {
+            for (uint32_t id : pools[poolId].pages) {
+                if (GpuAllocation a = allocateLinear(id, req.size, alignment))
+                    return a;
+            }
+            const uint32_t id = createBlock(poolId, blockSize, BlockType::Linear, result);
+            if (id != kNone) {
+                if (GpuAllocation a = allocateLinear(id, req.size, alignment))
+                    return a;
+            }
+        } else {
+            for (uint32_t id : pools[poolId].blocks) {
+                if (GpuAllocation a = allocateTlsf(id, req.size, alignment))
+                    return a;
+            }
+            const uint32_t id = createBlock(poolId, blockSize, BlockType::Tlsf, result);
+            if (id != kNone) {
+                if (GpuAllocation a = allocateTlsf(id, req.size, alignment))
+                    return a;
+            }
+        }
+        // The pool could not grow by a whole block, or the alignment did not fit one; an exact-size allocation may.
+    }
+
+    const uint32_t id = createBlock(poolId, req.size, BlockType::Dedicated, result);
+    if (id == kNone)
+        vkFail(debugWhere, result);
+    Block& b = *blocks[id];
+    b.allocations = 1;
+    b.used = req.size;
+    return makeAllocation(id, 0, 0, req.size);
+}
+
+void GpuAllocator::free(const GpuAllocation& a)
+{
+    if (!a.memory)
+        return;
+
+    const uint32_t id = a.block;
+    Block& b = *blocks[id];
+    if (b.type == BlockType::Dedicated) {
+        releaseBlock(id);
+        return;
+    }
+
+    // Keep one empty block or page per pool around so a resource that is recreated every few frames does not hit
+    // vkAllocateMemory each time.
+    auto hasSpare = [&](const std::vector<uint32_t>& ids) {
+        for (uint32_t other : ids) {
+            if (other != id && blocks[other]->allocations == 0)
+                return true;
+        }
+        return false;
+    };
+
+    if (b.type == BlockType::Linear) {
+        b.used -= a.size;
+        if (--b.allocations == 0) {
+            b.top = 0;
+            if (hasSpare(pools[b.pool].pages))
+                releaseBlock(id);
+        }
+        return;
+    }
+
+    freeTlsf(b, a.node);
+    if (b.allocations == 0 && hasSpare(pools[b.pool].blocks))
+        releaseBlock(id);
+}
+
+uint32_t GpuAllocator::createBlock(uint32_t pool, VkDeviceSize size, BlockType type, VkResult& result)
+{
+    const uint32_t memoryType = pool / 2;
+
+    VkMemoryAllocateInfo mai{ VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+    mai.allocationSize = size;
+    mai.memoryTypeIndex = memoryType;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    result = vkAllocateMemory(dev, &mai, nullptr, &memory);
+    if (result != VK_SUCCESS)
+        return kNone;
+
+    auto b = std::make_unique<Block>();
+    b->memory = memory;
+    b->size = size;
+    b->pool = pool;
+    b->type = type;
+    if (memProps.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        void* p = nullptr;
+        vkCheck(vkMapMemory(dev, memory, 0, VK_WHOLE_SIZE, 0, &p), "vkMapMemory(block)");
+        b->mapped = static_cast<uint8_t*>(p);
+    }
+    if (type == BlockType::Tlsf) {
+        std::fill(std::begin(b->heads), std::end(b->heads), kNone);
+        const uint32_t n = newNode(*b);
+        b->nodes[n].size = size;
+        insertFree(*b, n);
+    }
+
+    uint32_t id = 0;
+    if (!recycledBlocks.empty()) {
+        id = recycledBlocks.back();
+        recycledBlocks.pop_back();
+        blocks[id] = std::move(b);
+    } else {
+        id = (uint32_t)blocks.size();
+        blocks.push_back(std::move(b));
+    }
+
+    Pool& p = pools[pool];
+    if (type == BlockType::Tlsf)
+        p.blocks.push_back(id);
+    else if (type == BlockType::Linear)
+        p.pages.push_back(id);
+    else
+        ++p.dedicated;
+    ++liveDeviceMemory;
+    return id;
+}
+
+void GpuAllocator::releaseBlock(uint32_t blockId)
+{
+    Block& b = *blocks[blockId];
+    Pool& p = pools[b.pool];
+    if (b.type == BlockType::Tlsf)
+        std::erase(p.blocks, blockId);
+    else if (b.type == BlockType::Linear)
+        std::erase(p.pages, blockId);
+    else
+        --p.dedicated;
+
+    vkFreeMemory(dev, b.memory, nullptr);
+    blocks[blockId].reset();
+    recycledBlocks.push_back(blockId);
+    --liveDeviceMemory;
+}
+
+GpuAllocation GpuAllocator::allocateTlsf(uint32_t blockId, VkDeviceSize size, VkDeviceSize alignment)
+{
+    Block& b = *blocks[blockId];
+    const uint32_t n = findFree(b, size + alignment - 1);
+    if (n == kNone)
+        return {};
+    removeFree(b, n);
+
+    const VkDeviceSize aligned = alignUp(b.nodes[n].offset, alignment);
+    if (aligned > b.nodes[n].offset) {
+        // Give the alignment gap back as a free range in front of the allocation.
+        const uint32_t front = newNode(b);
+        Node& cur = b.nodes[n];
+        Node& gap = b.nodes[front];
+        gap.offset = cur.offset;
+        gap.size = aligned - cur.offset;
+        gap.prevPhys = cur.prevPhys;
+        gap.nextPhys = n;
+        if (cur.prevPhys != kNone)
+            b.nodes[cur.prevPhys].nextPhys = front;
+        cur.prevPhys = front;
+        cur.offset = aligned;
+        cur.size -= gap.size;
+        insertFree(b, front);
+    }
+
+    if (b.nodes[n].size > size) {
+        const uint32_t back = newNode(b);
+        Node& cur = b.nodes[n];
+        Node& tail = b.nodes[back];
+        tail.offset = cur.offset + size;
+        tail.size = cur.size - size;
+        tail.prevPhys = n;
+        tail.nextPhys = cur.nextPhys;
+        if (cur.nextPhys != kNone)
+            b.nodes[cur.nextPhys].prevPhys = back;
+        cur.nextPhys = back;
+        cur.size = size;
+        insertFree(b, back);
+    }
+
+    ++b.allocations;
+    b.used += size;
+    return makeAllocation(blockId, n, b.nodes[n].offset, size);
+}
+
+GpuAllocation GpuAllocator::allocateLinear(uint32_t blockId, VkDeviceSize size, VkDeviceSize alignment)
+{
+    Block& b = *blocks[blockId];
+    const VkDeviceSize offset = alignUp(b.top, alignment);
+    if (offset + size > b.size)
+        return {};
+    b.top = offset + size;
+    ++b.allocations;
+    b.used += size;
+    return makeAllocation(blockId, 0, offset, size);
+}
+
+GpuAllocation GpuAllocator::makeAllocation(uint32_t blockId, uint32_t node, VkDeviceSize offset, VkDeviceSize size) const
+{
+    const Block& b = *blocks[blockId];
+    GpuAllocation a{};
+    a.memory = b.memory;
+    a.offset = offset;
+    a.size = size;
+    a.mapped = b.mapped ? b.mapped + offset : nullptr;
+    a.block = blockId;
+    a.node = node;
+    return a;
+}
+
+void GpuAllocator::mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl)
+{
+    if (size < (1ull << kMinShift)) {
+        fl = 0;
+        sl = (uint32_t)(size >> (kMinShift - kSLBits));
+        return;
+    }
+    const uint32_t f = msb(size);
+    fl = f - kMinShift + 1;
+    sl = (uint32_t)(size >> (f - kSLBits)) ^ kSLCount;
+}
+
+uint32_t GpuAllocator::newNode(Block& b)
+{
+    if (!b.recycledNodes.empty()) {
+        const uint32_t n = b.recycledNodes.back();
+        b.recycledNodes.pop_back();
+        b.nodes[n] = Node{};
+        return n;
+    }
+    b.nodes.emplace_back();
+    return (uint32_t)b.nodes.size() - 1;
+}
+
+void GpuAllocator::insertFree(Block& b, uint32_t n)
+{
+    uint32_t fl = 0, sl = 0;
+    mapping(b.nodes[n].size, fl, sl);
+    uint32_t& head = b.heads[fl * kSLCount + sl];
+
+    Node& node = b.nodes[n];
+    node.free = true;
+    node.prevFree = kNone;
+    node.nextFree = head;
+    if (head != kNone)
+        b.nodes[head].prevFree = n;
+    head = n;
+    b.flBitmap |= 1u << fl;
+    b.slBitmap[fl] |= 1u << sl;
+}
+
+void GpuAllocator::removeFree(Block& b, uint32_t n)
+{
+    uint32_t fl = 0, sl = 0;
+    mapping(b.nodes[n].size, fl, sl);
+
+    Node& node = b.nodes[n];
+    if (node.prevFree != kNone) {
+        b.nodes[node.prevFree].nextFree = node.nextFree;
+    } else {
+        b.heads[fl * kSLCount + sl] = node.nextFree;
+        if (node.nextFree == kNone) {
+            b.slBitmap[fl] &= ~(1u << sl);
+            if (!b.slBitmap[fl])
+                b.flBitmap &= ~(1u << fl);
+        }
+    }
+    if (node.nextFree != kNone)
+        b.nodes[node.nextFree].prevFree = node.prevFree;
+    node.free = false;
+    node.prevFree = kNone;
+    node.nextFree = kNone;
+}
+
+uint32_t GpuAllocator::findFree(const Block& b, VkDeviceSize size) const
+{
+    // Round up to the next second-level bucket so any range found there is large enough.
+    size += (1ull << (size >= (1ull << kMinShift) ? msb(size) - kSLBits : kMinShift - kSLBits)) - 1;
+    uint32_t fl = 0, sl = 0;
+    mapping(size, fl, sl);
+    if (fl >= kFLCount)
+        return kNone;
+
+    uint32_t slMap = b.slBitmap[fl] & (~0u << sl);
+    if (!slMap) {
+        const uint32_t flMap = fl + 1 < kFLCount ? b.flBitmap & (~0u << (fl + 1)) : 0u;
+        if (!flMap)
+            return kNone;
+        fl = (uint32_t)std::countr_zero(flMap);
+        slMap = b.slBitmap[fl];
+    }
+    sl = (uint32_t)std::countr_zero(slMap);
+    return b.heads[fl * kSLCount + sl];
+}
+
+void GpuAllocator::freeTlsf(Block& b, uint32_t n)
+{
+    --b.allocations;
+    b.used -= b.nodes[n].size;
+
+    const uint32_t prev = b.nodes[n].prevPhys;
+    if (prev != kNone && b.nodes[prev].free) {
+        removeFree(b, prev);
+        Node& cur = b.nodes[n];
+        const Node& p = b.nodes[prev];
+        cur.offset = p.offset;
+        cur.size += p.size;
+        cur.prevPhys = p.prevPhys;
+        if (p.prevPhys != kNone)
+            b.nodes[p.prevPhys].nextPhys = n;
+        b.nodes[prev] = Node{};
+        b.recycledNodes.push_back(prev);
+    }
+
+    const uint32_t next = b.nodes[n].nextPhys;
+    if (next != kNone && b.nodes[next].free) {
+        removeFree(b, next);
+        Node& cur = b.nodes[n];
+        const Node& x = b.nodes[next];
+        cur.size += x.size;
+        cur.nextPhys = x.nextPhys;
+        if (x.nextPhys != kNone)
+            b.nodes[x.nextPhys].prevPhys = n;
+        b.nodes[next] = Node{};
+        b.recycledNodes.push_back(next);
+    }
+
+    insertFree(b, n);
+}
+
+std::vector<GpuAllocator::PoolStats> GpuAllocator::stats() const
+{
+    std::vector<PoolStats> all(pools.size());
+    std::vector<VkDeviceSize> largestPerBlock(pools.size(), 0);
+    for (const auto& bp : blocks) {
+        if (!bp)
+            continue;
+        const Block& b = *bp;
+        PoolStats& s = all[b.pool];
+        s.reservedBytes += b.size;
+        s.usedBytes += b.used;
+        s.allocations += b.allocations;
+        if (b.type == BlockType::Tlsf) {
+            ++s.blocks;
+            VkDeviceSize largest = 0;
+            for (const Node& n : b.nodes) {
+                if (!n.free)
+                    continue;
+                ++s.freeRanges;
+                s.freeBytes += n.size;
+                largest = std::max(largest, n.size);
+            }
+            s.largestFreeRange = std::max(s.largestFreeRange, largest);
+            largestPerBlock[b.pool] += largest;
+        } else if (b.type == BlockType::Linear) {
+            ++s.linearPages;
+        } else {
+            ++s.dedicated;
+        }
+    }
+
+    std::vector<PoolStats> out;
+    for (uint32_t p = 0; p < (uint32_t)all.size(); ++p) {
+        PoolStats& s = all[p];
+        if (!s.reservedBytes)
+            continue;
+        s.memoryType = p / 2;
+        s.heapIndex = memProps.memoryTypes[s.memoryType].heapIndex;
+        s.kind = (p & 1) ? Kind::Image : Kind::Buffer;
+        s.fragmentation = s.freeBytes ? 1.0f - (float)((double)largestPerBlock[p] / (double)s.freeBytes) : 0.0f;
+        out.push_back(s);
+    }
+    return out;
+}
+
+void GpuAllocator::logStats() const
+{
+#if defined(CFGC_DIAGNOSTICS)
+    for (const PoolStats& s : stats()) {
+        CFGC_LOGF("GpuAllocator: type %u (heap %u) %s: %u blocks, %u linear pages, %u dedicated, %u allocations, "
+                  "%.1f / %.1f MiB used, %u free ranges, fragmentation %.2f",
+                  s.memoryType, s.heapIndex, s.kind == Kind::Image ? "images" : "buffers", s.blocks, s.linearPages, s.dedicated,
+                  s.allocations, s.usedBytes / 1048576.0, s.reservedBytes / 1048576.0, s.freeRanges, s.fragmentation);
+    }
+    CFGC_LOGF("GpuAllocator: %u device memory objects", liveDeviceMemory);
+#endif
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A range of device memory owned by GpuAllocator. `mapped` already points at `offset` and is set for host-visible
+// memory, which stays persistently mapped for the lifetime of its block.
+struct GpuAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void* mapped = nullptr;
+    uint32_t block = 0;
+    uint32_t node = 0;
+
+    explicit operator bool() const { return memory != VK_NULL_HANDLE; }
+};
+
+// Sub-allocates resources out of large VkDeviceMemory blocks, one pool per memory type and resource kind. Buffers and
+// optimal-tiling images never share a block, so bufferImageGranularity never has to be honoured between neighbours.
+// Persistent resources are placed with a TLSF allocator inside each block; transient resources are bumped into linear
+// pages that rewind once every allocation in them is freed. Requests larger than half a block get their own memory.
+class GpuAllocator {
+   public:
+    enum class Kind : uint8_t { Buffer, Image };
+    enum class Lifetime : uint8_t { Persistent, Transient };
+
+    void init(VkDevice dev, VkPhysicalDevice phys, VkDeviceSize preferredBlockSize = 64ull * 1024ull * 1024ull);
+    void shutdown();
+
+    VkDevice device() const { return dev; }
+
+    GpuAllocation allocate(const VkMemoryRequirements& req,
+                           VkMemoryPropertyFlags memFlags,
+                           Kind kind,
+                           Lifetime lifetime = Lifetime::Persistent,
+                           const char* debugWhere = "vkAllocateMemory");
+    void free(const GpuAllocation& a);
+
+    struct PoolStats {
+        uint32_t memoryType = 0;
+        uint32_t heapIndex = 0;
+        Kind kind = Kind::Buffer;
+        uint32_t blocks = 0;
+        uint32_t linearPages = 0;
+        uint32_t dedicated = 0;
+        uint32_t allocations = 0;
+        VkDeviceSize reservedBytes = 0;
+        VkDeviceSize usedBytes = 0;
+        VkDeviceSize freeBytes = 0;
+        VkDeviceSize largestFreeRange = 0;
+        uint32_t freeRanges = 0;
+        // Free space in TLSF blocks: 0 when each block's free space is a single range, approaching 1 as it splinters.
+        float fragmentation = 0.0f;
+    };
+
+    // One entry per pool that currently owns device memory.
+    std::vector<PoolStats> stats() const;
+    void logStats() const;
+    uint32_t deviceMemoryCount() const { return liveDeviceMemory; }
+
+   private:
+    enum class BlockType : uint8_t { Tlsf, Linear, Dedicated };
+
+    static constexpr uint32_t kNone = ~0u;
+    static constexpr uint32_t kSLBits = 4;
+    static constexpr uint32_t kSLCount = 1u << kSLBits;
+    static constexpr uint32_t kMinShift = 8;
+    static constexpr uint32_t kFLCount = 32;
+
+    struct Node {
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        uint32_t prevPhys = kNone;
+        uint32_t nextPhys = kNone;
+        uint32_t prevFree = kNone;
+        uint32_t nextFree = kNone;
+        bool free = false;
+    };
+
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        uint8_t* mapped = nullptr;
+        uint32_t pool = 0;
+        BlockType type = BlockType::Tlsf;
+        uint32_t allocations = 0;
+        VkDeviceSize used = 0;
+
+        // TLSF: two-level segregated free lists over the block's nodes.
+        uint32_t flBitmap = 0;
+        uint32_t slBitmap[kFLCount]{};
+        uint32_t heads[kFLCount * kSLCount]{};
+        std::vector<Node> nodes;
+        std::vector<uint32_t> recycledNodes;
+
+        // Linear: bump pointer, rewound when `allocations` drops to zero.
+        VkDeviceSize top = 0;
+    };
+
+    struct Pool {
+        std::vector<uint32_t> blocks;
+        std::vector<uint32_t> pages;
+        uint32_t dedicated = 0;
+    };
+
+    uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags flags) const;
+    VkDeviceSize blockSizeFor(uint32_t memoryType) const;
+
+    uint32_t createBlock(uint32_t pool, VkDeviceSize size, BlockType type, VkResult& result);
+    void releaseBlock(uint32_t blockId);
+
+    GpuAllocation allocateTlsf(uint32_t blockId, VkDeviceSize size, VkDeviceSize alignment);
+    GpuAllocation allocateLinear(uint32_t blockId, VkDeviceSize size, VkDeviceSize alignment);
+    GpuAllocation makeAllocation(uint32_t blockId, uint32_t node, VkDeviceSize offset, VkDeviceSize size) const;
+
+    static void mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl);
+    uint32_t newNode(Block& b);
+    void insertFree(Block& b, uint32_t n);
+    void removeFree(Block& b, uint32_t n);
+    uint32_t findFree(const Block& b, VkDeviceSize size) const;
+    void freeTlsf(Block& b, uint32_t n);
+
+    VkDevice dev = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memProps{};
+    VkDeviceSize preferredBlock = 0;
+
+    std::vector<Pool> pools;
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::vector<uint32_t> recycledBlocks;
+    uint32_t liveDeviceMemory = 0;
+};
@@ -0,0 +1,218 @@
+#include "engine/gfx/GpuProfiler.hpp"
+
+#include "engine/gfx/VulkanContext.hpp"
+#include "engine/gfx/VulkanHelpers.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+static constexpr uint32_t kStatisticCount = 5;
+
+static uint64_t timestampMask(uint32_t validBits)
+{
+    if (validBits == 0)
+        return 0;
+    return validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+}
+
+void GpuProfiler::init(VulkanContext& vk, uint32_t scopeCapacity)
+{
+    VkPhysicalDeviceProperties props{};
+    vkGetPhysicalDeviceProperties(vk.physicalDevice(), &props);
+    nsPerTick = props.limits.timestampPeriod;
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(vk.physicalDevice(), &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(vk.physicalDevice(), &familyCount, families.data());
+    graphicsMask = timestampMask(families[vk.graphicsFamilyIndex()].timestampValidBits);
+    computeMask = vk.hasAsyncCompute() ? timestampMask(families[vk.asyncComputeFamilyIndex()].timestampValidBits) : 0;
+
+    statisticsSupported = vk.pipelineStatisticsEnabled();
+    maxScopes = scopeCapacity;
+}
+
+void GpuProfiler::shutdown(VulkanContext& vk)
+{
+    for (auto& slot : slots) {
+        if (slot.timestamps)
+            vkDestroyQueryPool(vk.device(), slot.timestamps, nullptr);
+        if (slot.statistics)
+            vkDestroyQueryPool(vk.device(), slot.statistics, nullptr);
+    }
+    slots.clear();
+    current = nullptr;
+    maxScopes = 0;
+}
+
+VkQueryPipelineStatisticFlags GpuProfiler::statisticFlags() const
+{
+    // Results come back in bit order, which is the field order of PipelineStats.
+    return VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+           VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+           VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+}
+
+void GpuProfiler::beginFrame(VulkanContext& vk, VkCommandBuffer cmd)
+{
+    const uint32_t index = vk.currentFrameIndex();
+    if (slots.size() <= index)
+        slots.resize(index + 1);
+    Slot& slot = slots[index];
+
+    readBack(vk, slot);
+    slot.scopes.clear();
+    current = nullptr;
+    frameStatistics = false;
+    if (!enabled || graphicsMask == 0)
+        return;
+
+    if (!slot.timestamps) {
+        VkQueryPoolCreateInfo qci{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        qci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        qci.queryCount = maxScopes * 2;
+        vkCheck(vkCreateQueryPool(vk.device(), &qci, nullptr, &slot.timestamps), "vkCreateQueryPool(timestamps)");
+    }
+    vkCmdResetQueryPool(cmd, slot.timestamps, 0, maxScopes * 2);
+
+    if (pipelineStatistics()) {
+        if (!slot.statistics) {
+            VkQueryPoolCreateInfo qci{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+            qci.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+            qci.queryCount = maxScopes;
+            qci.pipelineStatistics = statisticFlags();
+            vkCheck(vkCreateQueryPool(vk.device(), &qci, nullptr, &slot.statistics), "vkCreateQueryPool(statistics)");
+        }
+        vkCmdResetQueryPool(cmd, slot.statistics, 0, maxScopes);
+        frameStatistics = true;
+    }
+    current = &slot;
+}
+
+uint32_t GpuProfiler::beginScope(VkCommandBuffer cmd, std::string_view name, bool graphicsFamily, bool statistics)
+{
+    if (!current || current->scopes.size() >= maxScopes || (graphicsFamily ? graphicsMask : computeMask) == 0)
+        return kNoScope;
+
+    const uint32_t scope = (uint32_t)current->scopes.size();
+    statistics = statistics && frameStatistics && graphicsFamily;
+    current->scopes.push_back(Scope{ timingIndex(name), graphicsFamily, statistics });
+
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, current->timestamps, scope * 2);
+    if (statistics)
+        vkCmdBeginQuery(cmd, current->statistics, scope, 0);
+    return scope;
+}
+
+void GpuProfiler::endScope(VkCommandBuffer cmd, uint32_t scope)
+{
+    if (scope == kNoScope)
+        return;
+    if (current->scopes[scope].statistics)
+        vkCmdEndQuery(cmd, current->statistics, scope);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, current->timestamps, scope * 2 + 1);
+}
+
+uint32_t GpuProfiler::timingIndex(std::string_view name)
+{
+    for (uint32_t i = 0; i < timings.size(); ++i) {
+        if (timings[i].name == name)
+            return i;
+    }
+    timings.push_back(PassTiming{ std::string(name) });
+    histories.emplace_back();
+    return (uint32_t)timings.size() - 1;
+}
+
+// The slot's last frame has retired, so every query it recorded is available; WITH_AVAILABILITY only guards against scopes
+// whose command buffer was never submitted.
+void GpuProfiler::readBack(VulkanContext& vk, Slot& slot)
+{
+    const uint32_t count = (uint32_t)slot.scopes.size();
+    if (count == 0)
+        return;
+
+    const VkQueryResultFlags flags = VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT;
+    scratch.resize((size_t)count * 4);
+    const VkResult r = vkGetQueryPoolResults(vk.device(), slot.timestamps, 0, count * 2, scratch.size() * sizeof(uint64_t),
+                                             scratch.data(), sizeof(uint64_t) * 2, flags);
+    if (r != VK_SUCCESS && r != VK_NOT_READY)
+        vkCheck(r, "vkGetQueryPoolResults(timestamps)");
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const Scope& s = slot.scopes[i];
+        const uint64_t* q = &scratch[(size_t)i * 4];
+        if (!q[1] || !q[3])
+            continue;
+
+        const uint64_t ticks = (q[2] - q[0]) & (s.graphicsFamily ? graphicsMask : computeMask);
+        const float ms = (float)((double)ticks * nsPerTick * 1e-6);
+
+        History& h = histories[s.timing];
+        h.ms[h.head] = ms;
+        h.head = (h.head + 1) % kWindow;
+        h.count = std::min(h.count + 1, kWindow);
+
+        PassTiming& t = timings[s.timing];
+        t.samples = h.count;
+        t.lastMs = ms;
+        t.minMs = h.ms[0];
+        t.maxMs = h.ms[0];
+        double sum = 0.0;
+        for (uint32_t k = 0; k < h.count; ++k) {
+            t.minMs = std::min(t.minMs, (double)h.ms[k]);
+            t.maxMs = std::max(t.maxMs, (double)h.ms[k]);
+            sum += h.ms[k];
+        }
+        t.avgMs = sum / h.count;
+    }
+
+    if (!slot.statistics)
+        return;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!slot.scopes[i].statistics)
+            continue;
+        uint64_t q[kStatisticCount + 1]{};
+        const VkResult sr = vkGetQueryPoolResults(vk.device(), slot.statistics, i, 1, sizeof(q), q, sizeof(q), flags);
+        if (sr != VK_SUCCESS || !q[kStatisticCount])
+            continue;
+        PipelineStats& st = timings[slot.scopes[i].timing].stats;
+        st.inputVertices = q[0];
+        st.vertexInvocations = q[1];
+        st.clippingPrimitives = q[2];
+        st.fragmentInvocations = q[3];
+        st.computeInvocations = q[4];
+    }
+}
+
+const GpuProfiler::PassTiming* GpuProfiler::find(std::string_view name) const
+{
+    for (const auto& t : timings) {
+        if (t.name == name)
+            return &t;
+    }
+    return nullptr;
+}
+
+void GpuProfiler::resetTimings()
+{
+    for (auto& t : timings)
+        t = PassTiming{ t.name };
+    for (auto& h : histories)
+        h = History{};
+}
+
+bool GpuProfiler::writeCsv(const std::string& path) const
+{
+    std::ofstream f(path);
+    if (!f)
+        return false;
+
+    f << "pass,samples,last_ms,min_ms,avg_ms,max_ms,ia_vertices,vs_invocations,clipping_primitives,fs_invocations,cs_invocations\n";
+    for (const auto& t : timings) {
+        f << t.name << ',' << t.samples << ',' << t.lastMs << ',' << t.minMs << ',' << t.avgMs << ',' << t.maxMs << ','
+          << t.stats.inputVertices << ',' << t.stats.vertexInvocations << ',' << t.stats.clippingPrimitives << ','
+          << t.stats.fragmentInvocations << ',' << t.stats.computeInvocations << '\n';
+    }
+    return (bool)f;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class VulkanContext;
+
+// Per-pass GPU timings from timestamp queries, with optional pipeline statistics. Every frame slot has its own query
+// pools, read back without waiting when the slot comes around again, so results lag by the number of frames in flight.
+// Timings are kept per pass name over a rolling window of recent frames.
+class GpuProfiler {
+   public:
+    static constexpr uint32_t kNoScope = ~0u;
+    static constexpr uint32_t kWindow = 128;
+
+    struct PipelineStats {
+        uint64_t inputVertices = 0;
+        uint64_t vertexInvocations = 0;
+        uint64_t clippingPrimitives = 0;
+        uint64_t fragmentInvocations = 0;
+        uint64_t computeInvocations = 0;
+    };
+
+    struct PassTiming {
+        std::string name;
+        // Frames in the window; min/avg/max cover those, last is the newest.
+        uint32_t samples = 0;
+        double lastMs = 0.0;
+        double minMs = 0.0;
+        double avgMs = 0.0;
+        double maxMs = 0.0;
+        // Newest frame's counters; zero unless statistics were enabled and the pass could be queried.
+        PipelineStats stats{};
+    };
+
+    void init(VulkanContext& vk, uint32_t scopeCapacity = 64);
+    void shutdown(VulkanContext& vk);
+    bool initialized() const { return maxScopes != 0; }
+
+    void setEnabled(bool on) { enabled = on; }
+    // Only takes effect on devices with the pipelineStatisticsQuery feature.
+    void setPipelineStatistics(bool on) { statisticsRequested = on; }
+    bool pipelineStatistics() const { return enabled && statisticsRequested && statisticsSupported; }
+    VkQueryPipelineStatisticFlags statisticFlags() const;
+    // Whether the frame since the last beginFrame() collects statistics; secondaries executed inside a statistics scope
+    // must inherit statisticFlags() then.
+    bool statisticsThisFrame() const { return frameStatistics; }
+
+    // Reads back what the current frame slot recorded the last time around, then resets its queries in cmd, which
+    // must be submitted before anything recorded through beginScope(). The slot's last frame must have retired.
+    void beginFrame(VulkanContext& vk, VkCommandBuffer cmd);
+    // Brackets a pass with timestamps, and with a statistics query when statistics is set; that one must begin and
+    // end outside any render pass instance. graphicsFamily selects which family's timestamp width applies. Returns
+    // kNoScope when profiling is off, the queue cannot write timestamps or the slot ran out of queries.
+    uint32_t beginScope(VkCommandBuffer cmd, std::string_view name, bool graphicsFamily, bool statistics);
+    void endScope(VkCommandBuffer cmd, uint32_t scope);
+
+    // In order of first appearance.
+    const std::vector<PassTiming>& passTimings() const { return timings; }
+    const PassTiming* find(std::string_view name) const;
+    void resetTimings();
+    // One row per pass; returns false if the file could not be written.
+    bool writeCsv(const std::string& path) const;
+
+   private:
+    struct Scope {
+        uint32_t timing = 0;
+        bool graphicsFamily = true;
+        bool statistics = false;
+    };
+
+    struct Slot {
+        VkQueryPool timestamps = VK_NULL_HANDLE;
+        VkQueryPool statistics = VK_NULL_HANDLE;
+        std::vector<Scope> scopes;
+    };
+
+    struct History {
+        float ms[kWindow]{};
+        uint32_t head = 0;
+        uint32_t count = 0;
+    };
+
+    uint32_t timingIndex(std::string_view name);
+    void readBack(VulkanContext& vk, Slot& slot);
+
+    std::vector<Slot> slots;
+    Slot* current = nullptr;
+    uint32_t maxScopes = 0;
+    bool enabled = true;
+    bool statisticsRequested = false;
+    bool statisticsSupported = false;
+    bool frameStatistics = false;
+    double nsPerTick = 1.0;
+    uint64_t graphicsMask = 0;
+    uint64_t computeMask = 0;
+
+    std::vector<PassTiming> timings;
+    std::vector<History> histories;
+    std::vector<uint64_t> scratch;
+};
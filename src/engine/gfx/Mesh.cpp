@@ -2,6 +2,21 @@
 
 #include "VulkanHelpers.hpp"
 
+namespace {
+void destroyBufferDeferred(VulkanContext& vk, VkBuffer buf, const GpuAllocation& mem)
+{
+    if (!buf && !mem)
+        return;
+    const VkDevice dev = vk.device();
+    GpuAllocator* allocator = &vk.allocator();
+    vk.frameDeletionQueue().push([dev, allocator, buf, mem]() {
+        if (buf)
+            vkDestroyBuffer(dev, buf, nullptr);
+        allocator->free(mem);
+    });
+}
+}  // namespace
+
 bool Mesh::create(VulkanContext& vk, UploadManager& up, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
 {
     destroy(vk);
@@ -15,16 +30,13 @@ bool Mesh::create(VulkanContext& vk, UploadManager& up, const std::vector<Vertex
         bmax = glm::max(bmax, v.pos);
     }
 
-    const VkDevice dev = vk.device();
-    const VkPhysicalDevice phys = vk.physicalDevice();
-
     const VkDeviceSize vbytes = sizeof(Vertex) * static_cast<VkDeviceSize>(vertices.size());
     const VkDeviceSize ibytes = sizeof(uint32_t) * static_cast<VkDeviceSize>(indices.size());
 
-    createBuffer(dev, phys, vbytes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    createBuffer(vk.allocator(), vbytes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vb, vbMem, "vkCreateBuffer(mesh vb)");
 
-    createBuffer(dev, phys, ibytes, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    createBuffer(vk.allocator(), ibytes, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ib, ibMem, "vkCreateBuffer(mesh ib)");
 
     if (!up.uploadToBuffer(vb, 0, vertices.data(), vbytes, alignof(Vertex)))
@@ -38,24 +50,8 @@ bool Mesh::create(VulkanContext& vk, UploadManager& up, const std::vector<Vertex
 
 void Mesh::destroy(VulkanContext& vk)
 {
-    const VkDevice dev = vk.device();
-    const VkBuffer oldVb = vb;
-    const VkDeviceMemory oldVbMem = vbMem;
-    const VkBuffer oldIb = ib;
-    const VkDeviceMemory oldIbMem = ibMem;
-
-    if (oldVb || oldVbMem || oldIb || oldIbMem) {
-        vk.frameDeletionQueue().push([dev, oldVb, oldVbMem, oldIb, oldIbMem]() {
-            if (oldVb)
-                vkDestroyBuffer(dev, oldVb, nullptr);
-            if (oldVbMem)
-                vkFreeMemory(dev, oldVbMem, nullptr);
-            if (oldIb)
-                vkDestroyBuffer(dev, oldIb, nullptr);
-            if (oldIbMem)
-                vkFreeMemory(dev, oldIbMem, nullptr);
-        });
-    }
+    destroyBufferDeferred(vk, vb, vbMem);
+    destroyBufferDeferred(vk, ib, ibMem);
 
     vb = {};
     vbMem = {};
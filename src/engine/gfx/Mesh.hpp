@@ -31,9 +31,9 @@ class Mesh {
 
    private:
     VkBuffer vb{};
-    VkDeviceMemory vbMem{};
+    GpuAllocation vbMem{};
     VkBuffer ib{};
-    VkDeviceMemory ibMem{};
+    GpuAllocation ibMem{};
     uint32_t idxCount = 0;
     glm::vec3 bmin{ 0.0f };
     glm::vec3 bmax{ 0.0f };
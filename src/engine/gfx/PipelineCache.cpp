@@ -0,0 +1,154 @@
+#include "PipelineCache.hpp"
+
+#include "VulkanContext.hpp"
+#include "VulkanHelpers.hpp"
+#include "engine/core/Log.hpp"
+#include "engine/core/Trace.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t kMagic = 0x43505643u;  // "CVPC"
+constexpr uint32_t kVersion = 1;
+
+// Leading fields of VkPipelineCacheHeaderVersionOne, which every driver puts in front of its data.
+constexpr size_t kVkHeaderBytes = 16 + VK_UUID_SIZE;
+
+uint32_t readU32(const uint8_t* p)
+{
+    uint32_t v = 0;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+}  // namespace
+
+uint64_t PipelineCache::checksum(const void* data, size_t size)
+{
+    // FNV-1a; only meant to catch truncated or corrupted files.
+    uint64_t h = 0xcbf29ce484222325ull;
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+PipelineCache::FileHeader PipelineCache::expectedHeader() const
+{
+    // save() writes the struct as raw bytes, so clear the padding as well.
+    FileHeader h;
+    std::memset(static_cast<void*>(&h), 0, sizeof(h));
+    h.magic = kMagic;
+    h.version = kVersion;
+    h.vendorID = props.vendorID;
+    h.deviceID = props.deviceID;
+    h.driverVersion = props.driverVersion;
+    std::memcpy(h.cacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE);
+    return h;
+}
+
+void PipelineCache::init(VulkanContext& vk, std::string path)
+{
+    CFGC_ZONE("PipelineCache::init");
+    file = std::move(path);
+    loadedBytes = 0;
+    vkGetPhysicalDeviceProperties(vk.physicalDevice(), &props);
+
+    std::vector<uint8_t> data;
+    const char* rejected = nullptr;
+    if (std::ifstream f(file, std::ios::binary); f) {
+        const FileHeader want = expectedHeader();
+        f.seekg(0, std::ios::end);
+        const uint64_t payloadBytes = (uint64_t)f.tellg() - sizeof(FileHeader);
+        f.seekg(0);
+        FileHeader h{};
+        f.read(reinterpret_cast<char*>(&h), sizeof(h));
+        if (!f || h.magic != want.magic || h.version != want.version)
+            rejected = "unrecognized file";
+        else if (h.vendorID != want.vendorID || h.deviceID != want.deviceID || h.driverVersion != want.driverVersion ||
+                 std::memcmp(h.cacheUUID, want.cacheUUID, VK_UUID_SIZE) != 0)
+            rejected = "written by another device or driver";
+        // Check the size against the file before trusting it for an allocation.
+        else if (h.dataSize != payloadBytes)
+            rejected = "truncated or corrupted";
+        else {
+            data.resize((size_t)h.dataSize);
+            f.read(reinterpret_cast<char*>(data.data()), (std::streamsize)data.size());
+            if (!f || checksum(data.data(), data.size()) != h.checksum)
+                rejected = "truncated or corrupted";
+            else if (data.size() < kVkHeaderBytes || readU32(data.data()) < kVkHeaderBytes ||
+                     readU32(data.data() + 4) != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || readU32(data.data() + 8) != props.vendorID ||
+                     readU32(data.data() + 12) != props.deviceID ||
+                     std::memcmp(data.data() + 16, props.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+                rejected = "driver header mismatch";
+        }
+        if (rejected)
+            data.clear();
+    }
+
+    VkPipelineCacheCreateInfo ci{ VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+    ci.initialDataSize = data.size();
+    ci.pInitialData = data.empty() ? nullptr : data.data();
+    vkCheck(vkCreatePipelineCache(vk.device(), &ci, nullptr, &cache), "vkCreatePipelineCache");
+    loadedBytes = data.size();
+
+    if (rejected)
+        CFGC_LOGF("PipelineCache: ignoring %s (%s), starting cold", file.c_str(), rejected);
+    else if (warm())
+        CFGC_LOGF("PipelineCache: loaded %zu bytes from %s", loadedBytes, file.c_str());
+}
+
+void PipelineCache::shutdown(VulkanContext& vk)
+{
+    if (!cache)
+        return;
+    if (!save(vk))
+        CFGC_LOGF("PipelineCache: could not write %s", file.c_str());
+    vkDestroyPipelineCache(vk.device(), cache, nullptr);
+    cache = VK_NULL_HANDLE;
+    loadedBytes = 0;
+}
+
+bool PipelineCache::save(VulkanContext& vk) const
+{
+    CFGC_ZONE("PipelineCache::save");
+    if (!cache || file.empty())
+        return false;
+
+    size_t size = 0;
+    if (vkGetPipelineCacheData(vk.device(), cache, &size, nullptr) != VK_SUCCESS || size == 0)
+        return false;
+    std::vector<uint8_t> data(size);
+    if (vkGetPipelineCacheData(vk.device(), cache, &size, data.data()) != VK_SUCCESS)
+        return false;
+    data.resize(size);
+
+    FileHeader h = expectedHeader();
+    h.dataSize = data.size();
+    h.checksum = checksum(data.data(), data.size());
+
+    // Written next to the target and renamed over it, so an interrupted write never leaves a half-written cache behind.
+    const std::string tmp = file + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        if (!f)
+            return false;
+        f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        f.write(reinterpret_cast<const char*>(data.data()), (std::streamsize)data.size());
+        if (!f)
+            return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, file, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
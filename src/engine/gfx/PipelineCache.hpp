@@ -0,0 +1,45 @@
+#pragma once
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+
+class VulkanContext;
+
+// VkPipelineCache persisted between runs. The file carries the vendor, device, driver version and cache UUID it was
+// written with plus a checksum of the blob; anything that does not match the current device starts an empty cache, so
+// a driver update or a different GPU costs one cold start rather than feeding the driver foreign data.
+class PipelineCache {
+   public:
+    void init(VulkanContext& vk, std::string path);
+    // Writes the cache back to disk before destroying it.
+    void shutdown(VulkanContext& vk);
+
+    VkPipelineCache handle() const { return cache; }
+    // Whether init() seeded the cache from a valid file.
+    bool warm() const { return loadedBytes != 0; }
+    size_t loadedSize() const { return loadedBytes; }
+
+    // Returns false if the file could not be written; the previous file is kept then.
+    bool save(VulkanContext& vk) const;
+
+   private:
+    struct FileHeader {
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        uint32_t vendorID = 0;
+        uint32_t deviceID = 0;
+        uint32_t driverVersion = 0;
+        uint8_t cacheUUID[VK_UUID_SIZE]{};
+        uint64_t dataSize = 0;
+        uint64_t checksum = 0;
+    };
+
+    static uint64_t checksum(const void* data, size_t size);
+    FileHeader expectedHeader() const;
+
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties props{};
+    std::string file;
+    size_t loadedBytes = 0;
+};
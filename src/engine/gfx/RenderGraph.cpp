@@ -1,5 +1,7 @@
 #include "engine/gfx/RenderGraph.hpp"
 
+#include "engine/core/Log.hpp"
+#include "engine/core/Trace.hpp"
 #include "engine/gfx/VulkanContext.hpp"
 #include "engine/gfx/VulkanHelpers.hpp"
 
@@ -91,13 +93,29 @@ VkCommandBuffer RenderGraph::begin(VulkanContext& vk)
     passes.clear();
     images.clear();
     buffers.clear();
-    retireImages.clear();
-    retireBuffers.clear();
+    schedule.clear();
+    lastCompileStats.culledPasses.clear();
+    compiled = false;
+    transientKeys.clear();
+    transientRefs.clear();
+    aliasIds.clear();
+    recordTasks.clear();
+    secondaries.clear();
+    batches.clear();
+    splitQueues = false;
 
     arena.reset();
     images = std::pmr::vector<ImageResource>(arena.resource());
     buffers = std::pmr::vector<BufferResource>(arena.resource());
     passes = std::pmr::vector<Pass>(arena.resource());
+    schedule = std::pmr::vector<uint32_t>(arena.resource());
+    lastCompileStats.culledPasses = std::pmr::vector<std::string_view>(arena.resource());
+    transientKeys = std::pmr::vector<TransientKey>(arena.resource());
+    transientRefs = std::pmr::vector<TransientRef>(arena.resource());
+    aliasIds = std::pmr::vector<uint32_t>(arena.resource());
+    recordTasks = std::pmr::vector<RecordTask>(arena.resource());
+    secondaries = std::pmr::vector<VkCommandBuffer>(arena.resource());
+    batches = std::pmr::vector<QueueBatch>(arena.resource());
 
     if (passes.capacity() < 16)
         passes.reserve(16);
@@ -110,7 +128,12 @@ VkCommandBuffer RenderGraph::begin(VulkanContext& vk)
     if (!cmdBuf)
         return VK_NULL_HANDLE;
 
+    if (!gpuProfiler.initialized())
+        gpuProfiler.init(vk);
+    gpuProfiler.beginFrame(vk, cmdBuf);
+
     backbufferHandle = importBackbuffer(vk);
+    backbufferFinalLayout = vk.presentLayout();
     depthHandle = importDepth(vk);
     return cmdBuf;
 }
@@ -149,6 +172,14 @@ void RenderGraph::addPass(std::string_view name, PassType type, SetupFn setup, E
     passes.push_back(std::move(p));
 }
 
+void RenderGraph::addParallelPass(std::string_view name, PassType type, SetupFn setup, uint32_t chunkCount, ChunkExecFn exec)
+{
+    addPass(name, type, std::move(setup), nullptr);
+    Pass& p = passes.back();
+    p.chunkExec = std::move(exec);
+    p.chunkCount = p.chunkExec ? chunkCount : 0;
+}
+
 static VkClearValue defaultColorClear()
 {
     VkClearValue c{};
@@ -194,10 +225,17 @@ void RenderGraph::stagesAccessForImageUse(ImageUse use,
             layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
             aspect = VK_IMAGE_ASPECT_COLOR_BIT;
             break;
+        case ImageUse::Storage:
+            stage = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+            access = write ? (VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT)
+                           : (VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+            layout = VK_IMAGE_LAYOUT_GENERAL;
+            aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+            break;
         case ImageUse::Present:
             stage = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT;
             access = 0;
-            layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+            layout = backbufferFinalLayout;
             aspect = VK_IMAGE_ASPECT_COLOR_BIT;
             break;
     }
@@ -229,28 +267,81 @@ void RenderGraph::stagesAccessForBufferUse(BufferUse use, bool write, VkPipeline
     }
 }
 
-void RenderGraph::applyBarriers(VulkanContext& vk, VkCommandBuffer cmd, const Pass& pass)
+// The stages a compute-only queue supports; barriers on it may not name graphics stages.
+static VkPipelineStageFlags2 asyncComputeStages(VkPipelineStageFlags2 stages)
+{
+    stages &= VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT |
+              VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT | VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT |
+              VK_PIPELINE_STAGE_2_HOST_BIT;
+    return stages ? stages : VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+}
+
+uint32_t RenderGraph::applyBarriers(VulkanContext& vk, VkCommandBuffer cmd, const Pass& pass)
 {
     scratchImgBarriers.clear();
     scratchBufBarriers.clear();
+    scratchImgBarrierIds.clear();
+    scratchBufBarrierIds.clear();
+    scratchImgBarrierSteps.clear();
+    scratchBufBarrierSteps.clear();
     if (scratchImgBarriers.capacity() < 32)
         scratchImgBarriers.reserve(32);
     if (scratchBufBarriers.capacity() < 32)
         scratchBufBarriers.reserve(32);
 
-    scratchDep = VkDependencyInfo{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
-
     for (const auto& ia : pass.images) {
         if (ia.id >= images.size())
             continue;
         auto& res = images[ia.id];
         VkImageLayout& curLayout = res.externalLayoutPtr ? *res.externalLayoutPtr : res.layout;
+        const uint32_t srcStep = res.aliasCount ? kUnused : res.lastStep;
+        res.lastStep = barrierStep;
+
+        // First use of a transient placed over earlier ones: the layout stays UNDEFINED, but their accesses must
+        // finish before this one takes over the memory.
+        if (res.aliasCount) {
+            res.lastStage = 0;
+            for (uint32_t i = 0; i < res.aliasCount; ++i) {
+                const auto& prev = images[aliasIds[res.aliasBegin + i]];
+                res.lastStage |= prev.lastStage;
+                res.lastAccess |= prev.lastAccess;
+            }
+            res.aliasCount = 0;
+        }
 
         VkPipelineStageFlags2 dstStage{};
         VkAccessFlags2 dstAccess{};
         VkImageLayout desiredLayout{};
         VkImageAspectFlags aspect{};
         stagesAccessForImageUse(ia.use, ia.write, dstStage, dstAccess, desiredLayout, aspect);
+        if (ia.use == ImageUse::Sampled && res.aspectMask)
+            aspect = res.aspectMask;
+        if (pass.onAsyncQueue)
+            dstStage = asyncComputeStages(dstStage);
+
+        // Moving to another queue family takes a release/acquire pair even between reads in the same layout.
+        const uint32_t family = splitQueues ? queueFamilies[pass.onAsyncQueue ? 1 : 0] : kUnused;
+        if (family != kUnused && res.queueFamily != kUnused && res.queueFamily != family) {
+            VkImageMemoryBarrier2 b = releaseImage(vk, res, desiredLayout, aspect, family);
+            b.dstStageMask = dstStage;
+            b.dstAccessMask = dstAccess;
+            scratchImgBarriers.push_back(b);
+            scratchImgBarrierIds.push_back(ia.id);
+            scratchImgBarrierSteps.push_back(srcStep);
+            ++lastQueueStats.ownershipTransfers;
+
+            curLayout = desiredLayout;
+            res.lastStage = dstStage;
+            res.lastAccess = dstAccess;
+            res.aspectMask = aspect;
+            res.queueFamily = family;
+            res.lastBatch = pass.batch;
+            continue;
+        }
+        if (family != kUnused) {
+            res.queueFamily = family;
+            res.lastBatch = pass.batch;
+        }
 
         VkImageLayout oldLayout = curLayout;
 
@@ -281,11 +372,13 @@ void RenderGraph::applyBarriers(VulkanContext& vk, VkCommandBuffer cmd, const Pa
         b.image = res.image;
         b.subresourceRange.aspectMask = aspect;
         b.subresourceRange.baseMipLevel = 0;
-        b.subresourceRange.levelCount = 1;
+        b.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
         b.subresourceRange.baseArrayLayer = 0;
         b.subresourceRange.layerCount = 1;
 
         scratchImgBarriers.push_back(b);
+        scratchImgBarrierIds.push_back(ia.id);
+        scratchImgBarrierSteps.push_back(srcStep);
 
         curLayout = desiredLayout;
         res.lastStage = dstStage;
@@ -297,10 +390,45 @@ void RenderGraph::applyBarriers(VulkanContext& vk, VkCommandBuffer cmd, const Pa
         if (ba.id >= buffers.size())
             continue;
         auto& res = buffers[ba.id];
+        const uint32_t srcStep = res.aliasCount ? kUnused : res.lastStep;
+        res.lastStep = barrierStep;
+
+        if (res.aliasCount) {
+            res.lastStage = 0;
+            for (uint32_t i = 0; i < res.aliasCount; ++i) {
+                const auto& prev = buffers[aliasIds[res.aliasBegin + i]];
+                res.lastStage |= prev.lastStage;
+                res.lastAccess |= prev.lastAccess;
+            }
+            res.aliasCount = 0;
+        }
 
         VkPipelineStageFlags2 dstStage{};
         VkAccessFlags2 dstAccess{};
         stagesAccessForBufferUse(ba.use, ba.write, dstStage, dstAccess);
+        if (pass.onAsyncQueue)
+            dstStage = asyncComputeStages(dstStage);
+
+        const uint32_t family = splitQueues ? queueFamilies[pass.onAsyncQueue ? 1 : 0] : kUnused;
+        if (family != kUnused && res.queueFamily != kUnused && res.queueFamily != family) {
+            VkBufferMemoryBarrier2 b = releaseBuffer(vk, res, family);
+            b.dstStageMask = dstStage;
+            b.dstAccessMask = dstAccess;
+            scratchBufBarriers.push_back(b);
+            scratchBufBarrierIds.push_back(ba.id);
+            scratchBufBarrierSteps.push_back(srcStep);
+            ++lastQueueStats.ownershipTransfers;
+
+            res.lastStage = dstStage;
+            res.lastAccess = dstAccess;
+            res.queueFamily = family;
+            res.lastBatch = pass.batch;
+            continue;
+        }
+        if (family != kUnused) {
+            res.queueFamily = family;
+            res.lastBatch = pass.batch;
+        }
 
         if (res.lastAccess == 0) {
             res.lastStage = dstStage;
@@ -328,14 +456,249 @@ void RenderGraph::applyBarriers(VulkanContext& vk, VkCommandBuffer cmd, const Pa
         b.size = VK_WHOLE_SIZE;
 
         scratchBufBarriers.push_back(b);
+        scratchBufBarrierIds.push_back(ba.id);
+        scratchBufBarrierSteps.push_back(srcStep);
 
         res.lastStage = dstStage;
         res.lastAccess = dstAccess;
     }
 
+    const uint32_t count = (uint32_t)(scratchImgBarriers.size() + scratchBufBarriers.size());
+    if (cmd)
+        recordBarriers(vk, cmd);
+    return count;
+}
+
+// The release half goes to the end of the batch that used the resource last, which the acquiring batch waits on.
+// Nothing on the releasing side reads the barrier's destination scopes, and an unknown prior access (an import's first
+// use, or uploads recorded before execute()) is treated as any write.
+VkImageMemoryBarrier2 RenderGraph::releaseImage(VulkanContext& vk,
+                                                const ImageResource& res,
+                                                VkImageLayout newLayout,
+                                                VkImageAspectFlags aspect,
+                                                uint32_t dstFamily)
+{
+    VkImageMemoryBarrier2 b{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+    b.srcStageMask = res.lastAccess ? res.lastStage : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    b.srcAccessMask = res.lastAccess ? res.lastAccess : VK_ACCESS_2_MEMORY_WRITE_BIT;
+    b.dstStageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT;
+    b.dstAccessMask = 0;
+    b.oldLayout = res.externalLayoutPtr ? *res.externalLayoutPtr : res.layout;
+    b.newLayout = newLayout;
+    b.srcQueueFamilyIndex = res.queueFamily;
+    b.dstQueueFamilyIndex = dstFamily;
+    b.image = res.image;
+    b.subresourceRange.aspectMask = aspect;
+    b.subresourceRange.baseMipLevel = 0;
+    b.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    b.subresourceRange.baseArrayLayer = 0;
+    b.subresourceRange.layerCount = 1;
+
+    VkDependencyInfo dep{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    dep.imageMemoryBarrierCount = 1;
+    dep.pImageMemoryBarriers = &b;
+    vk.cmdPipelineBarrier2(batches[res.lastBatch].cmd, dep);
+
+    b.srcStageMask = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT;
+    b.srcAccessMask = 0;
+    return b;
+}
+
+VkBufferMemoryBarrier2 RenderGraph::releaseBuffer(VulkanContext& vk, const BufferResource& res, uint32_t dstFamily)
+{
+    VkBufferMemoryBarrier2 b{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2 };
+    b.srcStageMask = res.lastAccess ? res.lastStage : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    b.srcAccessMask = res.lastAccess ? res.lastAccess : VK_ACCESS_2_MEMORY_WRITE_BIT;
+    b.dstStageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT;
+    b.dstAccessMask = 0;
+    b.srcQueueFamilyIndex = res.queueFamily;
+    b.dstQueueFamilyIndex = dstFamily;
+    b.buffer = res.buffer;
+    b.offset = 0;
+    b.size = VK_WHOLE_SIZE;
+
+    VkDependencyInfo dep{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    dep.bufferMemoryBarrierCount = 1;
+    dep.pBufferMemoryBarriers = &b;
+    vk.cmdPipelineBarrier2(batches[res.lastBatch].cmd, dep);
+
+    b.srcStageMask = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT;
+    b.srcAccessMask = 0;
+    return b;
+}
+
+// Runs the schedule's barriers against the resource state without recording anything and leaves the state where the
+// frame ends, so execute() can replay the plan and end() continues from the right layouts.
+void RenderGraph::buildBarrierPlan(VulkanContext& vk)
+{
+    for (auto& r : images)
+        r.lastStep = kUnused;
+    for (auto& r : buffers)
+        r.lastStep = kUnused;
+
+    for (size_t i = 0; i < schedule.size(); ++i) {
+        barrierStep = (uint32_t)i;
+        applyBarriers(vk, VK_NULL_HANDLE, passes[schedule[i]]);
+        for (size_t k = 0; k < scratchImgBarriers.size(); ++k)
+            plan.imageBarriers.push_back(
+                PlannedImageBarrier{ scratchImgBarrierIds[k], scratchImgBarrierSteps[k], scratchImgBarriers[k] });
+        for (size_t k = 0; k < scratchBufBarriers.size(); ++k)
+            plan.bufferBarriers.push_back(
+                PlannedBufferBarrier{ scratchBufBarrierIds[k], scratchBufBarrierSteps[k], scratchBufBarriers[k] });
+        plan.imageBegin.push_back((uint32_t)plan.imageBarriers.size());
+        plan.bufferBegin.push_back((uint32_t)plan.bufferBarriers.size());
+    }
+    barrierStep = kUnused;
+
+    plan.events.clear();
+    plan.eventsByProducer.clear();
+    plan.imageFull.clear();
+    plan.bufferFull.clear();
+    // Events cannot be set inside the legacy render pass, which spans consecutive graphics passes.
+    if (vk.splitBarriersEnabled() && vk.dynamicRenderingEnabled()) {
+        splitPlanBarriers();
+    } else {
+        plan.imageFull.assign(plan.imageBegin.begin(), plan.imageBegin.end() - 1);
+        plan.bufferFull.assign(plan.bufferBegin.begin(), plan.bufferBegin.end() - 1);
+    }
+
+    saveAccessState(plan.finalImages, plan.finalBuffers);
+    plan.hash = plan.pendingHash;
+}
+
+// A barrier whose producer ran right before the consumer gains nothing from an event, so only those with at least one
+// pass in between are split. Each step's split barriers are grouped by producer into one event each.
+void RenderGraph::splitPlanBarriers()
+{
+    for (uint32_t step = 0; step < (uint32_t)schedule.size(); ++step) {
+        auto producerOf = [step](uint32_t srcStep) { return srcStep != kUnused && srcStep + 1 < step ? srcStep : kUnused; };
+        auto byProducer = [&](const auto& a, const auto& b) { return producerOf(a.srcStep) < producerOf(b.srcStep); };
+
+        const uint32_t imageEnd = plan.imageBegin[step + 1];
+        const uint32_t bufferEnd = plan.bufferBegin[step + 1];
+        uint32_t img = plan.imageBegin[step];
+        uint32_t buf = plan.bufferBegin[step];
+        std::stable_sort(plan.imageBarriers.begin() + img, plan.imageBarriers.begin() + imageEnd, byProducer);
+        std::stable_sort(plan.bufferBarriers.begin() + buf, plan.bufferBarriers.begin() + bufferEnd, byProducer);
+
+        for (;;) {
+            const uint32_t imgProducer = img < imageEnd ? producerOf(plan.imageBarriers[img].srcStep) : kUnused;
+            const uint32_t bufProducer = buf < bufferEnd ? producerOf(plan.bufferBarriers[buf].srcStep) : kUnused;
+            const uint32_t producer = std::min(imgProducer, bufProducer);
+            if (producer == kUnused)
+                break;
+
+            SplitEvent e{ producer, step, img, 0, buf, 0 };
+            for (; img < imageEnd && producerOf(plan.imageBarriers[img].srcStep) == producer; ++img)
+                ++e.imageCount;
+            for (; buf < bufferEnd && producerOf(plan.bufferBarriers[buf].srcStep) == producer; ++buf)
+                ++e.bufferCount;
+            plan.events.push_back(e);
+        }
+        plan.imageFull.push_back(img);
+        plan.bufferFull.push_back(buf);
+    }
+
+    plan.eventsByProducer.resize(plan.events.size());
+    for (uint32_t i = 0; i < (uint32_t)plan.events.size(); ++i)
+        plan.eventsByProducer[i] = i;
+    std::stable_sort(plan.eventsByProducer.begin(), plan.eventsByProducer.end(),
+                     [this](uint32_t a, uint32_t b) { return plan.events[a].producer < plan.events[b].producer; });
+}
+
+// Appends the event's barriers, patched with this frame's handles, to the scratch arrays. The set and the wait build
+// their dependency info through here, as the two have to match exactly.
+VkDependencyInfo RenderGraph::splitDependency(uint32_t event)
+{
+    const SplitEvent& e = plan.events[event];
+    const size_t imageFirst = scratchImgBarriers.size();
+    const size_t bufferFirst = scratchBufBarriers.size();
+    for (uint32_t k = e.imageFirst; k < e.imageFirst + e.imageCount; ++k) {
+        VkImageMemoryBarrier2 b = plan.imageBarriers[k].barrier;
+        b.image = images[plan.imageBarriers[k].id].image;
+        scratchImgBarriers.push_back(b);
+    }
+    for (uint32_t k = e.bufferFirst; k < e.bufferFirst + e.bufferCount; ++k) {
+        VkBufferMemoryBarrier2 b = plan.bufferBarriers[k].barrier;
+        b.buffer = buffers[plan.bufferBarriers[k].id].buffer;
+        scratchBufBarriers.push_back(b);
+    }
+
+    VkDependencyInfo dep{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    dep.imageMemoryBarrierCount = e.imageCount;
+    dep.pImageMemoryBarriers = e.imageCount ? scratchImgBarriers.data() + imageFirst : nullptr;
+    dep.bufferMemoryBarrierCount = e.bufferCount;
+    dep.pBufferMemoryBarriers = e.bufferCount ? scratchBufBarriers.data() + bufferFirst : nullptr;
+    return dep;
+}
+
+void RenderGraph::replayBarriers(VulkanContext& vk, VkCommandBuffer cmd, uint32_t step)
+{
+    // Reserved up front so the dependency infos can point into the arrays while they fill.
+    scratchImgBarriers.clear();
+    scratchBufBarriers.clear();
+    scratchImgBarriers.reserve(plan.imageBegin[step + 1] - plan.imageBegin[step]);
+    scratchBufBarriers.reserve(plan.bufferBegin[step + 1] - plan.bufferBegin[step]);
+    scratchDeps.clear();
+    scratchEvents.clear();
+
+    const EventPool& pool = eventPools[vk.currentFrameIndex()];
+    for (; nextWaitEvent < plan.events.size() && plan.events[nextWaitEvent].consumer == step; ++nextWaitEvent) {
+        scratchDeps.push_back(splitDependency(nextWaitEvent));
+        scratchEvents.push_back(pool.events[nextWaitEvent]);
+    }
+    const size_t splitImages = scratchImgBarriers.size();
+    const size_t splitBuffers = scratchBufBarriers.size();
+    if (!scratchEvents.empty()) {
+        vk.cmdWaitEvents2(cmd, (uint32_t)scratchEvents.size(), scratchEvents.data(), scratchDeps.data());
+        lastBarrierStats.split += (uint32_t)(splitImages + splitBuffers);
+        lastBarrierStats.events += (uint32_t)scratchEvents.size();
+    }
+
+    for (uint32_t k = plan.imageFull[step]; k < plan.imageBegin[step + 1]; ++k) {
+        VkImageMemoryBarrier2 b = plan.imageBarriers[k].barrier;
+        b.image = images[plan.imageBarriers[k].id].image;
+        scratchImgBarriers.push_back(b);
+    }
+    for (uint32_t k = plan.bufferFull[step]; k < plan.bufferBegin[step + 1]; ++k) {
+        VkBufferMemoryBarrier2 b = plan.bufferBarriers[k].barrier;
+        b.buffer = buffers[plan.bufferBarriers[k].id].buffer;
+        scratchBufBarriers.push_back(b);
+    }
+    const uint32_t fullImages = (uint32_t)(scratchImgBarriers.size() - splitImages);
+    const uint32_t fullBuffers = (uint32_t)(scratchBufBarriers.size() - splitBuffers);
+    if (fullImages + fullBuffers == 0)
+        return;
+
+    scratchDep = VkDependencyInfo{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    scratchDep.imageMemoryBarrierCount = fullImages;
+    scratchDep.pImageMemoryBarriers = scratchImgBarriers.data() + splitImages;
+    scratchDep.bufferMemoryBarrierCount = fullBuffers;
+    scratchDep.pBufferMemoryBarriers = scratchBufBarriers.data() + splitBuffers;
+    vk.cmdPipelineBarrier2(cmd, scratchDep);
+    lastBarrierStats.full += fullImages + fullBuffers;
+}
+
+void RenderGraph::setSplitEvents(VulkanContext& vk, VkCommandBuffer cmd, uint32_t step)
+{
+    const EventPool& pool = eventPools[vk.currentFrameIndex()];
+    for (; nextSetEvent < plan.eventsByProducer.size(); ++nextSetEvent) {
+        const uint32_t event = plan.eventsByProducer[nextSetEvent];
+        if (plan.events[event].producer != step)
+            break;
+        scratchImgBarriers.clear();
+        scratchBufBarriers.clear();
+        const VkDependencyInfo dep = splitDependency(event);
+        vk.cmdSetEvent2(cmd, pool.events[event], dep);
+    }
+}
+
+void RenderGraph::recordBarriers(VulkanContext& vk, VkCommandBuffer cmd)
+{
     if (scratchImgBarriers.empty() && scratchBufBarriers.empty())
         return;
 
+    scratchDep = VkDependencyInfo{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
     scratchDep.imageMemoryBarrierCount = (uint32_t)scratchImgBarriers.size();
     scratchDep.pImageMemoryBarriers = scratchImgBarriers.data();
     scratchDep.bufferMemoryBarrierCount = (uint32_t)scratchBufBarriers.size();
@@ -344,20 +707,638 @@ void RenderGraph::applyBarriers(VulkanContext& vk, VkCommandBuffer cmd, const Pa
     vk.cmdPipelineBarrier2(cmd, scratchDep);
 }
 
+void RenderGraph::saveAccessState(std::vector<AccessState>& imageStates, std::vector<AccessState>& bufferStates) const
+{
+    imageStates.clear();
+    bufferStates.clear();
+    for (const auto& r : images) {
+        const VkImageLayout layout = r.externalLayoutPtr ? *r.externalLayoutPtr : r.layout;
+        imageStates.push_back(AccessState{ layout, r.lastStage, r.lastAccess, r.aspectMask });
+    }
+    for (const auto& r : buffers)
+        bufferStates.push_back(AccessState{ VK_IMAGE_LAYOUT_UNDEFINED, r.lastStage, r.lastAccess, 0 });
+}
+
+void RenderGraph::restoreAccessState(const std::vector<AccessState>& imageStates, const std::vector<AccessState>& bufferStates)
+{
+    for (size_t i = 0; i < images.size() && i < imageStates.size(); ++i) {
+        auto& r = images[i];
+        (r.externalLayoutPtr ? *r.externalLayoutPtr : r.layout) = imageStates[i].layout;
+        r.lastStage = imageStates[i].stage;
+        r.lastAccess = imageStates[i].access;
+        r.aspectMask = imageStates[i].aspect;
+    }
+    for (size_t i = 0; i < buffers.size() && i < bufferStates.size(); ++i) {
+        buffers[i].lastStage = bufferStates[i].stage;
+        buffers[i].lastAccess = bufferStates[i].access;
+    }
+}
+
+enum : uint8_t {
+    kHazardNone = 0,
+    // The later pass only overwrites what the earlier one reads.
+    kHazardOrder = 1,
+    // The later pass accesses something the earlier one writes.
+    kHazardData = 2,
+};
+
+template <typename PassT>
+static uint8_t hazardBetween(const PassT& earlier, const PassT& later)
+{
+    uint8_t h = kHazardNone;
+    for (const auto& a : earlier.images) {
+        for (const auto& b : later.images) {
+            if (a.id != b.id)
+                continue;
+            if (a.write)
+                return kHazardData;
+            if (b.write)
+                h = kHazardOrder;
+        }
+    }
+    for (const auto& a : earlier.buffers) {
+        for (const auto& b : later.buffers) {
+            if (a.id != b.id)
+                continue;
+            if (a.write)
+                return kHazardData;
+            if (b.write)
+                h = kHazardOrder;
+        }
+    }
+    return h;
+}
+
+static uint64_t hashBytes(uint64_t h, const void* data, size_t size)
+{
+    const auto* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+template <typename T>
+static uint64_t hashValue(uint64_t h, const T& v)
+{
+    return hashBytes(h, &v, sizeof(v));
+}
+
+uint64_t RenderGraph::topologyHash(VulkanContext& vk) const
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    h = hashValue(h, vk.dynamicRenderingEnabled());
+
+    // Starting state is part of the key: a swapchain image seen for the first time needs different barriers.
+    for (const auto& r : images) {
+        h = hashValue(h, r.format);
+        h = hashValue(h, r.aspectMask);
+        h = hashValue(h, r.externalLayoutPtr ? *r.externalLayoutPtr : r.layout);
+        h = hashValue(h, r.lastStage);
+        h = hashValue(h, r.lastAccess);
+        h = hashValue(h, r.transient);
+        if (r.transient) {
+            h = hashValue(h, r.extent.width);
+            h = hashValue(h, r.extent.height);
+            h = hashValue(h, r.usage);
+        }
+    }
+    for (const auto& r : buffers) {
+        h = hashValue(h, r.lastStage);
+        h = hashValue(h, r.lastAccess);
+        h = hashValue(h, r.transient);
+        if (r.transient) {
+            h = hashValue(h, r.size);
+            h = hashValue(h, r.usage);
+            h = hashValue(h, r.memFlags);
+        }
+    }
+
+    for (const Pass& p : passes) {
+        h = hashBytes(h, p.name.data(), p.name.size());
+        h = hashValue(h, p.type);
+        h = hashValue(h, (uint32_t)p.images.size());
+        for (const auto& a : p.images) {
+            h = hashValue(h, a.id);
+            h = hashValue(h, a.use);
+            h = hashValue(h, a.write);
+        }
+        h = hashValue(h, (uint32_t)p.buffers.size());
+        for (const auto& a : p.buffers) {
+            h = hashValue(h, a.id);
+            h = hashValue(h, a.use);
+            h = hashValue(h, a.write);
+        }
+    }
+    return h;
+}
+
+void RenderGraph::compile(VulkanContext& vk)
+{
+    if (compiled)
+        return;
+    compiled = true;
+    CFGC_ZONE("RenderGraph::compile");
+
+    CompileStats& st = lastCompileStats;
+    st.culledPasses.clear();
+
+    // Same topology and starting state as the frame the plan was recorded in: take its schedule and replay its barriers.
+    const uint64_t hash = topologyHash(vk);
+    replayPlan = plan.hash == hash;
+    if (replayPlan) {
+        schedule.assign(plan.schedule.begin(), plan.schedule.end());
+        st.passes = (uint32_t)passes.size();
+        st.culled = (uint32_t)plan.culled.size();
+        for (uint32_t i : plan.culled)
+            st.culledPasses.push_back(passes[i].name);
+        st.barriersDeclared = plan.barriersDeclared;
+        st.barriersCompiled = plan.barriersCompiled;
+        st.stallsDeclared = plan.stallsDeclared;
+        st.stallsCompiled = plan.stallsCompiled;
+        st.planReused = true;
+        return;
+    }
+
+    const uint32_t n = (uint32_t)passes.size();
+    std::pmr::vector<uint8_t> hazards(size_t(n) * n, kHazardNone, arena.resource());
+    for (uint32_t j = 0; j < n; ++j) {
+        for (uint32_t i = 0; i < j; ++i)
+            hazards[size_t(i) * n + j] = hazardBetween(passes[i], passes[j]);
+    }
+
+    // Walk backwards from the passes with effects outside the graph; anything a live pass consumes stays live too.
+    std::pmr::vector<uint8_t> live(n, 0, arena.resource());
+    for (uint32_t i = n; i-- > 0;) {
+        const Pass& p = passes[i];
+        bool writes = false;
+        bool exported = false;
+        for (const auto& ia : p.images) {
+            writes = writes || ia.write;
+            exported = exported || (ia.write && ia.id < images.size() && !images[ia.id].transient);
+        }
+        for (const auto& ba : p.buffers) {
+            writes = writes || ba.write;
+            exported = exported || (ba.write && ba.id < buffers.size() && !buffers[ba.id].transient);
+        }
+        live[i] = !writes || exported;
+        for (uint32_t j = i + 1; j < n && !live[i]; ++j)
+            live[i] = live[j] && hazards[size_t(i) * n + j] == kHazardData;
+    }
+
+    st.passes = n;
+    st.culled = 0;
+    st.planReused = false;
+    plan.culled.clear();
+
+    std::pmr::vector<uint32_t> declared(arena.resource());
+    for (uint32_t i = 0; i < n; ++i) {
+        if (live[i]) {
+            declared.push_back(i);
+        } else {
+            ++st.culled;
+            st.culledPasses.push_back(passes[i].name);
+            plan.culled.push_back(i);
+        }
+    }
+
+    // The legacy path folds consecutive graphics passes into one render pass, so it keeps the declared order.
+    schedule.clear();
+    if (!vk.dynamicRenderingEnabled()) {
+        schedule.assign(declared.begin(), declared.end());
+    } else {
+        // List scheduling: of the passes whose dependencies have all run, take the one furthest from its most recent
+        // dependency, preferring the earliest declared on ties.
+        std::pmr::vector<uint32_t> position(n, kUnused, arena.resource());
+        for (uint32_t step = 0; step < (uint32_t)declared.size(); ++step) {
+            uint32_t best = kUnused;
+            uint32_t bestDistance = 0;
+            for (uint32_t j : declared) {
+                if (position[j] != kUnused)
+                    continue;
+                bool ready = true;
+                uint32_t distance = kUnused;
+                for (uint32_t i = 0; i < j && ready; ++i) {
+                    if (!live[i] || hazards[size_t(i) * n + j] == kHazardNone)
+                        continue;
+                    if (position[i] == kUnused)
+                        ready = false;
+                    else
+                        distance = std::min(distance, step - position[i]);
+                }
+                if (ready && (best == kUnused || distance > bestDistance)) {
+                    best = j;
+                    bestDistance = distance;
+                }
+            }
+            position[best] = step;
+            schedule.push_back(best);
+        }
+    }
+
+    auto countStalls = [&](const std::pmr::vector<uint32_t>& order) {
+        uint32_t stalls = 0;
+        for (size_t k = 1; k < order.size(); ++k) {
+            const uint32_t a = std::min(order[k - 1], order[k]);
+            const uint32_t b = std::max(order[k - 1], order[k]);
+            stalls += hazards[size_t(a) * n + b] != kHazardNone ? 1u : 0u;
+        }
+        return stalls;
+    };
+    st.barriersDeclared = countBarriers(vk, declared);
+    st.barriersCompiled = countBarriers(vk, schedule);
+    st.stallsDeclared = countStalls(declared);
+    st.stallsCompiled = countStalls(schedule);
+
+    // execute() fills in the barriers as it records them and only then marks the plan valid.
+    plan.hash = 0;
+    plan.pendingHash = hash;
+    plan.schedule.assign(schedule.begin(), schedule.end());
+    plan.barriersDeclared = st.barriersDeclared;
+    plan.barriersCompiled = st.barriersCompiled;
+    plan.stallsDeclared = st.stallsDeclared;
+    plan.stallsCompiled = st.stallsCompiled;
+    plan.imageBegin.assign(1, 0);
+    plan.bufferBegin.assign(1, 0);
+    plan.imageBarriers.clear();
+    plan.bufferBarriers.clear();
+
+#if defined(CFGC_DIAGNOSTICS)
+    const LoggedCompile shape{ st.passes, st.culled, st.barriersCompiled, st.stallsCompiled };
+    if (shape != lastLoggedCompile) {
+        CFGC_LOGF("RenderGraph: %u passes, %u culled; barriers %u -> %u, stalls %u -> %u after reordering", st.passes, st.culled,
+                  st.barriersDeclared, st.barriersCompiled, st.stallsDeclared, st.stallsCompiled);
+        for (std::string_view name : st.culledPasses)
+            CFGC_LOGF("RenderGraph:   culled '%.*s'", (int)name.size(), name.data());
+        lastLoggedCompile = shape;
+    }
+#endif
+}
+
+uint32_t RenderGraph::countBarriers(VulkanContext& vk, const std::pmr::vector<uint32_t>& order)
+{
+    saveAccessState(scratchImageStates, scratchBufferStates);
+    uint32_t count = 0;
+    for (uint32_t pi : order)
+        count += applyBarriers(vk, VK_NULL_HANDLE, passes[pi]);
+    restoreAccessState(scratchImageStates, scratchBufferStates);
+    return count;
+}
+
+void RenderGraph::recordParallelPasses(VulkanContext& vk)
+{
+    CFGC_ZONE("RenderGraph::recordParallelPasses");
+    for (uint32_t pi : schedule) {
+        Pass& p = passes[pi];
+        if (p.chunkCount == 0 || p.onAsyncQueue)
+            continue;
+        p.firstSecondary = (uint32_t)recordTasks.size();
+        for (uint32_t c = 0; c < p.chunkCount; ++c)
+            recordTasks.push_back(RecordTask{ pi, c });
+    }
+    if (recordTasks.empty())
+        return;
+
+    const VkDevice dev = vk.device();
+    const uint32_t slot = vk.currentFrameIndex();
+    if (recordPools.size() <= slot)
+        recordPools.resize(slot + 1);
+    std::vector<RecordPool>& pools = recordPools[slot];
+    const uint32_t workerCount = jobs ? jobs->workerCount() : 1u;
+    if (pools.size() < workerCount)
+        pools.resize(workerCount);
+
+    // beginFrame() waited for this slot's previous submission, so its pools can be reset wholesale.
+    for (auto& rp : pools) {
+        if (!rp.pool) {
+            VkCommandPoolCreateInfo pci{ VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+            pci.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            pci.queueFamilyIndex = vk.graphicsFamilyIndex();
+            vkCheck(vkCreateCommandPool(dev, &pci, nullptr, &rp.pool), "vkCreateCommandPool");
+        } else if (rp.used > 0) {
+            vkCheck(vkResetCommandPool(dev, rp.pool, 0), "vkResetCommandPool");
+        }
+        rp.used = 0;
+    }
+
+    secondaries.assign(recordTasks.size(), VK_NULL_HANDLE);
+    const VkExtent2D extent = vk.swapchainExtent();
+
+    auto record = [&](uint32_t task, uint32_t worker) {
+        CFGC_ZONE("Record pass chunk");
+        const RecordTask t = recordTasks[task];
+        const Pass& p = passes[t.pass];
+        RecordPool& rp = pools[worker];
+
+        if (rp.used == rp.buffers.size()) {
+            VkCommandBufferAllocateInfo ai{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+            ai.commandPool = rp.pool;
+            ai.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            ai.commandBufferCount = 1;
+            VkCommandBuffer cb = VK_NULL_HANDLE;
+            vkCheck(vkAllocateCommandBuffers(dev, &ai, &cb), "vkAllocateCommandBuffers");
+            rp.buffers.push_back(cb);
+        }
+        VkCommandBuffer cmd = rp.buffers[rp.used++];
+
+        VkFormat colorFormats[8]{};
+        VkCommandBufferInheritanceRenderingInfoKHR rendering{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR };
+        VkCommandBufferInheritanceInfo inheritance{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+        VkCommandBufferBeginInfo bi{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+        bi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        bi.pInheritanceInfo = &inheritance;
+
+        const bool graphics = p.type == PassType::Graphics;
+        if (graphics) {
+            const uint32_t colorCount = std::min((uint32_t)p.colorAttachments.size(), 8u);
+            for (uint32_t ci = 0; ci < colorCount; ++ci)
+                colorFormats[ci] = images[p.colorAttachments[ci]].format;
+            rendering.colorAttachmentCount = colorCount;
+            rendering.pColorAttachmentFormats = colorFormats;
+            rendering.depthAttachmentFormat = p.hasDepth ? images[p.depthAttachment].format : VK_FORMAT_UNDEFINED;
+            rendering.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+            inheritance.pNext = &rendering;
+            bi.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        }
+        if (gpuProfiler.statisticsThisFrame() && vk.inheritedQueriesEnabled())
+            inheritance.pipelineStatistics = gpuProfiler.statisticFlags();
+        vkCheck(vkBeginCommandBuffer(cmd, &bi), "vkBeginCommandBuffer");
+
+        // Dynamic state is not inherited from the primary.
+        if (graphics) {
+            VkViewport vp{ 0.0f, 0.0f, (float)extent.width, (float)extent.height, 0.0f, 1.0f };
+            VkRect2D sc{ { 0, 0 }, extent };
+            vkCmdSetViewport(cmd, 0, 1, &vp);
+            vkCmdSetScissor(cmd, 0, 1, &sc);
+        }
+
+        p.chunkExec(cmd, t.chunk);
+        vkCheck(vkEndCommandBuffer(cmd), "vkEndCommandBuffer");
+        secondaries[p.firstSecondary + t.chunk] = cmd;
+    };
+
+    const uint32_t taskCount = (uint32_t)recordTasks.size();
+    if (!jobs) {
+        for (uint32_t task = 0; task < taskCount; ++task)
+            record(task, 0);
+        return;
+    }
+    // One chunk per job: chunks are already sized to be worth a secondary command buffer each.
+    jobs->parallelFor(taskCount, 1, [&](uint32_t begin, uint32_t end, uint32_t worker) {
+        for (uint32_t task = begin; task < end; ++task)
+            record(task, worker);
+    });
+}
+
+void RenderGraph::recordPassCommands(const Pass& pass, VkCommandBuffer cmd)
+{
+    if (pass.firstSecondary != kUnused) {
+        vkCmdExecuteCommands(cmd, pass.chunkCount, secondaries.data() + pass.firstSecondary);
+        return;
+    }
+    if (pass.exec)
+        pass.exec(cmd);
+    for (uint32_t c = 0; c < pass.chunkCount; ++c)
+        pass.chunkExec(cmd, c);
+}
+
+template <typename PassT>
+static bool sharesResource(const PassT& a, const PassT& b)
+{
+    for (const auto& x : a.images) {
+        for (const auto& y : b.images) {
+            if (x.id == y.id)
+                return true;
+        }
+    }
+    for (const auto& x : a.buffers) {
+        for (const auto& y : b.buffers) {
+            if (x.id == y.id)
+                return true;
+        }
+    }
+    return false;
+}
+
+bool RenderGraph::splitQueueBatches(VulkanContext& vk)
+{
+    lastQueueStats = {};
+    const bool canSplit = asyncComputeEnabled && vk.hasAsyncCompute() && vk.dynamicRenderingEnabled();
+    for (uint32_t pi : schedule) {
+        Pass& p = passes[pi];
+        p.onAsyncQueue = canSplit && p.async && p.type == PassType::Compute;
+        // A transient's memory may be handed to another transient behind the graph's back, so it stays on one queue.
+        for (const auto& ia : p.images)
+            p.onAsyncQueue = p.onAsyncQueue && !images[ia.id].transient;
+        for (const auto& ba : p.buffers)
+            p.onAsyncQueue = p.onAsyncQueue && !buffers[ba.id].transient;
+        lastQueueStats.asyncPasses += p.onAsyncQueue;
+    }
+    if (lastQueueStats.asyncPasses == 0)
+        return false;
+
+    queueFamilies[0] = vk.graphicsFamilyIndex();
+    queueFamilies[1] = vk.asyncComputeFamilyIndex();
+
+    // Batch 0 is the frame's command buffer, and async work waits for what was recorded into it before execute().
+    // A pass that depends on work of the other queue closes the batch holding it, so that batch can signal, and
+    // opens a new batch waiting on it. Every queue waits on a given batch at most once.
+    batches.push_back(QueueBatch{ cmdBuf, false });
+    uint32_t open[2] = { 0, kUnused };
+    uint32_t waited[2] = { kUnused, kUnused };
+    for (size_t i = 0; i < schedule.size(); ++i) {
+        Pass& p = passes[schedule[i]];
+        const uint32_t q = p.onAsyncQueue ? 1 : 0;
+
+        uint32_t need = q == 1 ? 0 : kUnused;
+        for (size_t j = 0; j < i; ++j) {
+            const Pass& d = passes[schedule[j]];
+            if (d.onAsyncQueue == p.onAsyncQueue || (need != kUnused && d.batch <= need))
+                continue;
+            if (hazardBetween(d, p) != kHazardNone || sharesResource(d, p))
+                need = d.batch;
+        }
+
+        uint32_t waitBatch = kUnused;
+        if (need != kUnused && (waited[q] == kUnused || need > waited[q])) {
+            if (open[1 - q] == need)
+                open[1 - q] = kUnused;
+            open[q] = kUnused;
+            waited[q] = need;
+            waitBatch = need;
+        }
+        if (open[q] == kUnused) {
+            open[q] = (uint32_t)batches.size();
+            batches.push_back(QueueBatch{ VK_NULL_HANDLE, q == 1, waitBatch });
+        }
+        p.batch = open[q];
+    }
+
+    // The last graphics batch retires the frame and hands resources back to graphics, so it waits on all compute work.
+    uint32_t lastCompute = 0;
+    for (uint32_t b = 0; b < batches.size(); ++b) {
+        if (batches[b].compute)
+            lastCompute = b;
+    }
+    if (waited[0] == kUnused || waited[0] < lastCompute)
+        batches.push_back(QueueBatch{ VK_NULL_HANDLE, false, lastCompute });
+    for (uint32_t b = 0; b < batches.size(); ++b) {
+        if (!batches[b].compute)
+            lastGraphicsBatch = b;
+    }
+
+    // beginFrame() waited for this slot's previous submission, so its pools and semaphores are free again.
+    const VkDevice dev = vk.device();
+    const uint32_t slot = vk.currentFrameIndex();
+    if (queueFrames.size() <= slot)
+        queueFrames.resize(slot + 1);
+    QueueFrame& qf = queueFrames[slot];
+    for (uint32_t q = 0; q < 2; ++q) {
+        VkCommandPool& pool = q == 0 ? qf.graphicsPool : qf.computePool;
+        uint32_t& used = q == 0 ? qf.graphicsUsed : qf.computeUsed;
+        if (!pool) {
+            VkCommandPoolCreateInfo pci{ VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+            pci.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            pci.queueFamilyIndex = queueFamilies[q];
+            vkCheck(vkCreateCommandPool(dev, &pci, nullptr, &pool), "vkCreateCommandPool");
+        } else if (used > 0) {
+            vkCheck(vkResetCommandPool(dev, pool, 0), "vkResetCommandPool");
+        }
+        used = 0;
+    }
+    qf.semaphoresUsed = 0;
+
+    for (uint32_t b = 1; b < batches.size(); ++b) {
+        QueueBatch& batch = batches[b];
+        VkCommandPool pool = batch.compute ? qf.computePool : qf.graphicsPool;
+        std::vector<VkCommandBuffer>& cmds = batch.compute ? qf.computeCmds : qf.graphicsCmds;
+        uint32_t& used = batch.compute ? qf.computeUsed : qf.graphicsUsed;
+        if (used == cmds.size()) {
+            VkCommandBufferAllocateInfo ai{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+            ai.commandPool = pool;
+            ai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            ai.commandBufferCount = 1;
+            VkCommandBuffer cb = VK_NULL_HANDLE;
+            vkCheck(vkAllocateCommandBuffers(dev, &ai, &cb), "vkAllocateCommandBuffers");
+            cmds.push_back(cb);
+        }
+        batch.cmd = cmds[used++];
+        VkCommandBufferBeginInfo bi{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+        bi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkCheck(vkBeginCommandBuffer(batch.cmd, &bi), "vkBeginCommandBuffer");
+
+        if (batch.waitBatch == kUnused)
+            continue;
+        if (qf.semaphoresUsed == qf.semaphores.size()) {
+            VkSemaphoreCreateInfo sci{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+            VkSemaphore sem = VK_NULL_HANDLE;
+            vkCheck(vkCreateSemaphore(dev, &sci, nullptr, &sem), "vkCreateSemaphore");
+            qf.semaphores.push_back(sem);
+        }
+        VkSemaphore sem = qf.semaphores[qf.semaphoresUsed++];
+        batches[batch.waitBatch].signal = sem;
+        batch.waitSemaphore = sem;
+        batch.waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    }
+
+    lastQueueStats.batches = (uint32_t)batches.size();
+    lastQueueStats.semaphores = qf.semaphoresUsed;
+
+    // Between frames everything the graph imports belongs to the graphics family.
+    for (auto& r : images)
+        r.queueFamily = r.transient ? kUnused : queueFamilies[0];
+    for (auto& r : buffers)
+        r.queueFamily = r.transient ? kUnused : queueFamilies[0];
+    return true;
+}
+
+void RenderGraph::submitQueueBatches(VulkanContext& vk)
+{
+    // Hand back what the compute queue still owns, in the layouts it was left in.
+    const VkCommandBuffer last = batches[lastGraphicsBatch].cmd;
+    scratchImgBarriers.clear();
+    scratchBufBarriers.clear();
+    for (auto& res : images) {
+        if (res.queueFamily != queueFamilies[1])
+            continue;
+        const VkImageLayout layout = res.externalLayoutPtr ? *res.externalLayoutPtr : res.layout;
+        VkImageMemoryBarrier2 b = releaseImage(vk, res, layout, res.aspectMask, queueFamilies[0]);
+        b.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        b.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+        scratchImgBarriers.push_back(b);
+        res.queueFamily = queueFamilies[0];
+    }
+    for (auto& res : buffers) {
+        if (res.queueFamily != queueFamilies[1])
+            continue;
+        VkBufferMemoryBarrier2 b = releaseBuffer(vk, res, queueFamilies[0]);
+        b.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        b.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+        scratchBufBarriers.push_back(b);
+        res.queueFamily = queueFamilies[0];
+    }
+    lastQueueStats.ownershipTransfers += (uint32_t)(scratchImgBarriers.size() + scratchBufBarriers.size());
+    recordBarriers(vk, last);
+
+    std::pmr::vector<VulkanContext::QueueBatch> submits(arena.resource());
+    submits.reserve(batches.size());
+    for (uint32_t b = 0; b < batches.size(); ++b) {
+        const QueueBatch& batch = batches[b];
+        if (b > 0)
+            vkCheck(vkEndCommandBuffer(batch.cmd), "vkEndCommandBuffer");
+        VulkanContext::QueueBatch s{};
+        s.cmd = batch.cmd;
+        s.compute = batch.compute;
+        s.waitCount = batch.waitSemaphore ? 1u : 0u;
+        s.waitSemaphores = &batch.waitSemaphore;
+        s.waitStages = &batch.waitStage;
+        s.signal = batch.signal;
+        submits.push_back(s);
+    }
+    vk.endFrame(submits);
+}
+
 void RenderGraph::execute(VulkanContext& vk)
 {
     if (!cmdBuf)
         return;
+    CFGC_ZONE("RenderGraph::execute");
+
+    compile(vk);
+    allocateTransients(vk);
 
     const bool dyn = vk.dynamicRenderingEnabled();
+    splitQueues = splitQueueBatches(vk);
+    if (dyn)
+        recordParallelPasses(vk);
+
+    // A plan knows nothing about queue ownership, so frames split across queues record their barriers as they go.
+    // Otherwise the plan is built first, leaving every resource where the frame leaves it, so split barriers know
+    // their consumers before the producers are recorded.
+    lastBarrierStats = {};
+    if (!splitQueues) {
+        if (replayPlan)
+            restoreAccessState(plan.finalImages, plan.finalBuffers);
+        else
+            buildBarrierPlan(vk);
+        prepareSplitEvents(vk);
+    }
 
     bool legacyRenderPassOpen = false;
-    for (size_t i = 0; i < passes.size(); ++i) {
-        const Pass& p = passes[i];
+    for (size_t i = 0; i < schedule.size(); ++i) {
+        const Pass& p = passes[schedule[i]];
+        const VkCommandBuffer cmd = splitQueues ? batches[p.batch].cmd : cmdBuf;
 
-        vk.cmdBeginLabel(cmdBuf, p.name.c_str());
+        vk.cmdBeginLabel(cmd, p.name.c_str());
+        // Statistics scopes may not straddle the legacy render pass, and need inherited queries around secondaries.
+        const bool statistics = dyn && !p.onAsyncQueue && (p.firstSecondary == kUnused || vk.inheritedQueriesEnabled());
+        const uint32_t scope = gpuProfiler.beginScope(cmd, p.name, !p.onAsyncQueue, statistics);
 
-        applyBarriers(vk, cmdBuf, p);
+        if (splitQueues)
+            lastBarrierStats.full += applyBarriers(vk, cmd, p);
+        else
+            replayBarriers(vk, cmd, (uint32_t)i);
 
         if (p.type == PassType::Graphics) {
             if (dyn) {
@@ -404,32 +1385,57 @@ void RenderGraph::execute(VulkanContext& vk)
                 ri.pColorAttachments = scratchColorAtts.empty() ? nullptr : scratchColorAtts.data();
                 ri.pDepthAttachment = depthPtr;
 
-                vk.beginRendering(cmdBuf, ri);
-                if (p.exec)
-                    p.exec(cmdBuf);
-                vk.endRendering(cmdBuf);
-                vk.cmdEndLabel(cmdBuf);
+                if (p.firstSecondary != kUnused)
+                    ri.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR;
+
+                vk.beginRendering(cmd, ri);
+                recordPassCommands(p, cmd);
+                vk.endRendering(cmd);
             } else {
                 if (!legacyRenderPassOpen) {
-                    vk.beginMainPass(cmdBuf);
+                    vk.beginMainPass(cmd);
                     legacyRenderPassOpen = true;
                 }
-                if (p.exec)
-                    p.exec(cmdBuf);
+                recordPassCommands(p, cmd);
 
-                const bool nextIsGraphics = (i + 1 < passes.size()) && (passes[i + 1].type == PassType::Graphics);
+                const bool nextIsGraphics = (i + 1 < schedule.size()) && (passes[schedule[i + 1]].type == PassType::Graphics);
                 if (!nextIsGraphics) {
-                    vk.endMainPass(cmdBuf);
+                    vk.endMainPass(cmd);
                     legacyRenderPassOpen = false;
                 }
-                vk.cmdEndLabel(cmdBuf);
             }
         } else {
-            if (p.exec)
-                p.exec(cmdBuf);
-            vk.cmdEndLabel(cmdBuf);
+            recordPassCommands(p, cmd);
         }
+
+        gpuProfiler.endScope(cmd, scope);
+        vk.cmdEndLabel(cmd);
+
+        if (!splitQueues)
+            setSplitEvents(vk, cmd, (uint32_t)i);
+    }
+}
+
+// beginFrame() waited for this slot's previous submission, so the events it set can be reset from the host.
+void RenderGraph::prepareSplitEvents(VulkanContext& vk)
+{
+    nextWaitEvent = 0;
+    nextSetEvent = 0;
+
+    const VkDevice dev = vk.device();
+    const uint32_t slot = vk.currentFrameIndex();
+    if (eventPools.size() <= slot)
+        eventPools.resize(slot + 1);
+    EventPool& pool = eventPools[slot];
+    for (uint32_t i = 0; i < pool.used; ++i)
+        vkCheck(vkResetEvent(dev, pool.events[i]), "vkResetEvent");
+    while (pool.events.size() < plan.events.size()) {
+        VkEventCreateInfo eci{ VK_STRUCTURE_TYPE_EVENT_CREATE_INFO };
+        VkEvent event = VK_NULL_HANDLE;
+        vkCheck(vkCreateEvent(dev, &eci, nullptr, &event), "vkCreateEvent");
+        pool.events.push_back(event);
     }
+    pool.used = (uint32_t)plan.events.size();
 }
 
 void RenderGraph::end(VulkanContext& vk)
@@ -448,45 +1454,44 @@ void RenderGraph::end(VulkanContext& vk)
         p.colorClear = std::pmr::vector<VkClearValue>(arena.resource());
         p.type = PassType::Graphics;
         p.images.push_back(ImageAccess{ backbufferHandle.id, ImageUse::Present, false });
-        applyBarriers(vk, cmdBuf, p);
+        p.batch = lastGraphicsBatch;
+        lastBarrierStats.full += applyBarriers(vk, splitQueues ? batches[lastGraphicsBatch].cmd : cmdBuf, p);
     }
 
     for (auto& r : images) {
         if (!r.owned)
             continue;
         VkDevice dev = vk.device();
+        GpuAllocator* allocator = &vk.allocator();
         VkImage img = r.image;
         VkImageView view = r.view;
-        VkDeviceMemory mem = r.memory;
-        vk.frameDeletionQueue().push([dev, img, view, mem]() {
+        GpuAllocation mem = r.memory;
+        vk.frameDeletionQueue().push([dev, allocator, img, view, mem]() {
             if (view)
                 vkDestroyImageView(dev, view, nullptr);
             if (img)
                 vkDestroyImage(dev, img, nullptr);
-            if (mem)
-                vkFreeMemory(dev, mem, nullptr);
+            allocator->free(mem);
         });
     }
     for (auto& r : buffers) {
         if (!r.owned)
             continue;
         VkDevice dev = vk.device();
+        GpuAllocator* allocator = &vk.allocator();
         VkBuffer buf = r.buffer;
-        VkDeviceMemory mem = r.memory;
-        vk.frameDeletionQueue().push([dev, buf, mem]() {
+        GpuAllocation mem = r.memory;
+        vk.frameDeletionQueue().push([dev, allocator, buf, mem]() {
             if (buf)
                 vkDestroyBuffer(dev, buf, nullptr);
-            if (mem)
-                vkFreeMemory(dev, mem, nullptr);
+            allocator->free(mem);
         });
     }
 
-    for (const auto& ri : retireImages)
-        vk.retireTransientImage2D({ ri.format, ri.extent, ri.usage, ri.aspect, ri.image, ri.view, ri.memory });
-    for (const auto& rb : retireBuffers)
-        vk.retireTransientBuffer({ rb.size, rb.usage, rb.memFlags, rb.buffer, rb.memory });
-
-    vk.endFrame();
+    if (splitQueues)
+        submitQueueBatches(vk);
+    else
+        vk.endFrame();
     cmdBuf = VK_NULL_HANDLE;
 }
 
@@ -517,7 +1522,8 @@ RenderGraph::ImageHandle RenderGraph::importDepth(VulkanContext& vk)
     r.format = vk.depthFormat();
     r.extent = vk.swapchainExtent();
     r.externalLayoutPtr = vk.depthImageLayoutPtr();
-    r.lastStage = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT;
+    // The previous frame may still be sampling depth for its Hi-Z build.
+    r.lastStage = VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
     r.lastAccess = 0;
     r.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
 
@@ -526,8 +1532,32 @@ RenderGraph::ImageHandle RenderGraph::importDepth(VulkanContext& vk)
     return ImageHandle{ id };
 }
 
-RenderGraph::ImageHandle RenderGraph::createTransientImage2D(VulkanContext& vk,
-                                                             std::string_view name,
+RenderGraph::ImageHandle RenderGraph::importImage(std::string_view name,
+                                                  VkImage image,
+                                                  VkImageView view,
+                                                  VkFormat format,
+                                                  VkExtent2D extent,
+                                                  VkImageLayout* layout,
+                                                  VkImageAspectFlags aspect)
+{
+    ImageResource r{};
+    r.name = std::pmr::string(name, arena.resource());
+    r.image = image;
+    r.view = view;
+    r.format = format;
+    r.extent = extent;
+    r.externalLayoutPtr = layout;
+    r.lastStage = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    r.lastAccess = VK_ACCESS_2_MEMORY_WRITE_BIT;
+    r.aspectMask = aspect;
+
+    const uint32_t id = (uint32_t)images.size();
+    images.push_back(r);
+    return ImageHandle{ id };
+}
+
+
+RenderGraph::ImageHandle RenderGraph::createTransientImage2D(std::string_view name,
                                                              VkFormat format,
                                                              VkExtent2D extent,
                                                              VkImageUsageFlags usage,
@@ -538,41 +1568,335 @@ RenderGraph::ImageHandle RenderGraph::createTransientImage2D(VulkanContext& vk,
     r.format = format;
     r.extent = extent;
     r.aspectMask = aspect;
-    r.pooled = true;
-
-    auto t = vk.acquireTransientImage2D(r.name, format, extent, usage, aspect);
-    r.image = t.image;
-    r.view = t.view;
-    r.memory = t.memory;
+    r.usage = usage;
+    r.transient = true;
     r.layout = VK_IMAGE_LAYOUT_UNDEFINED;
-    r.externalLayoutPtr = nullptr;
     r.lastStage = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT;
     r.lastAccess = 0;
 
-    retireImages.push_back(RetireImage2D{ format, extent, usage, aspect, r.image, r.view, r.memory });
-
     const uint32_t id = (uint32_t)images.size();
     images.push_back(r);
     return ImageHandle{ id };
 }
 
-RenderGraph::BufferHandle RenderGraph::createTransientBuffer(VulkanContext& vk,
-                                                             std::string_view name,
+RenderGraph::BufferHandle RenderGraph::createTransientBuffer(std::string_view name,
                                                              VkDeviceSize size,
                                                              VkBufferUsageFlags usage,
                                                              VkMemoryPropertyFlags memFlags)
 {
     BufferResource r{};
-    r.pooled = true;
-    auto t = vk.acquireTransientBuffer(name, size, usage, memFlags);
-    r.buffer = t.buffer;
-    r.memory = t.memory;
+    r.name = std::pmr::string(name, arena.resource());
+    r.size = size;
+    r.usage = usage;
+    r.memFlags = memFlags;
+    r.transient = true;
     r.lastStage = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT;
     r.lastAccess = 0;
 
-    retireBuffers.push_back(RetireBuffer{ size, usage, memFlags, r.buffer, r.memory });
-
     const uint32_t id = (uint32_t)buffers.size();
     buffers.push_back(r);
     return BufferHandle{ id };
 }
+
+static VkDeviceSize alignUp(VkDeviceSize v, VkDeviceSize alignment)
+{
+    return (v + alignment - 1) & ~(alignment - 1);
+}
+
+void RenderGraph::allocateTransients(VulkanContext& vk)
+{
+    for (uint32_t pi = 0; pi < (uint32_t)schedule.size(); ++pi) {
+        for (const auto& ia : passes[schedule[pi]].images) {
+            if (ia.id >= images.size() || !images[ia.id].transient)
+                continue;
+            auto& r = images[ia.id];
+            r.firstUse = std::min(r.firstUse, pi);
+            r.lastUse = std::max(r.lastUse, pi);
+        }
+        for (const auto& ba : passes[schedule[pi]].buffers) {
+            if (ba.id >= buffers.size() || !buffers[ba.id].transient)
+                continue;
+            auto& r = buffers[ba.id];
+            r.firstUse = std::min(r.firstUse, pi);
+            r.lastUse = std::max(r.lastUse, pi);
+        }
+    }
+
+    for (uint32_t i = 0; i < (uint32_t)images.size(); ++i) {
+        const auto& r = images[i];
+        if (!r.transient)
+            continue;
+        TransientKey k{};
+        k.image = true;
+        k.format = r.format;
+        k.width = r.extent.width;
+        k.height = r.extent.height;
+        k.aspect = r.aspectMask;
+        k.usage = r.usage;
+        k.memFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        k.firstUse = r.firstUse;
+        k.lastUse = r.lastUse;
+        transientKeys.push_back(k);
+        transientRefs.push_back(TransientRef{ true, i });
+    }
+    for (uint32_t i = 0; i < (uint32_t)buffers.size(); ++i) {
+        const auto& r = buffers[i];
+        if (!r.transient)
+            continue;
+        TransientKey k{};
+        k.size = r.size;
+        k.usage = r.usage;
+        k.memFlags = r.memFlags;
+        k.firstUse = r.firstUse;
+        k.lastUse = r.lastUse;
+        transientKeys.push_back(k);
+        transientRefs.push_back(TransientRef{ false, i });
+    }
+
+    const uint32_t slot = vk.currentFrameIndex();
+    if (transientCaches.size() <= slot)
+        transientCaches.resize(slot + 1);
+    TransientCache& cache = transientCaches[slot];
+    if (!std::equal(cache.keys.begin(), cache.keys.end(), transientKeys.begin(), transientKeys.end()))
+        buildTransientCache(vk, cache);
+
+    TransientStats& st = lastTransientStats;
+    st = TransientStats{};
+    st.heaps = (uint32_t)cache.heaps.size();
+    st.heapBytes = cache.heapBytes;
+
+    for (uint32_t t = 0; t < (uint32_t)transientRefs.size(); ++t) {
+        const TransientRef ref = transientRefs[t];
+        const TransientSlot& ts = cache.slots[t];
+        if (ts.heap == kUnused)
+            continue;
+
+        const uint32_t aliasBegin = (uint32_t)aliasIds.size();
+        for (uint32_t a = 0; a < ts.aliasCount; ++a)
+            aliasIds.push_back(transientRefs[cache.aliases[ts.aliasBegin + a]].id);
+
+        if (ref.image) {
+            auto& r = images[ref.id];
+            r.image = ts.image;
+            r.view = ts.view;
+            r.aliasBegin = aliasBegin;
+            r.aliasCount = ts.aliasCount;
+            ++st.images;
+        } else {
+            auto& r = buffers[ref.id];
+            r.buffer = ts.buffer;
+            r.aliasBegin = aliasBegin;
+            r.aliasCount = ts.aliasCount;
+            ++st.buffers;
+        }
+        st.requestedBytes += ts.size;
+    }
+
+    for (uint32_t pi = 0; pi < (uint32_t)schedule.size(); ++pi) {
+        VkDeviceSize live = 0;
+        for (size_t t = 0; t < transientKeys.size(); ++t) {
+            if (transientKeys[t].firstUse <= pi && pi <= transientKeys[t].lastUse)
+                live += cache.slots[t].size;
+        }
+        st.peakLiveBytes = std::max(st.peakLiveBytes, live);
+    }
+}
+
+void RenderGraph::buildTransientCache(VulkanContext& vk, TransientCache& cache)
+{
+    releaseTransientCache(vk, cache, true);
+
+    const VkDevice dev = vk.device();
+    const uint32_t count = (uint32_t)transientKeys.size();
+    cache.keys.assign(transientKeys.begin(), transientKeys.end());
+    cache.slots.assign(count, TransientSlot{});
+
+    std::vector<VkMemoryRequirements> reqs(count);
+    for (uint32_t t = 0; t < count; ++t) {
+        const TransientKey& k = cache.keys[t];
+        if (k.firstUse == kUnused)
+            continue;
+
+        TransientSlot& ts = cache.slots[t];
+        if (k.image) {
+            VkImageCreateInfo ici{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+            ici.imageType = VK_IMAGE_TYPE_2D;
+            ici.format = k.format;
+            ici.extent = VkExtent3D{ k.width, k.height, 1 };
+            ici.mipLevels = 1;
+            ici.arrayLayers = 1;
+            ici.samples = VK_SAMPLE_COUNT_1_BIT;
+            ici.tiling = VK_IMAGE_TILING_OPTIMAL;
+            ici.usage = k.usage;
+            ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            ici.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            vkCheck(vkCreateImage(dev, &ici, nullptr, &ts.image), "vkCreateImage");
+            vkGetImageMemoryRequirements(dev, ts.image, &reqs[t]);
+            vk.setObjectName(VK_OBJECT_TYPE_IMAGE, (uint64_t)ts.image, images[transientRefs[t].id].name.c_str());
+        } else {
+            VkBufferCreateInfo bci{ VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+            bci.size = k.size;
+            bci.usage = k.usage;
+            bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            vkCheck(vkCreateBuffer(dev, &bci, nullptr, &ts.buffer), "vkCreateBuffer");
+            vkGetBufferMemoryRequirements(dev, ts.buffer, &reqs[t]);
+            vk.setObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)ts.buffer, buffers[transientRefs[t].id].name.c_str());
+        }
+        ts.size = reqs[t].size;
+    }
+
+    // Transients of the same kind, memory flags and memory types share a heap. Largest first, each one takes the lowest
+    // offset that no transient with an overlapping lifetime occupies; it aliases whatever it overlaps from earlier
+    // passes.
+    std::vector<uint32_t> group;
+    std::vector<uint32_t> conflicts;
+    for (uint32_t t = 0; t < count; ++t) {
+        const TransientKey& k = cache.keys[t];
+        if (k.firstUse == kUnused || cache.slots[t].heap != kUnused)
+            continue;
+
+        group.clear();
+        for (uint32_t u = t; u < count; ++u) {
+            const TransientKey& o = cache.keys[u];
+            if (o.firstUse != kUnused && o.image == k.image && o.memFlags == k.memFlags &&
+                reqs[u].memoryTypeBits == reqs[t].memoryTypeBits)
+                group.push_back(u);
+        }
+        std::stable_sort(group.begin(), group.end(), [&](uint32_t a, uint32_t b) { return reqs[a].size > reqs[b].size; });
+
+        const uint32_t heap = (uint32_t)cache.heaps.size();
+        VkDeviceSize heapSize = 0;
+        VkDeviceSize heapAlignment = 1;
+        for (size_t gi = 0; gi < group.size(); ++gi) {
+            const uint32_t u = group[gi];
+            const TransientKey& ku = cache.keys[u];
+
+            conflicts.clear();
+            for (size_t gj = 0; gj < gi; ++gj) {
+                const TransientKey& kv = cache.keys[group[gj]];
+                if (kv.firstUse <= ku.lastUse && ku.firstUse <= kv.lastUse)
+                    conflicts.push_back(group[gj]);
+            }
+            std::sort(conflicts.begin(), conflicts.end(),
+                      [&](uint32_t a, uint32_t b) { return cache.slots[a].offset < cache.slots[b].offset; });
+
+            VkDeviceSize offset = 0;
+            for (uint32_t v : conflicts) {
+                const TransientSlot& sv = cache.slots[v];
+                if (offset + reqs[u].size <= sv.offset)
+                    break;
+                offset = std::max(offset, alignUp(sv.offset + sv.size, reqs[u].alignment));
+            }
+
+            cache.slots[u].heap = heap;
+            cache.slots[u].offset = offset;
+            heapSize = std::max(heapSize, offset + reqs[u].size);
+            heapAlignment = std::max(heapAlignment, reqs[u].alignment);
+        }
+
+        for (uint32_t u : group) {
+            TransientSlot& su = cache.slots[u];
+            su.aliasBegin = (uint32_t)cache.aliases.size();
+            for (uint32_t v : group) {
+                const TransientSlot& sv = cache.slots[v];
+                if (cache.keys[v].lastUse < cache.keys[u].firstUse && sv.offset < su.offset + su.size &&
+                    su.offset < sv.offset + sv.size)
+                    cache.aliases.push_back(v);
+            }
+            su.aliasCount = (uint32_t)cache.aliases.size() - su.aliasBegin;
+        }
+
+        VkMemoryRequirements heapReq{};
+        heapReq.size = heapSize;
+        heapReq.alignment = heapAlignment;
+        heapReq.memoryTypeBits = reqs[t].memoryTypeBits;
+        const GpuAllocator::Kind kind = k.image ? GpuAllocator::Kind::Image : GpuAllocator::Kind::Buffer;
+        const GpuAllocation mem =
+            vk.allocator().allocate(heapReq, k.memFlags, kind, GpuAllocator::Lifetime::Persistent, "RenderGraph transient heap");
+        cache.heaps.push_back(mem);
+        cache.heapBytes += heapSize;
+
+        for (uint32_t u : group) {
+            TransientSlot& su = cache.slots[u];
+            if (su.image) {
+                vkCheck(vkBindImageMemory(dev, su.image, mem.memory, mem.offset + su.offset), "vkBindImageMemory");
+                su.view = createImageView2D(dev, su.image, cache.keys[u].format, cache.keys[u].aspect, 1);
+                vk.setObjectName(VK_OBJECT_TYPE_IMAGE_VIEW, (uint64_t)su.view, images[transientRefs[u].id].name.c_str());
+            } else {
+                vkCheck(vkBindBufferMemory(dev, su.buffer, mem.memory, mem.offset + su.offset), "vkBindBufferMemory");
+            }
+        }
+    }
+
+    VkDeviceSize requested = 0;
+    for (const TransientSlot& ts : cache.slots)
+        requested += ts.size;
+    CFGC_LOGF("RenderGraph: frame slot %u placed %u transients in %zu heaps, %llu KiB (%llu KiB without aliasing)",
+              vk.currentFrameIndex(), count, cache.heaps.size(), (unsigned long long)(cache.heapBytes >> 10),
+              (unsigned long long)(requested >> 10));
+}
+
+void RenderGraph::releaseTransientCache(VulkanContext& vk, TransientCache& cache, bool deferred)
+{
+    const VkDevice dev = vk.device();
+    GpuAllocator* allocator = &vk.allocator();
+    for (const TransientSlot& ts : cache.slots) {
+        const VkImage img = ts.image;
+        const VkImageView view = ts.view;
+        const VkBuffer buf = ts.buffer;
+        if (!img && !buf)
+            continue;
+        auto destroy = [dev, img, view, buf]() {
+            if (view)
+                vkDestroyImageView(dev, view, nullptr);
+            if (img)
+                vkDestroyImage(dev, img, nullptr);
+            if (buf)
+                vkDestroyBuffer(dev, buf, nullptr);
+        };
+        if (deferred)
+            vk.frameDeletionQueue().push(std::move(destroy));
+        else
+            destroy();
+    }
+    for (const GpuAllocation& mem : cache.heaps) {
+        if (deferred)
+            vk.frameDeletionQueue().push([allocator, mem]() { allocator->free(mem); });
+        else
+            allocator->free(mem);
+    }
+    cache = TransientCache{};
+}
+
+void RenderGraph::shutdown(VulkanContext& vk)
+{
+    for (auto& cache : transientCaches)
+        releaseTransientCache(vk, cache, false);
+    transientCaches.clear();
+
+    for (auto& slot : recordPools) {
+        for (auto& rp : slot) {
+            if (rp.pool)
+                vkDestroyCommandPool(vk.device(), rp.pool, nullptr);
+        }
+    }
+    recordPools.clear();
+
+    for (auto& qf : queueFrames) {
+        if (qf.graphicsPool)
+            vkDestroyCommandPool(vk.device(), qf.graphicsPool, nullptr);
+        if (qf.computePool)
+            vkDestroyCommandPool(vk.device(), qf.computePool, nullptr);
+        for (VkSemaphore sem : qf.semaphores)
+            vkDestroySemaphore(vk.device(), sem, nullptr);
+    }
+    queueFrames.clear();
+
+    for (auto& pool : eventPools) {
+        for (VkEvent event : pool.events)
+            vkDestroyEvent(vk.device(), event, nullptr);
+    }
+    eventPools.clear();
+
+    gpuProfiler.shutdown(vk);
+}
@@ -9,7 +9,10 @@
 #include <string_view>
 #include <vector>
 
+#include "GpuAllocator.hpp"
+#include "GpuProfiler.hpp"
 #include "engine/core/FrameArena.hpp"
+#include "engine/core/JobSystem.hpp"
 #include "engine/core/SmallFn.hpp"
 
 class VulkanContext;
@@ -30,6 +33,7 @@ class RenderGraph {
         ColorAttachment,
         DepthAttachment,
         Sampled,
+        Storage,
         Present,
     };
 
@@ -56,9 +60,27 @@ class RenderGraph {
 
     using SetupFn = SmallFn<void(PassBuilder&), 96>;
     using ExecFn = SmallFn<void(VkCommandBuffer), 96>;
+    using ChunkExecFn = SmallFn<void(VkCommandBuffer, uint32_t), 96>;
 
     VkCommandBuffer begin(VulkanContext& vk);
     void addPass(std::string_view name, PassType type, SetupFn setup, ExecFn exec);
+    // Like addPass, but exec(cmd, chunk) runs once per chunk in [0, chunkCount), each into its own secondary command
+    // buffer recorded on the job system's workers, and the frame's command buffer executes them in chunk order. Chunks of every
+    // such pass are recorded concurrently and before any addPass callback, so they may only read state that is final by
+    // the time execute() is called. Graphics chunks start with the viewport and scissor covering the render area. Without
+    // dynamic rendering the chunks are recorded inline, one after another.
+    void addParallelPass(std::string_view name, PassType type, SetupFn setup, uint32_t chunkCount, ChunkExecFn exec);
+    // Parallel pass chunks are recorded on its workers, so execute() must then run on the thread that started it.
+    // Without one they are recorded inline.
+    void setJobSystem(JobSystem* js) { jobs = js; }
+    // Lets passes declared with PassBuilder::asyncCompute() leave the graphics queue; on by default.
+    void setAsyncCompute(bool enabled) { asyncComputeEnabled = enabled; }
+    // Orders the passes added so far by their declared reads and writes. Passes are culled unless something that
+    // outlives the frame depends on them: a write to an imported resource (the backbuffer and depth included) or a pass
+    // that declares no writes at all, since the graph cannot see what it does. With dynamic rendering, independent
+    // passes are moved apart from what they wait on so barriers have other work to overlap with. execute() compiles
+    // if this was not called.
+    void compile(VulkanContext& vk);
     void execute(VulkanContext& vk);
     void end(VulkanContext& vk);
 
@@ -68,24 +90,107 @@ class RenderGraph {
     ImageHandle depth() const { return depthHandle; }
 
     BufferHandle importBuffer(VkBuffer buffer);
-    ImageHandle createTransientImage2D(VulkanContext& vk,
-                                       std::string_view name,
+    // Persistent images keep their layout in *layout across frames; the first use in a frame always gets a full barrier
+    // since the previous frame may still have writes in flight.
+    ImageHandle importImage(std::string_view name,
+                            VkImage image,
+                            VkImageView view,
+                            VkFormat format,
+                            VkExtent2D extent,
+                            VkImageLayout* layout,
+                            VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT);
+    // Transients are only declared here. execute() derives each one's first and last pass and places those whose
+    // lifetimes never overlap at shared offsets of one heap, so they have no VkImage/VkBuffer before then; exec
+    // callbacks resolve them through image()/imageView()/buffer(). Contents never survive into the next frame.
+    ImageHandle createTransientImage2D(std::string_view name,
                                        VkFormat format,
                                        VkExtent2D extent,
                                        VkImageUsageFlags usage,
                                        VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT);
-    BufferHandle createTransientBuffer(VulkanContext& vk,
-                                       std::string_view name,
+    BufferHandle createTransientBuffer(std::string_view name,
                                        VkDeviceSize size,
                                        VkBufferUsageFlags usage,
                                        VkMemoryPropertyFlags memFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
+    VkImage image(ImageHandle h) const { return images[h.id].image; }
+    VkImageView imageView(ImageHandle h) const { return images[h.id].view; }
+    VkBuffer buffer(BufferHandle h) const { return buffers[h.id].buffer; }
+
+    struct TransientStats {
+        uint32_t images = 0;
+        uint32_t buffers = 0;
+        uint32_t heaps = 0;
+        // What the frame's transients would cost with a dedicated allocation each.
+        VkDeviceSize requestedBytes = 0;
+        // Largest total size of transients alive during any single pass; the floor for heapBytes.
+        VkDeviceSize peakLiveBytes = 0;
+        // Device memory actually backing the frame's transients.
+        VkDeviceSize heapBytes = 0;
+    };
+    // Refreshed by every execute().
+    const TransientStats& transientStats() const { return lastTransientStats; }
+
+    struct CompileStats {
+        uint32_t passes = 0;
+        uint32_t culled = 0;
+        // Image and buffer barriers needed when running the surviving passes in addPass order and in compiled order.
+        uint32_t barriersDeclared = 0;
+        uint32_t barriersCompiled = 0;
+        // Passes waiting on the pass recorded right before them, where a barrier has nothing to overlap with.
+        uint32_t stallsDeclared = 0;
+        uint32_t stallsCompiled = 0;
+        // The topology hash matched the previous compile, so its schedule and barriers were reused as is.
+        bool planReused = false;
+        // Valid until the next begin().
+        std::pmr::vector<std::string_view> culledPasses;
+    };
+    // Refreshed by every compile().
+    const CompileStats& compileStats() const { return lastCompileStats; }
+
+    struct QueueStats {
+        // Passes that ran on the async compute queue.
+        uint32_t asyncPasses = 0;
+        // Submissions the frame was split into, and how many of them signal a semaphore for the other queue.
+        uint32_t batches = 0;
+        uint32_t semaphores = 0;
+        // Release/acquire pairs, including the ones handing resources back to graphics at the end of the frame.
+        uint32_t ownershipTransfers = 0;
+    };
+    // Refreshed by every execute(); all zero when the frame stayed on the graphics queue.
+    const QueueStats& queueStats() const { return lastQueueStats; }
+
+    struct BarrierStats {
+        // Barriers recorded right before their consumer, and ones split into an event set after the producer and
+        // waited on before the consumer, with the number of events that took.
+        uint32_t full = 0;
+        uint32_t split = 0;
+        uint32_t events = 0;
+    };
+    // Refreshed by every execute() and end().
+    const BarrierStats& barrierStats() const { return lastBarrierStats; }
+
+    // Times every pass by name, including the barriers recorded before it.
+    GpuProfiler& profiler() { return gpuProfiler; }
+    const GpuProfiler& profiler() const { return gpuProfiler; }
+
+    // Destroys the cached transient heaps, the per-frame pools, semaphores and events, and the profiler's queries; the
+    // device must be idle.
+    void shutdown(VulkanContext& vk);
+
    private:
     struct Pass {
         std::pmr::string name;
         PassType type = PassType::Graphics;
         SetupFn setup;
         ExecFn exec;
+        ChunkExecFn chunkExec;
+        uint32_t chunkCount = 0;
+        bool async = false;
+        bool onAsyncQueue = false;
+        // Index into batches while the frame is split across queues.
+        uint32_t batch = 0;
+        // Index of chunk 0 in secondaries, or kUnused when the chunks are recorded inline.
+        uint32_t firstSecondary = kUnused;
 
         std::pmr::vector<ImageAccess> images;
         std::pmr::vector<BufferAccess> buffers;
@@ -125,16 +230,25 @@ class RenderGraph {
                              VkAttachmentStoreOp storeOp,
                              const std::optional<VkClearValue>& clear = std::nullopt);
 
+        // Runs a compute pass on the async compute queue when the device has one and dynamic rendering is on. The graph
+        // splits the frame into per-queue submissions joined by semaphores wherever the queues depend on each other, and
+        // transfers queue family ownership of the declared resources; everything else the pass touches must be usable
+        // from both families. Async passes wait for what was recorded into cmd() before execute(), and passes that use
+        // transients stay on the graphics queue.
+        void asyncCompute() { pass.async = true; }
+
        private:
         Pass& pass;
     };
 
    private:
+    static constexpr uint32_t kUnused = ~0u;
+
     struct ImageResource {
         std::pmr::string name;
         VkImage image = VK_NULL_HANDLE;
         VkImageView view = VK_NULL_HANDLE;
-        VkDeviceMemory memory = VK_NULL_HANDLE;
+        GpuAllocation memory{};
         VkFormat format = VK_FORMAT_UNDEFINED;
         VkExtent2D extent{};
         VkImageAspectFlags aspectMask = 0;
@@ -143,16 +257,83 @@ class RenderGraph {
         VkPipelineStageFlags2 lastStage = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT;
         VkAccessFlags2 lastAccess = 0;
         bool owned = false;
-        bool pooled = false;
+        // Queue family that owns the image and the batch that used it last; only tracked in frames split across queues.
+        uint32_t queueFamily = kUnused;
+        uint32_t lastBatch = 0;
+        // Schedule step of the last pass that accessed it, while a barrier plan is being built.
+        uint32_t lastStep = kUnused;
+
+        bool transient = false;
+        VkImageUsageFlags usage = 0;
+        uint32_t firstUse = kUnused;
+        uint32_t lastUse = 0;
+        // Earlier transients sharing this one's memory, as a range of aliasIds; waited on at the first use.
+        uint32_t aliasBegin = 0;
+        uint32_t aliasCount = 0;
     };
 
     struct BufferResource {
+        std::pmr::string name;
         VkBuffer buffer = VK_NULL_HANDLE;
-        VkDeviceMemory memory = VK_NULL_HANDLE;
+        GpuAllocation memory{};
         VkPipelineStageFlags2 lastStage = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT;
         VkAccessFlags2 lastAccess = 0;
         bool owned = false;
-        bool pooled = false;
+        uint32_t queueFamily = kUnused;
+        uint32_t lastBatch = 0;
+        uint32_t lastStep = kUnused;
+
+        bool transient = false;
+        VkDeviceSize size = 0;
+        VkBufferUsageFlags usage = 0;
+        VkMemoryPropertyFlags memFlags = 0;
+        uint32_t firstUse = kUnused;
+        uint32_t lastUse = 0;
+        uint32_t aliasBegin = 0;
+        uint32_t aliasCount = 0;
+    };
+
+    // Describes one transient of a frame in declaration order; a frame whose keys match the cached ones reuses its
+    // resources and heap placement as is.
+    struct TransientKey {
+        bool image = false;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        VkImageAspectFlags aspect = 0;
+        VkFlags usage = 0;
+        VkDeviceSize size = 0;
+        VkMemoryPropertyFlags memFlags = 0;
+        uint32_t firstUse = kUnused;
+        uint32_t lastUse = 0;
+
+        bool operator==(const TransientKey&) const = default;
+    };
+
+    struct TransientSlot {
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        uint32_t heap = kUnused;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        uint32_t aliasBegin = 0;
+        uint32_t aliasCount = 0;
+    };
+
+    // One per frame in flight, so a heap is never rewritten while an earlier frame may still be reading it.
+    struct TransientCache {
+        std::vector<TransientKey> keys;
+        std::vector<TransientSlot> slots;
+        // Transient indices (into keys) of the resources each slot overlaps in memory and follows in time.
+        std::vector<uint32_t> aliases;
+        std::vector<GpuAllocation> heaps;
+        VkDeviceSize heapBytes = 0;
+    };
+
+    struct TransientRef {
+        bool image = false;
+        uint32_t id = 0;
     };
 
     ImageHandle importBackbuffer(VulkanContext& vk);
@@ -167,7 +348,42 @@ class RenderGraph {
 
     void stagesAccessForBufferUse(BufferUse use, bool write, VkPipelineStageFlags2& stage, VkAccessFlags2& access) const;
 
-    void applyBarriers(VulkanContext& vk, VkCommandBuffer cmd, const Pass& pass);
+    // Returns the number of barriers the pass needs; with a null cmd nothing is recorded but the state still advances.
+    uint32_t applyBarriers(VulkanContext& vk, VkCommandBuffer cmd, const Pass& pass);
+    uint32_t countBarriers(VulkanContext& vk, const std::pmr::vector<uint32_t>& order);
+    void buildBarrierPlan(VulkanContext& vk);
+    void splitPlanBarriers();
+    void replayBarriers(VulkanContext& vk, VkCommandBuffer cmd, uint32_t step);
+    void prepareSplitEvents(VulkanContext& vk);
+    void setSplitEvents(VulkanContext& vk, VkCommandBuffer cmd, uint32_t step);
+    VkDependencyInfo splitDependency(uint32_t event);
+    void recordBarriers(VulkanContext& vk, VkCommandBuffer cmd);
+    uint64_t topologyHash(VulkanContext& vk) const;
+
+    struct AccessState {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags2 stage = 0;
+        VkAccessFlags2 access = 0;
+        VkImageAspectFlags aspect = 0;
+    };
+    void saveAccessState(std::vector<AccessState>& imageStates, std::vector<AccessState>& bufferStates) const;
+    void restoreAccessState(const std::vector<AccessState>& imageStates, const std::vector<AccessState>& bufferStates);
+
+    void recordParallelPasses(VulkanContext& vk);
+    void recordPassCommands(const Pass& pass, VkCommandBuffer cmd);
+
+    bool splitQueueBatches(VulkanContext& vk);
+    VkImageMemoryBarrier2 releaseImage(VulkanContext& vk,
+                                       const ImageResource& res,
+                                       VkImageLayout newLayout,
+                                       VkImageAspectFlags aspect,
+                                       uint32_t dstFamily);
+    VkBufferMemoryBarrier2 releaseBuffer(VulkanContext& vk, const BufferResource& res, uint32_t dstFamily);
+    void submitQueueBatches(VulkanContext& vk);
+
+    void allocateTransients(VulkanContext& vk);
+    void buildTransientCache(VulkanContext& vk, TransientCache& cache);
+    void releaseTransientCache(VulkanContext& vk, TransientCache& cache, bool deferred);
 
    private:
     VkCommandBuffer cmdBuf = VK_NULL_HANDLE;
@@ -175,33 +391,157 @@ class RenderGraph {
     std::pmr::vector<ImageResource> images;
     std::pmr::vector<BufferResource> buffers;
     std::pmr::vector<Pass> passes;
+    // Compiled execution order as indices into passes.
+    std::pmr::vector<uint32_t> schedule;
+    bool compiled = false;
+    CompileStats lastCompileStats{};
+
+    // The compile report is only logged when the frame's shape changes.
+    struct LoggedCompile {
+        uint32_t passes = kUnused;
+        uint32_t culled = 0;
+        uint32_t barriers = 0;
+        uint32_t stalls = 0;
+
+        bool operator==(const LoggedCompile&) const = default;
+    };
+    LoggedCompile lastLoggedCompile{};
+
+    struct PlannedImageBarrier {
+        uint32_t id = 0;
+        // Step of the pass whose access the barrier waits for, or kUnused when that is not a single earlier pass.
+        uint32_t srcStep = kUnused;
+        VkImageMemoryBarrier2 barrier{};
+    };
+
+    struct PlannedBufferBarrier {
+        uint32_t id = 0;
+        uint32_t srcStep = kUnused;
+        VkBufferMemoryBarrier2 barrier{};
+    };
+
+    // Barriers on a resource the producer was done with at least one unrelated pass earlier, set after the producer
+    // and waited on before the consumer. They cover consecutive entries of the consumer's barrier ranges.
+    struct SplitEvent {
+        uint32_t producer = 0;
+        uint32_t consumer = 0;
+        uint32_t imageFirst = 0;
+        uint32_t imageCount = 0;
+        uint32_t bufferFirst = 0;
+        uint32_t bufferCount = 0;
+    };
+
+    // Schedule, barriers and final resource state of the last compiled topology. Resources are referred to by their
+    // declaration index, which is stable for a given topology; handles are patched in from the current frame on replay.
+    struct BarrierPlan {
+        uint64_t hash = 0;
+        uint64_t pendingHash = 0;
+        std::vector<uint32_t> schedule;
+        std::vector<uint32_t> culled;
+        uint32_t barriersDeclared = 0;
+        uint32_t barriersCompiled = 0;
+        uint32_t stallsDeclared = 0;
+        uint32_t stallsCompiled = 0;
+        // Per schedule step, the range of barriers recorded before it; one entry longer than the schedule.
+        std::vector<uint32_t> imageBegin;
+        std::vector<uint32_t> bufferBegin;
+        std::vector<PlannedImageBarrier> imageBarriers;
+        std::vector<PlannedBufferBarrier> bufferBarriers;
+        // Each step's ranges hold its split barriers first, grouped by event, and recorded as full barriers from here.
+        std::vector<uint32_t> imageFull;
+        std::vector<uint32_t> bufferFull;
+        // Ordered by consumer, and through eventsByProducer by producer.
+        std::vector<SplitEvent> events;
+        std::vector<uint32_t> eventsByProducer;
+        std::vector<AccessState> finalImages;
+        std::vector<AccessState> finalBuffers;
+    };
+    BarrierPlan plan;
+    bool replayPlan = false;
 
     std::vector<VkImageMemoryBarrier2> scratchImgBarriers;
     std::vector<VkBufferMemoryBarrier2> scratchBufBarriers;
+    std::vector<uint32_t> scratchImgBarrierIds;
+    std::vector<uint32_t> scratchBufBarrierIds;
+    std::vector<uint32_t> scratchImgBarrierSteps;
+    std::vector<uint32_t> scratchBufBarrierSteps;
+    // The step applyBarriers() records into lastStep.
+    uint32_t barrierStep = kUnused;
+    std::vector<VkDependencyInfo> scratchDeps;
+    std::vector<VkEvent> scratchEvents;
+    uint32_t nextWaitEvent = 0;
+    uint32_t nextSetEvent = 0;
+    BarrierStats lastBarrierStats{};
+    GpuProfiler gpuProfiler;
+
+    // Events for the plan's split barriers, one set per frame in flight, reset on the host when the slot comes around.
+    struct EventPool {
+        std::vector<VkEvent> events;
+        uint32_t used = 0;
+    };
+    std::vector<EventPool> eventPools;
+    std::vector<AccessState> scratchImageStates;
+    std::vector<AccessState> scratchBufferStates;
     VkDependencyInfo scratchDep{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
     std::vector<VkRenderingAttachmentInfoKHR> scratchColorAtts;
 
-    struct RetireImage2D {
-        VkFormat format = VK_FORMAT_UNDEFINED;
-        VkExtent2D extent{};
-        VkImageUsageFlags usage = 0;
-        VkImageAspectFlags aspect = 0;
-        VkImage image = VK_NULL_HANDLE;
-        VkImageView view = VK_NULL_HANDLE;
-        VkDeviceMemory memory = VK_NULL_HANDLE;
+    // Secondary command buffers come from one pool per frame in flight and record worker, reset as a whole when the
+    // frame slot comes around again.
+    struct RecordPool {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> buffers;
+        uint32_t used = 0;
     };
 
-    struct RetireBuffer {
-        VkDeviceSize size = 0;
-        VkBufferUsageFlags usage = 0;
-        VkMemoryPropertyFlags memFlags = 0;
-        VkBuffer buffer = VK_NULL_HANDLE;
-        VkDeviceMemory memory = VK_NULL_HANDLE;
+    struct RecordTask {
+        uint32_t pass = 0;
+        uint32_t chunk = 0;
+    };
+
+    JobSystem* jobs = nullptr;
+    std::vector<std::vector<RecordPool>> recordPools;
+    std::pmr::vector<RecordTask> recordTasks;
+    std::pmr::vector<VkCommandBuffer> secondaries;
+
+    // A frame with passes on the async compute queue is submitted as batches in index order. Batch 0 is the frame's
+    // own command buffer, and each batch waits on at most one batch of the other queue, the newest it depends on.
+    struct QueueBatch {
+        VkCommandBuffer cmd = VK_NULL_HANDLE;
+        bool compute = false;
+        uint32_t waitBatch = kUnused;
+        VkSemaphore waitSemaphore = VK_NULL_HANDLE;
+        VkPipelineStageFlags waitStage = 0;
+        VkSemaphore signal = VK_NULL_HANDLE;
+    };
+
+    // Command buffers and semaphores for the extra batches, one set per frame in flight.
+    struct QueueFrame {
+        VkCommandPool graphicsPool = VK_NULL_HANDLE;
+        VkCommandPool computePool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> graphicsCmds;
+        std::vector<VkCommandBuffer> computeCmds;
+        uint32_t graphicsUsed = 0;
+        uint32_t computeUsed = 0;
+        std::vector<VkSemaphore> semaphores;
+        uint32_t semaphoresUsed = 0;
     };
 
-    std::vector<RetireImage2D> retireImages;
-    std::vector<RetireBuffer> retireBuffers;
+    bool asyncComputeEnabled = true;
+    bool splitQueues = false;
+    // Graphics and async compute family indices of the split frame.
+    uint32_t queueFamilies[2]{};
+    uint32_t lastGraphicsBatch = 0;
+    std::pmr::vector<QueueBatch> batches;
+    std::vector<QueueFrame> queueFrames;
+    QueueStats lastQueueStats{};
+
+    std::pmr::vector<TransientKey> transientKeys;
+    std::pmr::vector<TransientRef> transientRefs;
+    std::pmr::vector<uint32_t> aliasIds;
+    std::vector<TransientCache> transientCaches;
+    TransientStats lastTransientStats{};
 
     ImageHandle backbufferHandle{};
+    VkImageLayout backbufferFinalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
     ImageHandle depthHandle{};
 };
@@ -3,29 +3,71 @@
 
 #include "VulkanHelpers.hpp"
 #include "engine/assets/GltfLoader.hpp"
+#include "engine/assets/MeshPartition.hpp"
 #include "engine/assets/ObjLoader.hpp"
+#include "engine/core/JobSystem.hpp"
+#include "engine/core/Log.hpp"
+#include "engine/core/Trace.hpp"
 #include "engine/render/Frustum.hpp"
 
 namespace {
 struct CullingUBO {
     glm::vec4 planes[6]{};
+    glm::mat4 viewProj{ 1.0f };
+    glm::mat4 prevViewProj{ 1.0f };
+    glm::vec4 pyramidSize{ 0.0f };
 };
 
 struct CullPush {
     uint32_t drawCount = 0;
-    uint32_t indexCount = 0;
+    uint32_t meshCount = 0;
+    uint32_t phase = 0;
+    uint32_t occlusion = 0;
+    uint32_t cmdBase = 0;
 };
-}  // namespace
 
-#include <GLFW/glfw3.h>
+struct HiZPush {
+    uint32_t srcWidth = 0;
+    uint32_t srcHeight = 0;
+    uint32_t dstWidth = 0;
+    uint32_t dstHeight = 0;
+};
+
+static_assert(sizeof(DrawItem) == sizeof(ShaderLayout::DrawData), "DrawData mirrors DrawItem");
+
+struct GpuCullStats {
+    uint32_t visibleDraws = 0;
+    uint32_t visibleTriangles = 0;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double msSince(Clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+}  // namespace
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <vector>
 
 namespace {
+void destroyBufferDeferred(VulkanContext& vk, VkBuffer buf, const GpuAllocation& mem)
+{
+    if (!buf && !mem)
+        return;
+    const VkDevice dev = vk.device();
+    GpuAllocator* allocator = &vk.allocator();
+    vk.frameDeletionQueue().push([dev, allocator, buf, mem]() {
+        if (buf)
+            vkDestroyBuffer(dev, buf, nullptr);
+        allocator->free(mem);
+    });
+}
 
 static VkPipelineShaderStageCreateInfo shaderStage(VkShaderStageFlagBits stage, VkShaderModule mod, const char* entry = "main")
 {
@@ -41,44 +83,7 @@ static void writeMat4(float out16[16], const glm::mat4& m)
     std::memcpy(out16, &m[0][0], sizeof(float) * 16);
 }
 
-static void transitionImage(VkCommandBuffer cmd, VkImage img, VkImageAspectFlags aspect, VkImageLayout oldLayout, VkImageLayout newLayout)
-{
-    VkImageMemoryBarrier b{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
-    b.oldLayout = oldLayout;
-    b.newLayout = newLayout;
-    b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    b.image = img;
-    b.subresourceRange.aspectMask = aspect;
-    b.subresourceRange.baseMipLevel = 0;
-    b.subresourceRange.levelCount = 1;
-    b.subresourceRange.baseArrayLayer = 0;
-    b.subresourceRange.layerCount = 1;
-
-    VkPipelineStageFlags srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-
-    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-        b.srcAccessMask = 0;
-        b.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-        b.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        b.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    } else {
-        b.srcAccessMask = 0;
-        b.dstAccessMask = 0;
-        srcStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
-        dstStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
-    }
-
-    vkCmdPipelineBarrier(cmd, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &b);
-}
-
-static void createTexture2D(VulkanContext& vk,
+static bool createTexture2D(VulkanContext& vk,
                             UploadManager& up,
                             Renderer::Texture& tex,
                             uint32_t w,
@@ -87,7 +92,6 @@ static void createTexture2D(VulkanContext& vk,
                             const uint8_t* rgbaPixels)
 {
     VkDevice dev = vk.device();
-    VkPhysicalDevice phys = vk.physicalDevice();
 
     tex.width = w;
     tex.height = h;
@@ -104,39 +108,14 @@ static void createTexture2D(VulkanContext& vk,
     ici.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
     ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-    vkCheck(vkCreateImage(dev, &ici, nullptr, &tex.image), "vkCreateImage(tex)");
-    VkMemoryRequirements mr{};
-    vkGetImageMemoryRequirements(dev, tex.image, &mr);
-
-    VkMemoryAllocateInfo mai{ VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-    mai.allocationSize = mr.size;
-    mai.memoryTypeIndex = findMemoryType(phys, mr.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    vkCheck(vkAllocateMemory(dev, &mai, nullptr, &tex.mem), "vkAllocateMemory(tex)");
-    vkCheck(vkBindImageMemory(dev, tex.image, tex.mem, 0), "vkBindImageMemory(tex)");
-
-    const VkDeviceSize byteSize = (VkDeviceSize)w * (VkDeviceSize)h * 4ull;
-    auto a = up.alloc(byteSize, 4);
-    if (!a.cpu) {
-        std::fprintf(stderr, "[upload] Out of staging memory while uploading texture %ux%u (need %llu bytes)\n", w, h,
-                     (unsigned long long)byteSize);
-        std::abort();
-    }
-    std::memcpy((uint8_t*)a.cpu, rgbaPixels, (size_t)byteSize);
+    createImage2D(vk.allocator(), ici, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, tex.image, tex.mem, "vkCreateImage(tex)");
 
-    transitionImage(up.cmd(), tex.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-    VkBufferImageCopy bic{};
-    bic.bufferOffset = a.srcOffset;
-    bic.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    bic.imageSubresource.mipLevel = 0;
-    bic.imageSubresource.baseArrayLayer = 0;
-    bic.imageSubresource.layerCount = 1;
-    bic.imageExtent = VkExtent3D{ w, h, 1 };
-
-    vkCmdCopyBufferToImage(up.cmd(), up.stagingBuffer(), tex.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bic);
-
-    transitionImage(up.cmd(), tex.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Large images are streamed in row bands and may span several upload submissions.
+    if (!up.uploadToImage(tex.image, VK_IMAGE_ASPECT_COLOR_BIT, w, h, 4, rgbaPixels, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)) {
+        CFGC_LOGF("Upload: could not stream texture %ux%u", w, h);
+        tex.destroy(vk);
+        return false;
+    }
 
     VkImageViewCreateInfo vci{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
     vci.image = tex.image;
@@ -158,13 +137,7 @@ static void createTexture2D(VulkanContext& vk,
     sci.maxAnisotropy = 1.0f;
     sci.anisotropyEnable = VK_FALSE;
     vkCheck(vkCreateSampler(dev, &sci, nullptr, &tex.sampler), "vkCreateSampler(tex)");
-}
-
-static void
-createSolidTexture(VulkanContext& vk, UploadManager& up, Renderer::Texture& tex, VkFormat fmt, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
-{
-    uint8_t px[4]{ r, g, b, a };
-    createTexture2D(vk, up, tex, 1, 1, fmt, px);
+    return true;
 }
 
 }  // namespace
@@ -180,109 +153,177 @@ VkShaderModule Renderer::makeShader(VulkanContext& vk, const char* path)
     return mod;
 }
 
-void Renderer::init(VulkanContext& vk)
+void Renderer::init(VulkanContext& vk, JobSystem& js)
 {
-    startTimeSeconds = glfwGetTime();
+    CFGC_ZONE("Renderer::init");
+    jobs = &js;
+    graph.setJobSystem(jobs);
+
+    VkPhysicalDeviceProperties props{};
+    vkGetPhysicalDeviceProperties(vk.physicalDevice(), &props);
+    maxBindlessTextures = std::min({ ShaderLayout::MAX_BINDLESS_TEXTURES, props.limits.maxPerStageDescriptorSampledImages,
+                                     props.limits.maxPerStageDescriptorSamplers, props.limits.maxDescriptorSetSampledImages });
+
     upload.init(vk);
+    pipelineCache.init(vk, "pipeline_cache.bin");
+    pipelineBuildMs = 0.0;
+
     createScene(vk);
     createFrameResources(vk);
     createMaterialResources(vk);
     createGpuDrivenResources(vk);
+    createHiZPipeline(vk);
+    createHiZResources(vk);
     createPipelines(vk);
+    lastSwapchainGen = vk.swapchainGeneration();
+
+    pipeStats = {};
+    pipeStats.warmStart = pipelineCache.warm();
+    pipeStats.startupMs = pipelineBuildMs;
+    CFGC_LOGF("Pipelines: %.2f ms at startup (%s cache)", pipeStats.startupMs, pipeStats.warmStart ? "warm" : "cold");
+
+    vk.allocator().logStats();
 }
 
 void Renderer::shutdown(VulkanContext& vk)
 {
     vkDeviceWaitIdle(vk.device());
+#if defined(CFGC_DIAGNOSTICS)
+    // Last resolved timings of every pass, written before the graph destroys its query pools.
+    if (!graph.profiler().writeCsv("gpu_passes.csv"))
+        CFGC_LOGF("Failed to write gpu_passes.csv");
+    CFGC_LOGF("Pipelines: %s start %.2f ms, %u swapchain changes (%u rebuilt), last %.2f ms", pipeStats.warmStart ? "warm" : "cold",
+              pipeStats.startupMs, pipeStats.resizes, pipeStats.rebuilds, pipeStats.lastResizeMs);
+#endif
+    graph.shutdown(vk);
     destroyPipelines(vk);
+    destroyHiZResources(vk);
+    destroyHiZPipeline(vk);
     destroyGpuDrivenResources(vk);
     destroyScene(vk);
     destroyMaterialResources(vk);
     destroyFrameResources(vk);
     upload.shutdown(vk);
+    pipelineCache.shutdown(vk);
 }
 
 void Renderer::createScene(VulkanContext& vk)
 {
-    upload.beginFrame(vk);
+    CFGC_ZONE("Renderer::createScene");
+    // Scene resources are all new, so they can load on the transfer queue; the first frame acquires them.
+    upload.beginFrame(vk, UploadManager::Queue::Transfer);
 
     std::string err;
-    std::vector<Vertex> verts;
-    std::vector<uint32_t> idx;
+    std::vector<GltfMesh> meshes;
+    loadedNodes.clear();
+
+    ShaderLayout::MaterialGPU sceneMaterial{};
 
     GltfSceneData gltf;
-    if (loadGltfScene("assets/map.gltf", gltf, err)) {
-        verts = std::move(gltf.vertices);
-        idx = std::move(gltf.indices);
-
-        sceneBaseColorFactor[0] = gltf.material.baseColorFactor.x;
-        sceneBaseColorFactor[1] = gltf.material.baseColorFactor.y;
-        sceneBaseColorFactor[2] = gltf.material.baseColorFactor.z;
-        sceneBaseColorFactor[3] = gltf.material.baseColorFactor.w;
-        sceneMetallicRoughness[0] = gltf.material.metallicFactor;
-        sceneMetallicRoughness[1] = gltf.material.roughnessFactor;
-
-        baseColorTex.destroy(vk);
-        normalTex.destroy(vk);
-        metalRoughTex.destroy(vk);
-
-        auto createFromGltfOrSolid = [&](const std::string& rel, Renderer::Texture& outTex, VkFormat fmt, uint8_t sr, uint8_t sg,
-                                         uint8_t sb, uint8_t sa) {
-            if (!rel.empty()) {
-                ImageRGBA8 img;
-                std::string imErr;
-                std::string fullPath = std::string("assets/") + rel;
-                if (loadImageRGBA8_WIC(fullPath, img, imErr)) {
-                    createTexture2D(vk, upload, outTex, img.width, img.height, fmt, img.pixels.data());
-                    return;
-                }
-            }
-            createSolidTexture(vk, upload, outTex, fmt, sr, sg, sb, sa);
+    if (loadGltfScene("assets/map.gltf", gltf, err, jobs)) {
+        meshes = std::move(gltf.meshes);
+        loadedNodes = std::move(gltf.nodes);
+
+        sceneMaterial.baseColorFactor = gltf.material.baseColorFactor;
+        sceneMaterial.metallicRoughnessFactor = glm::vec2(gltf.material.metallicFactor, gltf.material.roughnessFactor);
+
+        // Images decode in parallel; creating and uploading the textures stays on this thread.
+        struct TextureLoad {
+            const std::string* uri = nullptr;
+            VkFormat format = VK_FORMAT_UNDEFINED;
+            ImageRGBA8 image;
+            bool ok = false;
         };
-
-        createFromGltfOrSolid(gltf.material.baseColorUri, baseColorTex, VK_FORMAT_R8G8B8A8_SRGB, 255, 255, 255, 255);
-        createFromGltfOrSolid(gltf.material.normalUri, normalTex, VK_FORMAT_R8G8B8A8_UNORM, 128, 128, 255, 255);
-        createFromGltfOrSolid(gltf.material.metallicRoughnessUri, metalRoughTex, VK_FORMAT_R8G8B8A8_UNORM, 0, 255, 0, 255);
+        TextureLoad loads[3] = { { &gltf.material.baseColorUri, VK_FORMAT_R8G8B8A8_SRGB },
+                                 { &gltf.material.normalUri, VK_FORMAT_R8G8B8A8_UNORM },
+                                 { &gltf.material.metallicRoughnessUri, VK_FORMAT_R8G8B8A8_UNORM } };
+        jobs->parallelFor(3, 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+            for (uint32_t i = begin; i < end; ++i) {
+                CFGC_ZONE("Decode texture");
+                std::string loadErr;
+                loads[i].ok = !loads[i].uri->empty() && loadImageRGBA8_WIC(std::string("assets/") + *loads[i].uri, loads[i].image, loadErr);
+            }
+        });
+        uint32_t* slots[3] = { &sceneMaterial.baseColorTex, &sceneMaterial.normalTex, &sceneMaterial.metalRoughTex };
+        for (uint32_t i = 0; i < 3; ++i)
+            *slots[i] = loads[i].ok ? addTexture(vk, loads[i].image, loads[i].format) : ShaderLayout::INVALID_TEXTURE;
     } else {
+        // The fallbacks are a single mesh placed once at the origin.
+        GltfMesh& mesh = meshes.emplace_back();
         ObjMeshData obj;
         std::string objErr;
         if (loadObj("assets/map.obj", obj, objErr)) {
-            verts.reserve(obj.vertices.size());
+            mesh.vertices.reserve(obj.vertices.size());
             for (auto& v : obj.vertices) {
-                verts.push_back(Vertex{ v.pos, v.nrm, v.uv });
+                mesh.vertices.push_back(Vertex{ v.pos, v.nrm, v.uv });
             }
-            idx = std::move(obj.indices);
+            mesh.indices = std::move(obj.indices);
         } else {
-            verts = {
+            mesh.vertices = {
                 { { -50, 0, -50 }, { 0, 1, 0 }, { 0, 0 } },
                 { { 50, 0, -50 }, { 0, 1, 0 }, { 1, 0 } },
                 { { 50, 0, 50 }, { 0, 1, 0 }, { 1, 1 } },
                 { { -50, 0, 50 }, { 0, 1, 0 }, { 0, 1 } },
             };
-            idx = { 0, 1, 2, 0, 2, 3 };
+            mesh.indices = { 0, 1, 2, 0, 2, 3 };
         }
+        GltfNode& root = loadedNodes.emplace_back();
+        root.mesh = 0;
     }
 
-    sceneMesh.create(vk, upload, verts, idx);
-    upload.endFrame(vk);
+    // Every mesh is stored once however many nodes place it; nodes only add transforms.
+    geometry.init(vk);
+    loadedMeshes.clear();
+    sceneTriangleCount = 0;
+    size_t chunkTotal = 0;
+    for (GltfMesh& mesh : meshes) {
+        const std::vector<MeshChunk> chunks = partitionMesh(mesh.vertices, mesh.indices);
+        SceneMesh& sm = loadedMeshes.emplace_back();
+        sm.firstMeshId = geometry.addMeshGroup(vk, upload, mesh.vertices, mesh.indices, chunks);
+        if (sm.firstMeshId != GeometryPool::kInvalidMesh)
+            sm.chunkCount = (uint32_t)chunks.size();
+        sceneTriangleCount += mesh.indices.size() / 3;
+        chunkTotal += chunks.size();
+    }
+    geometry.flush(upload);
+    CFGC_LOGF("Scene: %llu unique triangles in %zu meshes (%zu chunks), %zu nodes", (unsigned long long)sceneTriangleCount,
+              loadedMeshes.size(), chunkTotal, loadedNodes.size());
 
-    vkQueueWaitIdle(vk.graphicsQueue());
+    materials.clear();
+    materials.push_back(sceneMaterial);
+
+    upload.endFrame(vk);
 }
 
 void Renderer::destroyScene(VulkanContext& vk)
 {
-    sceneMesh.destroy(vk);
-    baseColorTex.destroy(vk);
-    normalTex.destroy(vk);
-    metalRoughTex.destroy(vk);
+    geometry.shutdown(vk);
+    loadedMeshes.clear();
+    loadedNodes.clear();
+    sceneTriangleCount = 0;
+    for (Texture& t : textures)
+        t.destroy(vk);
+    textures.clear();
+    materials.clear();
+}
+
+uint32_t Renderer::addTexture(VulkanContext& vk, const ImageRGBA8& img, VkFormat format)
+{
+    if (textures.size() >= maxBindlessTextures)
+        return ShaderLayout::INVALID_TEXTURE;
+
+    Texture tex;
+    if (!createTexture2D(vk, upload, tex, img.width, img.height, format, img.pixels.data()))
+        return ShaderLayout::INVALID_TEXTURE;
+    textures.push_back(tex);
+    return (uint32_t)textures.size() - 1;
 }
 
 void Renderer::createFrameResources(VulkanContext& vk)
 {
     VkDevice dev = vk.device();
-    VkPhysicalDevice phys = vk.physicalDevice();
 
-    VkDescriptorSetLayoutBinding bs[3]{};
+    VkDescriptorSetLayoutBinding bs[4]{};
 
     bs[0].binding = ShaderLayout::BIND_CAMERA;
     bs[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -299,8 +340,14 @@ void Renderer::createFrameResources(VulkanContext& vk)
     bs[2].descriptorCount = 1;
     bs[2].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
+    // Written in createGpuDrivenResources, which owns the per-frame draw data buffer.
+    bs[3].binding = ShaderLayout::BIND_DRAWS;
+    bs[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bs[3].descriptorCount = 1;
+    bs[3].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
     VkDescriptorSetLayoutCreateInfo lci{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-    lci.bindingCount = 3;
+    lci.bindingCount = 4;
     lci.pBindings = bs;
     vkCheck(vkCreateDescriptorSetLayout(dev, &lci, nullptr, &frameSetLayout), "vkCreateDescriptorSetLayout(frameSetLayout)");
 
@@ -308,7 +355,7 @@ void Renderer::createFrameResources(VulkanContext& vk)
     ps[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     ps[0].descriptorCount = kFramesInFlight * 2;
     ps[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    ps[1].descriptorCount = kFramesInFlight;
+    ps[1].descriptorCount = kFramesInFlight * 2;
 
     VkDescriptorPoolCreateInfo pci{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
     pci.maxSets = kFramesInFlight;
@@ -330,25 +377,23 @@ void Renderer::createFrameResources(VulkanContext& vk)
 
     constexpr VkDeviceSize CAMERA_SIZE = sizeof(ShaderLayout::CameraUBO);
     constexpr VkDeviceSize LIGHT_SIZE = sizeof(ShaderLayout::LightUBO);
-    constexpr VkDeviceSize TRANSFORM_SSBO_SIZE = sizeof(glm::mat4) * 4096ull;
+    instanceCapacity = 4096;
+    createBuffer(vk.allocator(), sizeof(glm::mat4) * (VkDeviceSize)instanceCapacity,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instanceBuffer, instanceMem, "vkCreateBuffer(instances)");
 
     for (uint32_t i = 0; i < kFramesInFlight; ++i) {
         frames[i].frameSet = sets[i];
 
-        createBuffer(dev, phys, CAMERA_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        createBuffer(vk.allocator(), CAMERA_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frames[i].cameraUbo,
                      frames[i].cameraUboMem, "vkCreateBuffer(camera ubo)");
-        frames[i].cameraUboMapped = mapMemory(dev, frames[i].cameraUboMem, CAMERA_SIZE);
+        frames[i].cameraUboMapped = frames[i].cameraUboMem.mapped;
 
-        createBuffer(dev, phys, LIGHT_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        createBuffer(vk.allocator(), LIGHT_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frames[i].lightUbo, frames[i].lightUboMem,
                      "vkCreateBuffer(light ubo)");
-        frames[i].lightUboMapped = mapMemory(dev, frames[i].lightUboMem, LIGHT_SIZE);
-
-        createBuffer(dev, phys, TRANSFORM_SSBO_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frames[i].transformSsbo,
-                     frames[i].transformSsboMem, "vkCreateBuffer(transform ssbo)");
-        frames[i].transformSsboMapped = mapMemory(dev, frames[i].transformSsboMem, TRANSFORM_SSBO_SIZE);
+        frames[i].lightUboMapped = frames[i].lightUboMem.mapped;
 
         VkDescriptorBufferInfo camBI{};
         camBI.buffer = frames[i].cameraUbo;
@@ -361,9 +406,9 @@ void Renderer::createFrameResources(VulkanContext& vk)
         lightBI.range = LIGHT_SIZE;
 
         VkDescriptorBufferInfo tbi{};
-        tbi.buffer = frames[i].transformSsbo;
+        tbi.buffer = instanceBuffer;
         tbi.offset = 0;
-        tbi.range = TRANSFORM_SSBO_SIZE;
+        tbi.range = VK_WHOLE_SIZE;
 
         VkWriteDescriptorSet ws[3]{};
 
@@ -389,6 +434,7 @@ void Renderer::createFrameResources(VulkanContext& vk)
         ws[2].pBufferInfo = &tbi;
 
         vkUpdateDescriptorSets(dev, 3, ws, 0, nullptr);
+        frames[i].boundInstanceBuffer = instanceBuffer;
     }
 }
 
@@ -396,35 +442,23 @@ void Renderer::destroyFrameResources(VulkanContext& vk)
 {
     VkDevice dev = vk.device();
     for (uint32_t i = 0; i < kFramesInFlight; ++i) {
-        if (frames[i].cameraUboMapped) {
-            vkUnmapMemory(dev, frames[i].cameraUboMem);
-            frames[i].cameraUboMapped = nullptr;
-        }
         if (frames[i].cameraUbo)
             vkDestroyBuffer(dev, frames[i].cameraUbo, nullptr);
-        if (frames[i].cameraUboMem)
-            vkFreeMemory(dev, frames[i].cameraUboMem, nullptr);
+        vk.allocator().free(frames[i].cameraUboMem);
 
-        if (frames[i].lightUboMapped) {
-            vkUnmapMemory(dev, frames[i].lightUboMem);
-            frames[i].lightUboMapped = nullptr;
-        }
         if (frames[i].lightUbo)
             vkDestroyBuffer(dev, frames[i].lightUbo, nullptr);
-        if (frames[i].lightUboMem)
-            vkFreeMemory(dev, frames[i].lightUboMem, nullptr);
-
-        if (frames[i].transformSsboMapped) {
-            vkUnmapMemory(dev, frames[i].transformSsboMem);
-            frames[i].transformSsboMapped = nullptr;
-        }
-        if (frames[i].transformSsbo)
-            vkDestroyBuffer(dev, frames[i].transformSsbo, nullptr);
-        if (frames[i].transformSsboMem)
-            vkFreeMemory(dev, frames[i].transformSsboMem, nullptr);
+        vk.allocator().free(frames[i].lightUboMem);
 
         frames[i] = {};
     }
+    if (instanceBuffer)
+        vkDestroyBuffer(dev, instanceBuffer, nullptr);
+    vk.allocator().free(instanceMem);
+    instanceBuffer = {};
+    instanceMem = {};
+    instanceCapacity = 0;
+    pendingTransformUploads.clear();
     if (framePool)
         vkDestroyDescriptorPool(dev, framePool, nullptr);
     if (frameSetLayout)
@@ -436,30 +470,38 @@ void Renderer::destroyFrameResources(VulkanContext& vk)
 void Renderer::createMaterialResources(VulkanContext& vk)
 {
     VkDevice dev = vk.device();
-    VkPhysicalDevice phys = vk.physicalDevice();
 
-    VkDescriptorSetLayoutBinding bs[4]{};
-    for (uint32_t i = 0; i < 3; ++i) {
-        bs[i].binding = i;
-        bs[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        bs[i].descriptorCount = 1;
-        bs[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-    }
-    bs[3].binding = ShaderLayout::BIND_MATERIAL;
-    bs[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    bs[3].descriptorCount = 1;
-    bs[3].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    const uint32_t textureSlots = std::max(maxBindlessTextures, 1u);
+
+    VkDescriptorSetLayoutBinding bs[2]{};
+    bs[0].binding = ShaderLayout::BIND_MATERIALS;
+    bs[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bs[0].descriptorCount = 1;
+    bs[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    bs[1].binding = ShaderLayout::BIND_TEXTURES;
+    bs[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bs[1].descriptorCount = textureSlots;
+    bs[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorBindingFlags bindFlags[2]{};
+    bindFlags[1] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bfci{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO };
+    bfci.bindingCount = 2;
+    bfci.pBindingFlags = bindFlags;
 
     VkDescriptorSetLayoutCreateInfo lci{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-    lci.bindingCount = 4;
+    lci.pNext = &bfci;
+    lci.bindingCount = 2;
     lci.pBindings = bs;
     vkCheck(vkCreateDescriptorSetLayout(dev, &lci, nullptr, &materialSetLayout), "vkCreateDescriptorSetLayout(materialSetLayout)");
 
     VkDescriptorPoolSize ps[2]{};
-    ps[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    ps[0].descriptorCount = 3;
-    ps[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    ps[1].descriptorCount = 1;
+    ps[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    ps[0].descriptorCount = 1;
+    ps[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    ps[1].descriptorCount = textureSlots;
 
     VkDescriptorPoolCreateInfo pci{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
     pci.maxSets = 1;
@@ -467,83 +509,65 @@ void Renderer::createMaterialResources(VulkanContext& vk)
     pci.pPoolSizes = ps;
     vkCheck(vkCreateDescriptorPool(dev, &pci, nullptr, &materialPool), "vkCreateDescriptorPool(materialPool)");
 
+    VkDescriptorSetVariableDescriptorCountAllocateInfo vci{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO };
+    vci.descriptorSetCount = 1;
+    vci.pDescriptorCounts = &textureSlots;
+
     VkDescriptorSetAllocateInfo asi{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    asi.pNext = &vci;
     asi.descriptorPool = materialPool;
     asi.descriptorSetCount = 1;
     asi.pSetLayouts = &materialSetLayout;
     vkCheck(vkAllocateDescriptorSets(dev, &asi, &materialSet), "vkAllocateDescriptorSets(materialSet)");
 
-    constexpr VkDeviceSize MAT_SIZE = sizeof(ShaderLayout::MaterialUBO);
-    createBuffer(dev, phys, MAT_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, materialUbo, materialUboMem,
-                 "vkCreateBuffer(material ubo)");
-    materialUboMapped = mapMemory(dev, materialUboMem, MAT_SIZE);
-
-    VkDescriptorImageInfo imgBase{};
-    imgBase.sampler = baseColorTex.sampler;
-    imgBase.imageView = baseColorTex.view;
-    imgBase.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-    VkDescriptorImageInfo imgNrm{};
-    imgNrm.sampler = normalTex.sampler;
-    imgNrm.imageView = normalTex.view;
-    imgNrm.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    if (materials.empty())
+        materials.push_back(ShaderLayout::MaterialGPU{});
 
-    VkDescriptorImageInfo imgMR{};
-    imgMR.sampler = metalRoughTex.sampler;
-    imgMR.imageView = metalRoughTex.view;
-    imgMR.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    const VkDeviceSize matBytes = sizeof(ShaderLayout::MaterialGPU) * (VkDeviceSize)materials.size();
+    createBuffer(vk.allocator(), matBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, materialSsbo, materialSsboMem,
+                 "vkCreateBuffer(material table)");
+    std::memcpy(materialSsboMem.mapped, materials.data(), (size_t)matBytes);
 
     VkDescriptorBufferInfo mbi{};
-    mbi.buffer = materialUbo;
+    mbi.buffer = materialSsbo;
     mbi.offset = 0;
-    mbi.range = MAT_SIZE;
+    mbi.range = matBytes;
 
-    VkWriteDescriptorSet ws[4]{};
+    std::vector<VkDescriptorImageInfo> imgs(textures.size());
+    for (size_t i = 0; i < textures.size(); ++i) {
+        imgs[i].sampler = textures[i].sampler;
+        imgs[i].imageView = textures[i].view;
+        imgs[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+
+    VkWriteDescriptorSet ws[2]{};
     ws[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     ws[0].dstSet = materialSet;
-    ws[0].dstBinding = ShaderLayout::BIND_BASE_COLOR;
+    ws[0].dstBinding = ShaderLayout::BIND_MATERIALS;
     ws[0].descriptorCount = 1;
-    ws[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    ws[0].pImageInfo = &imgBase;
+    ws[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    ws[0].pBufferInfo = &mbi;
 
     ws[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     ws[1].dstSet = materialSet;
-    ws[1].dstBinding = ShaderLayout::BIND_NORMAL;
-    ws[1].descriptorCount = 1;
+    ws[1].dstBinding = ShaderLayout::BIND_TEXTURES;
+    ws[1].dstArrayElement = 0;
+    ws[1].descriptorCount = (uint32_t)imgs.size();
     ws[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    ws[1].pImageInfo = &imgNrm;
-
-    ws[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    ws[2].dstSet = materialSet;
-    ws[2].dstBinding = ShaderLayout::BIND_METAL_ROUGH;
-    ws[2].descriptorCount = 1;
-    ws[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    ws[2].pImageInfo = &imgMR;
-
-    ws[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    ws[3].dstSet = materialSet;
-    ws[3].dstBinding = ShaderLayout::BIND_MATERIAL;
-    ws[3].descriptorCount = 1;
-    ws[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    ws[3].pBufferInfo = &mbi;
-
-    vkUpdateDescriptorSets(dev, 4, ws, 0, nullptr);
+    ws[1].pImageInfo = imgs.data();
+
+    vkUpdateDescriptorSets(dev, imgs.empty() ? 1u : 2u, ws, 0, nullptr);
 }
 
 void Renderer::destroyMaterialResources(VulkanContext& vk)
 {
     VkDevice dev = vk.device();
-    if (materialUboMapped) {
-        vkUnmapMemory(dev, materialUboMem);
-        materialUboMapped = nullptr;
-    }
-    if (materialUbo)
-        vkDestroyBuffer(dev, materialUbo, nullptr);
-    if (materialUboMem)
-        vkFreeMemory(dev, materialUboMem, nullptr);
-    materialUbo = {};
-    materialUboMem = {};
+    if (materialSsbo)
+        vkDestroyBuffer(dev, materialSsbo, nullptr);
+    vk.allocator().free(materialSsboMem);
+    materialSsbo = {};
+    materialSsboMem = {};
 
     if (materialPool)
         vkDestroyDescriptorPool(dev, materialPool, nullptr);
@@ -557,25 +581,9 @@ void Renderer::destroyMaterialResources(VulkanContext& vk)
 void Renderer::createGpuDrivenResources(VulkanContext& vk)
 {
     VkDevice dev = vk.device();
-    VkPhysicalDevice phys = vk.physicalDevice();
 
     {
-        const glm::vec3 bmin = sceneMesh.boundsMin();
-        const glm::vec3 bmax = sceneMesh.boundsMax();
-        const glm::vec3 center = (bmin + bmax) * 0.5f;
-        const float radius = glm::length(bmax - center);
-        const glm::vec4 centerRadius(center, radius);
-
-        createBuffer(dev, phys, sizeof(glm::vec4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, meshBoundsSsbo, meshBoundsMem,
-                     "vkCreateBuffer(mesh bounds)");
-        void* mapped = mapMemory(dev, meshBoundsMem, sizeof(glm::vec4));
-        std::memcpy(mapped, &centerRadius, sizeof(glm::vec4));
-        vkUnmapMemory(dev, meshBoundsMem);
-    }
-
-    {
-        VkDescriptorSetLayoutBinding b[6]{};
+        VkDescriptorSetLayoutBinding b[9]{};
         b[0].binding = 0;
         b[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
         b[0].descriptorCount = 1;
@@ -606,8 +614,24 @@ void Renderer::createGpuDrivenResources(VulkanContext& vk)
         b[5].descriptorCount = 1;
         b[5].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
+        b[6].binding = 6;
+        b[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        b[6].descriptorCount = 1;
+        b[6].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        b[7].binding = 7;
+        b[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        b[7].descriptorCount = 1;
+        b[7].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        // Hi-Z pyramid, written in createHiZResources since it follows the swapchain size.
+        b[8].binding = 8;
+        b[8].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        b[8].descriptorCount = 1;
+        b[8].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
         VkDescriptorSetLayoutCreateInfo lci{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-        lci.bindingCount = 6;
+        lci.bindingCount = 9;
         lci.pBindings = b;
         vkCheck(vkCreateDescriptorSetLayout(dev, &lci, nullptr, &cullSetLayout), "vkCreateDescriptorSetLayout(cull)");
     }
@@ -615,40 +639,52 @@ void Renderer::createGpuDrivenResources(VulkanContext& vk)
     {
         VkDescriptorPoolSize ps[3]{};
         ps[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        ps[0].descriptorCount = kFramesInFlight * 5;
+        ps[0].descriptorCount = kFramesInFlight * 7;
         ps[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
         ps[1].descriptorCount = kFramesInFlight * 1;
+        ps[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        ps[2].descriptorCount = kFramesInFlight * 1;
 
         VkDescriptorPoolCreateInfo pci{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
         pci.maxSets = kFramesInFlight;
-        pci.poolSizeCount = 2;
+        pci.poolSizeCount = 3;
         pci.pPoolSizes = ps;
         vkCheck(vkCreateDescriptorPool(dev, &pci, nullptr, &cullPool), "vkCreateDescriptorPool(cull)");
     }
 
     for (uint32_t fi = 0; fi < kFramesInFlight; ++fi) {
         constexpr VkDeviceSize CULL_UBO_SIZE = sizeof(CullingUBO);
-        createBuffer(dev, phys, CULL_UBO_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        createBuffer(vk.allocator(), CULL_UBO_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frames[fi].cullUbo, frames[fi].cullUboMem,
                      "vkCreateBuffer(cull ubo)");
-        frames[fi].cullUboMapped = mapMemory(dev, frames[fi].cullUboMem, CULL_UBO_SIZE);
+        frames[fi].cullUboMapped = frames[fi].cullUboMem.mapped;
 
         const uint32_t initialDraws = 1024;
         frames[fi].indirectMaxDraws = initialDraws;
 
-        createBuffer(dev, phys, sizeof(uint32_t) * initialDraws, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frames[fi].drawTransformSsbo,
-                     frames[fi].drawTransformSsboMem, "vkCreateBuffer(draw transforms)");
-        frames[fi].drawTransformSsboMapped = mapMemory(dev, frames[fi].drawTransformSsboMem, sizeof(uint32_t) * initialDraws);
+        createBuffer(vk.allocator(), sizeof(ShaderLayout::DrawData) * initialDraws, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frames[fi].drawDataSsbo,
+                     frames[fi].drawDataSsboMem, "vkCreateBuffer(draw data)");
+        frames[fi].drawDataSsboMapped = frames[fi].drawDataSsboMem.mapped;
 
-        createBuffer(dev, phys, sizeof(VkDrawIndexedIndirectCommand) * initialDraws,
+        createBuffer(vk.allocator(), sizeof(VkDrawIndexedIndirectCommand) * initialDraws * 2,
                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                      frames[fi].indirectCmdBuffer, frames[fi].indirectCmdMem, "vkCreateBuffer(indirect)");
 
-        createBuffer(dev, phys, sizeof(uint32_t),
+        createBuffer(vk.allocator(), sizeof(uint32_t) * initialDraws, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frames[fi].occlusionFlagsBuffer, frames[fi].occlusionFlagsMem,
+                     "vkCreateBuffer(occlusion flags)");
+
+        createBuffer(vk.allocator(), sizeof(uint32_t) * 2,
                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frames[fi].drawCountBuffer, frames[fi].drawCountMem, "vkCreateBuffer(drawCount)");
 
+        createBuffer(vk.allocator(), sizeof(GpuCullStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frames[fi].cullStatsBuffer,
+                     frames[fi].cullStatsMem, "vkCreateBuffer(cull stats)");
+        frames[fi].cullStatsMapped = frames[fi].cullStatsMem.mapped;
+        std::memset(frames[fi].cullStatsMapped, 0, sizeof(GpuCullStats));
+
         VkDescriptorSetAllocateInfo asi{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
         asi.descriptorPool = cullPool;
         asi.descriptorSetCount = 1;
@@ -658,12 +694,12 @@ void Renderer::createGpuDrivenResources(VulkanContext& vk)
 
     for (uint32_t fi = 0; fi < kFramesInFlight; ++fi) {
         VkDescriptorBufferInfo transforms{};
-        transforms.buffer = frames[fi].transformSsbo;
+        transforms.buffer = instanceBuffer;
         transforms.offset = 0;
         transforms.range = VK_WHOLE_SIZE;
 
         VkDescriptorBufferInfo drawX{};
-        drawX.buffer = frames[fi].drawTransformSsbo;
+        drawX.buffer = frames[fi].drawDataSsbo;
         drawX.offset = 0;
         drawX.range = VK_WHOLE_SIZE;
 
@@ -672,10 +708,10 @@ void Renderer::createGpuDrivenResources(VulkanContext& vk)
         cullU.offset = 0;
         cullU.range = sizeof(CullingUBO);
 
-        VkDescriptorBufferInfo bounds{};
-        bounds.buffer = meshBoundsSsbo;
-        bounds.offset = 0;
-        bounds.range = sizeof(glm::vec4);
+        VkDescriptorBufferInfo meshTable{};
+        meshTable.buffer = geometry.meshTableBuffer();
+        meshTable.offset = 0;
+        meshTable.range = VK_WHOLE_SIZE;
 
         VkDescriptorBufferInfo outCmd{};
         VkDescriptorBufferInfo countB{};
@@ -685,10 +721,20 @@ void Renderer::createGpuDrivenResources(VulkanContext& vk)
 
         countB.buffer = frames[fi].drawCountBuffer;
         countB.offset = 0;
-        countB.range = sizeof(uint32_t);
+        countB.range = sizeof(uint32_t) * 2;
 
-        VkWriteDescriptorSet ws[6]{};
-        for (int i = 0; i < 6; ++i)
+        VkDescriptorBufferInfo statsB{};
+        statsB.buffer = frames[fi].cullStatsBuffer;
+        statsB.offset = 0;
+        statsB.range = sizeof(GpuCullStats);
+
+        VkDescriptorBufferInfo flagsB{};
+        flagsB.buffer = frames[fi].occlusionFlagsBuffer;
+        flagsB.offset = 0;
+        flagsB.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet ws[8]{};
+        for (int i = 0; i < 8; ++i)
             ws[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 
         ws[0].dstSet = frames[fi].cullSet;
@@ -713,7 +759,7 @@ void Renderer::createGpuDrivenResources(VulkanContext& vk)
         ws[3].dstBinding = 3;
         ws[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
         ws[3].descriptorCount = 1;
-        ws[3].pBufferInfo = &bounds;
+        ws[3].pBufferInfo = &meshTable;
 
         ws[4].dstSet = frames[fi].cullSet;
         ws[4].dstBinding = 4;
@@ -727,9 +773,31 @@ void Renderer::createGpuDrivenResources(VulkanContext& vk)
         ws[5].descriptorCount = 1;
         ws[5].pBufferInfo = &countB;
 
-        vkUpdateDescriptorSets(dev, 6, ws, 0, nullptr);
+        ws[6].dstSet = frames[fi].cullSet;
+        ws[6].dstBinding = 6;
+        ws[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        ws[6].descriptorCount = 1;
+        ws[6].pBufferInfo = &statsB;
+
+        ws[7].dstSet = frames[fi].cullSet;
+        ws[7].dstBinding = 7;
+        ws[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        ws[7].descriptorCount = 1;
+        ws[7].pBufferInfo = &flagsB;
+
+        vkUpdateDescriptorSets(dev, 8, ws, 0, nullptr);
+        frames[fi].boundMeshTable = geometry.meshTableBuffer();
+
+        VkWriteDescriptorSet fw{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+        fw.dstSet = frames[fi].frameSet;
+        fw.dstBinding = ShaderLayout::BIND_DRAWS;
+        fw.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        fw.descriptorCount = 1;
+        fw.pBufferInfo = &drawX;
+        vkUpdateDescriptorSets(dev, 1, &fw, 0, nullptr);
     }
 
+    const Clock::time_point buildStart = Clock::now();
     VkShaderModule cullSm = makeShader(vk, "shaders/cull.comp.spv");
     VkPipelineShaderStageCreateInfo sci{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
     sci.stage = VK_SHADER_STAGE_COMPUTE_BIT;
@@ -751,8 +819,9 @@ void Renderer::createGpuDrivenResources(VulkanContext& vk)
     VkComputePipelineCreateInfo cpci{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
     cpci.stage = sci;
     cpci.layout = cullLayout;
-    vkCheck(vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &cpci, nullptr, &cullPipeline), "vkCreateComputePipelines");
+    vkCheck(vkCreateComputePipelines(dev, pipelineCache.handle(), 1, &cpci, nullptr, &cullPipeline), "vkCreateComputePipelines");
     vkDestroyShaderModule(dev, cullSm, nullptr);
+    pipelineBuildMs += msSince(buildStart);
 }
 
 void Renderer::destroyGpuDrivenResources(VulkanContext& vk)
@@ -773,102 +842,187 @@ void Renderer::destroyGpuDrivenResources(VulkanContext& vk)
     cullSetLayout = {};
 
     for (uint32_t fi = 0; fi < kFramesInFlight; ++fi) {
-        if (frames[fi].cullUboMapped) {
-            vkUnmapMemory(dev, frames[fi].cullUboMem);
-            frames[fi].cullUboMapped = nullptr;
-        }
         if (frames[fi].cullUbo)
             vkDestroyBuffer(dev, frames[fi].cullUbo, nullptr);
-        if (frames[fi].cullUboMem)
-            vkFreeMemory(dev, frames[fi].cullUboMem, nullptr);
+        vk.allocator().free(frames[fi].cullUboMem);
 
-        if (frames[fi].drawTransformSsboMapped) {
-            vkUnmapMemory(dev, frames[fi].drawTransformSsboMem);
-            frames[fi].drawTransformSsboMapped = nullptr;
-        }
-        if (frames[fi].drawTransformSsbo)
-            vkDestroyBuffer(dev, frames[fi].drawTransformSsbo, nullptr);
-        if (frames[fi].drawTransformSsboMem)
-            vkFreeMemory(dev, frames[fi].drawTransformSsboMem, nullptr);
+        if (frames[fi].drawDataSsbo)
+            vkDestroyBuffer(dev, frames[fi].drawDataSsbo, nullptr);
+        vk.allocator().free(frames[fi].drawDataSsboMem);
 
         if (frames[fi].indirectCmdBuffer)
             vkDestroyBuffer(dev, frames[fi].indirectCmdBuffer, nullptr);
-        if (frames[fi].indirectCmdMem)
-            vkFreeMemory(dev, frames[fi].indirectCmdMem, nullptr);
+        vk.allocator().free(frames[fi].indirectCmdMem);
+
+        if (frames[fi].occlusionFlagsBuffer)
+            vkDestroyBuffer(dev, frames[fi].occlusionFlagsBuffer, nullptr);
+        vk.allocator().free(frames[fi].occlusionFlagsMem);
 
         if (frames[fi].drawCountBuffer)
             vkDestroyBuffer(dev, frames[fi].drawCountBuffer, nullptr);
-        if (frames[fi].drawCountMem)
-            vkFreeMemory(dev, frames[fi].drawCountMem, nullptr);
-
+        vk.allocator().free(frames[fi].drawCountMem);
+
+        if (frames[fi].cullStatsBuffer)
+            vkDestroyBuffer(dev, frames[fi].cullStatsBuffer, nullptr);
+        vk.allocator().free(frames[fi].cullStatsMem);
+
+        frames[fi].cullUbo = {};
+        frames[fi].cullUboMem = {};
+        frames[fi].cullUboMapped = nullptr;
+        frames[fi].drawDataSsbo = {};
+        frames[fi].drawDataSsboMem = {};
+        frames[fi].drawDataSsboMapped = nullptr;
         frames[fi].indirectCmdBuffer = {};
         frames[fi].indirectCmdMem = {};
+        frames[fi].occlusionFlagsBuffer = {};
+        frames[fi].occlusionFlagsMem = {};
         frames[fi].drawCountBuffer = {};
         frames[fi].drawCountMem = {};
+        frames[fi].cullStatsBuffer = {};
+        frames[fi].cullStatsMem = {};
+        frames[fi].cullStatsMapped = nullptr;
+        frames[fi].cullStatsPending = false;
         frames[fi].indirectMaxDraws = 0;
         frames[fi].cullSet = {};
+        frames[fi].boundMeshTable = {};
     }
+}
+
+void Renderer::uploadTransforms(VulkanContext& vk, const RenderScene& scene)
+{
+    CFGC_ZONE("Renderer::uploadTransforms");
+    const uint32_t count = (uint32_t)scene.transforms.size();
+    if (pendingTransformUploads.empty() && count <= instanceCapacity)
+        return;
 
-    if (meshBoundsSsbo)
-        vkDestroyBuffer(dev, meshBoundsSsbo, nullptr);
-    if (meshBoundsMem)
-        vkFreeMemory(dev, meshBoundsMem, nullptr);
-    meshBoundsSsbo = {};
-    meshBoundsMem = {};
+    upload.beginFrame(vk);
+
+    // Earlier frames may still be reading the buffer and earlier uploads may still be writing it.
+    upload.memoryBarrier(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    if (count > instanceCapacity)
+        growInstanceBuffer(vk, count);
+
+    size_t kept = 0;
+    for (const TransformRange& r : pendingTransformUploads) {
+        if (r.first >= count)
+            continue;
+        const uint32_t n = std::min(r.count, count - r.first);
+        if (!upload.uploadToBuffer(instanceBuffer, sizeof(glm::mat4) * (VkDeviceSize)r.first, &scene.transforms[r.first],
+                                   sizeof(glm::mat4) * (VkDeviceSize)n)) {
+            pendingTransformUploads[kept++] = TransformRange{ r.first, n };
+        }
+    }
+    pendingTransformUploads.resize(kept);
+
+    upload.memoryBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    upload.endFrame(vk);
 }
 
-uint32_t Renderer::recordGpuCulling(VulkanContext& vk, VkCommandBuffer cmd, const RenderScene& scene)
+void Renderer::acquireUploads(VulkanContext& vk, VkCommandBuffer cmd)
+{
+    if (!upload.handoverPending())
+        return;
+
+    const VkBuffer buffers[] = { geometry.vertexBuffer(), geometry.indexBuffer(), geometry.meshTableBuffer() };
+    std::vector<VkImage> images;
+    images.reserve(textures.size());
+    for (const Texture& t : textures)
+        images.push_back(t.image);
+    upload.acquire(vk, cmd, buffers, images);
+}
+
+void Renderer::growInstanceBuffer(VulkanContext& vk, uint32_t minCapacity)
 {
-    if (!gpuDriven)
-        return 0;
 
+    uint32_t newCapacity = std::max(instanceCapacity, 1024u);
+    while (newCapacity < minCapacity)
+        newCapacity *= 2;
+
+    VkBuffer buf{};
+    GpuAllocation mem{};
+    createBuffer(vk.allocator(), sizeof(glm::mat4) * (VkDeviceSize)newCapacity,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buf, mem, "vkCreateBuffer(instances resize)");
+
+    // Clean transforms are only on the GPU, so carry them over before the dirty ranges land on top.
+    upload.copyBuffer(instanceBuffer, buf, 0, 0, sizeof(glm::mat4) * (VkDeviceSize)instanceCapacity);
+    upload.memoryBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    upload.destroyBuffer(vk, instanceBuffer, instanceMem);
+
+    instanceBuffer = buf;
+    instanceMem = mem;
+    instanceCapacity = newCapacity;
+}
+
+// Each frame slot rebinds on its own turn, once its last frame has retired, so the old set is no longer in use.
+void Renderer::bindInstanceBuffer(VulkanContext& vk, uint32_t fi)
+{
+    auto& fr = frames[fi];
+    if (fr.boundInstanceBuffer == instanceBuffer)
+        return;
+
+    VkDescriptorBufferInfo tbi{ instanceBuffer, 0, VK_WHOLE_SIZE };
+
+    VkWriteDescriptorSet ws[2]{};
+    ws[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    ws[0].dstSet = fr.frameSet;
+    ws[0].dstBinding = ShaderLayout::BIND_TRANSFORMS;
+    ws[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    ws[0].descriptorCount = 1;
+    ws[0].pBufferInfo = &tbi;
+
+    ws[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    ws[1].dstSet = fr.cullSet;
+    ws[1].dstBinding = 0;
+    ws[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    ws[1].descriptorCount = 1;
+    ws[1].pBufferInfo = &tbi;
+
+    vkUpdateDescriptorSets(vk.device(), 2, ws, 0, nullptr);
+    fr.boundInstanceBuffer = instanceBuffer;
+}
+
+uint32_t Renderer::writeDrawData(VulkanContext& vk, const RenderScene& scene)
+{
+    CFGC_ZONE("Renderer::writeDrawData");
     const uint32_t fi = vk.currentFrameIndex();
     const uint32_t drawCount = (uint32_t)scene.draws.size();
     if (drawCount == 0)
         return 0;
 
     VkDevice dev = vk.device();
-    VkPhysicalDevice phys = vk.physicalDevice();
 
     auto& fr = frames[fi];
     if (drawCount > fr.indirectMaxDraws) {
         const uint32_t newMax = std::max(drawCount, fr.indirectMaxDraws * 2u);
 
-        VkBuffer oldDraw = fr.drawTransformSsbo;
-        VkDeviceMemory oldDrawMem = fr.drawTransformSsboMem;
-        VkBuffer oldIndirect = fr.indirectCmdBuffer;
-        VkDeviceMemory oldIndirectMem = fr.indirectCmdMem;
-        void* oldDrawMapped = fr.drawTransformSsboMapped;
-
-        vk.frameDeletionQueue().push([dev, oldDraw, oldDrawMem, oldIndirect, oldIndirectMem]() {
-            if (oldDraw)
-                vkDestroyBuffer(dev, oldDraw, nullptr);
-            if (oldDrawMem)
-                vkFreeMemory(dev, oldDrawMem, nullptr);
-            if (oldIndirect)
-                vkDestroyBuffer(dev, oldIndirect, nullptr);
-            if (oldIndirectMem)
-                vkFreeMemory(dev, oldIndirectMem, nullptr);
-        });
+        destroyBufferDeferred(vk, fr.drawDataSsbo, fr.drawDataSsboMem);
+        destroyBufferDeferred(vk, fr.indirectCmdBuffer, fr.indirectCmdMem);
+        destroyBufferDeferred(vk, fr.occlusionFlagsBuffer, fr.occlusionFlagsMem);
 
-        if (oldDrawMapped) {
-            vkUnmapMemory(dev, oldDrawMem);
-        }
+        createBuffer(vk.allocator(), sizeof(ShaderLayout::DrawData) * newMax, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, fr.drawDataSsbo, fr.drawDataSsboMem,
+                     "vkCreateBuffer(draw data resize)");
+        fr.drawDataSsboMapped = fr.drawDataSsboMem.mapped;
 
-        createBuffer(dev, phys, sizeof(uint32_t) * newMax, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, fr.drawTransformSsbo,
-                     fr.drawTransformSsboMem, "vkCreateBuffer(draw transforms resize)");
-        fr.drawTransformSsboMapped = mapMemory(dev, fr.drawTransformSsboMem, sizeof(uint32_t) * newMax);
-
-        createBuffer(dev, phys, sizeof(VkDrawIndexedIndirectCommand) * newMax,
+        createBuffer(vk.allocator(), sizeof(VkDrawIndexedIndirectCommand) * newMax * 2,
                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                      fr.indirectCmdBuffer, fr.indirectCmdMem, "vkCreateBuffer(indirect resize)");
+        createBuffer(vk.allocator(), sizeof(uint32_t) * newMax, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                     fr.occlusionFlagsBuffer, fr.occlusionFlagsMem, "vkCreateBuffer(occlusion flags resize)");
         fr.indirectMaxDraws = newMax;
 
-        VkDescriptorBufferInfo drawX{ fr.drawTransformSsbo, 0, VK_WHOLE_SIZE };
+        VkDescriptorBufferInfo drawX{ fr.drawDataSsbo, 0, VK_WHOLE_SIZE };
         VkDescriptorBufferInfo outCmd{ fr.indirectCmdBuffer, 0, VK_WHOLE_SIZE };
+        VkDescriptorBufferInfo flags{ fr.occlusionFlagsBuffer, 0, VK_WHOLE_SIZE };
 
-        VkWriteDescriptorSet ws[2]{};
+        VkWriteDescriptorSet ws[4]{};
         ws[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         ws[0].dstSet = fr.cullSet;
         ws[0].dstBinding = 1;
@@ -883,20 +1037,82 @@ uint32_t Renderer::recordGpuCulling(VulkanContext& vk, VkCommandBuffer cmd, cons
         ws[1].descriptorCount = 1;
         ws[1].pBufferInfo = &outCmd;
 
-        vkUpdateDescriptorSets(dev, 2, ws, 0, nullptr);
+        ws[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        ws[2].dstSet = fr.frameSet;
+        ws[2].dstBinding = ShaderLayout::BIND_DRAWS;
+        ws[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        ws[2].descriptorCount = 1;
+        ws[2].pBufferInfo = &drawX;
+
+        ws[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        ws[3].dstSet = fr.cullSet;
+        ws[3].dstBinding = 7;
+        ws[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        ws[3].descriptorCount = 1;
+        ws[3].pBufferInfo = &flags;
+
+        vkUpdateDescriptorSets(dev, 4, ws, 0, nullptr);
     }
 
-    uint32_t* outT = reinterpret_cast<uint32_t*>(fr.drawTransformSsboMapped);
-    uint32_t written = 0;
+    // Filtered on the CPU side so both paths can address draws by slot, then copied to the mapped buffer in one go.
+    drawScratch.clear();
+    drawScratch.reserve(drawCount);
+    uint64_t trianglesTotal = 0;
     for (const DrawItem& d : scene.draws) {
-        if (d.meshId != 0)
+        if (!geometry.valid(d.meshId))
             continue;
         if (d.transformIndex >= scene.transforms.size())
             continue;
-        outT[written++] = d.transformIndex;
+        ShaderLayout::DrawData dd{};
+        dd.meshId = d.meshId;
+        dd.materialId = d.materialId < materials.size() ? d.materialId : 0u;
+        dd.transformIndex = d.transformIndex;
+        dd.baseColorFactor = d.baseColorFactor;
+        dd.metallicRoughnessFactor = d.metallicRoughnessFactor;
+        drawScratch.push_back(dd);
+        trianglesTotal += geometry.mesh(d.meshId).indexCount / 3;
     }
 
-    const uint32_t finalDrawCount = written;
+    if (!drawScratch.empty())
+        std::memcpy(fr.drawDataSsboMapped, drawScratch.data(), sizeof(ShaderLayout::DrawData) * drawScratch.size());
+
+    drawTrianglesTotal = trianglesTotal;
+    return (uint32_t)drawScratch.size();
+}
+
+uint32_t Renderer::recordGpuCulling(VulkanContext& vk,
+                                    VkCommandBuffer cmd,
+                                    const RenderScene& scene,
+                                    uint32_t drawCount,
+                                    bool occlusionTest)
+{
+    const uint32_t fi = vk.currentFrameIndex();
+    VkDevice dev = vk.device();
+
+    auto& fr = frames[fi];
+    if (fr.cullStatsPending) {
+        GpuCullStats st{};
+        std::memcpy(&st, fr.cullStatsMapped, sizeof(st));
+        lastCullStats.drawsTotal = fr.cullStatsDrawsTotal;
+        lastCullStats.drawsVisible = st.visibleDraws;
+        lastCullStats.trianglesTotal = fr.cullStatsTrianglesTotal;
+        lastCullStats.trianglesVisible = st.visibleTriangles;
+        fr.cullStatsPending = false;
+    }
+
+    if (fr.boundMeshTable != geometry.meshTableBuffer()) {
+        VkDescriptorBufferInfo meshes{ geometry.meshTableBuffer(), 0, VK_WHOLE_SIZE };
+        VkWriteDescriptorSet w{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+        w.dstSet = fr.cullSet;
+        w.dstBinding = 3;
+        w.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        w.descriptorCount = 1;
+        w.pBufferInfo = &meshes;
+        vkUpdateDescriptorSets(dev, 1, &w, 0, nullptr);
+        fr.boundMeshTable = geometry.meshTableBuffer();
+    }
+
+    const uint32_t finalDrawCount = drawCount;
     if (finalDrawCount == 0)
         return 0;
 
@@ -906,9 +1122,12 @@ uint32_t Renderer::recordGpuCulling(VulkanContext& vk, VkCommandBuffer cmd, cons
     for (int i = 0; i < 6; ++i) {
         u.planes[i] = frPlanes.p[(size_t)i];
     }
+    u.viewProj = vp;
+    u.prevViewProj = hizViewProj;
+    u.pyramidSize = glm::vec4((float)hizExtent.width, (float)hizExtent.height, (float)hizLevels, 0.0f);
     std::memcpy(fr.cullUboMapped, &u, sizeof(u));
 
-    vkCmdFillBuffer(cmd, fr.drawCountBuffer, 0, sizeof(uint32_t), 0);
+    vkCmdFillBuffer(cmd, fr.drawCountBuffer, 0, sizeof(uint32_t) * 2, 0);
     VkBufferMemoryBarrier countReset{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
     countReset.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
     countReset.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
@@ -916,7 +1135,7 @@ uint32_t Renderer::recordGpuCulling(VulkanContext& vk, VkCommandBuffer cmd, cons
     countReset.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     countReset.buffer = fr.drawCountBuffer;
     countReset.offset = 0;
-    countReset.size = sizeof(uint32_t);
+    countReset.size = sizeof(uint32_t) * 2;
     vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &countReset, 0,
                          nullptr);
 
@@ -925,33 +1144,400 @@ uint32_t Renderer::recordGpuCulling(VulkanContext& vk, VkCommandBuffer cmd, cons
 
     CullPush pc{};
     pc.drawCount = finalDrawCount;
-    pc.indexCount = sceneMesh.indexCount();
+    pc.meshCount = geometry.meshCount();
+    pc.phase = 0;
+    pc.occlusion = occlusionTest ? 1u : 0u;
+    pc.cmdBase = 0;
     vkCmdPushConstants(cmd, cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
 
+    std::memset(fr.cullStatsMapped, 0, sizeof(GpuCullStats));
+
     const uint32_t groups = (finalDrawCount + 63u) / 64u;
     vkCmdDispatch(cmd, groups, 1, 1);
 
+    VkMemoryBarrier statsRead{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    statsRead.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    statsRead.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &statsRead, 0, nullptr, 0,
+                         nullptr);
+
+    fr.cullStatsDrawsTotal = finalDrawCount;
+    fr.cullStatsTrianglesTotal = drawTrianglesTotal;
+    fr.cullStatsPending = true;
+
     return finalDrawCount;
 }
 
+void Renderer::recordLateCulling(VulkanContext& vk, VkCommandBuffer cmd, uint32_t drawCount)
+{
+    if (drawCount == 0)
+        return;
+
+    auto& fr = frames[vk.currentFrameIndex()];
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullLayout, 0, 1, &fr.cullSet, 0, nullptr);
+
+    CullPush pc{};
+    pc.drawCount = drawCount;
+    pc.meshCount = geometry.meshCount();
+    pc.phase = 1;
+    pc.occlusion = 1;
+    pc.cmdBase = fr.indirectMaxDraws;
+    vkCmdPushConstants(cmd, cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+
+    vkCmdDispatch(cmd, (drawCount + 63u) / 64u, 1, 1);
+
+    VkMemoryBarrier statsRead{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    statsRead.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    statsRead.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &statsRead, 0, nullptr, 0,
+                         nullptr);
+}
+
+void Renderer::createHiZPipeline(VulkanContext& vk)
+{
+    VkDevice dev = vk.device();
+    const Clock::time_point buildStart = Clock::now();
+
+    {
+        VkDescriptorSetLayoutBinding b[2]{};
+        b[0].binding = 0;
+        b[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        b[0].descriptorCount = 1;
+        b[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        b[1].binding = 1;
+        b[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        b[1].descriptorCount = 1;
+        b[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutCreateInfo lci{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+        lci.bindingCount = 2;
+        lci.pBindings = b;
+        vkCheck(vkCreateDescriptorSetLayout(dev, &lci, nullptr, &hizSetLayout), "vkCreateDescriptorSetLayout(hiz)");
+    }
+
+    VkShaderModule sm = makeShader(vk, "shaders/hiz.comp.spv");
+
+    VkPushConstantRange pcr{};
+    pcr.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pcr.offset = 0;
+    pcr.size = sizeof(HiZPush);
+
+    VkPipelineLayoutCreateInfo plci{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    plci.setLayoutCount = 1;
+    plci.pSetLayouts = &hizSetLayout;
+    plci.pushConstantRangeCount = 1;
+    plci.pPushConstantRanges = &pcr;
+    vkCheck(vkCreatePipelineLayout(dev, &plci, nullptr, &hizLayout), "vkCreatePipelineLayout(hiz)");
+
+    VkComputePipelineCreateInfo cpci{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    cpci.stage = shaderStage(VK_SHADER_STAGE_COMPUTE_BIT, sm);
+    cpci.layout = hizLayout;
+    vkCheck(vkCreateComputePipelines(dev, pipelineCache.handle(), 1, &cpci, nullptr, &hizPipeline), "vkCreateComputePipelines(hiz)");
+    vkDestroyShaderModule(dev, sm, nullptr);
+    pipelineBuildMs += msSince(buildStart);
+}
+
+void Renderer::destroyHiZPipeline(VulkanContext& vk)
+{
+    const VkDevice dev = vk.device();
+    vk.frameDeletionQueue().push([dev, pipeline = hizPipeline, layout = hizLayout, setLayout = hizSetLayout]() {
+        if (pipeline)
+            vkDestroyPipeline(dev, pipeline, nullptr);
+        if (layout)
+            vkDestroyPipelineLayout(dev, layout, nullptr);
+        if (setLayout)
+            vkDestroyDescriptorSetLayout(dev, setLayout, nullptr);
+    });
+    hizPipeline = {};
+    hizLayout = {};
+    hizSetLayout = {};
+}
+
+void Renderer::createHiZResources(VulkanContext& vk)
+{
+    VkDevice dev = vk.device();
+
+    // Level 0 is half the depth resolution; each texel holds the farthest depth of the region it covers.
+    const VkExtent2D ext = vk.swapchainExtent();
+    hizExtent = { std::max(ext.width / 2u, 1u), std::max(ext.height / 2u, 1u) };
+    hizLevels = 1;
+    while ((hizExtent.width >> hizLevels) > 0 || (hizExtent.height >> hizLevels) > 0)
+        ++hizLevels;
+
+    VkImageCreateInfo ici{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    ici.imageType = VK_IMAGE_TYPE_2D;
+    ici.format = VK_FORMAT_R32_SFLOAT;
+    ici.extent = VkExtent3D{ hizExtent.width, hizExtent.height, 1 };
+    ici.mipLevels = hizLevels;
+    ici.arrayLayers = 1;
+    ici.samples = VK_SAMPLE_COUNT_1_BIT;
+    ici.tiling = VK_IMAGE_TILING_OPTIMAL;
+    ici.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    createImage2D(vk.allocator(), ici, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, hizImage, hizMem, "vkCreateImage(hiz)");
+
+    VkImageViewCreateInfo vci{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    vci.image = hizImage;
+    vci.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    vci.format = VK_FORMAT_R32_SFLOAT;
+    vci.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    vci.subresourceRange.levelCount = hizLevels;
+    vci.subresourceRange.layerCount = 1;
+    vkCheck(vkCreateImageView(dev, &vci, nullptr, &hizView), "vkCreateImageView(hiz)");
+
+    hizMipViews.resize(hizLevels);
+    for (uint32_t i = 0; i < hizLevels; ++i) {
+        vci.subresourceRange.baseMipLevel = i;
+        vci.subresourceRange.levelCount = 1;
+        vkCheck(vkCreateImageView(dev, &vci, nullptr, &hizMipViews[i]), "vkCreateImageView(hiz mip)");
+    }
+    hizImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkSamplerCreateInfo sci{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    sci.magFilter = VK_FILTER_NEAREST;
+    sci.minFilter = VK_FILTER_NEAREST;
+    sci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sci.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sci.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sci.maxLod = (float)hizLevels;
+    sci.maxAnisotropy = 1.0f;
+    vkCheck(vkCreateSampler(dev, &sci, nullptr, &hizSampler), "vkCreateSampler(hiz)");
+
+    {
+        VkDescriptorPoolSize ps[2]{};
+        ps[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        ps[0].descriptorCount = hizLevels;
+        ps[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        ps[1].descriptorCount = hizLevels;
+
+        VkDescriptorPoolCreateInfo pci{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+        pci.maxSets = hizLevels;
+        pci.poolSizeCount = 2;
+        pci.pPoolSizes = ps;
+        vkCheck(vkCreateDescriptorPool(dev, &pci, nullptr, &hizPool), "vkCreateDescriptorPool(hiz)");
+    }
+
+    std::vector<VkDescriptorSetLayout> layouts(hizLevels, hizSetLayout);
+    hizSets.resize(hizLevels);
+    VkDescriptorSetAllocateInfo asi{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    asi.descriptorPool = hizPool;
+    asi.descriptorSetCount = hizLevels;
+    asi.pSetLayouts = layouts.data();
+    vkCheck(vkAllocateDescriptorSets(dev, &asi, hizSets.data()), "vkAllocateDescriptorSets(hiz)");
+
+    // Level 0 reads depth in SHADER_READ_ONLY_OPTIMAL; the pyramid itself stays in GENERAL so a level can be read while the
+    // next one is written.
+    for (uint32_t i = 0; i < hizLevels; ++i) {
+        if (i == 0 && !vk.depthSampleable())
+            continue;
+
+        VkDescriptorImageInfo src{};
+        src.sampler = hizSampler;
+        src.imageView = (i == 0) ? vk.depthView() : hizMipViews[i - 1];
+        src.imageLayout = (i == 0) ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+        VkDescriptorImageInfo dst{};
+        dst.imageView = hizMipViews[i];
+        dst.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet ws[2]{};
+        ws[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        ws[0].dstSet = hizSets[i];
+        ws[0].dstBinding = 0;
+        ws[0].descriptorCount = 1;
+        ws[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        ws[0].pImageInfo = &src;
+
+        ws[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        ws[1].dstSet = hizSets[i];
+        ws[1].dstBinding = 1;
+        ws[1].descriptorCount = 1;
+        ws[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        ws[1].pImageInfo = &dst;
+
+        vkUpdateDescriptorSets(dev, 2, ws, 0, nullptr);
+    }
+
+    for (uint32_t fi = 0; fi < kFramesInFlight; ++fi) {
+        VkDescriptorImageInfo pyramid{};
+        pyramid.sampler = hizSampler;
+        pyramid.imageView = hizView;
+        pyramid.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet w{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+        w.dstSet = frames[fi].cullSet;
+        w.dstBinding = 8;
+        w.descriptorCount = 1;
+        w.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        w.pImageInfo = &pyramid;
+        vkUpdateDescriptorSets(dev, 1, &w, 0, nullptr);
+    }
+
+    hizValid = false;
+}
+
+void Renderer::destroyHiZResources(VulkanContext& vk)
+{
+    // Frames in flight may still build or sample the pyramid, e.g. when it is rebuilt for a new swapchain size.
+    const VkDevice dev = vk.device();
+    GpuAllocator* allocator = &vk.allocator();
+    DeletionQueue& dq = vk.frameDeletionQueue();
+    dq.push([dev, pool = hizPool, sampler = hizSampler]() {
+        if (pool)
+            vkDestroyDescriptorPool(dev, pool, nullptr);
+        if (sampler)
+            vkDestroySampler(dev, sampler, nullptr);
+    });
+    for (VkImageView v : hizMipViews)
+        dq.push([dev, v]() { vkDestroyImageView(dev, v, nullptr); });
+    dq.push([dev, allocator, view = hizView, image = hizImage, mem = hizMem]() {
+        if (view)
+            vkDestroyImageView(dev, view, nullptr);
+        if (image)
+            vkDestroyImage(dev, image, nullptr);
+        allocator->free(mem);
+    });
+
+    hizPool = {};
+    hizSampler = {};
+    hizMipViews.clear();
+    hizSets.clear();
+    hizView = {};
+    hizImage = {};
+    hizMem = {};
+    hizImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    hizLevels = 0;
+    hizValid = false;
+}
+
+void Renderer::recordHiZBuild(VulkanContext& vk, VkCommandBuffer cmd)
+{
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, hizPipeline);
+
+    VkExtent2D src = vk.swapchainExtent();
+    for (uint32_t i = 0; i < hizLevels; ++i) {
+        const VkExtent2D dst{ std::max(hizExtent.width >> i, 1u), std::max(hizExtent.height >> i, 1u) };
+
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, hizLayout, 0, 1, &hizSets[i], 0, nullptr);
+
+        HiZPush pc{ src.width, src.height, dst.width, dst.height };
+        vkCmdPushConstants(cmd, hizLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+        vkCmdDispatch(cmd, (dst.width + 7u) / 8u, (dst.height + 7u) / 8u, 1);
+
+        if (i + 1 < hizLevels) {
+            VkMemoryBarrier levelDone{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+            levelDone.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            levelDone.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &levelDone, 0,
+                                 nullptr, 0, nullptr);
+        }
+        src = dst;
+    }
+}
+
+void Renderer::bindOpaqueState(VkCommandBuffer cmd, uint32_t fi)
+{
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline);
+
+    VkDeviceSize off = 0;
+    VkBuffer vb = geometry.vertexBuffer();
+    vkCmdBindVertexBuffers(cmd, 0, 1, &vb, &off);
+    vkCmdBindIndexBuffer(cmd, geometry.indexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+    VkDescriptorSet sets[2] = { frames[fi].frameSet, materialSet };
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, meshLayout, 0, 2, sets, 0, nullptr);
+}
+
+void Renderer::cullOnCpu(const RenderScene& scene)
+{
+    CFGC_ZONE("Renderer::cullOnCpu");
+    const glm::mat4 vp = scene.camera.proj * scene.camera.view;
+    const FrustumPlanes fr = makeFrustumPlanes(vp);
+
+    visibleScratch.clear();
+    visibleScratch.reserve(drawScratch.size());
+
+    // The tests run on the job system; gathering the survivors in order stays serial and cheap.
+    constexpr uint32_t kCullGrain = 512;
+    const uint32_t drawCount = (uint32_t)drawScratch.size();
+    cullFlags.resize(drawCount);
+    jobs->parallelFor(drawCount, kCullGrain, [&](uint32_t begin, uint32_t end, uint32_t) {
+        CFGC_ZONE("Cull chunk");
+        for (uint32_t slot = begin; slot < end; ++slot) {
+            const ShaderLayout::DrawData& d = drawScratch[slot];
+            const GeometryPool::MeshInfo& m = geometry.mesh(d.meshId);
+            glm::vec3 wmin{}, wmax{};
+            transformAABB(scene.transforms[d.transformIndex], m.boundsMin, m.boundsMax, wmin, wmax);
+            cullFlags[slot] = frustumIntersectsAABB(fr, wmin, wmax) ? 1 : 0;
+        }
+    });
+
+    CullStats st{};
+    for (uint32_t slot = 0; slot < drawCount; ++slot) {
+        const ShaderLayout::DrawData& d = drawScratch[slot];
+        const GeometryPool::MeshInfo& m = geometry.mesh(d.meshId);
+        st.drawsTotal++;
+        st.trianglesTotal += m.indexCount / 3;
+        if (!cullFlags[slot])
+            continue;
+
+        st.drawsVisible++;
+        st.trianglesVisible += m.indexCount / 3;
+        visibleScratch.push_back(slot);
+    }
+    lastCullStats = st;
+
+    std::sort(visibleScratch.begin(), visibleScratch.end(), [this](uint32_t a, uint32_t b) {
+        const ShaderLayout::DrawData& da = drawScratch[a];
+        const ShaderLayout::DrawData& db = drawScratch[b];
+        if (da.materialId != db.materialId)
+            return da.materialId < db.materialId;
+        if (da.meshId != db.meshId)
+            return da.meshId < db.meshId;
+        return da.transformIndex < db.transformIndex;
+    });
+}
+
 void Renderer::drawFrame(VulkanContext& vk, const RenderScene& scene)
 {
+    CFGC_ZONE("Renderer::drawFrame");
     if (lastSwapchainGen != vk.swapchainGeneration()) {
-        destroyPipelines(vk);
-        createPipelines(vk);
+        CFGC_ZONE("Swapchain change");
+        const Clock::time_point t0 = Clock::now();
+        const bool rebuild = pipelineFormats != attachmentFormats(vk);
+        if (rebuild) {
+            destroyPipelines(vk);
+            createPipelines(vk);
+            pipeStats.rebuilds++;
+        }
+        destroyHiZResources(vk);
+        createHiZResources(vk);
+        lastSwapchainGen = vk.swapchainGeneration();
+
+        pipeStats.resizes++;
+        pipeStats.lastResizeMs = msSince(t0);
+        CFGC_LOGF("Swapchain change: %.2f ms, pipelines %s", pipeStats.lastResizeMs, rebuild ? "rebuilt for new formats" : "kept");
     }
 
+    // Queued before begin() so ranges survive a skipped frame; the caller clears the scene's dirty list after this call.
+    pendingTransformUploads.insert(pendingTransformUploads.end(), scene.dirtyTransforms.begin(), scene.dirtyTransforms.end());
+
     VkCommandBuffer cmd = graph.begin(vk);
     if (!cmd)
         return;
 
     const uint32_t fi = vk.currentFrameIndex();
 
+    uploadTransforms(vk, scene);
+    acquireUploads(vk, cmd);
+    bindInstanceBuffer(vk, fi);
+
     VkExtent2D ext = vk.swapchainExtent();
     float aspect = (ext.height > 0) ? ((float)ext.width / (float)ext.height) : 1.0f;
 
-    uint32_t visibleDrawCount = 0;
-
     VkViewport vp{};
     vp.x = 0.0f;
     vp.y = 0.0f;
@@ -981,18 +1567,8 @@ void Renderer::drawFrame(VulkanContext& vk, const RenderScene& scene)
     lightUbo.lightColor = scene.sun.color;
     lightUbo.exposure = scene.exposure;
 
-    ShaderLayout::MaterialUBO matUbo{};
-    matUbo.baseColorFactor = glm::vec4(sceneBaseColorFactor[0], sceneBaseColorFactor[1], sceneBaseColorFactor[2], sceneBaseColorFactor[3]);
-    matUbo.metallicRoughnessFactor = glm::vec2(sceneMetallicRoughness[0], sceneMetallicRoughness[1]);
-
     std::memcpy(frames[fi].cameraUboMapped, &camUbo, sizeof(camUbo));
     std::memcpy(frames[fi].lightUboMapped, &lightUbo, sizeof(lightUbo));
-    std::memcpy(materialUboMapped, &matUbo, sizeof(matUbo));
-    constexpr uint32_t kMaxTransforms = 4096;
-    const uint32_t transformCount = (uint32_t)std::min<size_t>(scene.transforms.size(), kMaxTransforms);
-    if (transformCount > 0) {
-        std::memcpy(frames[fi].transformSsboMapped, scene.transforms.data(), sizeof(glm::mat4) * transformCount);
-    }
 
     VkClearValue cclear{};
     cclear.color = { { 0.05f, 0.06f, 0.08f, 1.0f } };
@@ -1000,23 +1576,53 @@ void Renderer::drawFrame(VulkanContext& vk, const RenderScene& scene)
     VkClearValue dclear{};
     dclear.depthStencil = { 1.0f, 0 };
 
+    // Written before any buffer is imported, as growing the draw buffers replaces them.
+    const uint32_t drawCount = writeDrawData(vk, scene);
+    const bool useGpuCulling = gpuDriven && vk.indirectFirstInstanceEnabled();
+    // Two-phase occlusion culling needs depth to survive the opaque pass and a compute pass between the two opaque passes,
+    // which the legacy single render pass cannot express.
+    const bool useOcclusion = useGpuCulling && vk.dynamicRenderingEnabled() && vk.depthSampleable() && drawCount > 0;
+    const bool occlusionTest = useOcclusion && hizValid;
+
     auto indirectH = graph.importBuffer(frames[fi].indirectCmdBuffer);
     auto countH = graph.importBuffer(frames[fi].drawCountBuffer);
-
+    auto flagsH = graph.importBuffer(frames[fi].occlusionFlagsBuffer);
+    auto hizH = graph.importImage("hiz", hizImage, hizView, VK_FORMAT_R32_SFLOAT, hizExtent, &hizImageLayout);
+    // Everything the culling passes bind is declared, as on the async compute queue it changes queue family ownership.
+    auto instancesH = graph.importBuffer(instanceBuffer);
+    auto drawDataH = graph.importBuffer(frames[fi].drawDataSsbo);
+    auto meshTableH = graph.importBuffer(geometry.meshTableBuffer());
+    auto cullUboH = graph.importBuffer(frames[fi].cullUbo);
+    auto cullStatsH = graph.importBuffer(frames[fi].cullStatsBuffer);
+    const bool asyncCull = useGpuCulling && drawCount > 0;
+
+    // Early phase: frustum test plus the previous frame's pyramid. Draws it rejects are flagged for the late phase.
     graph.addPass(
         "cull", RenderGraph::PassType::Compute,
         [&](RenderGraph::PassBuilder& b) {
             b.writeBuffer(indirectH, RenderGraph::BufferUse::Storage);
             b.writeBuffer(countH, RenderGraph::BufferUse::Storage);
+            b.writeBuffer(flagsH, RenderGraph::BufferUse::Storage);
+            b.writeBuffer(cullStatsH, RenderGraph::BufferUse::Storage);
+            b.readImage(hizH, RenderGraph::ImageUse::Storage);
+            b.readBuffer(instancesH, RenderGraph::BufferUse::Storage);
+            b.readBuffer(drawDataH, RenderGraph::BufferUse::Storage);
+            b.readBuffer(meshTableH, RenderGraph::BufferUse::Storage);
+            b.readBuffer(cullUboH, RenderGraph::BufferUse::Uniform);
+            if (asyncCull)
+                b.asyncCompute();
         },
-        [&](VkCommandBuffer pcmd) { visibleDrawCount = recordGpuCulling(vk, pcmd, scene); });
+        [&](VkCommandBuffer pcmd) {
+            if (useGpuCulling)
+                recordGpuCulling(vk, pcmd, scene, drawCount, occlusionTest);
+        });
 
-    graph.addPass(
+    graph.addParallelPass(
         "sky", RenderGraph::PassType::Graphics,
         [&](RenderGraph::PassBuilder& b) {
             b.colorAttachment(graph.backbuffer(), VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE, cclear);
         },
-        [&](VkCommandBuffer pcmd) {
+        1, [&](VkCommandBuffer pcmd, uint32_t) {
             vkCmdBindPipeline(pcmd, VK_PIPELINE_BIND_POINT_GRAPHICS, skyPipeline);
 
             struct SkyPC {
@@ -1054,90 +1660,143 @@ void Renderer::drawFrame(VulkanContext& vk, const RenderScene& scene)
             vkCmdDraw(pcmd, 3, 1, 0, 0);
         });
 
-    graph.addPass(
+    // Without GPU culling the visible set is known up front, so the opaque draws can be split across record workers.
+    uint32_t opaqueChunks = 1;
+    if (!useGpuCulling) {
+        cullOnCpu(scene);
+        opaqueChunks = std::clamp((uint32_t)visibleScratch.size() / kDrawsPerRecordChunk, 1u, kMaxRecordChunks);
+    }
+
+    graph.addParallelPass(
         "opaque", RenderGraph::PassType::Graphics,
         [&](RenderGraph::PassBuilder& b) {
             b.colorAttachment(graph.backbuffer(), VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_STORE);
-            b.depthAttachment(graph.depth(), VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_DONT_CARE, dclear);
+            b.depthAttachment(graph.depth(), VK_ATTACHMENT_LOAD_OP_CLEAR,
+                              useOcclusion ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE, dclear);
             b.readBuffer(indirectH, RenderGraph::BufferUse::Indirect);
             b.readBuffer(countH, RenderGraph::BufferUse::Indirect);
+            b.readBuffer(instancesH, RenderGraph::BufferUse::Storage);
+            b.readBuffer(drawDataH, RenderGraph::BufferUse::Storage);
         },
-        [&](VkCommandBuffer pcmd) {
-            vkCmdBindPipeline(pcmd, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline);
+        opaqueChunks, [&](VkCommandBuffer pcmd, uint32_t chunk) {
+            bindOpaqueState(pcmd, fi);
 
-            VkDeviceSize off = 0;
-            VkBuffer vb = sceneMesh.vertexBuffer();
-            vkCmdBindVertexBuffers(pcmd, 0, 1, &vb, &off);
-            vkCmdBindIndexBuffer(pcmd, sceneMesh.indexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-            VkDescriptorSet sets[2] = { frames[fi].frameSet, materialSet };
-            vkCmdBindDescriptorSets(pcmd, VK_PIPELINE_BIND_POINT_GRAPHICS, meshLayout, 0, 2, sets, 0, nullptr);
-
-            if (gpuDriven) {
-                if (visibleDrawCount > 0) {
+            if (useGpuCulling) {
+                if (drawCount > 0) {
                     vk.cmdDrawIndexedIndirectCount(pcmd, frames[fi].indirectCmdBuffer, 0, frames[fi].drawCountBuffer, 0,
                                                    frames[fi].indirectMaxDraws, sizeof(VkDrawIndexedIndirectCommand));
                 }
                 return;
             }
 
-            const glm::mat4 vp = scene.camera.proj * scene.camera.view;
-            const FrustumPlanes fr = makeFrustumPlanes(vp);
-
-            std::vector<const DrawItem*> visible;
-            visible.reserve(scene.draws.size());
-
-            for (const DrawItem& d : scene.draws) {
-                if (d.meshId != 0)
-                    continue;
-                if (d.transformIndex >= scene.transforms.size())
-                    continue;
-
-                glm::vec3 wmin{}, wmax{};
-                transformAABB(scene.transforms[d.transformIndex], sceneMesh.boundsMin(), sceneMesh.boundsMax(), wmin, wmax);
-                if (!frustumIntersectsAABB(fr, wmin, wmax))
-                    continue;
-
-                visible.push_back(&d);
+            // firstInstance carries the draw slot; the vertex shader fetches transform and material from it. Visible
+            // draws of one mesh in consecutive slots go out as one instanced draw, since gl_InstanceIndex still
+            // counts up through their slots.
+            const size_t first = visibleScratch.size() * chunk / opaqueChunks;
+            const size_t last = visibleScratch.size() * (chunk + 1) / opaqueChunks;
+            for (size_t v = first; v < last;) {
+                const uint32_t slot = visibleScratch[v];
+                const uint32_t meshId = drawScratch[slot].meshId;
+                uint32_t count = 1;
+                while (v + count < last && visibleScratch[v + count] == slot + count && drawScratch[slot + count].meshId == meshId)
+                    ++count;
+                const GeometryPool::MeshInfo& m = geometry.mesh(meshId);
+                vkCmdDrawIndexed(pcmd, m.indexCount, count, m.firstIndex, m.vertexOffset, slot);
+                v += count;
             }
+        });
 
-            std::sort(visible.begin(), visible.end(), [](const DrawItem* a, const DrawItem* b) {
-                if (a->materialId != b->materialId)
-                    return a->materialId < b->materialId;
-                if (a->meshId != b->meshId)
-                    return a->meshId < b->meshId;
-                return a->transformIndex < b->transformIndex;
+    if (useOcclusion) {
+        graph.addPass(
+            "hiz", RenderGraph::PassType::Compute,
+            [&](RenderGraph::PassBuilder& b) {
+                b.readImage(graph.depth(), RenderGraph::ImageUse::Sampled);
+                b.writeImage(hizH, RenderGraph::ImageUse::Storage);
+                b.asyncCompute();
+            },
+            [&](VkCommandBuffer pcmd) { recordHiZBuild(vk, pcmd); });
+
+        // Late phase: re-test what the early phase rejected against this frame's pyramid, so newly revealed objects
+        // are drawn in the same frame instead of popping in one frame later.
+        graph.addPass(
+            "cull late", RenderGraph::PassType::Compute,
+            [&](RenderGraph::PassBuilder& b) {
+                b.readImage(hizH, RenderGraph::ImageUse::Storage);
+                b.readBuffer(flagsH, RenderGraph::BufferUse::Storage);
+                b.writeBuffer(indirectH, RenderGraph::BufferUse::Storage);
+                b.writeBuffer(countH, RenderGraph::BufferUse::Storage);
+                b.writeBuffer(cullStatsH, RenderGraph::BufferUse::Storage);
+                b.readBuffer(instancesH, RenderGraph::BufferUse::Storage);
+                b.readBuffer(drawDataH, RenderGraph::BufferUse::Storage);
+                b.readBuffer(meshTableH, RenderGraph::BufferUse::Storage);
+                b.readBuffer(cullUboH, RenderGraph::BufferUse::Uniform);
+                b.asyncCompute();
+            },
+            [&](VkCommandBuffer pcmd) { recordLateCulling(vk, pcmd, drawCount); });
+
+        graph.addParallelPass(
+            "opaque late", RenderGraph::PassType::Graphics,
+            [&](RenderGraph::PassBuilder& b) {
+                b.colorAttachment(graph.backbuffer(), VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_STORE);
+                b.depthAttachment(graph.depth(), VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_DONT_CARE);
+                b.readBuffer(indirectH, RenderGraph::BufferUse::Indirect);
+                b.readBuffer(countH, RenderGraph::BufferUse::Indirect);
+                b.readBuffer(instancesH, RenderGraph::BufferUse::Storage);
+                b.readBuffer(drawDataH, RenderGraph::BufferUse::Storage);
+            },
+            1, [&](VkCommandBuffer pcmd, uint32_t) {
+                bindOpaqueState(pcmd, fi);
+                const VkDeviceSize lateOffset = sizeof(VkDrawIndexedIndirectCommand) * (VkDeviceSize)frames[fi].indirectMaxDraws;
+                vk.cmdDrawIndexedIndirectCount(pcmd, frames[fi].indirectCmdBuffer, lateOffset, frames[fi].drawCountBuffer,
+                                               sizeof(uint32_t), frames[fi].indirectMaxDraws, sizeof(VkDrawIndexedIndirectCommand));
             });
-
-            for (const DrawItem* pd : visible) {
-                vkCmdDrawIndexed(pcmd, sceneMesh.indexCount(), 1, 0, 0, pd->transformIndex);
-            }
-        });
+    }
 
     graph.execute(vk);
     graph.end(vk);
+
+    // The pyramid now holds this frame's depth; the next early phase projects against the matching view.
+    hizValid = useOcclusion;
+    if (useOcclusion)
+        hizViewProj = scene.camera.proj * scene.camera.view;
 }
 
 void Renderer::destroyPipelines(VulkanContext& vk)
 {
-    VkDevice dev = vk.device();
-    if (meshPipeline)
-        vkDestroyPipeline(dev, meshPipeline, nullptr);
-    if (meshLayout)
-        vkDestroyPipelineLayout(dev, meshLayout, nullptr);
-    if (skyPipeline)
-        vkDestroyPipeline(dev, skyPipeline, nullptr);
-    if (skyLayout)
-        vkDestroyPipelineLayout(dev, skyLayout, nullptr);
+    const VkDevice dev = vk.device();
+    vk.frameDeletionQueue().push([dev, mp = meshPipeline, ml = meshLayout, sp = skyPipeline, sl = skyLayout]() {
+        if (mp)
+            vkDestroyPipeline(dev, mp, nullptr);
+        if (ml)
+            vkDestroyPipelineLayout(dev, ml, nullptr);
+        if (sp)
+            vkDestroyPipeline(dev, sp, nullptr);
+        if (sl)
+            vkDestroyPipelineLayout(dev, sl, nullptr);
+    });
     meshPipeline = {};
     meshLayout = {};
     skyPipeline = {};
     skyLayout = {};
-    lastSwapchainGen = ~0ull;
+    pipelineFormats = {};
+}
+
+Renderer::AttachmentFormats Renderer::attachmentFormats(const VulkanContext& vk)
+{
+    AttachmentFormats f{};
+    f.color = vk.swapchainFormat();
+    f.depth = vk.depthFormat();
+    if (!vk.dynamicRenderingEnabled())
+        f.renderPass = vk.renderPass();
+    return f;
 }
 
 void Renderer::createPipelines(VulkanContext& vk)
 {
+    CFGC_ZONE("Renderer::createPipelines");
     VkDevice dev = vk.device();
+    const Clock::time_point buildStart = Clock::now();
+    pipelineFormats = attachmentFormats(vk);
 
     VkDynamicState dyns[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
     VkPipelineDynamicStateCreateInfo dyn{ VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
@@ -1168,8 +1827,8 @@ void Renderer::createPipelines(VulkanContext& vk)
     const bool dynRender = vk.dynamicRenderingEnabled();
 
     VkPipelineRenderingCreateInfoKHR renderingInfo{ VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR };
-    VkFormat colorFmt = vk.swapchainFormat();
-    VkFormat depthFmt = vk.depthFormat();
+    VkFormat colorFmt = pipelineFormats.color;
+    VkFormat depthFmt = pipelineFormats.depth;
     if (dynRender) {
         renderingInfo.colorAttachmentCount = 1;
         renderingInfo.pColorAttachmentFormats = &colorFmt;
@@ -1232,10 +1891,10 @@ void Renderer::createPipelines(VulkanContext& vk)
             pci.renderPass = VK_NULL_HANDLE;
             pci.subpass = 0;
         } else {
-            pci.renderPass = vk.renderPass();
+            pci.renderPass = pipelineFormats.renderPass;
             pci.subpass = 0;
         }
-        vkCheck(vkCreateGraphicsPipelines(dev, VK_NULL_HANDLE, 1, &pci, nullptr, &skyPipeline), "vkCreateGraphicsPipelines(sky)");
+        vkCheck(vkCreateGraphicsPipelines(dev, pipelineCache.handle(), 1, &pci, nullptr, &skyPipeline), "vkCreateGraphicsPipelines(sky)");
         vkDestroyShaderModule(dev, vs, nullptr);
         vkDestroyShaderModule(dev, fs, nullptr);
     }
@@ -1310,13 +1969,13 @@ void Renderer::createPipelines(VulkanContext& vk)
             pci.renderPass = VK_NULL_HANDLE;
             pci.subpass = 0;
         } else {
-            pci.renderPass = vk.renderPass();
+            pci.renderPass = pipelineFormats.renderPass;
             pci.subpass = 0;
         }
-        vkCheck(vkCreateGraphicsPipelines(dev, VK_NULL_HANDLE, 1, &pci, nullptr, &meshPipeline), "vkCreateGraphicsPipelines(mesh)");
+        vkCheck(vkCreateGraphicsPipelines(dev, pipelineCache.handle(), 1, &pci, nullptr, &meshPipeline), "vkCreateGraphicsPipelines(mesh)");
         vkDestroyShaderModule(dev, vs, nullptr);
         vkDestroyShaderModule(dev, fs, nullptr);
     }
 
-    lastSwapchainGen = vk.swapchainGeneration();
+    pipelineBuildMs += msSince(buildStart);
 }
@@ -1,26 +1,69 @@
 #pragma once
 #include <vulkan/vulkan.h>
+#include "../assets/GltfLoader.hpp"
 #include "../render/RenderScene.hpp"
 #include "VulkanContext.hpp"
 
+#include "GeometryPool.hpp"
 #include "Mesh.hpp"
+#include "PipelineCache.hpp"
 #include "RenderGraph.hpp"
 #include "UploadManager.hpp"
 
 #include "../render/ShaderLayouts.hpp"
 
+class JobSystem;
+struct ImageRGBA8;
+
 class Renderer {
    public:
-    void init(VulkanContext& vk);
+    // Scene loading, CPU culling and parallel recording run on jobs, which has to outlive the renderer.
+    void init(VulkanContext& vk, JobSystem& jobs);
     void shutdown(VulkanContext& vk);
 
     void drawFrame(VulkanContext& vk, const RenderScene& scene);
 
     void setGpuDriven(bool enabled) { gpuDriven = enabled; }
 
+    // Each mesh of the loaded scene is uploaded once and split into spatial chunks at load, each registered as its own
+    // GeometryPool mesh with ids firstMeshId .. firstMeshId + chunkCount - 1.
+    struct SceneMesh {
+        uint32_t firstMeshId = GeometryPool::kInvalidMesh;
+        uint32_t chunkCount = 0;
+    };
+    const std::vector<SceneMesh>& sceneMeshes() const { return loadedMeshes; }
+    // Node hierarchy of the loaded scene; GltfNode::mesh indexes sceneMeshes().
+    const std::vector<GltfNode>& sceneNodes() const { return loadedNodes; }
+
+    struct CullStats {
+        uint32_t drawsTotal = 0;
+        uint32_t drawsVisible = 0;
+        uint64_t trianglesTotal = 0;
+        uint64_t trianglesVisible = 0;
+    };
+    // GPU-driven results lag by kFramesInFlight frames since they are read back without stalling.
+    const CullStats& cullStats() const { return lastCullStats; }
+
+    // Per-pass GPU timings of the render graph; same latency as cullStats().
+    GpuProfiler& gpuProfiler() { return graph.profiler(); }
+    const GpuProfiler& gpuProfiler() const { return graph.profiler(); }
+
+    struct PipelineStats {
+        // Whether the pipeline cache was seeded from disk at startup.
+        bool warmStart = false;
+        // Time spent creating every pipeline during init().
+        double startupMs = 0.0;
+        // Time the last swapchain change took to handle, including any pipeline rebuild.
+        double lastResizeMs = 0.0;
+        uint32_t resizes = 0;
+        // Swapchain changes whose attachment formats differed, so the graphics pipelines had to be rebuilt.
+        uint32_t rebuilds = 0;
+    };
+    const PipelineStats& pipelineStats() const { return pipeStats; }
+
     struct Texture {
         VkImage image{};
-        VkDeviceMemory mem{};
+        GpuAllocation mem{};
         VkImageView view{};
         VkSampler sampler{};
         VkFormat format{};
@@ -28,21 +71,21 @@ class Renderer {
         void destroy(VulkanContext& vk)
         {
             const VkDevice dev = vk.device();
+            GpuAllocator* allocator = &vk.allocator();
             const VkSampler oldSampler = sampler;
             const VkImageView oldView = view;
             const VkImage oldImage = image;
-            const VkDeviceMemory oldMem = mem;
+            const GpuAllocation oldMem = mem;
 
             if (oldSampler || oldView || oldImage || oldMem) {
-                vk.frameDeletionQueue().push([dev, oldSampler, oldView, oldImage, oldMem]() {
+                vk.frameDeletionQueue().push([dev, allocator, oldSampler, oldView, oldImage, oldMem]() {
                     if (oldSampler)
                         vkDestroySampler(dev, oldSampler, nullptr);
                     if (oldView)
                         vkDestroyImageView(dev, oldView, nullptr);
                     if (oldImage)
                         vkDestroyImage(dev, oldImage, nullptr);
-                    if (oldMem)
-                        vkFreeMemory(dev, oldMem, nullptr);
+                    allocator->free(oldMem);
                 });
             }
             sampler = {};
@@ -55,6 +98,16 @@ class Renderer {
    private:
     VkShaderModule makeShader(VulkanContext& vk, const char* path);
 
+    // Graphics pipelines depend on nothing but the attachments they render to.
+    struct AttachmentFormats {
+        VkFormat color = VK_FORMAT_UNDEFINED;
+        VkFormat depth = VK_FORMAT_UNDEFINED;
+        // Only without dynamic rendering.
+        VkRenderPass renderPass = VK_NULL_HANDLE;
+        bool operator==(const AttachmentFormats&) const = default;
+    };
+    static AttachmentFormats attachmentFormats(const VulkanContext& vk);
+
     void createPipelines(VulkanContext& vk);
     void destroyPipelines(VulkanContext& vk);
 
@@ -66,9 +119,28 @@ class Renderer {
     void createMaterialResources(VulkanContext& vk);
     void destroyMaterialResources(VulkanContext& vk);
 
+    void uploadTransforms(VulkanContext& vk, const RenderScene& scene);
+    // Hands resources loaded on the transfer queue to graphics before the frame first uses them.
+    void acquireUploads(VulkanContext& vk, VkCommandBuffer cmd);
+    void growInstanceBuffer(VulkanContext& vk, uint32_t minCapacity);
+    void bindInstanceBuffer(VulkanContext& vk, uint32_t fi);
+
     void createGpuDrivenResources(VulkanContext& vk);
     void destroyGpuDrivenResources(VulkanContext& vk);
-    uint32_t recordGpuCulling(VulkanContext& vk, VkCommandBuffer cmd, const RenderScene& scene);
+    uint32_t writeDrawData(VulkanContext& vk, const RenderScene& scene);
+    uint32_t recordGpuCulling(VulkanContext& vk, VkCommandBuffer cmd, const RenderScene& scene, uint32_t drawCount, bool occlusionTest);
+    void recordLateCulling(VulkanContext& vk, VkCommandBuffer cmd, uint32_t drawCount);
+    void bindOpaqueState(VkCommandBuffer cmd, uint32_t fi);
+    // Frustum-culls drawScratch into visibleScratch, sorted by material then mesh.
+    void cullOnCpu(const RenderScene& scene);
+
+    // The pipeline outlives resizes; the resources follow the swapchain extent.
+    void createHiZPipeline(VulkanContext& vk);
+    void destroyHiZPipeline(VulkanContext& vk);
+    void createHiZResources(VulkanContext& vk);
+    void destroyHiZResources(VulkanContext& vk);
+    void recordHiZBuild(VulkanContext& vk, VkCommandBuffer cmd);
+    uint32_t addTexture(VulkanContext& vk, const ImageRGBA8& img, VkFormat format);
 
     VkPipelineLayout meshLayout{};
     VkPipeline meshPipeline{};
@@ -77,14 +149,30 @@ class Renderer {
     VkPipeline skyPipeline{};
 
     UploadManager upload;
-    Mesh sceneMesh;
-
-    Texture baseColorTex;
-    Texture normalTex;
-    Texture metalRoughTex;
-
-    float sceneBaseColorFactor[4]{ 1.0f, 1.0f, 1.0f, 1.0f };
-    float sceneMetallicRoughness[2]{ 1.0f, 1.0f };
+    GeometryPool geometry;
+    std::vector<SceneMesh> loadedMeshes;
+    std::vector<GltfNode> loadedNodes;
+    uint64_t sceneTriangleCount = 0;
+    CullStats lastCullStats{};
+    std::vector<ShaderLayout::DrawData> drawScratch;
+    std::vector<uint32_t> visibleScratch;
+    std::vector<uint8_t> cullFlags;
+    // CPU-culled opaque draws are recorded in chunks of about this many, each into its own secondary command buffer.
+    static constexpr uint32_t kDrawsPerRecordChunk = 512;
+    static constexpr uint32_t kMaxRecordChunks = 16;
+
+    // Device-local mirror of RenderScene::transforms shared by all frames. Only the scene's dirty ranges are uploaded;
+    // ranges that did not fit in staging stay pending for the next frame.
+    VkBuffer instanceBuffer{};
+    GpuAllocation instanceMem{};
+    uint32_t instanceCapacity = 0;
+    std::vector<TransformRange> pendingTransformUploads;
+    uint64_t drawTrianglesTotal = 0;
+
+    // Bindless texture and material tables; DrawItem::materialId indexes `materials`.
+    std::vector<Texture> textures;
+    std::vector<ShaderLayout::MaterialGPU> materials;
+    uint32_t maxBindlessTextures = 0;
 
     VkDescriptorSetLayout frameSetLayout{};
     VkDescriptorPool framePool{};
@@ -92,46 +180,56 @@ class Renderer {
     VkDescriptorSetLayout materialSetLayout{};
     VkDescriptorPool materialPool{};
     VkDescriptorSet materialSet{};
-    VkBuffer materialUbo{};
-    VkDeviceMemory materialUboMem{};
-    void* materialUboMapped = nullptr;
+    VkBuffer materialSsbo{};
+    GpuAllocation materialSsboMem{};
 
     struct FrameResources {
         VkDescriptorSet frameSet{};
 
         VkBuffer cameraUbo{};
-        VkDeviceMemory cameraUboMem{};
+        GpuAllocation cameraUboMem{};
         void* cameraUboMapped = nullptr;
 
         VkBuffer lightUbo{};
-        VkDeviceMemory lightUboMem{};
+        GpuAllocation lightUboMem{};
         void* lightUboMapped = nullptr;
 
-        VkBuffer transformSsbo{};
-        VkDeviceMemory transformSsboMem{};
-        void* transformSsboMapped = nullptr;
+        VkBuffer boundInstanceBuffer{};
 
-        VkBuffer drawTransformSsbo{};
-        VkDeviceMemory drawTransformSsboMem{};
-        void* drawTransformSsboMapped = nullptr;
+        VkBuffer drawDataSsbo{};
+        GpuAllocation drawDataSsboMem{};
+        void* drawDataSsboMapped = nullptr;
 
         VkBuffer cullUbo{};
-        VkDeviceMemory cullUboMem{};
+        GpuAllocation cullUboMem{};
         void* cullUboMapped = nullptr;
 
+        // Holds two command lists of indirectMaxDraws each: early-phase draws, then late-phase draws.
         VkBuffer indirectCmdBuffer{};
-        VkDeviceMemory indirectCmdMem{};
+        GpuAllocation indirectCmdMem{};
         uint32_t indirectMaxDraws = 0;
 
+        VkBuffer occlusionFlagsBuffer{};
+        GpuAllocation occlusionFlagsMem{};
+
         VkBuffer drawCountBuffer{};
-        VkDeviceMemory drawCountMem{};
+        GpuAllocation drawCountMem{};
+
+        VkBuffer cullStatsBuffer{};
+        GpuAllocation cullStatsMem{};
+        void* cullStatsMapped = nullptr;
+        uint64_t cullStatsTrianglesTotal = 0;
+        uint32_t cullStatsDrawsTotal = 0;
+        bool cullStatsPending = false;
 
         VkDescriptorSet cullSet{};
+        VkBuffer boundMeshTable{};
     };
 
     static constexpr uint32_t kFramesInFlight = 2;
     FrameResources frames[kFramesInFlight]{};
 
+    JobSystem* jobs = nullptr;
     RenderGraph graph;
 
     VkDescriptorSetLayout cullSetLayout{};
@@ -139,11 +237,31 @@ class Renderer {
     VkPipelineLayout cullLayout{};
     VkPipeline cullPipeline{};
 
-    VkBuffer meshBoundsSsbo{};
-    VkDeviceMemory meshBoundsMem{};
+    // Max-depth pyramid of the opaque pass. One copy is enough as every access happens on the graphics queue in
+    // submission order; the early cull of frame N reads what frame N-1 built.
+    VkImage hizImage{};
+    GpuAllocation hizMem{};
+    VkImageView hizView{};
+    std::vector<VkImageView> hizMipViews;
+    VkImageLayout hizImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkExtent2D hizExtent{};
+    uint32_t hizLevels = 0;
+    VkSampler hizSampler{};
+    VkDescriptorSetLayout hizSetLayout{};
+    VkDescriptorPool hizPool{};
+    std::vector<VkDescriptorSet> hizSets;
+    VkPipelineLayout hizLayout{};
+    VkPipeline hizPipeline{};
+    bool hizValid = false;
+    glm::mat4 hizViewProj{ 1.0f };
 
     bool gpuDriven = true;
 
+    PipelineCache pipelineCache;
+    AttachmentFormats pipelineFormats{};
+    PipelineStats pipeStats{};
+    // Accumulates time spent creating pipelines, shader modules included.
+    double pipelineBuildMs = 0.0;
+
     uint64_t lastSwapchainGen = ~0ull;
-    double startTimeSeconds = 0.0;
 };
@@ -2,146 +2,449 @@
 
 #include "VulkanHelpers.hpp"
 
+#include <algorithm>
 #include <cstring>
+#include <numeric>
+
+namespace {
+// What a transfer-only queue can execute; everything else in a barrier is left to the graphics side of the handover.
+constexpr VkPipelineStageFlags kTransferStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT |
+                                                 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+constexpr VkAccessFlags kTransferAccess = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_MEMORY_READ_BIT |
+                                          VK_ACCESS_MEMORY_WRITE_BIT;
+}  // namespace
 
 VkDeviceSize UploadManager::alignUp(VkDeviceSize v, VkDeviceSize a)
 {
-    return (v + a - 1) & ~(a - 1);
+    return (v + a - 1) / a * a;
 }
 
-void UploadManager::init(VulkanContext& vk, VkDeviceSize perFrameBytes)
+void UploadManager::init(VulkanContext& vk, VkDeviceSize ringBytes)
 {
-    VkDevice dev = vk.device();
-    VkPhysicalDevice phys = vk.physicalDevice();
+    ctx = &vk;
+    graphicsFamily = vk.graphicsFamilyIndex();
+    transferAvailable = vk.hasTransferQueue();
+    transferFamily = transferAvailable ? vk.transferFamilyIndex() : graphicsFamily;
+    transferGranularity = vk.transferImageGranularity();
 
-    frames.clear();
-    frames.resize(2);
-
-    for (auto& f : frames) {
+    for (uint32_t q = 0; q < (transferAvailable ? 2u : 1u); ++q) {
         VkCommandPoolCreateInfo pci{};
         pci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        pci.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-        pci.queueFamilyIndex = vk.graphicsFamilyIndex();
-        vkCheck(vkCreateCommandPool(dev, &pci, nullptr, &f.pool), "vkCreateCommandPool(upload)");
-
-        VkCommandBufferAllocateInfo ai{};
-        ai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        ai.commandPool = f.pool;
-        ai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        ai.commandBufferCount = 1;
-        vkCheck(vkAllocateCommandBuffers(dev, &ai, &f.cmd), "vkAllocateCommandBuffers(upload)");
+        pci.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        pci.queueFamilyIndex = q ? transferFamily : graphicsFamily;
+        vkCheck(vkCreateCommandPool(vk.device(), &pci, nullptr, &pools[q]), "vkCreateCommandPool(upload)");
+    }
 
-        VkFenceCreateInfo fci{};
-        fci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fci.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-        vkCheck(vkCreateFence(dev, &fci, nullptr, &f.fence), "vkCreateFence(upload)");
+    capacity = ringBytes;
+    createBuffer(vk.allocator(), capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging, stagingMem,
+                 "vkCreateBuffer(upload staging)");
+    mapped = static_cast<uint8_t*>(stagingMem.mapped);
+    head = 0;
+    tail = 0;
+    counters = {};
+}
 
-        f.capacity = perFrameBytes;
-        createBuffer(dev, phys, f.capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, f.staging, f.stagingMem,
-                     "vkCreateBuffer(upload staging)");
+void UploadManager::shutdown(VulkanContext& vk)
+{
+    VkDevice dev = vk.device();
+    for (uint32_t i : inFlight)
+        vk.waitTimeline(batches[i].transfer ? VulkanContext::Timeline::Transfer : VulkanContext::Timeline::Graphics, batches[i].value);
+    inFlight.clear();
 
-        f.mapped = reinterpret_cast<uint8_t*>(mapMemory(dev, f.stagingMem, f.capacity));
+    for (Batch& b : batches)
+        b.deletions.flush();
+    batches.clear();
+    for (uint32_t q = 0; q < 2; ++q) {
+        freeBatches[q].clear();
+        if (pools[q])
+            vkDestroyCommandPool(dev, pools[q], nullptr);
+        pools[q] = VK_NULL_HANDLE;
     }
+
+    handovers.clear();
+
+    if (staging)
+        vkDestroyBuffer(dev, staging, nullptr);
+    vk.allocator().free(stagingMem);
+    staging = VK_NULL_HANDLE;
+    stagingMem = {};
+    mapped = nullptr;
+    capacity = 0;
+
+    current = ~0u;
+    currentCmd = VK_NULL_HANDLE;
+    ctx = nullptr;
 }
 
-void UploadManager::shutdown(VulkanContext& vk)
+void UploadManager::retire(VulkanContext& vk, bool waitOldest)
 {
-    VkDevice dev = vk.device();
-    for (auto& f : frames) {
-        if (f.mapped) {
-            vkUnmapMemory(dev, f.stagingMem);
-            f.mapped = nullptr;
+    while (!inFlight.empty()) {
+        const uint32_t index = inFlight.front();
+        Batch& b = batches[index];
+        const VulkanContext::Timeline t = b.transfer ? VulkanContext::Timeline::Transfer : VulkanContext::Timeline::Graphics;
+        if (waitOldest) {
+            vk.waitTimeline(t, b.value);
+            waitOldest = false;
+        } else if (vk.completedValue(t) < b.value) {
+            break;
         }
-        if (f.staging)
-            vkDestroyBuffer(dev, f.staging, nullptr);
-        if (f.stagingMem)
-            vkFreeMemory(dev, f.stagingMem, nullptr);
-        if (f.fence)
-            vkDestroyFence(dev, f.fence, nullptr);
-        if (f.pool)
-            vkDestroyCommandPool(dev, f.pool, nullptr);
-        f = {};
+        tail = std::max(tail, b.end);
+        // Frames recorded before the copies finished may still use what the batch replaced.
+        vk.frameDeletionQueue().append(b.deletions);
+        freeBatches[b.transfer].push_back(index);
+        inFlight.pop_front();
     }
-    frames.clear();
-    cur = nullptr;
-    currentCmd = VK_NULL_HANDLE;
 }
 
-void UploadManager::beginFrame(VulkanContext& vk)
+uint32_t UploadManager::startBatch(VulkanContext& vk, bool transfer)
 {
-    if (frames.empty())
-        return;
-    Frame& f = frames[vk.currentFrameIndex() % frames.size()];
-    cur = &f;
-    currentCmd = f.cmd;
+    retire(vk, false);
 
-    VkDevice dev = vk.device();
-    vkCheck(vkWaitForFences(dev, 1, &f.fence, VK_TRUE, UINT64_MAX), "vkWaitForFences(upload)");
-    vkCheck(vkResetFences(dev, 1, &f.fence), "vkResetFences(upload)");
-    vkResetCommandPool(dev, f.pool, 0);
-    f.head = 0;
-    f.recorded = false;
+    std::vector<uint32_t>& freeList = freeBatches[transfer];
+    if (freeList.empty()) {
+        Batch b{};
+        b.transfer = transfer;
+        VkCommandBufferAllocateInfo ai{};
+        ai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        ai.commandPool = pools[transfer];
+        ai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        ai.commandBufferCount = 1;
+        vkCheck(vkAllocateCommandBuffers(vk.device(), &ai, &b.cmd), "vkAllocateCommandBuffers(upload)");
 
+        freeList.push_back((uint32_t)batches.size());
+        batches.push_back(std::move(b));
+    }
+    const uint32_t index = freeList.back();
+    freeList.pop_back();
+
+    Batch& b = batches[index];
+    b.end = head;
+    vkResetCommandBuffer(b.cmd, 0);
     VkCommandBufferBeginInfo bi{};
     bi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     bi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    vkCheck(vkBeginCommandBuffer(f.cmd, &bi), "vkBeginCommandBuffer(upload)");
+    vkCheck(vkBeginCommandBuffer(b.cmd, &bi), "vkBeginCommandBuffer(upload)");
+    return index;
+}
+
+void UploadManager::submit(VulkanContext& vk, uint32_t index, bool recordedWork, bool release)
+{
+    Batch& b = batches[index];
+    vkCheck(vkEndCommandBuffer(b.cmd), "vkEndCommandBuffer(upload)");
+
+    // Nothing recorded and no ring space taken: the command buffer is simply reused.
+    if (!recordedWork && b.end == head && b.deletions.empty()) {
+        freeBatches[b.transfer].push_back(index);
+        return;
+    }
+
+    b.value = vk.submit(b.transfer ? VulkanContext::Timeline::Transfer : VulkanContext::Timeline::Graphics, b.cmd);
+    // Releases take no ring space, so they must not move the tail past a batch that is still recording.
+    b.end = release ? 0 : head;
+    inFlight.push_back(index);
+    ++counters.submits;
+}
+
+void UploadManager::beginBatch(VulkanContext& vk, bool transfer)
+{
+    current = startBatch(vk, transfer);
+    currentCmd = batches[current].cmd;
+    recorded = false;
+}
+
+void UploadManager::submitBatch(VulkanContext& vk)
+{
+    submit(vk, current, recorded, false);
+    current = ~0u;
+    currentCmd = VK_NULL_HANDLE;
+}
+
+void UploadManager::beginFrame(VulkanContext& vk, Queue queue)
+{
+    if (!staging || current != ~0u)
+        return;
+    beginBatch(vk, queue == Queue::Transfer && transferAvailable);
 }
 
 void UploadManager::endFrame(VulkanContext& vk)
 {
-    if (!cur)
+    if (current == ~0u)
         return;
-    Frame& f = *cur;
+    submitBatch(vk);
+    for (Handover& h : handovers)
+        h.open = false;
+}
+
+bool UploadManager::reserve(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset)
+{
+    if (size > capacity)
+        return false;
 
-    vkCheck(vkEndCommandBuffer(f.cmd), "vkEndCommandBuffer(upload)");
+    for (;;) {
+        // Nothing in use: restart at the beginning of the ring so that anything up to its full size fits.
+        if (head == tail) {
+            head = alignUp(head, capacity);
+            tail = head;
+        }
 
-    VkSubmitInfo si{};
-    si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    if (f.recorded) {
-        si.commandBufferCount = 1;
-        si.pCommandBuffers = &f.cmd;
+        const VkDeviceSize phys = head % capacity;
+        VkDeviceSize off = alignUp(phys, alignment);
+        uint64_t start = head + (off - phys);
+        if (off + size > capacity) {
+            start = head + (capacity - phys);
+            off = 0;
+        }
+        if (start + size - tail <= capacity) {
+            head = start + size;
+            outOffset = off;
+            return true;
+        }
+
+        if (!inFlight.empty()) {
+            retire(*ctx, true);
+            ++counters.stalls;
+            continue;
+        }
+
+        // Everything still in use belongs to the open batch, so hand it to the GPU and keep recording in a new one.
+        const bool transfer = batches[current].transfer;
+        submitBatch(*ctx);
+        beginBatch(*ctx, transfer);
+        ++counters.earlySubmits;
     }
+}
 
-    vkCheck(vkQueueSubmit(vk.graphicsQueue(), 1, &si, f.fence), "vkQueueSubmit(upload)");
+void UploadManager::trackWrite(uint64_t handle, bool image, VkImageAspectFlags aspect, VkImageLayout layout)
+{
+    if (!batches[current].transfer)
+        return;
+    for (Handover& h : handovers) {
+        if (h.handle == handle && h.image == image) {
+            h.layout = layout;
+            h.open = true;
+            return;
+        }
+    }
+    handovers.push_back(Handover{ handle, image, aspect, layout, true });
+}
 
-    cur = nullptr;
-    currentCmd = VK_NULL_HANDLE;
+void UploadManager::destroyBuffer(VulkanContext& vk, VkBuffer buf, const GpuAllocation& mem)
+{
+    std::erase_if(handovers, [buf](const Handover& h) { return !h.image && h.handle == (uint64_t)buf; });
+
+    const VkDevice dev = vk.device();
+    GpuAllocator* allocator = &vk.allocator();
+    DeletionQueue& queue = current != ~0u ? batches[current].deletions : vk.frameDeletionQueue();
+    queue.push([dev, allocator, buf, mem]() {
+        if (buf)
+            vkDestroyBuffer(dev, buf, nullptr);
+        allocator->free(mem);
+    });
 }
 
 UploadManager::Allocation UploadManager::alloc(VkDeviceSize size, VkDeviceSize alignment)
 {
     Allocation a{};
-    if (!cur)
+    if (current == ~0u)
         return a;
 
-    VkDeviceSize off = alignUp(cur->head, alignment);
-    if (off + size > cur->capacity)
+    VkDeviceSize off = 0;
+    if (!reserve(size, alignment, off))
         return a;
 
-    a.cpu = cur->mapped + off;
+    a.cpu = mapped + off;
     a.srcOffset = off;
     a.size = size;
-    cur->head = off + size;
     return a;
 }
 
 void UploadManager::copyToBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize srcOffset, VkDeviceSize size)
 {
-    if (!cur)
+    if (current == ~0u)
         return;
     VkBufferCopy c{ srcOffset, dstOffset, size };
-    vkCmdCopyBuffer(cur->cmd, cur->staging, dst, 1, &c);
-    cur->recorded = true;
+    vkCmdCopyBuffer(currentCmd, staging, dst, 1, &c);
+    trackWrite((uint64_t)dst, false, 0, VK_IMAGE_LAYOUT_UNDEFINED);
+    recorded = true;
 }
 
 bool UploadManager::uploadToBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size, VkDeviceSize alignment)
 {
-    Allocation a = alloc(size, alignment);
-    if (!a.cpu)
+    if (current == ~0u)
+        return false;
+
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    const VkDeviceSize step = size <= chunkBytes() ? size : std::max(chunkBytes() / alignment * alignment, alignment);
+    for (VkDeviceSize done = 0; done < size;) {
+        const VkDeviceSize n = std::min(step, size - done);
+        Allocation a = alloc(n, alignment);
+        if (!a.cpu)
+            return false;
+        std::memcpy(a.cpu, src + done, static_cast<size_t>(n));
+        copyToBuffer(dst, dstOffset + done, a.srcOffset, n);
+        done += n;
+    }
+    return true;
+}
+
+bool UploadManager::uploadToImage(VkImage dst,
+                                  VkImageAspectFlags aspect,
+                                  uint32_t width,
+                                  uint32_t height,
+                                  uint32_t texelBytes,
+                                  const void* data,
+                                  VkImageLayout finalLayout)
+{
+    const VkDeviceSize rowBytes = (VkDeviceSize)width * texelBytes;
+    if (current == ~0u || rowBytes > capacity)
+        return false;
+
+    // Buffer offsets of image copies must be multiples of both the texel size and 4.
+    const VkDeviceSize alignment = std::lcm<VkDeviceSize>(texelBytes, 4);
+    uint32_t rowsPerChunk = (uint32_t)std::max<VkDeviceSize>(1, chunkBytes() / rowBytes);
+    if (batches[current].transfer) {
+        // Bands have to start on the queue's copy granularity; a zero granularity only allows whole-image copies.
+        const uint32_t g = transferGranularity.height;
+        rowsPerChunk = g == 0 ? height : std::max(rowsPerChunk / g, 1u) * g;
+    }
+    if ((VkDeviceSize)std::min(rowsPerChunk, height) * rowBytes > capacity)
         return false;
-    std::memcpy(a.cpu, data, static_cast<size_t>(size));
-    copyToBuffer(dst, dstOffset, a.srcOffset, size);
+
+    VkImageMemoryBarrier b{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+    b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    b.image = dst;
+    b.subresourceRange = { aspect, 0, 1, 0, 1 };
+    b.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    b.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    b.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(currentCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &b);
+    recorded = true;
+
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    for (uint32_t y = 0; y < height;) {
+        const uint32_t rows = std::min(rowsPerChunk, height - y);
+        const VkDeviceSize bytes = rowBytes * rows;
+        Allocation a = alloc(bytes, alignment);
+        if (!a.cpu)
+            return false;
+        std::memcpy(a.cpu, src + rowBytes * y, static_cast<size_t>(bytes));
+
+        VkBufferImageCopy bic{};
+        bic.bufferOffset = a.srcOffset;
+        bic.imageSubresource.aspectMask = aspect;
+        bic.imageSubresource.layerCount = 1;
+        bic.imageOffset = VkOffset3D{ 0, (int32_t)y, 0 };
+        bic.imageExtent = VkExtent3D{ width, rows, 1 };
+        vkCmdCopyBufferToImage(currentCmd, staging, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bic);
+        y += rows;
+    }
+
+    // On the transfer queue the final layout is reached by the release and acquire in acquire().
+    if (batches[current].transfer) {
+        trackWrite((uint64_t)dst, true, aspect, finalLayout);
+        return true;
+    }
+    b.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    b.newLayout = finalLayout;
+    b.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    b.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    vkCmdPipelineBarrier(currentCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                         &b);
     return true;
 }
+
+void UploadManager::copyBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize srcOffset, VkDeviceSize dstOffset, VkDeviceSize size)
+{
+    if (current == ~0u)
+        return;
+    VkBufferCopy c{ srcOffset, dstOffset, size };
+    vkCmdCopyBuffer(currentCmd, src, dst, 1, &c);
+    trackWrite((uint64_t)dst, false, 0, VK_IMAGE_LAYOUT_UNDEFINED);
+    recorded = true;
+}
+
+void UploadManager::memoryBarrier(VkPipelineStageFlags srcStage,
+                                  VkAccessFlags srcAccess,
+                                  VkPipelineStageFlags dstStage,
+                                  VkAccessFlags dstAccess)
+{
+    if (current == ~0u)
+        return;
+    if (batches[current].transfer) {
+        srcStage &= kTransferStages;
+        dstStage &= kTransferStages;
+        srcAccess &= kTransferAccess;
+        dstAccess &= kTransferAccess;
+        if (!srcStage)
+            srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        if (!dstStage)
+            dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    }
+    VkMemoryBarrier b{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    b.srcAccessMask = srcAccess;
+    b.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(currentCmd, srcStage, dstStage, 0, 1, &b, 0, nullptr, 0, nullptr);
+    recorded = true;
+}
+
+uint64_t UploadManager::acquire(VulkanContext& vk, VkCommandBuffer cmd, std::span<const VkBuffer> buffers, std::span<const VkImage> images)
+{
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    size_t kept = 0;
+    for (const Handover& h : handovers) {
+        const bool wanted = !h.open && (h.image ? std::find(images.begin(), images.end(), (VkImage)h.handle) != images.end()
+                                                : std::find(buffers.begin(), buffers.end(), (VkBuffer)h.handle) != buffers.end());
+        if (!wanted) {
+            handovers[kept++] = h;
+            continue;
+        }
+        if (h.image) {
+            VkImageMemoryBarrier b{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+            b.srcQueueFamilyIndex = transferFamily;
+            b.dstQueueFamilyIndex = graphicsFamily;
+            b.image = (VkImage)h.handle;
+            b.subresourceRange = { h.aspect, 0, 1, 0, 1 };
+            b.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            b.newLayout = h.layout;
+            imageBarriers.push_back(b);
+        } else {
+            VkBufferMemoryBarrier b{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+            b.srcQueueFamilyIndex = transferFamily;
+            b.dstQueueFamilyIndex = graphicsFamily;
+            b.buffer = (VkBuffer)h.handle;
+            b.size = VK_WHOLE_SIZE;
+            bufferBarriers.push_back(b);
+        }
+    }
+    handovers.resize(kept);
+    if (bufferBarriers.empty() && imageBarriers.empty())
+        return 0;
+
+    // Release on the transfer queue, which orders it after every copy submitted there before.
+    for (auto& b : bufferBarriers)
+        b.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    for (auto& b : imageBarriers)
+        b.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    const uint32_t release = startBatch(vk, true);
+    vkCmdPipelineBarrier(batches[release].cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         (uint32_t)bufferBarriers.size(), bufferBarriers.data(), (uint32_t)imageBarriers.size(), imageBarriers.data());
+    submit(vk, release, true, true);
+    const uint64_t value = batches[release].value;
+
+    for (auto& b : bufferBarriers) {
+        b.srcAccessMask = 0;
+        b.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+    for (auto& b : imageBarriers) {
+        b.srcAccessMask = 0;
+        b.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr,
+                         (uint32_t)bufferBarriers.size(), bufferBarriers.data(), (uint32_t)imageBarriers.size(), imageBarriers.data());
+    vk.waitTimelineThisFrame(vk.timelineSemaphore(VulkanContext::Timeline::Transfer), value, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    counters.handovers += bufferBarriers.size() + imageBarriers.size();
+    return value;
+}
@@ -3,47 +3,129 @@
 #include "VulkanContext.hpp"
 
 #include <cstdint>
+#include <deque>
+#include <span>
 #include <vector>
 
+// Streams uploads through one staging ring shared by every batch. A batch runs from beginFrame() to endFrame(); when the
+// ring fills up mid-batch the recorded work is submitted early and recording continues in a fresh command buffer, so a
+// single batch may span several submissions. Ring space is recycled as the timeline values of those submissions retire.
+//
+// Batches opened on the transfer queue run on the device's copy engine when it has one. Resources they write stay owned
+// by that queue until acquire() hands them to graphics: the release is submitted on the transfer queue, the acquire is
+// recorded into the frame, and only that frame's submission waits on the transfer timeline for the release. Transfer
+// batches may only write resources graphics has not taken over yet; updates to resources in use go through graphics.
 class UploadManager {
    public:
+    enum class Queue { Graphics, Transfer };
+
     struct Allocation {
         void* cpu = nullptr;
         VkDeviceSize srcOffset = 0;
         VkDeviceSize size = 0;
     };
 
-    void init(VulkanContext& vk, VkDeviceSize perFrameBytes = 64ull * 1024ull * 1024ull);
+    void init(VulkanContext& vk, VkDeviceSize ringBytes = 32ull * 1024ull * 1024ull);
     void shutdown(VulkanContext& vk);
 
-    void beginFrame(VulkanContext& vk);
+    // Queue::Transfer falls back to graphics on devices without a transfer queue.
+    void beginFrame(VulkanContext& vk, Queue queue = Queue::Graphics);
     void endFrame(VulkanContext& vk);
+    bool onTransferQueue() const { return current != ~0u && batches[current].transfer; }
 
+    // May submit the batch recorded so far and wait for older submissions to make room, which changes cmd(). Returns an
+    // empty allocation outside a batch or when size exceeds the ring.
     Allocation alloc(VkDeviceSize size, VkDeviceSize alignment = 16);
     void copyToBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize srcOffset, VkDeviceSize size);
+    // Uploads of any size, split into chunks that each go through the ring.
     bool uploadToBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size, VkDeviceSize alignment = 16);
+    // Tightly packed rows into mip 0, layer 0 of an image with undefined contents, which ends up in finalLayout.
+    bool uploadToImage(VkImage dst,
+                       VkImageAspectFlags aspect,
+                       uint32_t width,
+                       uint32_t height,
+                       uint32_t texelBytes,
+                       const void* data,
+                       VkImageLayout finalLayout);
+    void copyBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize srcOffset, VkDeviceSize dstOffset, VkDeviceSize size);
+    // On the transfer queue, stages and accesses it cannot execute are dropped; acquire() covers the graphics side.
+    void memoryBarrier(VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
 
     VkCommandBuffer cmd() const { return currentCmd; }
-    VkBuffer stagingBuffer() const { return cur ? cur->staging : VK_NULL_HANDLE; }
+    VkBuffer stagingBuffer() const { return staging; }
+
+    // Destroys a buffer the open batch may still copy from once its submissions retire and the frames in flight finish.
+    void destroyBuffer(VulkanContext& vk, VkBuffer buf, const GpuAllocation& mem);
+
+    // Hands the listed resources that finished transfer batches wrote over to graphics: records the acquires into cmd
+    // and makes the current frame wait for the matching release. Resources without a pending handover are skipped.
+    // Returns the timeline value waited for, or 0 when nothing had to be handed over.
+    bool handoverPending() const { return !handovers.empty(); }
+    uint64_t acquire(VulkanContext& vk, VkCommandBuffer cmd, std::span<const VkBuffer> buffers, std::span<const VkImage> images);
+
+    struct Stats {
+        uint64_t submits = 0;
+        // Submissions made mid-batch because the ring was full, and waits for the GPU to free ring space.
+        uint64_t earlySubmits = 0;
+        uint64_t stalls = 0;
+        uint64_t handovers = 0;
+    };
+    const Stats& stats() const { return counters; }
 
    private:
-    struct Frame {
-        VkCommandPool pool{};
+    struct Batch {
         VkCommandBuffer cmd{};
-        VkFence fence{};
-
-        VkBuffer staging{};
-        VkDeviceMemory stagingMem{};
-        uint8_t* mapped = nullptr;
+        bool transfer = false;
+        // Timeline value the submission signals on its queue's timeline.
+        uint64_t value = 0;
+        // Ring position just past the last byte this submission reads.
+        uint64_t end = 0;
+        DeletionQueue deletions;
+    };
 
-        VkDeviceSize capacity = 0;
-        VkDeviceSize head = 0;
-        bool recorded = false;
+    // A resource written on the transfer queue whose ownership has not moved to graphics yet.
+    struct Handover {
+        uint64_t handle = 0;
+        bool image = false;
+        VkImageAspectFlags aspect = 0;
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        // Written by the open batch, which has to be submitted before the release can follow.
+        bool open = true;
     };
 
     static VkDeviceSize alignUp(VkDeviceSize v, VkDeviceSize a);
 
-    std::vector<Frame> frames;
-    Frame* cur = nullptr;
+    uint32_t startBatch(VulkanContext& vk, bool transfer);
+    void submit(VulkanContext& vk, uint32_t index, bool recorded, bool release);
+    void beginBatch(VulkanContext& vk, bool transfer);
+    void submitBatch(VulkanContext& vk);
+    void retire(VulkanContext& vk, bool wait);
+    bool reserve(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset);
+    VkDeviceSize chunkBytes() const { return capacity / 4; }
+    void trackWrite(uint64_t handle, bool image, VkImageAspectFlags aspect, VkImageLayout layout);
+
+    VulkanContext* ctx = nullptr;
+    VkCommandPool pools[2]{};
+    std::vector<Batch> batches;
+    std::vector<uint32_t> freeBatches[2];
+    std::deque<uint32_t> inFlight;
+    uint32_t current = ~0u;
     VkCommandBuffer currentCmd = VK_NULL_HANDLE;
+    bool recorded = false;
+
+    VkBuffer staging{};
+    GpuAllocation stagingMem{};
+    uint8_t* mapped = nullptr;
+    VkDeviceSize capacity = 0;
+    // Monotonic byte positions; the ring offset is position % capacity. Bytes in [tail, head) are still in use.
+    uint64_t head = 0;
+    uint64_t tail = 0;
+
+    bool transferAvailable = false;
+    uint32_t graphicsFamily = 0;
+    uint32_t transferFamily = 0;
+    VkExtent3D transferGranularity{ 1, 1, 1 };
+    std::vector<Handover> handovers;
+
+    Stats counters{};
 };
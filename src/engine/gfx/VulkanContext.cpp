@@ -4,6 +4,7 @@
 #include "VulkanContext.hpp"
 #include "VulkanHelpers.hpp"
 #include "engine/core/Log.hpp"
+#include "engine/core/Trace.hpp"
 
 #include <algorithm>
 #include <cstring>
@@ -27,13 +28,20 @@ void VulkanContext::initWindow(int w, int h, const char* title)
     });
 }
 
+void VulkanContext::initHeadless(uint32_t width, uint32_t height)
+{
+    headlessMode = true;
+    headlessExtent = { std::max(width, 1u), std::max(height, 1u) };
+}
+
 bool VulkanContext::shouldClose() const
 {
-    return glfwWindowShouldClose(win);
+    return win && glfwWindowShouldClose(win);
 }
 void VulkanContext::pollEvents() const
 {
-    glfwPollEvents();
+    if (win)
+        glfwPollEvents();
 }
 void VulkanContext::deviceWaitIdle() const
 {
@@ -45,11 +53,13 @@ void VulkanContext::initVulkan()
 {
     createInstance();
 
-    createSurface();
+    if (!headlessMode)
+        createSurface();
 
     pickPhysicalDevice();
     createDevice();
     loadDeviceFunctionPointers();
+    gpuAllocator.init(dev, phys);
 
     createOrResizeSwapchain();
     createCommands();
@@ -66,24 +76,35 @@ void VulkanContext::recreateSwapchain()
     framebufferResized = false;
 
     int w = 0, h = 0;
-    glfwGetFramebufferSize(win, &w, &h);
-    while (w == 0 || h == 0) {
+    if (win)
+        glfwGetFramebufferSize(win, &w, &h);
+    while (win && (w == 0 || h == 0)) {
         glfwWaitEvents();
         glfwGetFramebufferSize(win, &w, &h);
     }
 
-    vkDeviceWaitIdle(dev);
-    cleanupSwapchain();
+    // Frames still in flight keep using the old swapchain's resources; they are destroyed once those frames retire.
+    cleanupSwapchain(true);
     createOrResizeSwapchain();
     swapchainGen++;
 }
 
 void VulkanContext::createOrResizeSwapchain()
 {
-    createSwapchain();
+    if (headlessMode)
+        createOffscreenTargets();
+    else
+        createSwapchain();
     createDepthResources();
     if (!useDynamicRendering) {
-        createRenderPass();
+        // A render pass with the same formats is kept, so pipelines built against it stay valid across resizes.
+        if (rp && (rpColorFmt != swapFormat || rpDepthFmt != depthFmt)) {
+            const VkDevice device = dev;
+            pendingDeletion.push([device, oldRp = rp]() { vkDestroyRenderPass(device, oldRp, nullptr); });
+            rp = {};
+        }
+        if (!rp)
+            createRenderPass();
         createFramebuffers();
     }
 }
@@ -98,57 +119,25 @@ void VulkanContext::shutdown()
     if (dev)
         vkDeviceWaitIdle(dev);
 
-    for (uint32_t i = 0; i < MAX_FRAMES; i++)
-        frameDeletion[i].flush();
+    collectRetired(true);
+    pendingDeletion.flush();
     deviceDeletion.flush();
 
-    for (auto& img : transientImagesFree) {
-        if (img.view)
-            vkDestroyImageView(dev, img.view, nullptr);
-        if (img.image)
-            vkDestroyImage(dev, img.image, nullptr);
-        if (img.memory)
-            vkFreeMemory(dev, img.memory, nullptr);
-    }
-    transientImagesFree.clear();
-    for (uint32_t i = 0; i < MAX_FRAMES; ++i) {
-        for (auto& img : transientImagesInFlight[i]) {
-            if (img.view)
-                vkDestroyImageView(dev, img.view, nullptr);
-            if (img.image)
-                vkDestroyImage(dev, img.image, nullptr);
-            if (img.memory)
-                vkFreeMemory(dev, img.memory, nullptr);
-        }
-        transientImagesInFlight[i].clear();
-    }
-
-    for (auto& b : transientBuffersFree) {
-        if (b.buffer)
-            vkDestroyBuffer(dev, b.buffer, nullptr);
-        if (b.memory)
-            vkFreeMemory(dev, b.memory, nullptr);
-    }
-    transientBuffersFree.clear();
-    for (uint32_t i = 0; i < MAX_FRAMES; ++i) {
-        for (auto& b : transientBuffersInFlight[i]) {
-            if (b.buffer)
-                vkDestroyBuffer(dev, b.buffer, nullptr);
-            if (b.memory)
-                vkFreeMemory(dev, b.memory, nullptr);
-        }
-        transientBuffersInFlight[i].clear();
-    }
+    cleanupSwapchain(false);
 
-    cleanupSwapchain();
+    gpuAllocator.logStats();
+    gpuAllocator.shutdown();
 
     for (uint32_t i = 0; i < MAX_FRAMES; i++) {
         if (imageAvailable[i])
             vkDestroySemaphore(dev, imageAvailable[i], nullptr);
         if (renderFinished[i])
             vkDestroySemaphore(dev, renderFinished[i], nullptr);
-        if (inFlight[i])
-            vkDestroyFence(dev, inFlight[i], nullptr);
+    }
+    for (TimelineState& t : timelines) {
+        if (t.semaphore)
+            vkDestroySemaphore(dev, t.semaphore, nullptr);
+        t = {};
     }
 
     if (cmdPool)
@@ -169,38 +158,62 @@ void VulkanContext::shutdown()
     }
 }
 
-void VulkanContext::cleanupSwapchain()
+void VulkanContext::cleanupSwapchain(bool deferred)
 {
-    for (auto fb : framebuffers)
-        vkDestroyFramebuffer(dev, fb, nullptr);
-    framebuffers.clear();
+    std::vector<VkFramebuffer> oldFramebuffers = std::move(framebuffers);
+    std::vector<VkImageView> oldViews = std::move(swapViews);
+    std::vector<VkImage> oldImages = std::move(swapImages);
+    std::vector<GpuAllocation> oldOffscreenMem = std::move(offscreenMem);
+    const VkDevice device = dev;
+    const VkRenderPass oldRp = deferred ? VK_NULL_HANDLE : rp;
+    const VkImageView oldDepthView = depthIv;
+    const VkImage oldDepth = depthImg;
+    const GpuAllocation oldDepthMem = depthMem;
+    GpuAllocator* allocator = &gpuAllocator;
 
-    if (rp) {
-        vkDestroyRenderPass(dev, rp, nullptr);
+    framebuffers.clear();
+    swapViews.clear();
+    swapImages.clear();
+    offscreenMem.clear();
+    swapImageLayouts.clear();
+    if (!deferred)
         rp = {};
-    }
-
-    if (depthIv)
-        vkDestroyImageView(dev, depthIv, nullptr);
-    if (depthImg)
-        vkDestroyImage(dev, depthImg, nullptr);
-    if (depthMem)
-        vkFreeMemory(dev, depthMem, nullptr);
     depthIv = {};
     depthImg = {};
     depthMem = {};
     depthFmt = VK_FORMAT_UNDEFINED;
     depthLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-    for (auto v : swapViews)
-        vkDestroyImageView(dev, v, nullptr);
-    swapViews.clear();
-    swapImages.clear();
-    swapImageLayouts.clear();
+    DeletionQueue now;
+    DeletionQueue& queue = deferred ? pendingDeletion : now;
+    for (VkFramebuffer fb : oldFramebuffers)
+        queue.push([device, fb]() { vkDestroyFramebuffer(device, fb, nullptr); });
+    queue.push([device, oldRp, oldDepthView, oldDepth, oldDepthMem, allocator]() {
+        if (oldRp)
+            vkDestroyRenderPass(device, oldRp, nullptr);
+        if (oldDepthView)
+            vkDestroyImageView(device, oldDepthView, nullptr);
+        if (oldDepth)
+            vkDestroyImage(device, oldDepth, nullptr);
+        allocator->free(oldDepthMem);
+    });
+    for (VkImageView v : oldViews)
+        queue.push([device, v]() { vkDestroyImageView(device, v, nullptr); });
+    for (size_t i = 0; i < oldOffscreenMem.size(); ++i) {
+        queue.push([device, allocator, image = oldImages[i], mem = oldOffscreenMem[i]]() {
+            vkDestroyImage(device, image, nullptr);
+            allocator->free(mem);
+        });
+    }
 
-    if (swap)
-        vkDestroySwapchainKHR(dev, swap, nullptr);
+    // A deferred swapchain stays alive until its replacement has been created from it.
+    if (swap) {
+        const VkSwapchainKHR oldSwap = swap;
+        queue.push([device, oldSwap]() { vkDestroySwapchainKHR(device, oldSwap, nullptr); });
+        retiredSwap = deferred ? oldSwap : VK_NULL_HANDLE;
+    }
     swap = {};
+    now.flush();
 }
 
 void VulkanContext::createInstance()
@@ -254,9 +267,12 @@ void VulkanContext::createInstance()
     ai.engineVersion = VK_MAKE_VERSION(0, 1, 0);
     ai.apiVersion = apiVersion;
 
-    uint32_t extCount = 0;
-    const char** exts = glfwGetRequiredInstanceExtensions(&extCount);
-    std::vector<const char*> extensions(exts, exts + extCount);
+    std::vector<const char*> extensions;
+    if (!headlessMode) {
+        uint32_t extCount = 0;
+        const char** exts = glfwGetRequiredInstanceExtensions(&extCount);
+        extensions.assign(exts, exts + extCount);
+    }
 
     std::vector<const char*> layers;
     if (validationEnabled) {
@@ -323,7 +339,7 @@ void VulkanContext::pickPhysicalDevice()
         for (auto& e : exts)
             if (std::strcmp(e.extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0)
                 hasSwapchain = true;
-        if (!hasSwapchain)
+        if (!hasSwapchain && !headlessMode)
             continue;
 
         uint32_t qcount = 0;
@@ -332,8 +348,9 @@ void VulkanContext::pickPhysicalDevice()
         vkGetPhysicalDeviceQueueFamilyProperties(d, &qcount, qprops.data());
 
         for (uint32_t i = 0; i < qcount; i++) {
-            VkBool32 present = VK_FALSE;
-            vkGetPhysicalDeviceSurfaceSupportKHR(d, i, surf, &present);
+            VkBool32 present = headlessMode ? VK_TRUE : VK_FALSE;
+            if (!headlessMode)
+                vkGetPhysicalDeviceSurfaceSupportKHR(d, i, surf, &present);
             if ((qprops[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) && present) {
                 VkPhysicalDeviceProperties props{};
                 vkGetPhysicalDeviceProperties(d, &props);
@@ -359,6 +376,32 @@ void VulkanContext::pickPhysicalDevice()
         throw std::runtime_error("No suitable physical device found");
     phys = best;
     gfxFamily = bestFamily;
+
+    // Async compute needs a family without graphics; one that shares the graphics family's hardware queue would only
+    // interleave with it.
+    uint32_t qcount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(phys, &qcount, nullptr);
+    std::vector<VkQueueFamilyProperties> qprops(qcount);
+    vkGetPhysicalDeviceQueueFamilyProperties(phys, &qcount, qprops.data());
+    computeFamily = ~0u;
+    for (uint32_t i = 0; i < qcount; i++) {
+        if (i != gfxFamily && (qprops[i].queueFlags & VK_QUEUE_COMPUTE_BIT) && !(qprops[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+            computeFamily = i;
+            break;
+        }
+    }
+
+    // Uploads want a copy engine of its own: a transfer-only family, so streaming never queues behind render or compute work.
+    transferFamily = ~0u;
+    for (uint32_t i = 0; i < qcount; i++) {
+        const VkQueueFlags flags = qprops[i].queueFlags;
+        const bool copyOnly = (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+        if (copyOnly && i != gfxFamily && i != computeFamily) {
+            transferFamily = i;
+            transferGranularity = qprops[i].minImageTransferGranularity;
+            break;
+        }
+    }
 }
 
 void VulkanContext::createDevice()
@@ -406,13 +449,24 @@ void VulkanContext::createDevice()
     CFGC_LOGF("Synchronization2: %s", useSync2 ? "enabled" : "disabled");
 
     float prio = 1.0f;
-    VkDeviceQueueCreateInfo qci{};
+    VkDeviceQueueCreateInfo qcis[3]{};
+    uint32_t queueInfoCount = 0;
+    VkDeviceQueueCreateInfo& qci = qcis[queueInfoCount++];
     qci.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
     qci.queueFamilyIndex = gfxFamily;
     qci.queueCount = 1;
     qci.pQueuePriorities = &prio;
+    if (computeFamily != ~0u) {
+        VkDeviceQueueCreateInfo& cqci = qcis[queueInfoCount++];
+        cqci.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        cqci.queueFamilyIndex = computeFamily;
+        cqci.queueCount = 1;
+        cqci.pQueuePriorities = &prio;
+    }
+    CFGC_LOGF("Async compute: %s", computeFamily != ~0u ? "enabled" : "unavailable");
     std::vector<const char*> exts;
-    exts.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    if (!headlessMode)
+        exts.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
     if (props.apiVersion < VK_API_VERSION_1_2)
         exts.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
 
@@ -420,8 +474,49 @@ void VulkanContext::createDevice()
         exts.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
     if (useSync2 && props.apiVersion < VK_API_VERSION_1_3)
         exts.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+    if (props.apiVersion < VK_API_VERSION_1_2)
+        exts.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+
+    // Bindless materials index a runtime-sized, partially bound texture array with a per-draw material id.
+    VkPhysicalDeviceDescriptorIndexingFeatures indexingSupport{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES };
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineSupport{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES };
+    const bool timelineKnown = (props.apiVersion >= VK_API_VERSION_1_2) || hasExt(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    if (timelineKnown)
+        indexingSupport.pNext = &timelineSupport;
+    VkPhysicalDeviceFeatures2 supported2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+    supported2.pNext = &indexingSupport;
+    vkGetPhysicalDeviceFeatures2(phys, &supported2);
+    if (!indexingSupport.runtimeDescriptorArray || !indexingSupport.descriptorBindingPartiallyBound ||
+        !indexingSupport.descriptorBindingVariableDescriptorCount || !indexingSupport.shaderSampledImageArrayNonUniformIndexing)
+        throw std::runtime_error("Descriptor indexing not supported");
+
+    // Submissions, frame pacing and resource retirement all run on timeline semaphores.
+    if (!timelineKnown || !timelineSupport.timelineSemaphore)
+        throw std::runtime_error("Timeline semaphores not supported");
+    if (props.apiVersion < VK_API_VERSION_1_2)
+        exts.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    if (transferFamily != ~0u) {
+        VkDeviceQueueCreateInfo& tqci = qcis[queueInfoCount++];
+        tqci.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        tqci.queueFamilyIndex = transferFamily;
+        tqci.queueCount = 1;
+        tqci.pQueuePriorities = &prio;
+    }
+    CFGC_LOGF("Transfer queue: %s", transferFamily != ~0u ? "enabled" : "unavailable");
 
     VkPhysicalDeviceFeatures features{};
+    features.drawIndirectFirstInstance = feats.drawIndirectFirstInstance;
+    useIndirectFirstInstance = feats.drawIndirectFirstInstance == VK_TRUE;
+    features.pipelineStatisticsQuery = feats.pipelineStatisticsQuery;
+    usePipelineStatistics = feats.pipelineStatisticsQuery == VK_TRUE;
+    features.inheritedQueries = usePipelineStatistics ? feats.inheritedQueries : VK_FALSE;
+    useInheritedQueries = features.inheritedQueries == VK_TRUE;
+
+    VkPhysicalDeviceDescriptorIndexingFeatures indexing{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES };
+    indexing.runtimeDescriptorArray = VK_TRUE;
+    indexing.descriptorBindingPartiallyBound = VK_TRUE;
+    indexing.descriptorBindingVariableDescriptorCount = VK_TRUE;
+    indexing.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
 
     VkPhysicalDeviceDynamicRenderingFeaturesKHR dynFeat{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR };
     dynFeat.dynamicRendering = useDynamicRendering ? VK_TRUE : VK_FALSE;
@@ -429,11 +524,18 @@ void VulkanContext::createDevice()
     VkPhysicalDeviceSynchronization2FeaturesKHR sync2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR };
     sync2.synchronization2 = useSync2 ? VK_TRUE : VK_FALSE;
     sync2.pNext = useDynamicRendering ? &dynFeat : nullptr;
+    indexing.pNext = sync2.pNext;
+    sync2.pNext = &indexing;
 
     VkPhysicalDeviceShaderDrawParametersFeatures shaderParams{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_DRAW_PARAMETERS_FEATURES };
     shaderParams.shaderDrawParameters = VK_TRUE;
     shaderParams.pNext = &sync2;
 
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES };
+    timeline.timelineSemaphore = VK_TRUE;
+    timeline.pNext = shaderParams.pNext;
+    shaderParams.pNext = &timeline;
+
     VkPhysicalDeviceFeatures2 feats2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
     feats2.features = features;
     feats2.pNext = &shaderParams;
@@ -441,14 +543,18 @@ void VulkanContext::createDevice()
     VkDeviceCreateInfo dci{};
     dci.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     dci.pNext = &feats2;
-    dci.queueCreateInfoCount = 1;
-    dci.pQueueCreateInfos = &qci;
+    dci.queueCreateInfoCount = queueInfoCount;
+    dci.pQueueCreateInfos = qcis;
     dci.pEnabledFeatures = nullptr;
     dci.enabledExtensionCount = static_cast<uint32_t>(exts.size());
     dci.ppEnabledExtensionNames = exts.data();
 
     vkCheck(vkCreateDevice(phys, &dci, nullptr, &dev), "vkCreateDevice");
     vkGetDeviceQueue(dev, gfxFamily, 0, &gfxQ);
+    if (computeFamily != ~0u)
+        vkGetDeviceQueue(dev, computeFamily, 0, &computeQ);
+    if (transferFamily != ~0u)
+        vkGetDeviceQueue(dev, transferFamily, 0, &transferQ);
 }
 
 void VulkanContext::loadDeviceFunctionPointers()
@@ -471,7 +577,21 @@ void VulkanContext::loadDeviceFunctionPointers()
     if (useSync2) {
         pfnCmdPipelineBarrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2>(vkGetDeviceProcAddr(dev, "vkCmdPipelineBarrier2"));
         pfnCmdPipelineBarrier2KHR = reinterpret_cast<PFN_vkCmdPipelineBarrier2KHR>(vkGetDeviceProcAddr(dev, "vkCmdPipelineBarrier2KHR"));
+        pfnCmdSetEvent2 = reinterpret_cast<PFN_vkCmdSetEvent2>(vkGetDeviceProcAddr(dev, "vkCmdSetEvent2"));
+        if (!pfnCmdSetEvent2)
+            pfnCmdSetEvent2 = reinterpret_cast<PFN_vkCmdSetEvent2KHR>(vkGetDeviceProcAddr(dev, "vkCmdSetEvent2KHR"));
+        pfnCmdWaitEvents2 = reinterpret_cast<PFN_vkCmdWaitEvents2>(vkGetDeviceProcAddr(dev, "vkCmdWaitEvents2"));
+        if (!pfnCmdWaitEvents2)
+            pfnCmdWaitEvents2 = reinterpret_cast<PFN_vkCmdWaitEvents2KHR>(vkGetDeviceProcAddr(dev, "vkCmdWaitEvents2KHR"));
     }
+
+    pfnWaitSemaphores = reinterpret_cast<PFN_vkWaitSemaphores>(vkGetDeviceProcAddr(dev, "vkWaitSemaphores"));
+    if (!pfnWaitSemaphores)
+        pfnWaitSemaphores = reinterpret_cast<PFN_vkWaitSemaphores>(vkGetDeviceProcAddr(dev, "vkWaitSemaphoresKHR"));
+    pfnGetSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValue>(vkGetDeviceProcAddr(dev, "vkGetSemaphoreCounterValue"));
+    if (!pfnGetSemaphoreCounterValue)
+        pfnGetSemaphoreCounterValue =
+            reinterpret_cast<PFN_vkGetSemaphoreCounterValue>(vkGetDeviceProcAddr(dev, "vkGetSemaphoreCounterValueKHR"));
 }
 
 void VulkanContext::createSwapchain()
@@ -531,7 +651,10 @@ void VulkanContext::createSwapchain()
     sci.presentMode = pm;
     sci.clipped = VK_TRUE;
 
+    sci.oldSwapchain = retiredSwap;
+
     vkCheck(vkCreateSwapchainKHR(dev, &sci, nullptr, &swap), "vkCreateSwapchainKHR");
+    retiredSwap = VK_NULL_HANDLE;
     swapFormat = chosen.format;
 
     uint32_t scCount = 0;
@@ -555,6 +678,34 @@ void VulkanContext::createSwapchain()
     swapImageLayouts.assign(scCount, VK_IMAGE_LAYOUT_UNDEFINED);
 }
 
+void VulkanContext::createOffscreenTargets()
+{
+    // Every device supports this format as a color attachment and transfer source.
+    swapFormat = VK_FORMAT_B8G8R8A8_UNORM;
+    swapExtent = headlessExtent;
+
+    // A frame slot only reuses its image once its previous frame retired, so one image per slot needs no acquire.
+    swapImages.resize(MAX_FRAMES);
+    swapViews.resize(MAX_FRAMES);
+    offscreenMem.resize(MAX_FRAMES);
+    for (uint32_t i = 0; i < MAX_FRAMES; i++) {
+        VkImageCreateInfo ici{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+        ici.imageType = VK_IMAGE_TYPE_2D;
+        ici.format = swapFormat;
+        ici.extent = VkExtent3D{ swapExtent.width, swapExtent.height, 1 };
+        ici.mipLevels = 1;
+        ici.arrayLayers = 1;
+        ici.samples = VK_SAMPLE_COUNT_1_BIT;
+        ici.tiling = VK_IMAGE_TILING_OPTIMAL;
+        ici.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        createImage2D(gpuAllocator, ici, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapImages[i], offscreenMem[i], "vkCreateImage(offscreen)");
+        swapViews[i] = createImageView2D(dev, swapImages[i], swapFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+    }
+
+    swapImageLayouts.assign(MAX_FRAMES, VK_IMAGE_LAYOUT_UNDEFINED);
+}
+
 void VulkanContext::createDepthResources()
 {
     const VkFormat candidates[] = {
@@ -564,11 +715,13 @@ void VulkanContext::createDepthResources()
     };
 
     depthFmt = VK_FORMAT_UNDEFINED;
+    depthSampled = false;
     for (VkFormat f : candidates) {
         VkFormatProperties props{};
         vkGetPhysicalDeviceFormatProperties(phys, f, &props);
         if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
             depthFmt = f;
+            depthSampled = (f == VK_FORMAT_D32_SFLOAT) && (props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
             break;
         }
     }
@@ -583,17 +736,9 @@ void VulkanContext::createDepthResources()
     ici.arrayLayers = 1;
     ici.samples = VK_SAMPLE_COUNT_1_BIT;
     ici.tiling = VK_IMAGE_TILING_OPTIMAL;
-    ici.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    ici.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (depthSampled ? VK_IMAGE_USAGE_SAMPLED_BIT : 0u);
     ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    vkCheck(vkCreateImage(dev, &ici, nullptr, &depthImg), "vkCreateImage(depth)");
-
-    VkMemoryRequirements req{};
-    vkGetImageMemoryRequirements(dev, depthImg, &req);
-    VkMemoryAllocateInfo mai{ VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-    mai.allocationSize = req.size;
-    mai.memoryTypeIndex = findMemoryType(phys, req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    vkCheck(vkAllocateMemory(dev, &mai, nullptr, &depthMem), "vkAllocateMemory(depth)");
-    vkCheck(vkBindImageMemory(dev, depthImg, depthMem, 0), "vkBindImageMemory(depth)");
+    createImage2D(gpuAllocator, ici, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImg, depthMem, "vkCreateImage(depth)");
 
     VkImageViewCreateInfo vci{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
     vci.image = depthImg;
@@ -618,7 +763,7 @@ void VulkanContext::createRenderPass()
     attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attachments[0].finalLayout = presentLayout();
 
     attachments[1].format = depthFmt;
     attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
@@ -654,6 +799,8 @@ void VulkanContext::createRenderPass()
     rpci.pDependencies = &dep;
 
     vkCheck(vkCreateRenderPass(dev, &rpci, nullptr, &rp), "vkCreateRenderPass");
+    rpColorFmt = swapFormat;
+    rpDepthFmt = depthFmt;
 }
 
 void VulkanContext::createFramebuffers()
@@ -693,16 +840,106 @@ void VulkanContext::createCommands()
 void VulkanContext::createSync()
 {
     VkSemaphoreCreateInfo sci{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
-    VkFenceCreateInfo fci{ VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
-    fci.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
     for (uint32_t i = 0; i < MAX_FRAMES; i++) {
         vkCheck(vkCreateSemaphore(dev, &sci, nullptr, &imageAvailable[i]), "vkCreateSemaphore");
         vkCheck(vkCreateSemaphore(dev, &sci, nullptr, &renderFinished[i]), "vkCreateSemaphore");
-        vkCheck(vkCreateFence(dev, &fci, nullptr, &inFlight[i]), "vkCreateFence");
+        frameValues[i] = 0;
+    }
+
+    VkSemaphoreTypeCreateInfo tci{ VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+    tci.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    tci.initialValue = 0;
+    sci.pNext = &tci;
+    const char* names[2] = { "graphics timeline", "transfer timeline" };
+    for (uint32_t i = 0; i < 2; ++i) {
+        if (i == (uint32_t)Timeline::Transfer && !transferQ)
+            continue;
+        vkCheck(vkCreateSemaphore(dev, &sci, nullptr, &timelines[i].semaphore), "vkCreateSemaphore(timeline)");
+        setObjectName(VK_OBJECT_TYPE_SEMAPHORE, (uint64_t)timelines[i].semaphore, names[i]);
     }
 }
 
+uint64_t VulkanContext::completedValue(Timeline t)
+{
+    TimelineState& tl = timelines[(uint32_t)t];
+    if (tl.completed < tl.submitted) {
+        uint64_t value = 0;
+        vkCheck(pfnGetSemaphoreCounterValue(dev, tl.semaphore, &value), "vkGetSemaphoreCounterValue");
+        tl.completed = std::max(tl.completed, value);
+    }
+    return tl.completed;
+}
+
+void VulkanContext::waitTimeline(Timeline t, uint64_t value)
+{
+    TimelineState& tl = timelines[(uint32_t)t];
+    if (tl.completed >= value)
+        return;
+    VkSemaphoreWaitInfo wi{ VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+    wi.semaphoreCount = 1;
+    wi.pSemaphores = &tl.semaphore;
+    wi.pValues = &value;
+    vkCheck(pfnWaitSemaphores(dev, &wi, UINT64_MAX), "vkWaitSemaphores");
+    tl.completed = value;
+}
+
+uint64_t VulkanContext::submit(Timeline t, VkCommandBuffer cmd)
+{
+    TimelineState& tl = timelines[(uint32_t)t];
+    const uint64_t value = tl.submitted + 1;
+
+    VkTimelineSemaphoreSubmitInfo tsi{ VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+    tsi.signalSemaphoreValueCount = 1;
+    tsi.pSignalSemaphoreValues = &value;
+    VkSubmitInfo si{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
+    si.pNext = &tsi;
+    si.commandBufferCount = 1;
+    si.pCommandBuffers = &cmd;
+    si.signalSemaphoreCount = 1;
+    si.pSignalSemaphores = &tl.semaphore;
+    vkCheck(vkQueueSubmit(t == Timeline::Transfer ? transferQ : gfxQ, 1, &si, VK_NULL_HANDLE), "vkQueueSubmit");
+    tl.submitted = value;
+
+    // Outside a frame nothing recorded later can still be using what was queued for deletion.
+    if (t == Timeline::Graphics && !frameOpen)
+        tagPendingDeletion(value);
+    return value;
+}
+
+void VulkanContext::tagPendingDeletion(uint64_t graphicsValue)
+{
+    if (pendingDeletion.empty())
+        return;
+    if (retiring.empty() || retiring.back().timeline != Timeline::Graphics || retiring.back().value != graphicsValue)
+        retiring.push_back(Retiring{ Timeline::Graphics, graphicsValue, {} });
+    retiring.back().fns.append(pendingDeletion);
+}
+
+void VulkanContext::retireAt(Timeline t, uint64_t value, DeletionQueue& fns)
+{
+    if (fns.empty())
+        return;
+    retiring.push_back(Retiring{ t, value, {} });
+    retiring.back().fns.append(fns);
+}
+
+void VulkanContext::collectRetired(bool all)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < retiring.size(); ++i) {
+        Retiring& r = retiring[i];
+        if (all || completedValue(r.timeline) >= r.value) {
+            r.fns.flush();
+            continue;
+        }
+        if (kept != i)
+            retiring[kept] = std::move(r);
+        ++kept;
+    }
+    retiring.resize(kept);
+}
+
 void VulkanContext::cmdDrawIndexedIndirectCount(VkCommandBuffer cmd,
                                                 VkBuffer indirectBuffer,
                                                 VkDeviceSize indirectOffset,
@@ -727,25 +964,22 @@ VkCommandBuffer VulkanContext::beginFrame()
     if (framebufferResized) {
         return VK_NULL_HANDLE;
     }
+    CFGC_TRACE_FRAME_BEGIN();
 
-    VkFence fence = inFlight[frameIndex];
-    vkWaitForFences(dev, 1, &fence, VK_TRUE, UINT64_MAX);
-
-    if (!transientImagesInFlight[frameIndex].empty()) {
-        transientImagesFree.insert(transientImagesFree.end(), transientImagesInFlight[frameIndex].begin(),
-                                   transientImagesInFlight[frameIndex].end());
-        transientImagesInFlight[frameIndex].clear();
-    }
-    if (!transientBuffersInFlight[frameIndex].empty()) {
-        transientBuffersFree.insert(transientBuffersFree.end(), transientBuffersInFlight[frameIndex].begin(),
-                                    transientBuffersInFlight[frameIndex].end());
-        transientBuffersInFlight[frameIndex].clear();
+    // The slot's command buffer and per-frame resources are free once its last submission has retired.
+    {
+        CFGC_ZONE("Wait for frame slot");
+        waitTimeline(Timeline::Graphics, frameValues[frameIndex]);
+        collectRetired(false);
     }
 
-    frameDeletion[frameIndex].flush();
-    vkResetFences(dev, 1, &fence);
-
-    VkResult r = vkAcquireNextImageKHR(dev, swap, UINT64_MAX, imageAvailable[frameIndex], VK_NULL_HANDLE, &acquiredImage);
+    VkResult r = VK_SUCCESS;
+    if (headlessMode) {
+        acquiredImage = frameIndex;
+    } else {
+        CFGC_ZONE("Acquire image");
+        r = vkAcquireNextImageKHR(dev, swap, UINT64_MAX, imageAvailable[frameIndex], VK_NULL_HANDLE, &acquiredImage);
+    }
     if (r == VK_ERROR_OUT_OF_DATE_KHR || r == VK_ERROR_SURFACE_LOST_KHR) {
         framebufferResized = true;
         return VK_NULL_HANDLE;
@@ -762,6 +996,7 @@ VkCommandBuffer VulkanContext::beginFrame()
     VkCommandBufferBeginInfo bi{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
     bi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     vkCheck(vkBeginCommandBuffer(cmd, &bi), "vkBeginCommandBuffer");
+    frameOpen = true;
     return cmd;
 }
 
@@ -855,27 +1090,111 @@ void VulkanContext::endMainPass(VkCommandBuffer cmd)
     vkCmdEndRenderPass(cmd);
 }
 
+void VulkanContext::waitTimelineThisFrame(VkSemaphore timeline, uint64_t value, VkPipelineStageFlags stages)
+{
+    for (size_t i = 0; i < frameWaits.size(); ++i) {
+        if (frameWaits[i] == timeline) {
+            frameWaitValues[i] = std::max(frameWaitValues[i], value);
+            frameWaitStages[i] |= stages;
+            return;
+        }
+    }
+    frameWaits.push_back(timeline);
+    frameWaitStages.push_back(stages);
+    frameWaitValues.push_back(value);
+}
+
 void VulkanContext::endFrame()
 {
+    const QueueBatch batch{ cmdBuffers[frameIndex] };
+    endFrame(std::span<const QueueBatch>(&batch, 1));
+}
+
+void VulkanContext::endFrame(std::span<const QueueBatch> batches)
+{
+    CFGC_ZONE("Submit");
     VkCommandBuffer cmd = cmdBuffers[frameIndex];
 
     vkCheck(vkEndCommandBuffer(cmd), "vkEndCommandBuffer");
 
-    VkSemaphore waitSem = imageAvailable[frameIndex];
     VkSemaphore sigSem = renderFinished[frameIndex];
-    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    TimelineState& gfx = timelines[(uint32_t)Timeline::Graphics];
 
-    VkSubmitInfo si{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
-    si.waitSemaphoreCount = 1;
-    si.pWaitSemaphores = &waitSem;
-    si.pWaitDstStageMask = &waitStage;
-    si.commandBufferCount = 1;
-    si.pCommandBuffers = &cmd;
-    si.signalSemaphoreCount = 1;
-    si.pSignalSemaphores = &sigSem;
+    size_t lastGraphics = 0;
+    for (size_t i = 0; i < batches.size(); ++i) {
+        if (!batches[i].compute)
+            lastGraphics = i;
+    }
 
-    vkCheck(vkQueueSubmit(gfxQ, 1, &si, inFlight[frameIndex]), "vkQueueSubmit");
+    std::vector<VkSemaphore> waits;
+    std::vector<VkPipelineStageFlags> waitStages;
+    std::vector<uint64_t> waitValues;
+    for (size_t i = 0; i < batches.size(); ++i) {
+        const QueueBatch& b = batches[i];
+        const bool first = b.cmd == cmd;
+        const bool last = i == lastGraphics;
+
+        waits.assign(b.waitSemaphores, b.waitSemaphores + b.waitCount);
+        waitStages.assign(b.waitStages, b.waitStages + b.waitCount);
+        waitValues.assign(waits.size(), 0);
+        if (first) {
+            if (!headlessMode) {
+                waits.push_back(imageAvailable[frameIndex]);
+                waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+                waitValues.push_back(0);
+            }
+            waits.insert(waits.end(), frameWaits.begin(), frameWaits.end());
+            waitStages.insert(waitStages.end(), frameWaitStages.begin(), frameWaitStages.end());
+            waitValues.insert(waitValues.end(), frameWaitValues.begin(), frameWaitValues.end());
+        }
+        // Binary semaphores ignore their entries in the value arrays.
+        VkSemaphore signals[3]{};
+        uint64_t signalValues[3]{};
+        uint32_t signalCount = 0;
+        if (b.signal)
+            signals[signalCount++] = b.signal;
+        if (last && !headlessMode)
+            signals[signalCount++] = sigSem;
+        if (!b.compute) {
+            signalValues[signalCount] = ++gfx.submitted;
+            signals[signalCount++] = gfx.semaphore;
+        }
 
+        VkSubmitInfo si{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
+        si.waitSemaphoreCount = (uint32_t)waits.size();
+        si.pWaitSemaphores = waits.data();
+        si.pWaitDstStageMask = waitStages.data();
+        si.commandBufferCount = 1;
+        si.pCommandBuffers = &b.cmd;
+        si.signalSemaphoreCount = signalCount;
+        si.pSignalSemaphores = signals;
+
+        VkTimelineSemaphoreSubmitInfo tsi{ VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+        tsi.waitSemaphoreValueCount = (uint32_t)waitValues.size();
+        tsi.pWaitSemaphoreValues = waitValues.data();
+        tsi.signalSemaphoreValueCount = signalCount;
+        tsi.pSignalSemaphoreValues = signalValues;
+        si.pNext = &tsi;
+
+        const VkQueue queue = b.compute ? computeQ : gfxQ;
+        vkCheck(vkQueueSubmit(queue, 1, &si, VK_NULL_HANDLE), "vkQueueSubmit");
+    }
+    frameWaits.clear();
+    frameWaitStages.clear();
+    frameWaitValues.clear();
+
+    // Whatever was queued for deletion while recording retires with the frame's last submission.
+    frameValues[frameIndex] = gfx.submitted;
+    frameOpen = false;
+    tagPendingDeletion(gfx.submitted);
+
+    if (headlessMode) {
+        frameIndex = (frameIndex + 1) % MAX_FRAMES;
+        CFGC_TRACE_FRAME_END();
+        return;
+    }
+
+    CFGC_ZONE("Present");
     VkPresentInfoKHR pi{ VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
     pi.waitSemaphoreCount = 1;
     pi.pWaitSemaphores = &sigSem;
@@ -890,6 +1209,7 @@ void VulkanContext::endFrame()
     }
 
     frameIndex = (frameIndex + 1) % MAX_FRAMES;
+    CFGC_TRACE_FRAME_END();
 }
 
 void VulkanContext::cmdBeginLabel(VkCommandBuffer cmd, const char* name) const
@@ -998,100 +1318,3 @@ void VulkanContext::cmdPipelineBarrier2(VkCommandBuffer cmd, const VkDependencyI
     vkCmdPipelineBarrier(cmd, srcStages, dstStages, 0, (uint32_t)mem.size(), mem.data(), (uint32_t)buf.size(), buf.data(),
                          (uint32_t)img.size(), img.data());
 }
-
-static bool transientImageKeyMatch(const VulkanContext::TransientImage2D& a,
-                                   VkFormat format,
-                                   VkExtent2D extent,
-                                   VkImageUsageFlags usage,
-                                   VkImageAspectFlags aspect)
-{
-    return a.format == format && a.extent.width == extent.width && a.extent.height == extent.height && a.usage == usage &&
-           a.aspect == aspect;
-}
-
-VulkanContext::TransientImage2D VulkanContext::acquireTransientImage2D(std::string_view debugName,
-                                                                       VkFormat format,
-                                                                       VkExtent2D extent,
-                                                                       VkImageUsageFlags usage,
-                                                                       VkImageAspectFlags aspect)
-{
-    for (size_t i = 0; i < transientImagesFree.size(); ++i) {
-        if (!transientImageKeyMatch(transientImagesFree[i], format, extent, usage, aspect))
-            continue;
-        auto r = transientImagesFree[i];
-        transientImagesFree[i] = transientImagesFree.back();
-        transientImagesFree.pop_back();
-        if (!debugName.empty()) {
-            setObjectName(VK_OBJECT_TYPE_IMAGE, (uint64_t)r.image, std::string(debugName).c_str());
-            setObjectName(VK_OBJECT_TYPE_IMAGE_VIEW, (uint64_t)r.view, std::string(debugName).c_str());
-        }
-        return r;
-    }
-
-    TransientImage2D r{};
-    r.format = format;
-    r.extent = extent;
-    r.usage = usage;
-    r.aspect = aspect;
-
-    VkImageCreateInfo ici{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
-    ici.imageType = VK_IMAGE_TYPE_2D;
-    ici.format = format;
-    ici.extent = VkExtent3D{ extent.width, extent.height, 1 };
-    ici.mipLevels = 1;
-    ici.arrayLayers = 1;
-    ici.samples = VK_SAMPLE_COUNT_1_BIT;
-    ici.tiling = VK_IMAGE_TILING_OPTIMAL;
-    ici.usage = usage;
-    ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    ici.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-    createImage2D(dev, phys, ici, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, r.image, r.memory, "acquireTransientImage2D");
-    r.view = createImageView2D(dev, r.image, format, aspect, 1);
-    if (!debugName.empty()) {
-        setObjectName(VK_OBJECT_TYPE_IMAGE, (uint64_t)r.image, std::string(debugName).c_str());
-        setObjectName(VK_OBJECT_TYPE_IMAGE_VIEW, (uint64_t)r.view, std::string(debugName).c_str());
-    }
-    return r;
-}
-
-void VulkanContext::retireTransientImage2D(TransientImage2D img)
-{
-    if (!img.image)
-        return;
-    transientImagesInFlight[frameIndex].push_back(img);
-}
-
-VulkanContext::TransientBuffer VulkanContext::acquireTransientBuffer(std::string_view debugName,
-                                                                     VkDeviceSize size,
-                                                                     VkBufferUsageFlags usage,
-                                                                     VkMemoryPropertyFlags memFlags)
-{
-    for (size_t i = 0; i < transientBuffersFree.size(); ++i) {
-        auto& f = transientBuffersFree[i];
-        if (f.size == size && f.usage == usage && f.memFlags == memFlags) {
-            auto r = f;
-            transientBuffersFree[i] = transientBuffersFree.back();
-            transientBuffersFree.pop_back();
-            if (!debugName.empty())
-                setObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)r.buffer, std::string(debugName).c_str());
-            return r;
-        }
-    }
-
-    TransientBuffer r{};
-    r.size = size;
-    r.usage = usage;
-    r.memFlags = memFlags;
-    createBuffer(dev, phys, size, usage, memFlags, r.buffer, r.memory, "acquireTransientBuffer");
-    if (!debugName.empty())
-        setObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)r.buffer, std::string(debugName).c_str());
-    return r;
-}
-
-void VulkanContext::retireTransientBuffer(TransientBuffer buf)
-{
-    if (!buf.buffer)
-        return;
-    transientBuffersInFlight[frameIndex].push_back(buf);
-}
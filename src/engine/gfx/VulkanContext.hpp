@@ -2,14 +2,19 @@
 #include <GLFW/glfw3.h>
 #include <vulkan/vulkan.h>
 #include <cstdint>
+#include <span>
 #include <string>
 #include <vector>
 
+#include "GpuAllocator.hpp"
 #include "engine/core/DeletionQueue.hpp"
 
 class VulkanContext {
    public:
     void initWindow(int w, int h, const char* title);
+    // Instead of initWindow(): no GLFW, surface or swapchain. Frames render into offscreen color images of the given
+    // size that stand in for swapchain images, one per frame in flight, and are never presented.
+    void initHeadless(uint32_t width, uint32_t height);
     void initVulkan();
     void shutdown();
 
@@ -18,12 +23,34 @@ class VulkanContext {
     void deviceWaitIdle() const;
 
     GLFWwindow* window() const { return win; }
+    bool headless() const { return headlessMode; }
 
     VkInstance instance() const { return inst; }
     VkPhysicalDevice physicalDevice() const { return phys; }
     VkDevice device() const { return dev; }
     VkQueue graphicsQueue() const { return gfxQ; }
     uint32_t graphicsFamilyIndex() const { return gfxFamily; }
+    // A compute-only queue family the GPU can run next to graphics work, if the device exposes one.
+    bool hasAsyncCompute() const { return computeQ != VK_NULL_HANDLE; }
+    VkQueue asyncComputeQueue() const { return computeQ; }
+    uint32_t asyncComputeFamilyIndex() const { return computeFamily; }
+    // A transfer-only queue family for uploads, if the device exposes one.
+    bool hasTransferQueue() const { return transferQ != VK_NULL_HANDLE; }
+    VkQueue transferQueue() const { return transferQ; }
+    uint32_t transferFamilyIndex() const { return transferFamily; }
+    VkExtent3D transferImageGranularity() const { return transferGranularity; }
+
+    // Every submission to the graphics queue signals the next value of its timeline semaphore, and so does every
+    // submission to the transfer queue on a timeline of its own, as the two complete out of order. Async compute work
+    // is covered by the frame's last graphics submission, which waits on it. Retirement compares against these values.
+    enum class Timeline : uint32_t { Graphics, Transfer };
+    VkSemaphore timelineSemaphore(Timeline t) const { return timelines[(uint32_t)t].semaphore; }
+    // The value of the newest submission, and the newest value the GPU has reached, polled without blocking.
+    uint64_t submittedValue(Timeline t) const { return timelines[(uint32_t)t].submitted; }
+    uint64_t completedValue(Timeline t);
+    void waitTimeline(Timeline t, uint64_t value);
+    // Submits cmd to the timeline's queue; returns the value it signals.
+    uint64_t submit(Timeline t, VkCommandBuffer cmd);
     VkSurfaceKHR surface() const { return surf; }
 
     VkSwapchainKHR swapchain() const { return swap; }
@@ -32,6 +59,8 @@ class VulkanContext {
     const std::vector<VkImageView>& swapchainViews() const { return swapViews; }
     VkImageView depthView() const { return depthIv; }
     VkFormat depthFormat() const { return depthFmt; }
+    // True when the depth image can be read by shaders (depth-only format with sampled support), e.g. for Hi-Z builds.
+    bool depthSampleable() const { return depthSampled; }
 
     VkImage currentSwapchainImage() const { return swapImages[acquiredImage]; }
     VkImageView currentSwapchainImageView() const { return swapViews[acquiredImage]; }
@@ -40,6 +69,8 @@ class VulkanContext {
         return swapImageLayouts.empty() ? VK_IMAGE_LAYOUT_UNDEFINED : swapImageLayouts[acquiredImage];
     }
     VkImageLayout* currentSwapchainImageLayoutPtr() { return swapImageLayouts.empty() ? nullptr : &swapImageLayouts[acquiredImage]; }
+    // Where a finished frame leaves the swapchain image; headless frames keep theirs ready to be copied out.
+    VkImageLayout presentLayout() const { return headlessMode ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; }
 
     VkImage depthImage() const { return depthImg; }
     VkImageLayout depthImageLayout() const { return depthLayout; }
@@ -56,45 +87,27 @@ class VulkanContext {
             pfnCmdEndRendering(cmd);
     }
 
+    // Survives swapchain recreation as long as the color and depth formats stay the same.
     VkRenderPass renderPass() const { return rp; }
     bool dynamicRenderingEnabled() const { return useDynamicRendering; }
+    // GPU-driven draws encode the draw record index in firstInstance.
+    bool indirectFirstInstanceEnabled() const { return useIndirectFirstInstance; }
+    // Pipeline statistics queries, and whether they may stay active across vkCmdExecuteCommands.
+    bool pipelineStatisticsEnabled() const { return usePipelineStatistics; }
+    bool inheritedQueriesEnabled() const { return useInheritedQueries; }
 
     void cmdBeginLabel(VkCommandBuffer cmd, const char* name) const;
     void cmdEndLabel(VkCommandBuffer cmd) const;
     void setObjectName(VkObjectType type, uint64_t handle, const char* name) const;
 
     void cmdPipelineBarrier2(VkCommandBuffer cmd, const VkDependencyInfo& dep) const;
-
-    struct TransientImage2D {
-        VkFormat format = VK_FORMAT_UNDEFINED;
-        VkExtent2D extent{};
-        VkImageUsageFlags usage = 0;
-        VkImageAspectFlags aspect = 0;
-        VkImage image = VK_NULL_HANDLE;
-        VkImageView view = VK_NULL_HANDLE;
-        VkDeviceMemory memory = VK_NULL_HANDLE;
-    };
-
-    struct TransientBuffer {
-        VkDeviceSize size = 0;
-        VkBufferUsageFlags usage = 0;
-        VkMemoryPropertyFlags memFlags = 0;
-        VkBuffer buffer = VK_NULL_HANDLE;
-        VkDeviceMemory memory = VK_NULL_HANDLE;
-    };
-
-    TransientImage2D acquireTransientImage2D(std::string_view debugName,
-                                             VkFormat format,
-                                             VkExtent2D extent,
-                                             VkImageUsageFlags usage,
-                                             VkImageAspectFlags aspect);
-    void retireTransientImage2D(TransientImage2D img);
-
-    TransientBuffer acquireTransientBuffer(std::string_view debugName,
-                                           VkDeviceSize size,
-                                           VkBufferUsageFlags usage,
-                                           VkMemoryPropertyFlags memFlags);
-    void retireTransientBuffer(TransientBuffer buf);
+    // Split barriers; only available with synchronization2, and the wait must repeat the set's dependency info.
+    bool splitBarriersEnabled() const { return pfnCmdSetEvent2 && pfnCmdWaitEvents2; }
+    void cmdSetEvent2(VkCommandBuffer cmd, VkEvent event, const VkDependencyInfo& dep) const { pfnCmdSetEvent2(cmd, event, &dep); }
+    void cmdWaitEvents2(VkCommandBuffer cmd, uint32_t count, const VkEvent* events, const VkDependencyInfo* deps) const
+    {
+        pfnCmdWaitEvents2(cmd, count, events, deps);
+    }
 
     uint32_t currentFrameIndex() const { return frameIndex; }
     uint32_t imageIndex() const { return acquiredImage; }
@@ -111,7 +124,31 @@ class VulkanContext {
     void endMainPass(VkCommandBuffer cmd);
     void endFrame();
 
-    DeletionQueue& frameDeletionQueue() { return frameDeletion[frameIndex]; }
+    // One submission of a frame split across queues. Batches are submitted in the order given; a batch may only wait on
+    // semaphores signalled by an earlier one. The first graphics batch must be the command buffer from beginFrame() and
+    // additionally waits for the swapchain image; the last graphics batch signals presentation and retires the frame, so it
+    // has to wait, directly or through other batches, on every compute batch. Command buffers other than the frame's own
+    // must already be ended.
+    struct QueueBatch {
+        VkCommandBuffer cmd = VK_NULL_HANDLE;
+        bool compute = false;
+        uint32_t waitCount = 0;
+        const VkSemaphore* waitSemaphores = nullptr;
+        const VkPipelineStageFlags* waitStages = nullptr;
+        VkSemaphore signal = VK_NULL_HANDLE;
+    };
+    void endFrame(std::span<const QueueBatch> batches);
+    // Makes the frame's first graphics submission wait until timeline reaches value; cleared once the frame is submitted.
+    void waitTimelineThisFrame(VkSemaphore timeline, uint64_t value, VkPipelineStageFlags stages);
+
+    // All device memory goes through here; see GpuAllocator for pooling and stats.
+    GpuAllocator& allocator() { return gpuAllocator; }
+
+    // For resources the frame being recorded, or any work submitted before it, may still use. The entries retire once
+    // the graphics timeline passes that frame's submission, or outside a frame the next graphics submission.
+    DeletionQueue& frameDeletionQueue() { return pendingDeletion; }
+    // Runs fns once the timeline reaches value.
+    void retireAt(Timeline t, uint64_t value, DeletionQueue& fns);
     DeletionQueue& deviceDeletionQueue() { return deviceDeletion; }
 
     void requestSwapchainRebuild();
@@ -125,13 +162,17 @@ class VulkanContext {
     void pickPhysicalDevice();
     void createDevice();
     void createSwapchain();
+    void createOffscreenTargets();
     void createDepthResources();
     void createRenderPass();
     void createFramebuffers();
     void createCommands();
     void createSync();
 
-    void cleanupSwapchain();
+    // Deferred: destroyed once the work submitted so far is done, instead of idling the device.
+    void cleanupSwapchain(bool deferred);
+    void collectRetired(bool all);
+    void tagPendingDeletion(uint64_t graphicsValue);
 
     void createOrResizeSwapchain();
 
@@ -139,6 +180,8 @@ class VulkanContext {
 
    private:
     GLFWwindow* win = nullptr;
+    bool headlessMode = false;
+    VkExtent2D headlessExtent{};
 
     VkInstance inst{};
     VkSurfaceKHR surf{};
@@ -147,19 +190,31 @@ class VulkanContext {
 
     uint32_t gfxFamily = 0;
     VkQueue gfxQ{};
+    uint32_t computeFamily = ~0u;
+    VkQueue computeQ{};
+    uint32_t transferFamily = ~0u;
+    VkQueue transferQ{};
+    VkExtent3D transferGranularity{ 1, 1, 1 };
 
     VkSwapchainKHR swap{};
+    // The swapchain being replaced, handed to the new one as oldSwapchain.
+    VkSwapchainKHR retiredSwap{};
     VkFormat swapFormat{};
     VkExtent2D swapExtent{};
     std::vector<VkImage> swapImages;
     std::vector<VkImageView> swapViews;
+    // Headless only: the offscreen images in swapImages are ours to free.
+    std::vector<GpuAllocation> offscreenMem;
 
     VkFormat depthFmt = VK_FORMAT_UNDEFINED;
     VkImage depthImg{};
-    VkDeviceMemory depthMem{};
+    GpuAllocation depthMem{};
     VkImageView depthIv{};
+    bool depthSampled = false;
 
     VkRenderPass rp{};
+    VkFormat rpColorFmt = VK_FORMAT_UNDEFINED;
+    VkFormat rpDepthFmt = VK_FORMAT_UNDEFINED;
     std::vector<VkFramebuffer> framebuffers;
 
     bool useDynamicRendering = false;
@@ -168,10 +223,17 @@ class VulkanContext {
 
     PFN_vkCmdDrawIndexedIndirectCount pfnCmdDrawIndexedIndirectCount = nullptr;
     PFN_vkCmdDrawIndexedIndirectCountKHR pfnCmdDrawIndexedIndirectCountKHR = nullptr;
+    bool useIndirectFirstInstance = false;
+    bool usePipelineStatistics = false;
+    bool useInheritedQueries = false;
 
     bool useSync2 = false;
     PFN_vkCmdPipelineBarrier2 pfnCmdPipelineBarrier2 = nullptr;
     PFN_vkCmdPipelineBarrier2KHR pfnCmdPipelineBarrier2KHR = nullptr;
+    PFN_vkCmdSetEvent2 pfnCmdSetEvent2 = nullptr;
+    PFN_vkCmdWaitEvents2 pfnCmdWaitEvents2 = nullptr;
+    PFN_vkWaitSemaphores pfnWaitSemaphores = nullptr;
+    PFN_vkGetSemaphoreCounterValue pfnGetSemaphoreCounterValue = nullptr;
 
     VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
     PFN_vkCreateDebugUtilsMessengerEXT pfnCreateDebugUtilsMessenger = nullptr;
@@ -191,19 +253,35 @@ class VulkanContext {
 
     VkSemaphore imageAvailable[MAX_FRAMES]{};
     VkSemaphore renderFinished[MAX_FRAMES]{};
-    VkFence inFlight[MAX_FRAMES]{};
+    // Graphics timeline value each frame slot's last submission signals; the slot is free again once it is reached.
+    uint64_t frameValues[MAX_FRAMES]{};
+    bool frameOpen = false;
+
+    struct TimelineState {
+        VkSemaphore semaphore{};
+        uint64_t submitted = 0;
+        uint64_t completed = 0;
+    };
+    TimelineState timelines[2]{};
 
-    DeletionQueue frameDeletion[MAX_FRAMES]{};
-    DeletionQueue deviceDeletion{};
+    GpuAllocator gpuAllocator;
 
-    std::vector<TransientImage2D> transientImagesFree;
-    std::vector<TransientBuffer> transientBuffersFree;
-    std::vector<TransientImage2D> transientImagesInFlight[MAX_FRAMES]{};
-    std::vector<TransientBuffer> transientBuffersInFlight[MAX_FRAMES]{};
+    struct Retiring {
+        Timeline timeline = Timeline::Graphics;
+        uint64_t value = 0;
+        DeletionQueue fns;
+    };
+    DeletionQueue pendingDeletion{};
+    std::vector<Retiring> retiring;
+    DeletionQueue deviceDeletion{};
 
     bool framebufferResized = false;
     uint64_t swapchainGen = 0;
 
+    std::vector<VkSemaphore> frameWaits;
+    std::vector<VkPipelineStageFlags> frameWaitStages;
+    std::vector<uint64_t> frameWaitValues;
+
     std::vector<VkImageLayout> swapImageLayouts;
     VkImageLayout depthLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 };
@@ -25,26 +25,17 @@ std::vector<uint8_t> readFile(const char* path)
     return data;
 }
 
-uint32_t findMemoryType(VkPhysicalDevice phys, uint32_t typeBits, VkMemoryPropertyFlags props)
-{
-    VkPhysicalDeviceMemoryProperties mp{};
-    vkGetPhysicalDeviceMemoryProperties(phys, &mp);
-    for (uint32_t i = 0; i < mp.memoryTypeCount; i++) {
-        if ((typeBits & (1u << i)) && (mp.memoryTypes[i].propertyFlags & props) == props)
-            return i;
-    }
-    throw std::runtime_error("findMemoryType: no compatible type");
-}
-
-void createBuffer(VkDevice dev,
-                  VkPhysicalDevice phys,
+void createBuffer(GpuAllocator& allocator,
                   VkDeviceSize size,
                   VkBufferUsageFlags usage,
                   VkMemoryPropertyFlags memFlags,
                   VkBuffer& outBuf,
-                  VkDeviceMemory& outMem,
-                  const char* debugWhere)
+                  GpuAllocation& outMem,
+                  const char* debugWhere,
+                  GpuAllocator::Lifetime lifetime)
 {
+    const VkDevice dev = allocator.device();
+
     VkBufferCreateInfo bci{ VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
     bci.size = size;
     bci.usage = usage;
@@ -54,38 +45,28 @@ void createBuffer(VkDevice dev,
     VkMemoryRequirements req{};
     vkGetBufferMemoryRequirements(dev, outBuf, &req);
 
-    VkMemoryAllocateInfo mai{ VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-    mai.allocationSize = req.size;
-    mai.memoryTypeIndex = findMemoryType(phys, req.memoryTypeBits, memFlags);
-    vkCheck(vkAllocateMemory(dev, &mai, nullptr, &outMem), "vkAllocateMemory");
-    vkCheck(vkBindBufferMemory(dev, outBuf, outMem, 0), "vkBindBufferMemory");
-}
-
-void* mapMemory(VkDevice dev, VkDeviceMemory mem, VkDeviceSize size, VkDeviceSize offset)
-{
-    void* p = nullptr;
-    vkCheck(vkMapMemory(dev, mem, offset, size, 0, &p), "vkMapMemory");
-    return p;
+    outMem = allocator.allocate(req, memFlags, GpuAllocator::Kind::Buffer, lifetime, "vkAllocateMemory(buffer)");
+    vkCheck(vkBindBufferMemory(dev, outBuf, outMem.memory, outMem.offset), "vkBindBufferMemory");
 }
 
-void createImage2D(VkDevice dev,
-                   VkPhysicalDevice phys,
+void createImage2D(GpuAllocator& allocator,
                    const VkImageCreateInfo& info,
                    VkMemoryPropertyFlags memFlags,
                    VkImage& outImage,
-                   VkDeviceMemory& outMem,
-                   const char* debugWhere)
+                   GpuAllocation& outMem,
+                   const char* debugWhere,
+                   GpuAllocator::Lifetime lifetime)
 {
+    const VkDevice dev = allocator.device();
     vkCheck(vkCreateImage(dev, &info, nullptr, &outImage), debugWhere);
 
     VkMemoryRequirements req{};
     vkGetImageMemoryRequirements(dev, outImage, &req);
 
-    VkMemoryAllocateInfo mai{ VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-    mai.allocationSize = req.size;
-    mai.memoryTypeIndex = findMemoryType(phys, req.memoryTypeBits, memFlags);
-    vkCheck(vkAllocateMemory(dev, &mai, nullptr, &outMem), "vkAllocateMemory(image)");
-    vkCheck(vkBindImageMemory(dev, outImage, outMem, 0), "vkBindImageMemory");
+    // Linear-tiling images are placed like buffers; only optimal tiling is subject to bufferImageGranularity.
+    const GpuAllocator::Kind kind = info.tiling == VK_IMAGE_TILING_OPTIMAL ? GpuAllocator::Kind::Image : GpuAllocator::Kind::Buffer;
+    outMem = allocator.allocate(req, memFlags, kind, lifetime, "vkAllocateMemory(image)");
+    vkCheck(vkBindImageMemory(dev, outImage, outMem.memory, outMem.offset), "vkBindImageMemory");
 }
 
 VkImageView createImageView2D(VkDevice dev, VkImage image, VkFormat format, VkImageAspectFlags aspect, uint32_t mipLevels)
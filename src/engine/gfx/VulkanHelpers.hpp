@@ -5,30 +5,30 @@
 #include <string>
 #include <vector>
 
+#include "GpuAllocator.hpp"
+
 [[noreturn]] void vkFail(const char* where, VkResult r);
 void vkCheck(VkResult r, const char* where);
 
 std::vector<uint8_t> readFile(const char* path);
 
-uint32_t findMemoryType(VkPhysicalDevice phys, uint32_t typeBits, VkMemoryPropertyFlags props);
-
-void createBuffer(VkDevice dev,
-                  VkPhysicalDevice phys,
+// Creates the resource and binds it to memory sub-allocated from `allocator`. Host-visible memory comes back mapped
+// through `outMem.mapped`.
+void createBuffer(GpuAllocator& allocator,
                   VkDeviceSize size,
                   VkBufferUsageFlags usage,
                   VkMemoryPropertyFlags memFlags,
                   VkBuffer& outBuf,
-                  VkDeviceMemory& outMem,
-                  const char* debugWhere = "vkCreateBuffer");
-
-void* mapMemory(VkDevice dev, VkDeviceMemory mem, VkDeviceSize size, VkDeviceSize offset = 0);
+                  GpuAllocation& outMem,
+                  const char* debugWhere = "vkCreateBuffer",
+                  GpuAllocator::Lifetime lifetime = GpuAllocator::Lifetime::Persistent);
 
-void createImage2D(VkDevice dev,
-                   VkPhysicalDevice phys,
+void createImage2D(GpuAllocator& allocator,
                    const VkImageCreateInfo& info,
                    VkMemoryPropertyFlags memFlags,
                    VkImage& outImage,
-                   VkDeviceMemory& outMem,
-                   const char* debugWhere = "vkCreateImage");
+                   GpuAllocation& outMem,
+                   const char* debugWhere = "vkCreateImage",
+                   GpuAllocator::Lifetime lifetime = GpuAllocator::Lifetime::Persistent);
 
 VkImageView createImageView2D(VkDevice dev, VkImage image, VkFormat format, VkImageAspectFlags aspect, uint32_t mipLevels = 1);
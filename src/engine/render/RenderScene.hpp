@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <cstdint>
 #include <glm/glm.hpp>
 #include <vector>
@@ -35,6 +36,11 @@ struct DirectionalLight {
     float _pad0 = 0.0f;
 };
 
+struct TransformRange {
+    uint32_t first = 0;
+    uint32_t count = 0;
+};
+
 struct RenderScene {
     RenderCameraData camera{};
     DirectionalLight sun{};
@@ -43,9 +49,45 @@ struct RenderScene {
     std::vector<glm::mat4> transforms;
     std::vector<DrawItem> draws;
 
+    // Transforms changed since the owner last called clearDirtyTransforms(). The renderer keeps transforms resident on the
+    // GPU and only uploads these ranges, so writes that bypass addTransform/setTransform must call markTransformsDirty.
+    std::vector<TransformRange> dirtyTransforms;
+
+    uint32_t addTransform(const glm::mat4& m)
+    {
+        const uint32_t index = (uint32_t)transforms.size();
+        transforms.push_back(m);
+        markTransformsDirty(index, 1);
+        return index;
+    }
+
+    void setTransform(uint32_t index, const glm::mat4& m)
+    {
+        transforms[index] = m;
+        markTransformsDirty(index, 1);
+    }
+
+    void markTransformsDirty(uint32_t first, uint32_t count)
+    {
+        if (count == 0)
+            return;
+        // Extends the last range when contiguous, which covers the usual in-order update loops.
+        if (!dirtyTransforms.empty()) {
+            TransformRange& last = dirtyTransforms.back();
+            if (first >= last.first && first <= last.first + last.count) {
+                last.count = std::max(last.count, first + count - last.first);
+                return;
+            }
+        }
+        dirtyTransforms.push_back(TransformRange{ first, count });
+    }
+
+    void clearDirtyTransforms() { dirtyTransforms.clear(); }
+
     void clear()
     {
         transforms.clear();
         draws.clear();
+        dirtyTransforms.clear();
     }
 };
@@ -11,11 +11,13 @@ static constexpr uint32_t SET_MATERIAL = 1;
 static constexpr uint32_t BIND_CAMERA = 0;
 static constexpr uint32_t BIND_LIGHT = 1;
 static constexpr uint32_t BIND_TRANSFORMS = 2;
+static constexpr uint32_t BIND_DRAWS = 3;
 
-static constexpr uint32_t BIND_BASE_COLOR = 0;
-static constexpr uint32_t BIND_NORMAL = 1;
-static constexpr uint32_t BIND_METAL_ROUGH = 2;
-static constexpr uint32_t BIND_MATERIAL = 3;
+static constexpr uint32_t BIND_MATERIALS = 0;
+static constexpr uint32_t BIND_TEXTURES = 1;
+
+static constexpr uint32_t MAX_BINDLESS_TEXTURES = 4096;
+static constexpr uint32_t INVALID_TEXTURE = ~0u;
 
 struct CameraUBO {
     glm::mat4 view{ 1.0f };
@@ -31,10 +33,27 @@ struct LightUBO {
     float exposure = 1.0f;
 };
 
-struct MaterialUBO {
+// One record per material in the bindless material table; texture fields index tTextures[].
+struct MaterialGPU {
+    glm::vec4 baseColorFactor{ 1.0f };
+    glm::vec2 metallicRoughnessFactor{ 1.0f, 1.0f };
+    uint32_t baseColorTex = INVALID_TEXTURE;
+    uint32_t normalTex = INVALID_TEXTURE;
+    uint32_t metalRoughTex = INVALID_TEXTURE;
+    uint32_t _pad0 = 0;
+    uint32_t _pad1 = 0;
+    uint32_t _pad2 = 0;
+};
+
+// Per-draw record, laid out like DrawItem. Draws pass their slot as firstInstance.
+struct DrawData {
+    uint32_t meshId = 0;
+    uint32_t materialId = 0;
+    uint32_t transformIndex = 0;
+    uint32_t _pad0 = 0;
     glm::vec4 baseColorFactor{ 1.0f };
     glm::vec2 metallicRoughnessFactor{ 1.0f, 1.0f };
-    glm::vec2 _pad0{ 0.0f };
+    glm::vec2 _pad1{ 0.0f };
 };
 
 struct SkyPC {
@@ -1,16 +1,46 @@
 #include "App.hpp"
-#include "../engine/render/RenderScene.hpp"
+
+#include "../engine/core/Trace.hpp"
+
+#include <GLFW/glfw3.h>
 
 #include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <vector>
+
+#if defined(CFGC_TRACE)
+static void writeTrace(const std::string& path)
+{
+    if (Trace::writeChromeJson(path))
+        std::printf("Trace written to %s\n", path.c_str());
+    else
+        std::fprintf(stderr, "Failed to write trace %s\n", path.c_str());
+}
+#endif
 
-void App::run()
+void App::run(const Options& options)
 {
-    vk.initWindow(1280, 720, "Cotton Strike: Offensive Sox");
-    input.attach(vk.window());
-    vk.initVulkan();
+    CFGC_TRACE_THREAD_NAME("Main");
+#if !defined(CFGC_TRACE)
+    if (!options.tracePath.empty())
+        std::fprintf(stderr, "Tracing is not compiled into this build; ignoring --trace\n");
+#endif
+
+    if (options.headless) {
+        vk.initHeadless(options.width, options.height);
+    } else {
+        vk.initWindow((int)options.width, (int)options.height, "Cotton Strike: Offensive Sox");
+        input.attach(vk.window());
+    }
+    {
+        CFGC_ZONE("Startup");
+        vk.initVulkan();
 
-    renderer.init(vk);
+        jobs.start(options.threads);
+        renderer.init(vk, jobs);
+        buildScene();
+    }
 
     simCamera.setPosition({ 0.0f, 1.7f, 5.0f });
     simCamera.setYawPitch(3.14159f, 0.0f);
@@ -25,9 +55,25 @@ void App::run()
     double pendingMouseDx = 0.0;
     double pendingMouseDy = 0.0;
     double pendingScrollDy = 0.0;
+#if defined(CFGC_TRACE)
+    bool traceKeyWasDown = false;
+#endif
+
+    // A headless run without limits would never end.
+    constexpr uint32_t kDefaultHeadlessFrames = 1000;
+    const uint32_t frameLimit = (options.frames || options.seconds > 0.0) ? options.frames : kDefaultHeadlessFrames;
+    uint32_t framesRendered = 0;
 
+    jobs.resetStats();
+    startTime = std::chrono::steady_clock::now();
     auto t0 = std::chrono::high_resolution_clock::now();
+    const auto runStart = t0;
     while (!vk.shouldClose()) {
+        if (options.headless) {
+            const double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - runStart).count();
+            if ((frameLimit && framesRendered >= frameLimit) || (options.seconds > 0.0 && elapsed >= options.seconds))
+                break;
+        }
         vk.pollEvents();
 
         auto t1 = std::chrono::high_resolution_clock::now();
@@ -36,6 +82,12 @@ void App::run()
         frameDt = std::min(frameDt, 0.25f);
 
         input.update();
+#if defined(CFGC_TRACE)
+        const bool traceKey = !options.headless && input.keyDown(GLFW_KEY_F9);
+        if (traceKey && !traceKeyWasDown)
+            writeTrace(options.tracePath.empty() ? std::string("trace.json") : options.tracePath);
+        traceKeyWasDown = traceKey;
+#endif
         pendingMouseDx += input.mouseDx();
         pendingMouseDy += input.mouseDy();
         pendingScrollDy += input.scrollDy();
@@ -45,6 +97,7 @@ void App::run()
         steps = std::min(steps, kMaxSimStepsPerFrame);
 
         if (steps > 0) {
+            CFGC_ZONE("Simulate");
             for (int i = 0; i < steps; ++i) {
                 if (i == 0) {
                     input.setMouseDelta(pendingMouseDx, pendingMouseDy);
@@ -71,11 +124,28 @@ void App::run()
 
         const float alpha = std::clamp(accumulator / kFixedDt, 0.0f, 1.0f);
         render(alpha);
+        ++framesRendered;
     }
 
     vk.deviceWaitIdle();
+    if (options.headless) {
+        const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - runStart).count();
+        const double msPerFrame = framesRendered ? seconds * 1000.0 / framesRendered : 0.0;
+        std::printf("Headless: %u frames at %ux%u in %.3f s, %.3f ms/frame, %.1f fps\n", framesRendered, vk.swapchainExtent().width,
+                    vk.swapchainExtent().height, seconds, msPerFrame, msPerFrame > 0.0 ? 1000.0 / msPerFrame : 0.0);
+        const std::vector<JobSystem::WorkerStats> ws = jobs.stats();
+        for (size_t i = 0; i < ws.size(); ++i) {
+            std::printf("  worker %zu: %llu jobs, %llu stolen, %.1f%% busy\n", i, (unsigned long long)ws[i].jobs,
+                        (unsigned long long)ws[i].steals, ws[i].utilization * 100.0);
+        }
+    }
     renderer.shutdown(vk);
     vk.shutdown();
+    jobs.stop();
+#if defined(CFGC_TRACE)
+    if (!options.tracePath.empty())
+        writeTrace(options.tracePath);
+#endif
 }
 
 void App::simulateFixed(float dt)
@@ -86,6 +156,7 @@ void App::simulateFixed(float dt)
 void App::render(float alpha)
 {
     if (vk.swapchainRebuildRequested()) {
+        CFGC_ZONE("Recreate swapchain");
         vk.recreateSwapchain();
     }
 
@@ -94,7 +165,6 @@ void App::render(float alpha)
     VkExtent2D ext = vk.swapchainExtent();
     const float aspect = (ext.height > 0) ? ((float)ext.width / (float)ext.height) : 1.0f;
 
-    RenderScene scene{};
     scene.camera.view = renderCamera.viewMatrix();
     scene.camera.proj = renderCamera.projMatrix(aspect);
     scene.camera.position = renderCamera.position();
@@ -109,16 +179,48 @@ void App::render(float alpha)
     scene.sun.color = glm::vec3(1.0f, 0.98f, 0.92f);
 
     scene.exposure = 1.0f;
-    scene.timeSeconds = (float)glfwGetTime();
-
-    scene.transforms.push_back(glm::mat4(1.0f));
-    DrawItem d{};
-    d.meshId = 0;
-    d.materialId = 0;
-    d.transformIndex = 0;
-    d.baseColorFactor = glm::vec4(1.0f);
-    d.metallicRoughnessFactor = glm::vec2(1.0f, 1.0f);
-    scene.draws.push_back(d);
+    scene.timeSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
 
     renderer.drawFrame(vk, scene);
+    scene.clearDirtyTransforms();
+}
+
+// Draws and transforms persist across frames; only transforms touched through the scene helpers are re-uploaded.
+// Every placement of a mesh, whether a node or one of its EXT_mesh_gpu_instancing instances, gets its own transform.
+// Each chunk is then drawn for all placements of its mesh in consecutive slots, which the renderer merges into
+// instanced draws.
+void App::buildScene()
+{
+    scene.clear();
+
+    const std::vector<GltfNode>& nodes = renderer.sceneNodes();
+    const std::vector<Renderer::SceneMesh>& meshes = renderer.sceneMeshes();
+    std::vector<glm::mat4> world;
+    gltfWorldTransforms(nodes, world);
+
+    std::vector<std::vector<uint32_t>> placements(meshes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const GltfNode& n = nodes[i];
+        if (n.mesh < 0 || (size_t)n.mesh >= meshes.size())
+            continue;
+        std::vector<uint32_t>& p = placements[(size_t)n.mesh];
+        if (n.instances.empty())
+            p.push_back(scene.addTransform(world[i]));
+        for (const glm::mat4& instance : n.instances)
+            p.push_back(scene.addTransform(world[i] * instance));
+    }
+
+    for (size_t m = 0; m < meshes.size(); ++m) {
+        for (uint32_t c = 0; c < meshes[m].chunkCount; ++c) {
+            for (uint32_t transformIndex : placements[m]) {
+                DrawItem d{};
+                d.meshId = meshes[m].firstMeshId + c;
+                d.materialId = 0;
+                d.transformIndex = transformIndex;
+                d.baseColorFactor = glm::vec4(1.0f);
+                d.metallicRoughnessFactor = glm::vec2(1.0f, 1.0f);
+                scene.draws.push_back(d);
+            }
+        }
+    }
 }
@@ -1,19 +1,42 @@
 #pragma once
+#include "../engine/core/JobSystem.hpp"
 #include "../engine/gfx/Renderer.hpp"
 #include "../engine/gfx/VulkanContext.hpp"
 #include "../engine/platform/Input.hpp"
+#include "../engine/render/RenderScene.hpp"
 #include "Camera.hpp"
 
+#include <chrono>
+#include <cstdint>
+#include <string>
+
 class App {
    public:
-    void run();
+    struct Options {
+        // Renders offscreen without a window or input; see VulkanContext::initHeadless().
+        bool headless = false;
+        uint32_t width = 1280;
+        uint32_t height = 720;
+        // Headless runs stop after this many frames or seconds, whichever comes first; zero disables a limit.
+        uint32_t frames = 0;
+        double seconds = 0.0;
+        // Worker threads next to the main one; see JobSystem::start().
+        uint32_t threads = JobSystem::kAutoThreads;
+        // Chrome trace written at exit when set; F9 writes one on demand, to this path or trace.json. Needs CFGC_TRACE.
+        std::string tracePath;
+    };
+
+    void run(const Options& options);
 
    private:
     void simulateFixed(float dt);
     void render(float alpha);
+    void buildScene();
 
+    JobSystem jobs;
     VulkanContext vk;
     Renderer renderer;
+    RenderScene scene;
 
     Input input;
 
@@ -21,4 +44,6 @@ class App {
     Camera renderCamera;
     Camera::State prevCam{};
     Camera::State currCam{};
+
+    std::chrono::steady_clock::time_point startTime{};
 };
@@ -1,17 +1,56 @@
 #include "App.hpp"
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <stdexcept>
+#include <string>
 
 #if defined(_WIN32)
 #include <windows.h>
 #endif
 
-int main()
+namespace {
+
+// [--headless] [--frames N] [--seconds S] [--size WxH] [--threads N] [--trace FILE]
+App::Options parseOptions(int argc, char** argv)
+{
+    App::Options o;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (std::strcmp(arg, "--headless") == 0) {
+            o.headless = true;
+        } else if (std::strcmp(arg, "--frames") == 0 && value) {
+            o.frames = (uint32_t)std::strtoul(value, nullptr, 10);
+            ++i;
+        } else if (std::strcmp(arg, "--seconds") == 0 && value) {
+            o.seconds = std::strtod(value, nullptr);
+            ++i;
+        } else if (std::strcmp(arg, "--size") == 0 && value &&
+                   std::sscanf(value, "%ux%u", &o.width, &o.height) == 2 && o.width && o.height) {
+            ++i;
+        } else if (std::strcmp(arg, "--threads") == 0 && value) {
+            o.threads = (uint32_t)std::strtoul(value, nullptr, 10);
+            ++i;
+        } else if (std::strcmp(arg, "--trace") == 0 && value) {
+            o.tracePath = value;
+            ++i;
+        } else {
+            throw std::runtime_error(std::string("Unknown or incomplete argument: ") + arg);
+        }
+    }
+    return o;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
 {
     try {
         App app;
-        app.run();
+        app.run(parseOptions(argc, argv));
         return 0;
     } catch (const std::exception& e) {
         std::fprintf(stderr, "Fatal error: %s\n", e.what());
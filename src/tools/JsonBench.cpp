@@ -0,0 +1,332 @@
+// Compares mini_json::parse, the arena DOM of mini_json::parse_document and the on-demand cursor of
+// mini_json::parse_on_demand on real and synthetic glTF manifests, and measures structural indexing with each kernel.
+//
+//   JsonBench [--iterations N] [--synthetic-mb MB] [file.gltf ...]
+//
+// Without files it reads assets/map.gltf. Peak memory counts every heap byte live during a parse, including the result.
+
+#include "engine/assets/mini_json.hpp"
+#include "engine/assets/mini_json_ondemand.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::atomic<size_t> liveBytes{ 0 };
+std::atomic<size_t> peakBytes{ 0 };
+std::atomic<size_t> allocCount{ 0 };
+
+// Sizes are kept in front of each block so operator delete can account for them.
+constexpr size_t kHeader = alignof(std::max_align_t);
+
+void* trackedAlloc(size_t size, size_t align = kHeader)
+{
+    const size_t header = std::max(align, kHeader);
+    void* p = std::malloc(size + header + align);
+    if (!p)
+        throw std::bad_alloc();
+    // Over-aligned blocks are shifted forward; the offset back to the malloc'd pointer sits just before the size.
+    const uintptr_t user = ((uintptr_t)p + header + align - 1) & ~(uintptr_t)(align - 1);
+    const size_t offset = user - (uintptr_t)p;
+    std::memcpy((char*)user - sizeof(size_t), &size, sizeof(size));
+    std::memcpy((char*)user - 2 * sizeof(size_t), &offset, sizeof(offset));
+    const size_t live = liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    size_t peak = peakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    return (void*)user;
+}
+
+void trackedFree(void* p, size_t = kHeader)
+{
+    if (!p)
+        return;
+    size_t size = 0, offset = 0;
+    std::memcpy(&size, (char*)p - sizeof(size_t), sizeof(size));
+    std::memcpy(&offset, (char*)p - 2 * sizeof(size_t), sizeof(offset));
+    liveBytes.fetch_sub(size, std::memory_order_relaxed);
+    std::free((char*)p - offset);
+}
+
+struct Measure {
+    double ms = 0.0;
+    size_t peak = 0;
+    size_t allocs = 0;
+};
+
+template <typename F>
+Measure measure(uint32_t iterations, F&& parse)
+{
+    std::vector<double> times;
+    Measure m;
+    for (uint32_t i = 0; i < iterations; ++i) {
+        const size_t base = liveBytes.load();
+        peakBytes.store(base);
+        const size_t allocs0 = allocCount.load();
+        const auto t0 = std::chrono::steady_clock::now();
+        parse();
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+        m.peak = peakBytes.load() - base;
+        m.allocs = allocCount.load() - allocs0;
+    }
+    std::sort(times.begin(), times.end());
+    m.ms = times[times.size() / 2];
+    return m;
+}
+
+// Same total value count from both trees, so the benchmark cannot pass by parsing less.
+size_t countValues(const mini_json::Value& v)
+{
+    size_t n = 1;
+    if (v.is_arr()) {
+        for (const auto& c : v.as_arr())
+            n += countValues(c);
+    } else if (v.is_obj()) {
+        for (const auto& [k, c] : v.as_obj())
+            n += countValues(c);
+    }
+    return n;
+}
+
+size_t countValues(const mini_json::Node& v)
+{
+    size_t n = 1;
+    for (const auto& c : v.as_arr())
+        n += countValues(c);
+    for (const auto& m : v.as_obj())
+        n += countValues(m.value);
+    return n;
+}
+
+size_t countValues(const mini_json::Element& v)
+{
+    size_t n = 1;
+    for (mini_json::Element c : v.as_arr())
+        n += countValues(c);
+    for (mini_json::Field f : v.as_obj())
+        n += countValues(f.value());
+    return n;
+}
+
+// A manifest shaped like an exported level: many nodes with TRS transforms, meshes with several primitives, and the
+// accessors and buffer views they point at.
+std::string syntheticGltf(size_t targetBytes)
+{
+    std::string s;
+    s.reserve(targetBytes + 4096);
+    char buf[512];
+    s += "{\"asset\":{\"version\":\"2.0\",\"generator\":\"JsonBench \\\"synthetic\\\"\"},\"scene\":0,";
+    s += "\"buffers\":[{\"uri\":\"synthetic.bin\",\"byteLength\":1073741824}],";
+
+    // Each mesh brings 2 primitives, 8 accessors, 8 buffer views and a node; sized from a measured unit.
+    const size_t unitBytes = 2250;
+    const size_t meshes = std::max<size_t>(targetBytes / unitBytes, 1);
+
+    s += "\"bufferViews\":[";
+    for (size_t i = 0; i < meshes * 8; ++i) {
+        std::snprintf(buf, sizeof(buf), "%s{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"target\":%d}", i ? "," : "", i * 4096,
+                      (size_t)4096, (i % 4 == 3) ? 34963 : 34962);
+        s += buf;
+    }
+    s += "],\"accessors\":[";
+    for (size_t i = 0; i < meshes * 8; ++i) {
+        static const char* types[4] = { "VEC3", "VEC3", "VEC2", "SCALAR" };
+        const int t = (int)(i % 4);
+        std::snprintf(buf, sizeof(buf),
+                      "%s{\"bufferView\":%zu,\"byteOffset\":0,\"componentType\":%d,\"count\":%zu,\"type\":\"%s\","
+                      "\"min\":[-%.6f,-%.6f,-%.6f],\"max\":[%.6f,%.6f,%.6f]}",
+                      i ? "," : "", i, t == 3 ? 5125 : 5126, (size_t)(341 + i % 97), types[t], 1.0 + i * 0.001, 2.0, 3.0, 1.0 + i * 0.001,
+                      2.0, 3.0);
+        s += buf;
+    }
+    s += "],\"meshes\":[";
+    for (size_t i = 0; i < meshes; ++i) {
+        const size_t a = i * 8;
+        std::snprintf(buf, sizeof(buf),
+                      "%s{\"name\":\"mesh_%zu\",\"primitives\":[{\"attributes\":{\"POSITION\":%zu,\"NORMAL\":%zu,\"TEXCOORD_0\":%zu},"
+                      "\"indices\":%zu,\"material\":0,\"mode\":4},{\"attributes\":{\"POSITION\":%zu,\"NORMAL\":%zu,\"TEXCOORD_0\":%zu},"
+                      "\"indices\":%zu,\"material\":0,\"mode\":4}]}",
+                      i ? "," : "", i, a, a + 1, a + 2, a + 3, a + 4, a + 5, a + 6, a + 7);
+        s += buf;
+    }
+    s += "],\"nodes\":[";
+    for (size_t i = 0; i < meshes; ++i) {
+        std::snprintf(buf, sizeof(buf),
+                      "%s{\"name\":\"node_%zu\",\"mesh\":%zu,\"translation\":[%.4f,%.4f,%.4f],"
+                      "\"rotation\":[0.0,0.7071068,0.0,0.7071068],\"scale\":[1.0,1.0,1.0],\"extras\":{\"tag\":\"prop\\/static\"}}",
+                      i ? "," : "", i, i, (double)(i % 100), 0.0, (double)(i / 100));
+        s += buf;
+    }
+    s += "],\"scenes\":[{\"nodes\":[";
+    for (size_t i = 0; i < meshes; ++i) {
+        std::snprintf(buf, sizeof(buf), "%s%zu", i ? "," : "", i);
+        s += buf;
+    }
+    s += "]}],\"materials\":[{\"pbrMetallicRoughness\":{\"baseColorFactor\":[1,1,1,1],\"metallicFactor\":0,\"roughnessFactor\":1}}]}";
+    return s;
+}
+
+void run(const std::string& label, const std::string& text, uint32_t iterations)
+{
+    size_t legacyCount = 0, domCount = 0;
+    const Measure legacy = measure(iterations, [&]() {
+        mini_json::Value v = mini_json::parse(text);
+        legacyCount = countValues(v);
+    });
+    size_t arena = 0;
+    const Measure dom = measure(iterations, [&]() {
+        mini_json::Document d = mini_json::parse_document(text);
+        domCount = countValues(d.root());
+        arena = d.arena_bytes();
+    });
+
+    size_t onDemandCount = 0;
+    const Measure onDemand = measure(iterations, [&]() {
+        mini_json::OnDemandDocument d;
+        mini_json::parse_on_demand(text, d);
+        onDemandCount = countValues(d.root());
+    });
+
+    const double mb = (double)text.size() / (1024.0 * 1024.0);
+    const bool match = legacyCount == domCount && onDemandCount == domCount;
+    std::printf("%s: %.2f MB, %zu values%s\n", label.c_str(), mb, domCount, match ? "" : " (MISMATCH)");
+    std::printf("  %-16s %10s %10s %12s %12s\n", "parser", "ms", "MB/s", "peak KB", "allocs");
+    auto row = [&](const char* name, const Measure& m) {
+        std::printf("  %-16s %10.3f %10.1f %12.1f %12zu\n", name, m.ms, mb / (m.ms / 1000.0), m.peak / 1024.0, m.allocs);
+    };
+    row("parse", legacy);
+    row("parse_document", dom);
+    row("parse_on_demand", onDemand);
+    std::printf("  speedup %.2fx, peak memory %.2fx lower, tree %.1f KB in the arena\n", legacy.ms / dom.ms,
+                (double)legacy.peak / (double)std::max<size_t>(dom.peak, 1), arena / 1024.0);
+
+    // Stage one alone, once per kernel; every kernel has to produce the same index as the scalar one.
+    using Kernel = mini_json::StructuralIndex::Kernel;
+    const Kernel best = mini_json::StructuralIndex::best_kernel();
+    mini_json::StructuralIndex reference;
+    reference.build(text, Kernel::Scalar);
+    std::printf("  %-16s %10s %10s %12s\n", "stage 1", "ms", "GB/s", "tokens");
+    for (Kernel k : { Kernel::Scalar, Kernel::SSE2, Kernel::AVX2 }) {
+        if (k > best)
+            break;
+        mini_json::StructuralIndex index;
+        const Measure m = measure(iterations, [&]() { index.build(text, k); });
+        bool same = index.size() == reference.size();
+        for (uint32_t t = 0; same && t < index.size(); ++t)
+            same = index.position(t) == reference.position(t) && index.after(t) == reference.after(t);
+        std::printf("  %-16s %10.3f %10.2f %12zu%s\n", mini_json::StructuralIndex::kernel_name(k), m.ms,
+                    (double)text.size() / (m.ms / 1000.0) / 1e9, index.size(), same ? "" : " (MISMATCH)");
+    }
+}
+
+bool readFile(const std::string& path, std::string& out)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+        return false;
+    std::ostringstream ss;
+    ss << f.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+}  // namespace
+
+void* operator new(size_t size)
+{
+    return trackedAlloc(size);
+}
+void* operator new[](size_t size)
+{
+    return trackedAlloc(size);
+}
+void operator delete(void* p) noexcept
+{
+    trackedFree(p);
+}
+void operator delete[](void* p) noexcept
+{
+    trackedFree(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+    trackedFree(p);
+}
+void operator delete[](void* p, size_t) noexcept
+{
+    trackedFree(p);
+}
+
+// The arena's upstream resource allocates through the aligned forms.
+void* operator new(size_t size, std::align_val_t align)
+{
+    return trackedAlloc(size, (size_t)align);
+}
+void* operator new[](size_t size, std::align_val_t align)
+{
+    return trackedAlloc(size, (size_t)align);
+}
+void operator delete(void* p, std::align_val_t align) noexcept
+{
+    trackedFree(p, (size_t)align);
+}
+void operator delete[](void* p, std::align_val_t align) noexcept
+{
+    trackedFree(p, (size_t)align);
+}
+void operator delete(void* p, size_t, std::align_val_t align) noexcept
+{
+    trackedFree(p, (size_t)align);
+}
+void operator delete[](void* p, size_t, std::align_val_t align) noexcept
+{
+    trackedFree(p, (size_t)align);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t iterations = 5;
+    size_t syntheticMb = 50;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+            iterations = std::max(1u, (uint32_t)std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--synthetic-mb") == 0 && i + 1 < argc)
+            syntheticMb = (size_t)std::strtoul(argv[++i], nullptr, 10);
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.empty())
+        files.push_back("assets/map.gltf");
+
+    try {
+        for (const std::string& path : files) {
+            std::string text;
+            if (!readFile(path, text)) {
+                std::fprintf(stderr, "Could not read %s\n", path.c_str());
+                continue;
+            }
+            // Small files finish in microseconds; more runs keep the median stable.
+            run(path, text, text.size() < (1u << 20) ? std::max(iterations, 200u) : iterations);
+        }
+        if (syntheticMb) {
+            const std::string text = syntheticGltf(syntheticMb * 1024 * 1024);
+            run("synthetic", text, iterations);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "JsonBench: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}